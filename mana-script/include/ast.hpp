@@ -23,6 +23,16 @@ using StmtPtr = std::shared_ptr<Statement>;
 class AstNode {
 public:
     virtual ~AstNode() = default;
+
+    /**
+     * @brief Where the node is in its source: the token that names an
+     * operator, call or declaration, otherwise where the node starts
+     */
+    SourceLoc getLoc() const { return loc; }
+    void setLoc(SourceLoc location) { loc = location; }
+
+private:
+    SourceLoc loc;
 };
 
 /**
@@ -58,6 +68,11 @@ public:
     virtual void visitVariableExpr(class VariableExpr& expr) = 0;
     virtual void visitAssignExpr(class AssignExpr& expr) = 0;
     virtual void visitCallExpr(class CallExpr& expr) = 0;
+    virtual void visitSpawnExpr(class SpawnExpr& expr) = 0;
+    virtual void visitAwaitExpr(class AwaitExpr& expr) = 0;
+
+    // The parser drops every statement that holds an ErrorExpr, so back ends never see one
+    virtual void visitErrorExpr(class ErrorExpr&) {}
     
     // Statement visitors
     virtual void visitExpressionStmt(class ExpressionStmt& stmt) = 0;
@@ -65,8 +80,10 @@ public:
     virtual void visitBlockStmt(class BlockStmt& stmt) = 0;
     virtual void visitIfStmt(class IfStmt& stmt) = 0;
     virtual void visitWhileStmt(class WhileStmt& stmt) = 0;
+    virtual void visitParallelForStmt(class ParallelForStmt& stmt) = 0;
     virtual void visitFunctionStmt(class FunctionStmt& stmt) = 0;
     virtual void visitReturnStmt(class ReturnStmt& stmt) = 0;
+    virtual void visitImportStmt(class ImportStmt& stmt) = 0;
 };
 
 /**
@@ -148,6 +165,26 @@ private:
     ExprPtr expression;
 };
 
+/**
+ * @brief Stands in for an expression that failed to parse
+ *
+ * Lets the parser finish the statement it is in without unwinding; the
+ * error has already been reported.
+ */
+class ErrorExpr : public Expression {
+public:
+    explicit ErrorExpr(Token token) : token(std::move(token)) {}
+
+    void accept(AstVisitor& visitor) override {
+        visitor.visitErrorExpr(*this);
+    }
+
+    const Token& getToken() const { return token; }
+
+private:
+    Token token;
+};
+
 /**
  * @brief Represents a variable reference
  */
@@ -208,6 +245,51 @@ private:
     std::vector<ExprPtr> arguments;
 };
 
+/**
+ * @brief Starts a call as a task (e.g., spawn foo(a, b))
+ *
+ * Evaluates the callee and arguments, then runs the call on the scheduler
+ * and yields the task; see task.hpp.
+ */
+class SpawnExpr : public Expression {
+public:
+    SpawnExpr(Token keyword, std::shared_ptr<CallExpr> call)
+        : keyword(std::move(keyword)), call(std::move(call)) {}
+
+    void accept(AstVisitor& visitor) override {
+        visitor.visitSpawnExpr(*this);
+    }
+
+    const Token& getKeyword() const { return keyword; }
+    const std::shared_ptr<CallExpr>& getCall() const { return call; }
+
+private:
+    Token keyword;
+    std::shared_ptr<CallExpr> call;
+};
+
+/**
+ * @brief Waits for a task and yields its result (e.g., await fetch(url))
+ *
+ * Any other value is yielded as it is.
+ */
+class AwaitExpr : public Expression {
+public:
+    AwaitExpr(Token keyword, ExprPtr value)
+        : keyword(std::move(keyword)), value(std::move(value)) {}
+
+    void accept(AstVisitor& visitor) override {
+        visitor.visitAwaitExpr(*this);
+    }
+
+    const Token& getKeyword() const { return keyword; }
+    const ExprPtr& getValue() const { return value; }
+
+private:
+    Token keyword;
+    ExprPtr value;
+};
+
 /**
  * @brief Represents an expression statement
  */
@@ -308,13 +390,44 @@ private:
     StmtPtr body;
 };
 
+/**
+ * @brief Runs its body for every integer in a range, spread over the
+ * scheduler's workers (e.g., parallel for (i = 0; i < n) { ... })
+ *
+ * Iterations may run in any order and on any thread. The body sees copies
+ * of the enclosing locals and globals; see parallel.hpp.
+ */
+class ParallelForStmt : public Statement {
+public:
+    ParallelForStmt(Token keyword, Token variable, ExprPtr start, ExprPtr end, StmtPtr body)
+        : keyword(std::move(keyword)), variable(std::move(variable)), start(std::move(start)),
+          end(std::move(end)), body(std::move(body)) {}
+
+    void accept(AstVisitor& visitor) override {
+        visitor.visitParallelForStmt(*this);
+    }
+
+    const Token& getKeyword() const { return keyword; }
+    const Token& getVariable() const { return variable; }
+    ExprPtr getStart() const { return start; }
+    ExprPtr getEnd() const { return end; }  // Exclusive
+    StmtPtr getBody() const { return body; }
+
+private:
+    Token keyword;  // 'parallel', which is only a keyword before 'for'
+    Token variable;
+    ExprPtr start;
+    ExprPtr end;
+    StmtPtr body;
+};
+
 /**
  * @brief Represents a function declaration
  */
 class FunctionStmt : public Statement {
 public:
-    FunctionStmt(Token name, std::vector<Token> params, std::vector<StmtPtr> body)
-        : name(name), params(params), body(body) {}
+    FunctionStmt(Token name, std::vector<Token> params, std::vector<StmtPtr> body, bool is_async = false)
+        : name(name), params(params), body(body), is_async(is_async) {}
     
     void accept(AstVisitor& visitor) override {
         visitor.visitFunctionStmt(*this);
@@ -323,11 +436,17 @@ public:
     const Token& getName() const { return name; }
     const std::vector<Token>& getParams() const { return params; }
     const std::vector<StmtPtr>& getBody() const { return body; }
+
+    /**
+     * @brief Whether a call starts the body as a task and yields the task
+     */
+    bool isAsync() const { return is_async; }
     
 private:
     Token name;
     std::vector<Token> params;
     std::vector<StmtPtr> body;
+    bool is_async;
 };
 
 /**
@@ -350,6 +469,26 @@ private:
     ExprPtr value;
 };
 
+/**
+ * @brief Represents an import of a native extension module
+ */
+class ImportStmt : public Statement {
+public:
+    ImportStmt(Token keyword, std::string path)
+        : keyword(keyword), path(std::move(path)) {}
+    
+    void accept(AstVisitor& visitor) override {
+        visitor.visitImportStmt(*this);
+    }
+    
+    const Token& getKeyword() const { return keyword; }
+    const std::string& getPath() const { return path; }
+    
+private:
+    Token keyword;  // 'import' token, used for error reporting
+    std::string path;
+};
+
 } // namespace mana
 
 #endif // MANASCRIPT_AST_HPP
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef MANASCRIPT_BUILTINS_HPP
+#define MANASCRIPT_BUILTINS_HPP
+
+#include "object.hpp"
+#include "bytecode.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief Argument and result types in builtin signatures
+ */
+enum class BuiltinType : uint8_t {
+    ANY,
+    NUMBER,
+    STRING,
+    NIL
+};
+
+/**
+ * @brief Evaluate a pure builtin on constant arguments at compile time
+ * @return The result, or nothing if the call would fail at runtime
+ */
+using FoldFn = std::optional<Constant> (*)(const std::vector<Constant>& args);
+
+/**
+ * @brief Do at compile time what a builtin can with a constant first
+ * argument, such as compiling a pattern
+ * @return Why the call would fail at runtime, if it would
+ */
+using PrepareFn = std::optional<std::string> (*)(const Constant& first);
+
+/**
+ * @brief Description of one function every script can call
+ *
+ * The registry is the single list of builtins. The VM defines each one as a
+ * global and dispatches inlined calls through a table indexed like the
+ * registry. The bytecode compiler checks arity, folds pure builtins with
+ * constant arguments and emits CALLB for inlined ones. The transpiler and
+ * the LLVM code generator map them to their own spellings.
+ */
+struct Builtin {
+    const char* name;
+    int arity;                 // -1 accepts any number of arguments
+    BuiltinType params;        // Type of every argument
+    BuiltinType result;
+    bool pure;                 // No side effects; the result depends only on the arguments
+    bool inlined;              // Called with CALLB: no global lookup and no call frame
+    NativeFn function;
+    FoldFn fold;               // Null unless pure
+    const char* cpp_name;      // What the transpiler emits for a call
+    PrepareFn prepare = nullptr;
+};
+
+/**
+ * @brief All builtins; a builtin's index is its CALLB operand
+ */
+const std::vector<Builtin>& builtins();
+
+/**
+ * @return Index of the builtin with this name, or -1
+ */
+int findBuiltin(std::string_view name);
+
+const char* builtinTypeName(BuiltinType type);
+
+} // namespace mana
+
+#endif // MANASCRIPT_BUILTINS_HPP
@@ -0,0 +1,173 @@
+#ifndef MANASCRIPT_BYTECODE_HPP
+#define MANASCRIPT_BYTECODE_HPP
+
+#include "ast.hpp"
+#include "source.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief Opcodes of the register-based bytecode
+ *
+ * R[x] is a register of the current frame, K[x] an entry of the constant
+ * pool, P[x] a nested function prototype. Jump offsets are relative to the
+ * instruction after the jump.
+ */
+enum class OpCode : uint8_t {
+    LOADK,      // R[a] = K[b]
+    LOADNIL,    // R[a] = nil
+    LOADTRUE,   // R[a] = true
+    LOADFALSE,  // R[a] = false
+    MOVE,       // R[a] = R[b]
+
+    GETGLOBAL,  // R[a] = globals[K[b]], inline cache c
+    SETGLOBAL,  // globals[K[b]] = R[a], inline cache c
+    DEFGLOBAL,  // define globals[K[b]] = R[a]
+    IMPORT,     // load the extension module at path K[b]; see extension.hpp
+
+    ADD,        // R[a] = R[b] + R[c]
+    SUB,        // R[a] = R[b] - R[c]
+    MUL,        // R[a] = R[b] * R[c]
+    DIV,        // R[a] = R[b] / R[c]
+    MOD,        // R[a] = R[b] % R[c]
+    NEG,        // R[a] = -R[b]
+    NOT,        // R[a] = !R[b]
+
+    EQ,         // R[a] = R[b] == R[c]
+    NE,         // R[a] = R[b] != R[c]
+    LT,         // R[a] = R[b] < R[c]
+    LE,         // R[a] = R[b] <= R[c]
+    GT,         // R[a] = R[b] > R[c]
+    GE,         // R[a] = R[b] >= R[c]
+
+    JMP,        // pc += sC
+    JMPIF,      // if R[a] is truthy: pc += sC
+    JMPIFNOT,   // if R[a] is falsey: pc += sC
+
+    CALL,       // R[a] = R[a](R[a+1], ..., R[a+b]), inline cache c
+    CALLB,      // R[a] = builtin c(R[a+1], ..., R[a+b]); see builtins.hpp
+    ASYNC,      // R[a] = task of R[a](R[a+1], ..., R[a+b]) run as an async call; see vm.hpp
+    AWAIT,      // R[a] = result of R[b] if it is a task, else R[b]
+    FUNC,       // R[a] = function(P[b])
+    RETURN,     // return R[a]
+    RETURNNIL,  // return nil
+
+    GETMAPK,    // R[a] = map R[b] at key K[c]; see map.hpp
+    SETMAPK,    // map R[a] at key K[b] = R[c]
+
+    // Superinstructions. Only the peephole pass emits these; each replaces a
+    // sequence the compiler produces on its own.
+    ADDK,       // R[a] = R[b] + K[c]
+    SUBK,       // R[a] = R[b] - K[c]
+    MULK,       // R[a] = R[b] * K[c]
+    IFLT,       // if not R[a] < R[b]: pc += sC
+    IFLE,       // if not R[a] <= R[b]: pc += sC
+    IFEQ,       // if not R[a] == R[b]: pc += sC
+    IFNE,       // if not R[a] != R[b]: pc += sC
+
+    // Quickened forms. The compiler never emits these; the VM rewrites a
+    // generic instruction in place once it has seen its operand types, and
+    // rewrites it back when a guard fails. _II takes two ints, _DD two doubles.
+    ADD_II, ADD_DD,
+    SUB_II, SUB_DD,
+    MUL_II, MUL_DD,
+    DIV_II, DIV_DD,
+    MOD_II,
+    EQ_II, NE_II,
+    LT_II, LT_DD,
+    LE_II, LE_DD,
+    GT_II, GT_DD,
+    GE_II, GE_DD,
+    IFLT_II, IFLT_DD,
+    IFLE_II, IFLE_DD,  // Keep last; see kOpCodeCount
+};
+
+constexpr size_t kOpCodeCount = static_cast<size_t>(OpCode::IFLE_DD) + 1;
+
+/**
+ * @brief Map a quickened opcode back to its generic form
+ * @return The generic opcode; generic opcodes map to themselves
+ */
+OpCode genericOpcode(OpCode op);
+
+/**
+ * @brief Get the mnemonic of an opcode
+ */
+const char* opcodeName(OpCode op);
+
+/**
+ * @brief Whether the opcode jumps by the signed offset in c
+ */
+bool isJump(OpCode op);
+
+/**
+ * @brief A fixed-width 8-byte instruction
+ *
+ * Jumps keep their signed offset in c, so every jump form can also carry two
+ * register operands.
+ */
+struct Instruction {
+    OpCode op;
+    uint8_t deopts = 0;  // Times the VM had to undo quickening of this instruction
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    Instruction(OpCode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0)
+        : op(op), a(a), b(b), c(c) {}
+
+    int16_t sC() const { return static_cast<int16_t>(c); }
+};
+
+static_assert(sizeof(Instruction) == 8, "Instruction must stay 8 bytes");
+
+/**
+ * @brief Compile-time constant; materialized into a runtime Value when a
+ * function is loaded into a VM
+ */
+using Constant = LiteralExpr::LiteralValue;
+
+/**
+ * @brief Immutable compiled form of one function (or of the top-level script)
+ */
+struct FunctionProto {
+    std::string name;
+    std::string filename;
+    int arity = 0;
+    int num_registers = 0;  // Frame size
+    int num_caches = 0;     // Inline cache slots used by GETGLOBAL/SETGLOBAL/CALL
+
+    std::vector<Instruction> code;
+    std::vector<SourceLoc> locations;  // Source location of each instruction
+    std::vector<std::shared_ptr<const SourceBuffer>> sources;  // Keep the text locations point into
+    std::vector<Constant> constants;
+    std::vector<std::string> globals;  // Names its code reads, writes or defines, nested prototypes aside
+    std::vector<std::shared_ptr<FunctionProto>> functions;  // Nested prototypes
+};
+
+/**
+ * @brief Collect the registers an instruction reads
+ *
+ * A CALL or ASYNC reads its whole window: the callee and every argument. A CALLB
+ * reads only the arguments.
+ */
+void instructionReads(const Instruction& ins, std::vector<uint16_t>& registers);
+
+/**
+ * @brief Get the register an instruction writes
+ * @return The register, or -1 if the instruction writes none
+ */
+int instructionWrite(const Instruction& ins);
+
+/**
+ * @brief Render a prototype and its nested prototypes as readable text
+ */
+std::string disassemble(const FunctionProto& proto);
+
+} // namespace mana
+
+#endif // MANASCRIPT_BYTECODE_HPP
@@ -4,6 +4,8 @@
 #include "ast.hpp"
 #include "symbol_table.hpp"
 #include "error.hpp"
+#include "context.hpp"
+#include "extension.hpp"
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -15,6 +17,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace mana {
 
@@ -35,9 +38,17 @@ private:
     // Function and variable mapping
     std::unordered_map<std::string, llvm::Function*> functions;
     std::unordered_map<std::string, llvm::AllocaInst*> named_values;
+
+    // Functions of imported extension modules, called directly by symbol
+    std::unordered_map<std::string, const ExtFunction*> extern_functions;
     
     // Current function being compiled
     llvm::Function* current_function = nullptr;
+
+    DiagnosticManager* reports = &diagnostics;
+
+    // Call being compiled, where helpers report their errors
+    SourceLoc current_loc;
     
     // Helper methods
     llvm::Type* getIntType();
@@ -55,11 +66,24 @@ private:
     llvm::Value* popValue();
     llvm::Value* getCurrentValue();
     
+    void error(SourceLoc loc, std::string message);
+
     // Create basic library functions
     void createPrintFunction();
+
+    // Emit the body of a pure builtin in place of a call
+    llvm::Value* emitInlineBuiltin(const std::string& name, std::vector<llvm::Value*>& args);
+
+    // Call an extension function with raw scalars and pointer+length strings
+    llvm::Value* emitExternCall(const ExtFunction& function, std::vector<llvm::Value*>& args);
     
 public:
     CodeGenerator();
+
+    /**
+     * @brief Generate code for the given compilation, reporting into its diagnostics
+     */
+    explicit CodeGenerator(CompilationContext& compilation);
     
     // Initialize code generation
     void initialize(const std::string& module_name);
@@ -81,6 +105,8 @@ public:
     void visitVariableExpr(VariableExpr& expr) override;
     void visitAssignExpr(AssignExpr& expr) override;
     void visitCallExpr(CallExpr& expr) override;
+    void visitSpawnExpr(SpawnExpr& expr) override;
+    void visitAwaitExpr(AwaitExpr& expr) override;
     
     // Statement visitors
     void visitExpressionStmt(ExpressionStmt& stmt) override;
@@ -88,8 +114,10 @@ public:
     void visitBlockStmt(BlockStmt& stmt) override;
     void visitIfStmt(IfStmt& stmt) override;
     void visitWhileStmt(WhileStmt& stmt) override;
+    void visitParallelForStmt(ParallelForStmt& stmt) override;
     void visitFunctionStmt(FunctionStmt& stmt) override;
     void visitReturnStmt(ReturnStmt& stmt) override;
+    void visitImportStmt(ImportStmt& stmt) override;
 };
 
 } // namespace mana
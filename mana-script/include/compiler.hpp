@@ -0,0 +1,139 @@
+#ifndef MANASCRIPT_COMPILER_HPP
+#define MANASCRIPT_COMPILER_HPP
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "error.hpp"
+#include "context.hpp"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief Compiles the AST into register-based bytecode for the VM
+ *
+ * Every temporary gets a fresh register. Top-level declarations of the
+ * script become globals; declarations inside functions and blocks live in
+ * registers of the enclosing frame. Each finished function goes through the
+ * peephole pass in optimizer.hpp and has its frame packed by regalloc.hpp
+ * unless optimization is turned off.
+ *
+ * Calls to builtins the program does not shadow skip the global lookup:
+ * pure ones with constant arguments are folded into a constant, the rest
+ * become CALLB. Builtins cannot be redefined at the top level.
+ */
+class BytecodeCompiler : public AstVisitor {
+private:
+    struct Local {
+        std::string name;
+        int depth;
+        uint16_t reg;
+        bool is_const;
+        bool captured = false;  // A copy in a parallel for body; see visitParallelForStmt
+    };
+
+    struct FunctionState {
+        std::shared_ptr<FunctionProto> proto;
+        std::vector<Local> locals;
+        int scope_depth = 0;
+        int next_register = 0;
+        FunctionState* enclosing = nullptr;
+        bool parallel_body = false;
+        std::unordered_set<std::string> globals;  // Already in proto->globals
+    };
+
+    std::string filename;
+    bool optimize;
+    DiagnosticManager* reports = &diagnostics;
+    std::vector<std::shared_ptr<const SourceBuffer>> sources;  // Held by every prototype
+    FunctionState* current = nullptr;
+    std::unordered_set<std::string> const_globals;
+
+    // Register holding the value of the most recently compiled expression
+    uint16_t result_register = 0;
+    SourceLoc current_loc;
+
+    // Emission helpers
+    size_t emit(OpCode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+    size_t emitJump(OpCode op, uint16_t a = 0);
+    void patchJump(size_t offset);
+    void emitLoop(size_t loop_start);
+    uint16_t addConstant(const Constant& constant);
+    uint16_t addGlobal(const std::string& name);
+    uint16_t addCache();
+    void emitConstant(uint16_t reg, const Constant& constant);
+
+    // Register and scope management
+    uint16_t allocateRegister();
+    uint16_t allocateRegisters(int count);
+    uint16_t compileExpression(const ExprPtr& expr);
+    const Local* resolveLocal(const std::string& name) const;
+    void declareLocal(const Token& name, uint16_t reg, bool is_const);
+    bool isGlobalScope() const;
+    int resolveBuiltin(const Expression& callee) const;
+    std::optional<Constant> constantValue(const Expression& expr) const;
+    bool assignsRegister(const Expression& expr, uint16_t reg) const;
+    uint16_t keepOperand(uint16_t operand, const Expression& later);
+    void checkNotBuiltin(const Token& name);
+    void beginScope();
+    void endScope();
+
+    std::shared_ptr<FunctionProto> compileFunction(FunctionStmt& stmt);
+    std::shared_ptr<FunctionProto> compileAsyncFunction(FunctionStmt& stmt);
+    std::shared_ptr<FunctionProto> compileParallelBody(ParallelForStmt& stmt, const std::vector<Local>& captures);
+    bool compileBuiltinCall(CallExpr& expr, int id);
+
+    // Error handling
+    void error(const Token& token, const std::string& message);
+    void error(const std::string& message);
+
+public:
+    /**
+     * @param filename Source file name used in diagnostics and line info
+     * @param optimize Whether to run the peephole pass and register allocation
+     */
+    BytecodeCompiler(const std::string& filename = "", bool optimize = true);
+
+    /**
+     * @brief Compile the given compilation's AST, reporting into its diagnostics
+     */
+    explicit BytecodeCompiler(CompilationContext& context, bool optimize = true);
+
+    /**
+     * @brief Compile a parsed program into the prototype of its top-level script
+     * @param statements AST statements to compile
+     * @return Script prototype; check diagnostics for errors
+     */
+    std::shared_ptr<FunctionProto> compile(const std::vector<StmtPtr>& statements);
+
+    // Expression visitors
+    void visitLiteralExpr(LiteralExpr& expr) override;
+    void visitUnaryExpr(UnaryExpr& expr) override;
+    void visitBinaryExpr(BinaryExpr& expr) override;
+    void visitGroupingExpr(GroupingExpr& expr) override;
+    void visitVariableExpr(VariableExpr& expr) override;
+    void visitAssignExpr(AssignExpr& expr) override;
+    void visitCallExpr(CallExpr& expr) override;
+    void visitSpawnExpr(SpawnExpr& expr) override;
+    void visitAwaitExpr(AwaitExpr& expr) override;
+
+    // Statement visitors
+    void visitExpressionStmt(ExpressionStmt& stmt) override;
+    void visitVarDeclStmt(VarDeclStmt& stmt) override;
+    void visitBlockStmt(BlockStmt& stmt) override;
+    void visitIfStmt(IfStmt& stmt) override;
+    void visitWhileStmt(WhileStmt& stmt) override;
+    void visitParallelForStmt(ParallelForStmt& stmt) override;
+    void visitFunctionStmt(FunctionStmt& stmt) override;
+    void visitReturnStmt(ReturnStmt& stmt) override;
+    void visitImportStmt(ImportStmt& stmt) override;
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_COMPILER_HPP
@@ -0,0 +1,63 @@
+#ifndef MANASCRIPT_CONTEXT_HPP
+#define MANASCRIPT_CONTEXT_HPP
+
+#include "error.hpp"
+#include "source.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief State owned by one compilation: the file it compiles and the
+ * diagnostics its phases report
+ *
+ * The Lexer, Parser, BytecodeCompiler, Transpiler and CodeGenerator all
+ * report into the context they were constructed with, so compilations on
+ * different threads share nothing mutable. Phases constructed without a
+ * context report into the global diagnostics, which is kept for
+ * single-threaded callers.
+ *
+ * The context holds the source texts lexed in it, and the prototypes
+ * compiled in it hold them too, so the texts are released once both are
+ * gone.
+ */
+class CompilationContext {
+public:
+    /**
+     * @brief A context with diagnostics of its own
+     */
+    explicit CompilationContext(std::string filename = "")
+        : file(std::move(filename)), sink(&owned) {}
+
+    /**
+     * @brief A context that reports into an existing manager
+     */
+    CompilationContext(std::string filename, DiagnosticManager& reports)
+        : file(std::move(filename)), sink(&reports) {}
+
+    CompilationContext(const CompilationContext&) = delete;
+    CompilationContext& operator=(const CompilationContext&) = delete;
+
+    const std::string& filename() const { return file; }
+    DiagnosticManager& reports() const { return *sink; }
+    bool hasErrors() const { return sink->hasErrors(); }
+
+    /**
+     * @brief Keep a source text for as long as the context or its prototypes live
+     */
+    void keepSource(std::shared_ptr<const SourceBuffer> buffer) { held.push_back(std::move(buffer)); }
+    const std::vector<std::shared_ptr<const SourceBuffer>>& sources() const { return held; }
+
+private:
+    std::string file;
+    std::vector<std::shared_ptr<const SourceBuffer>> held;
+    DiagnosticManager owned;
+    DiagnosticManager* sink;
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_CONTEXT_HPP
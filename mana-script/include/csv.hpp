@@ -0,0 +1,79 @@
+#ifndef MANASCRIPT_CSV_HPP
+#define MANASCRIPT_CSV_HPP
+
+#include "object.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file csv.hpp
+ * @brief CSV tables read on demand
+ *
+ * Parsing finds the separators 64 bytes at a time (simd.hpp): commas and
+ * line breaks outside quotes, where the inside of quotes is the prefix XOR
+ * of the quote mask, so a doubled quote within a field toggles it twice and
+ * changes nothing. Only the offsets of the separators are kept. A field is
+ * cut out of the input, and unquoted, when a script asks for it.
+ */
+
+namespace mana {
+
+class CsvTable {
+public:
+    /**
+     * @brief Index a copy of text; throws RuntimeError for an unclosed quote
+     */
+    static std::shared_ptr<const CsvTable> parse(std::string_view text);
+
+    size_t rows() const { return row_starts.size() - 1; }
+
+    /**
+     * @return The column the first row names so, or -1
+     */
+    int column(std::string_view name) const;
+
+    /**
+     * @brief Characters of a field, unquoted into scratch if they have to be
+     * @return False if the row has no such column
+     */
+    bool field(size_t row, size_t column, std::string_view& chars, std::string& scratch) const;
+
+private:
+    std::string text;
+    std::vector<uint32_t> ends;         // Offset of the separator after each field
+    std::vector<uint32_t> row_starts;   // First field of each row in ends, then ends.size()
+    std::unordered_map<std::string, int> header;
+
+    void index();
+};
+
+/**
+ * @brief Heap handle of a CsvTable
+ */
+class ObjCsv : public Obj {
+public:
+    explicit ObjCsv(std::shared_ptr<const CsvTable> table)
+        : Obj(ObjType::CSV), table(std::move(table)) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjCsv(std::move(table)); }
+
+    std::shared_ptr<const CsvTable> table;
+};
+
+inline bool isCsv(Value value) { return isObjType(value, ObjType::CSV); }
+inline ObjCsv* asCsv(Value value) { return static_cast<ObjCsv*>(value.asObj()); }
+
+// Builtins; see builtins.cpp
+Value nativeParseCsv(VM& vm, int argc, const Value* args);
+Value nativeCsvRows(VM& vm, int argc, const Value* args);
+Value nativeCsvGet(VM& vm, int argc, const Value* args);
+Value nativeCsvNumber(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_CSV_HPP
@@ -0,0 +1,143 @@
+#ifndef MANASCRIPT_ENGINE_HPP
+#define MANASCRIPT_ENGINE_HPP
+
+#include "bytecode.hpp"
+#include "context.hpp"
+#include "gc.hpp"
+#include "vm.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @file engine.hpp
+ * @brief Embedding interface: compile a script once, run it many times
+ *
+ * Example:
+ *
+ *     mana::Engine engine;
+ *     auto script = engine.compile("function main() { return \"hello \" + name; }");
+ *     if (!script) {
+ *         mana::diagnostics.printDiagnostics();
+ *         return;
+ *     }
+ *     mana::RunResult result = engine.run(*script, {{"name", std::string("ada")}});
+ */
+
+namespace mana {
+
+/**
+ * @brief Settings shared by every compilation and run of an Engine
+ */
+struct EngineOptions {
+    bool optimize = true;                            // Peephole pass and register allocation
+    size_t nursery_size = Heap::kDefaultNurserySize;
+    AllocationMode allocation = AllocationMode::HEAP;  // For the call of the entry point
+    std::string entry = "main";                      // Called after top-level code if defined; awaited if async
+};
+
+/**
+ * @brief Values the host passes to one run, defined as globals before the
+ * script's top-level code runs
+ */
+using ScriptInputs = std::unordered_map<std::string, Constant>;
+
+/**
+ * @brief A script compiled to bytecode, ready to run any number of times
+ *
+ * Immutable once built, so it may be shared between threads. Each VM that
+ * runs it loads its own copy of the code.
+ */
+class CompiledScript {
+public:
+    CompiledScript(std::shared_ptr<const FunctionProto> bytecode, std::string filename)
+        : proto(std::move(bytecode)), name(std::move(filename)) {}
+
+    const std::shared_ptr<const FunctionProto>& bytecode() const { return proto; }
+    const std::string& filename() const { return name; }
+
+private:
+    std::shared_ptr<const FunctionProto> proto;
+    std::string name;
+};
+
+/**
+ * @brief Outcome of one run of a script
+ */
+struct RunResult {
+    InterpretResult status = InterpretResult::OK;
+    Constant value = nullptr;  // Returned by the entry point; other objects as their text
+    std::string error;         // Runtime error message; also reported to the VM's diagnostics
+
+    bool ok() const { return status == InterpretResult::OK; }
+};
+
+/**
+ * @brief Convert a host value into a value owned by vm
+ *
+ * A string input is young; see VM::newString().
+ */
+Value toValue(VM& vm, const Constant& input);
+
+/**
+ * @brief Copy a VM value out for the host
+ *
+ * Results outlive the VM that produced them, so objects other than strings
+ * leave as their text.
+ */
+Constant toConstant(Value value);
+
+/**
+ * @brief Compiles scripts and runs them in isolated VMs
+ *
+ * Compilations given a CompilationContext of their own, and runs in
+ * separate VMs, may proceed on any number of threads at once. The overloads
+ * without a context report to the global diagnostics and are for
+ * single-threaded callers.
+ */
+class Engine {
+public:
+    explicit Engine(EngineOptions options = {}) : engine_options(std::move(options)) {}
+
+    /**
+     * @brief Lex, parse and compile source code
+     * @return The script, or nullptr if the context has errors
+     */
+    std::shared_ptr<const CompiledScript> compile(const std::string& source,
+                                                  CompilationContext& context) const;
+    std::shared_ptr<const CompiledScript> compile(const std::string& source,
+                                                  const std::string& filename = "") const;
+
+    /**
+     * @brief Compile the file named by the context
+     * @return The script, or nullptr if the file cannot be read or has errors
+     */
+    std::shared_ptr<const CompiledScript> compileFile(CompilationContext& context) const;
+    std::shared_ptr<const CompiledScript> compileFile(const std::string& path) const;
+
+    /**
+     * @brief Run a script in a fresh VM
+     *
+     * Nothing one run does is visible to the next.
+     */
+    RunResult run(const CompiledScript& script, const ScriptInputs& inputs = {}) const;
+
+    /**
+     * @brief Run a script in a VM the host owns
+     *
+     * For hosts that define natives of their own or keep globals between
+     * runs. A VM runs a script's top-level code again each time, but loads
+     * its bytecode only once.
+     */
+    RunResult run(const CompiledScript& script, VM& vm, const ScriptInputs& inputs = {}) const;
+
+    const EngineOptions& options() const { return engine_options; }
+
+private:
+    EngineOptions engine_options;
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_ENGINE_HPP
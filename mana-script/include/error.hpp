@@ -1,7 +1,9 @@
 #ifndef MANASCRIPT_ERROR_HPP
 #define MANASCRIPT_ERROR_HPP
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 #include <memory>
@@ -9,6 +11,8 @@
 
 namespace mana {
 
+class SourceLoc;
+
 /**
  * @brief Severity levels for diagnostic messages
  */
@@ -33,28 +37,103 @@ struct SourceLocation {
     std::string toString() const;
 };
 
+/**
+ * @brief Index of a file in the SourceManager; 0 is no file
+ */
+using FileId = uint32_t;
+
+/**
+ * @brief Id of the latest file loaded under a name, registering the name if
+ * no file has it
+ */
+FileId fileId(const std::string& filename);
+
+/**
+ * @brief Name of a file
+ */
+const std::string& fileName(FileId file);
+
+/**
+ * @brief What a diagnostic reports
+ *
+ * Each code has a message template whose {0} and {1} are filled in from the
+ * diagnostic's arguments when the text is first needed.
+ */
+enum class DiagnosticCode : uint16_t {
+    TEXT,                  // {0}
+    UNEXPECTED_CHARACTER,  // Unexpected character '{0}'
+    INVALID_ESCAPE,        // Invalid escape sequence '\{0}'
+    UNTERMINATED_STRING,
+    UNTERMINATED_COMMENT,
+    INVALID_NUMBER,        // Invalid {0} number
+    INVALID_EXPONENT,
+    SYNTAX,                // {0} at '{1}'
+    SYNTAX_AT_END          // {0} at end of file
+};
+
+/**
+ * @brief Message template of a code
+ */
+const char* diagnosticFormat(DiagnosticCode code);
+
+/**
+ * @brief One argument of a diagnostic
+ *
+ * Static text such as a message literal is referenced, not copied. Other
+ * text is owned; token lexemes are usually short enough not to allocate.
+ */
+class DiagnosticArg {
+public:
+    DiagnosticArg() = default;
+    DiagnosticArg(const char* literal) : literal(literal) {}
+    DiagnosticArg(std::string text) : text(std::move(text)) {}
+    DiagnosticArg(char c) : text(1, c) {}
+
+    std::string_view view() const { return literal ? std::string_view(literal) : std::string_view(text); }
+
+private:
+    const char* literal = nullptr;
+    std::string text;
+};
+
 /**
  * @brief Represents a diagnostic message for error reporting
+ *
+ * Stored as a code, its arguments and a compact location. The message text
+ * is only built by getMessage() and toString(), and the source line shown
+ * under it is read from the SourceManager then.
  */
 class Diagnostic {
 private:
     DiagnosticSeverity severity;
-    std::string message;
-    SourceLocation location;
+    DiagnosticCode code;
+    FileId file;
+    int line;
+    int column;
+    DiagnosticArg args[2];
     std::string code_context;
 
 public:
+    Diagnostic(DiagnosticSeverity severity, DiagnosticCode code, FileId file, int line, int column,
+               DiagnosticArg first = {}, DiagnosticArg second = {}, std::string code_context = "")
+        : severity(severity), code(code), file(file), line(line), column(column),
+          args{std::move(first), std::move(second)}, code_context(std::move(code_context)) {}
+
     Diagnostic(DiagnosticSeverity severity, 
                const std::string& message,
                const SourceLocation& location,
                const std::string& code_context = "")
-        : severity(severity), message(message), 
-          location(location), code_context(code_context) {}
+        : Diagnostic(severity, DiagnosticCode::TEXT, fileId(location.filename), location.line,
+                     location.column, message, {}, code_context) {}
     
     DiagnosticSeverity getSeverity() const { return severity; }
-    const std::string& getMessage() const { return message; }
-    const SourceLocation& getLocation() const { return location; }
-    const std::string& getCodeContext() const { return code_context; }
+    DiagnosticCode getCode() const { return code; }
+    FileId getFile() const { return file; }
+    std::string getMessage() const;
+    SourceLocation getLocation() const { return SourceLocation(fileName(file), line, column); }
+    int getLine() const { return line; }
+    int getColumn() const { return column; }
+    std::string getCodeContext() const;
     
     std::string toString() const;
 };
@@ -65,14 +144,16 @@ public:
 class CompilerError : public std::exception {
 private:
     Diagnostic diagnostic;
+    std::string message;
     
 public:
-    CompilerError(const Diagnostic& diagnostic) : diagnostic(diagnostic) {}
+    CompilerError(const Diagnostic& diagnostic)
+        : diagnostic(diagnostic), message(diagnostic.getMessage()) {}
     
     const Diagnostic& getDiagnostic() const { return diagnostic; }
     
     const char* what() const noexcept override {
-        return diagnostic.getMessage().c_str();
+        return message.c_str();
     }
 };
 
@@ -90,6 +171,19 @@ public:
                 const std::string& message,
                 const SourceLocation& location,
                 const std::string& code_context = "");
+
+    /**
+     * @brief Record a diagnostic at a source location, decoding it to a line
+     * and column but formatting nothing
+     */
+    void report(DiagnosticSeverity severity, DiagnosticCode code, SourceLoc loc,
+                DiagnosticArg first = {}, DiagnosticArg second = {});
+
+    /**
+     * @brief Record a diagnostic without formatting anything
+     */
+    void report(DiagnosticSeverity severity, DiagnosticCode code, FileId file, int line, int column,
+                DiagnosticArg first = {}, DiagnosticArg second = {}, std::string code_context = "");
     
     bool hasErrors() const { return has_errors; }
     const std::vector<Diagnostic>& getDiagnostics() const { return diagnostics; }
@@ -0,0 +1,101 @@
+#ifndef MANASCRIPT_EXTENSION_HPP
+#define MANASCRIPT_EXTENSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @file extension.hpp
+ * @brief ABI between the engine and native extension modules
+ *
+ * An extension is a shared object that exports mana_extension_module(). That
+ * function returns a table describing the module's functions. Each function
+ * is a plain C function whose parameters are the raw scalars below. A string
+ * argument becomes two parameters, a pointer and a length, which view the
+ * script's own characters for the duration of the call. A string result is
+ * an ExtString that the engine copies before the next call into the module.
+ *
+ * A script loads a module with `import "path/to/module.so";` at the top
+ * level. Every function in the table becomes a global of that name.
+ *
+ * Example:
+ *
+ *     extern "C" double hypotenuse(double a, double b) { return std::hypot(a, b); }
+ *
+ *     static const mana::ExtFunction functions[] = {
+ *         {"hypot", "hypotenuse", reinterpret_cast<void*>(hypotenuse),
+ *          mana::ExtType::DOUBLE, 2, {mana::ExtType::DOUBLE, mana::ExtType::DOUBLE}},
+ *     };
+ *     static const mana::ExtModule module = {mana::kExtensionAbiVersion, "geometry", functions, 1};
+ *
+ *     extern "C" const mana::ExtModule* mana_extension_module() { return &module; }
+ */
+
+namespace mana {
+
+constexpr uint32_t kExtensionAbiVersion = 1;
+constexpr int kMaxExtensionParams = 3;
+
+/**
+ * @brief Type of an extension parameter or result, and the C type it maps to
+ */
+enum class ExtType : uint8_t {
+    VOID,    // Results only; the script sees nil
+    INT,     // int64_t
+    DOUBLE,  // double
+    BOOL,    // bool
+    STRING   // Parameters: const char*, size_t. Results: ExtString
+};
+
+/**
+ * @brief Characters returned by an extension function
+ */
+struct ExtString {
+    const char* data;
+    size_t length;
+};
+
+/**
+ * @brief One function exported by an extension
+ */
+struct ExtFunction {
+    const char* name;    // Global the script calls it by
+    const char* symbol;  // Exported C symbol, for code generators that call it directly
+    void* function;
+    ExtType result;
+    uint8_t arity;
+    ExtType params[kMaxExtensionParams];
+};
+
+/**
+ * @brief Descriptor table returned by mana_extension_module()
+ */
+struct ExtModule {
+    uint32_t abi_version;  // kExtensionAbiVersion the module was built against
+    const char* name;
+    const ExtFunction* functions;
+    uint32_t count;
+};
+
+using ExtModuleEntry = const ExtModule* (*)();
+
+constexpr const char* kExtensionEntry = "mana_extension_module";
+
+/**
+ * @brief Load an extension and validate its descriptor table
+ *
+ * The shared object stays loaded for the rest of the process, since
+ * functions defined from it may be referenced anywhere.
+ *
+ * @param path Passed to dlopen unchanged
+ * @param error Set to a description of the problem on failure
+ * @return The module's table, or nullptr on failure
+ */
+const ExtModule* loadExtension(const std::string& path, std::string& error);
+
+const char* extTypeName(ExtType type);
+
+} // namespace mana
+
+#endif // MANASCRIPT_EXTENSION_HPP
@@ -0,0 +1,145 @@
+#ifndef MANASCRIPT_FILE_HPP
+#define MANASCRIPT_FILE_HPP
+
+#include "io.hpp"
+#include "object.hpp"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * @file file.hpp
+ * @brief Files scripts open, read and write
+ *
+ * A file opened for reading always has its next chunk on the way: while a
+ * script works through one buffer, the following one is being read (see
+ * io.hpp). A task that gets ahead of the reads is parked until its data
+ * arrives, so many tasks can each have a file in flight on one worker; any
+ * other caller blocks its thread. Files opened for writing buffer what is
+ * written and write it out when the buffer fills and when they are closed.
+ * Pipes and FIFOs are read as their data comes in, and end when the last
+ * writer closes them.
+ *
+ * A file may be shared between tasks; its operations take turns.
+ */
+
+namespace mana {
+
+class File {
+public:
+    enum class Mode {
+        READ,
+        WRITE,    // Truncates the file, creating it if need be
+        APPEND
+    };
+
+    // Written text is collected up to this many bytes
+    static constexpr size_t kWriteBufferSize = 64 * 1024;
+
+    /**
+     * @brief Open a file; throws RuntimeError if it cannot be
+     */
+    static std::shared_ptr<File> open(const std::string& path, Mode mode, IoService& io = IoService::global());
+
+    ~File();
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    /**
+     * @brief Where read bytes go: called under the file's lock with a view
+     * of its buffers, so they are copied once
+     */
+    using Reader = std::function<void(std::string_view)>;
+
+    /**
+     * @brief Read the next line, without its line break
+     * @param take Called with the line, unless the file has ended
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     * @return DONE, or PARKED if parker must suspend
+     */
+    Channel::Status readLine(const Reader& take, Task* parker);
+
+    /**
+     * @brief Read up to max bytes, however many the next buffer holds
+     * @param take Called with the bytes, unless the file has ended
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     * @return DONE, or PARKED if parker must suspend
+     */
+    Channel::Status read(size_t max, const Reader& take, Task* parker);
+
+    void write(std::string_view text);
+
+    /**
+     * @brief Write out what is buffered and release the file; closing twice
+     * does nothing
+     */
+    void close();
+
+    const std::string& path() const { return file_path; }
+
+private:
+    // One read, from its buffer
+    struct Chunk {
+        IoService::Buffer buffer;
+        IoRequest request;
+        bool started = false;
+    };
+
+    File(std::string path, Mode mode, int fd, IoService& io);
+
+    std::mutex mutex;
+    std::string file_path;
+    Mode mode;
+    int fd;
+    IoService& io;
+    bool closed = false;
+
+    // Reading: chunks[current] is being used and the other is read ahead
+    Chunk chunks[2];
+    int current = 0;
+    size_t position = 0;       // Bytes of the current chunk already used
+    size_t length = 0;         // Bytes the current chunk holds
+    uint64_t next_offset = 0;  // Where the next read starts
+    bool stream = false;       // A pipe or other file read from its current position
+    bool at_end = false;
+    std::string partial;       // Start of a line that goes on in the next chunk
+
+    // Writing
+    std::string pending;
+
+    Channel::Status fill(Task* parker);
+    void start(Chunk& chunk);
+    void flush();
+    void release();
+    [[noreturn]] void fail(const char* action, int error) const;
+};
+
+/**
+ * @brief Heap handle of a File
+ */
+class ObjFile : public Obj {
+public:
+    explicit ObjFile(std::shared_ptr<File> file)
+        : Obj(ObjType::FILE), file(std::move(file)) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjFile(std::move(file)); }
+
+    std::shared_ptr<File> file;
+};
+
+inline bool isFile(Value value) { return isObjType(value, ObjType::FILE); }
+inline ObjFile* asFile(Value value) { return static_cast<ObjFile*>(value.asObj()); }
+
+// Builtins; see builtins.cpp. close() is shared with channels; see task.hpp
+Value nativeOpen(VM& vm, int argc, const Value* args);
+Value nativeRead(VM& vm, int argc, const Value* args);
+Value nativeReadLine(VM& vm, int argc, const Value* args);
+Value nativeWrite(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_FILE_HPP
@@ -0,0 +1,289 @@
+#ifndef MANASCRIPT_GC_HPP
+#define MANASCRIPT_GC_HPP
+
+#include "object.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief Where a new object is placed
+ */
+enum class Generation {
+    YOUNG,  // Nursery; moved to the old space if it survives a collection
+    OLD     // Old space directly, for objects expected to live long
+};
+
+/**
+ * @brief Distribution of collection pause times
+ */
+struct PauseHistogram {
+    // Upper bounds of the buckets in microseconds; the last bucket is open
+    static constexpr std::array<uint64_t, 8> kBucketLimitsUs = {
+        10, 50, 100, 250, 500, 1000, 5000, 20000
+    };
+
+    std::array<uint64_t, kBucketLimitsUs.size() + 1> buckets{};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    void record(std::chrono::nanoseconds pause);
+};
+
+/**
+ * @brief Collector counters and pause histograms
+ */
+struct GcStats {
+    PauseHistogram minor;
+    PauseHistogram major;
+    uint64_t promoted_bytes = 0;   // Moved from the nursery to the old space
+    uint64_t old_bytes = 0;        // Occupied in the old space right now
+    uint64_t arena_bytes = 0;      // Allocated in arenas, all of it freed by resets
+    uint64_t evacuated_bytes = 0;  // Copied out of arenas because they escaped
+};
+
+/**
+ * @brief Bump allocator for objects that die together
+ *
+ * Memory comes from a list of chunks that doubles in size as it grows.
+ * reset() rewinds to the first chunk in constant time and keeps the chunks
+ * for the next use, so a steady workload stops calling malloc altogether.
+ * Nothing allocated here is destroyed, so only objects with kTrivialStorage
+ * may live in an arena.
+ *
+ * Each thread has one arena, claimed by one owner at a time.
+ */
+class Arena {
+public:
+    static constexpr size_t kInitialChunkSize = 64 * 1024;
+
+    static Arena& forThread();
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * @brief Claim the arena
+     * @return False if another owner holds it
+     */
+    bool acquire(const void* owner);
+    void release() { holder = nullptr; }
+
+    void* allocate(size_t size) {
+        if (static_cast<size_t>(limit - top) < size) {
+            nextChunk(size);
+        }
+        void* memory = top;
+        top += size;
+        return memory;
+    }
+
+    bool contains(const void* address) const;
+
+    /**
+     * @brief Free everything allocated since the last reset
+     */
+    void reset();
+
+    size_t capacity() const;
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;         // Chunk the cursor is in
+    uint8_t* top = nullptr;
+    uint8_t* limit = nullptr;
+    const void* holder = nullptr;
+
+    void nextChunk(size_t size);
+};
+
+/**
+ * @brief Generational heap for runtime objects
+ *
+ * Young objects are bump-allocated in a fixed nursery. A minor collection
+ * promotes every nursery object reachable from the roots or the remembered
+ * set into the old space and empties the nursery. The old space is
+ * mark-region: blocks are divided into lines, objects are bump-allocated
+ * into runs of free lines, and a major collection marks live objects, frees
+ * the rest and recycles every line no survivor touches. Objects too big for
+ * a block get a block of their own. Old objects never move.
+ *
+ * The heap never collects on its own. When the nursery fills up, further
+ * young allocations go to the old space and collectionPending() turns true;
+ * the owner collects at its next safepoint, where the roots are exact.
+ *
+ * Between enterArena() and leaveArena() young objects with trivial storage
+ * are bump-allocated in an Arena instead and no collections are requested.
+ * Leaving copies the arena objects still reachable from the given roots
+ * into the heap and resets the arena.
+ */
+class Heap {
+public:
+    /**
+     * @brief Enumerates the roots, visiting every slot that may hold an object
+     */
+    using RootSource = std::function<void(GcTracer&)>;
+
+    static constexpr size_t kDefaultNurserySize = 256 * 1024;
+
+    explicit Heap(size_t nursery_size = kDefaultNurserySize);
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    /**
+     * @brief Construct an object in the heap
+     */
+    template <typename T, typename... Args>
+    T* allocate(Generation generation, Args&&... args) {
+        size_t size = sizeof(T);
+        if constexpr (std::is_same_v<T, ObjString>) {
+            size = ObjString::allocationSizeFor(args...);
+        }
+        size = alignSize(size);
+
+        Block* block = nullptr;
+        void* memory = nullptr;
+        if (generation == Generation::YOUNG) {
+            if constexpr (T::kTrivialStorage) {
+                if (arena) {
+                    gc_stats.arena_bytes += size;
+                    memory = arena->allocate(size);
+                }
+            }
+            if (!memory) {
+                memory = allocateYoung(size);
+            }
+        }
+        if (!memory) {
+            memory = allocateOld(size, block);
+        }
+
+        T* object = new (memory) T(std::forward<Args>(args)...);
+        object->size = static_cast<uint32_t>(size);
+        if (block) {
+            block->objects.push_back(object);
+        }
+        return object;
+    }
+
+    /**
+     * @brief Record a store of value into a field of owner
+     *
+     * Must follow every store of an object reference into another object, so
+     * minor collections find old objects that point into the nursery and
+     * leaveArena() finds heap objects that point into the arena.
+     */
+    void writeBarrier(Obj* owner, Value value) {
+        if (!value.isObj()) {
+            return;
+        }
+        if (isYoung(value.asObj()) && !owner->remembered && !isYoung(owner)) {
+            owner->remembered = true;
+            remembered.push_back(owner);
+        }
+        // Heap objects that point into the arena are scanned when leaving it
+        if (arena && !arena->contains(owner) && arena->contains(value.asObj())) {
+            arena_owners.push_back(owner);
+        }
+    }
+
+    bool isYoung(const Obj* object) const {
+        auto address = reinterpret_cast<const uint8_t*>(object);
+        return address >= nursery.get() && address < nursery_end;
+    }
+
+    /**
+     * @brief Whether the owner should collect at its next safepoint
+     */
+    bool collectionPending() const { return !arena && (minor_pending || major_pending); }
+    bool majorCollectionPending() const { return major_pending; }
+
+    /**
+     * @brief Collect garbage; a major collection also runs a minor one first
+     */
+    void collect(bool major, const RootSource& roots);
+
+    /**
+     * @brief Allocate young objects in arena until leaveArena()
+     */
+    void enterArena(Arena& arena);
+
+    /**
+     * @brief Copy the arena objects reachable from roots into the heap,
+     * then reset the arena
+     *
+     * Must be called at a point where roots reaches every arena object still
+     * in use.
+     */
+    void leaveArena(const RootSource& roots);
+
+    bool inArena() const { return arena != nullptr; }
+
+    const GcStats& stats() const { return gc_stats; }
+
+private:
+    static constexpr size_t kLineSize = 128;
+    static constexpr size_t kBlockSize = 32 * 1024;
+    static constexpr size_t kLinesPerBlock = kBlockSize / kLineSize;
+    static constexpr uint64_t kInitialMajorThreshold = 8 * 1024 * 1024;
+
+    struct Block {
+        std::unique_ptr<uint8_t[]> memory;
+        std::array<bool, kLinesPerBlock> line_used{};  // Touched by a survivor of the last major
+        std::vector<Obj*> objects;                     // Objects that start in this block
+        bool large = false;                            // Holds one object bigger than a block
+    };
+
+    std::unique_ptr<uint8_t[]> nursery;
+    uint8_t* nursery_end;
+    uint8_t* nursery_top;
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    size_t alloc_block = 0;        // Block the old-space cursor is in
+    size_t alloc_line = 0;         // First line after the current hole
+    uint8_t* old_top = nullptr;    // Bump cursor of the current hole
+    uint8_t* old_limit = nullptr;
+
+    std::vector<Obj*> remembered;
+    Arena* arena = nullptr;
+    std::vector<Obj*> arena_owners;
+    bool minor_pending = false;
+    bool major_pending = false;
+    uint64_t major_threshold = kInitialMajorThreshold;
+
+    GcStats gc_stats;
+
+    static size_t alignSize(size_t size) { return (size + 15) & ~size_t(15); }
+
+    void* allocateYoung(size_t size);
+    void* allocateOld(size_t size, Block*& block);
+    void* allocateLarge(size_t size, Block*& block);
+    bool nextHole(size_t size);
+
+    Obj* promote(Obj* object, std::vector<Obj*>& worklist);
+    Obj* evacuate(Obj* object, std::vector<Obj*>& worklist);
+    void minorCollection(const RootSource& roots);
+    void majorCollection(const RootSource& roots);
+    void sweep();
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_GC_HPP
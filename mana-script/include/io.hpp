@@ -0,0 +1,165 @@
+#ifndef MANASCRIPT_IO_HPP
+#define MANASCRIPT_IO_HPP
+
+#include "task.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+/**
+ * @file io.hpp
+ * @brief Asynchronous file reads on io_uring, with a blocking fallback
+ *
+ * Reads are submitted to a ring shared by the process and completed by a
+ * reaper thread, which wakes whoever waits for them: a parked task is queued
+ * again and a blocked thread is notified, as for channels. Reads go to
+ * buffers from a pool registered with the kernel once, so they skip mapping
+ * their pages on every read, and buffers return to the pool when a file is
+ * done with them.
+ *
+ * Without io_uring, because the kernel lacks it, forbids it or
+ * MANASCRIPT_IO_URING=0 is set, a read is a blocking pread() followed by a
+ * hint to read the next chunk ahead, or a blocking read() for pipes and
+ * other files without offsets.
+ */
+
+namespace mana {
+
+/**
+ * @brief One read in flight and its outcome
+ */
+class IoRequest {
+public:
+    IoRequest() = default;
+    IoRequest(const IoRequest&) = delete;
+    IoRequest& operator=(const IoRequest&) = delete;
+
+    /**
+     * @brief Wait for the read to complete
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     * @return DONE, or PARKED if parker must suspend
+     */
+    Channel::Status wait(Task* parker);
+
+    /**
+     * @brief Bytes read, or a negated errno; only once the read completed
+     */
+    ssize_t result();
+
+    /**
+     * @brief Make the request usable for another read
+     */
+    void reset();
+
+private:
+    friend class IoService;
+
+    std::mutex mutex;
+    bool done = false;
+    ssize_t bytes = 0;
+    WaitList waiters;
+
+    void complete(ssize_t result);
+};
+
+/**
+ * @brief Submits reads and completes them
+ */
+class IoService {
+public:
+    // Every read fills at most one buffer
+    static constexpr size_t kBufferSize = 256 * 1024;
+
+    // Offset of a read from the current position of a file without offsets,
+    // such as a pipe
+    static constexpr uint64_t kStream = UINT64_MAX;
+
+    // Buffers registered with the ring; more are allocated when they run out
+    static constexpr unsigned kRegisteredBuffers = 16;
+
+    /**
+     * @brief The service files use; never destroyed, since tasks may still
+     * be reading while the process exits
+     */
+    static IoService& global();
+
+    /**
+     * @param use_ring Whether to try io_uring at all
+     */
+    explicit IoService(bool use_ring);
+    ~IoService();
+
+    IoService(const IoService&) = delete;
+    IoService& operator=(const IoService&) = delete;
+
+    /**
+     * @brief Whether reads go through io_uring
+     */
+    bool usesRing() const { return ring_fd >= 0; }
+
+    /**
+     * @brief Memory for one read, from the pool if it has any left
+     */
+    struct Buffer {
+        char* data = nullptr;
+        int index = -1;   // Of the registered buffer, or -1 for one of its own
+    };
+
+    Buffer acquireBuffer();
+    void releaseBuffer(Buffer buffer);
+
+    /**
+     * @brief Read up to kBufferSize bytes at offset, or kStream, into buffer
+     *
+     * The request completes once the read has; without io_uring, before
+     * this returns. A read may return fewer bytes than there are left, and
+     * returns none at the end of the file.
+     */
+    void read(int fd, const Buffer& buffer, uint64_t offset, IoRequest& request);
+
+private:
+    // The mapped submission and completion queues of the ring
+    struct Ring {
+        void* sq_memory = nullptr;
+        size_t sq_size = 0;
+        void* cq_memory = nullptr;
+        size_t cq_size = 0;
+        void* sqe_memory = nullptr;
+        size_t sqe_size = 0;
+
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned sq_mask = 0;
+        unsigned* sq_array = nullptr;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned cq_mask = 0;
+        void* cqes = nullptr;
+        void* sqes = nullptr;
+    };
+
+    int ring_fd = -1;
+    Ring ring;
+    bool buffers_registered = false;
+    std::mutex submit_mutex;
+    std::atomic<uint64_t> submitted{0};   // Hands requests to the reaper in memory-order terms
+    std::thread reaper;
+
+    std::mutex buffer_mutex;
+    char* registered = nullptr;      // kRegisteredBuffers buffers, back to back
+    std::vector<int> free_buffers;
+
+    bool setupRing();
+    void teardownRing();
+    int submit(uint8_t opcode, int fd, const Buffer& buffer, uint64_t offset, uint64_t user_data);
+    void reap();
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_IO_HPP
@@ -0,0 +1,60 @@
+#ifndef MANASCRIPT_ISOLATE_HPP
+#define MANASCRIPT_ISOLATE_HPP
+
+#include "engine.hpp"
+#include "error.hpp"
+#include "vm.hpp"
+
+#include <string>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief An independent instance of the runtime, such as one per tenant
+ *
+ * An isolate owns a VM, and with it a heap, globals and interned strings,
+ * plus the diagnostics its code reports. Isolates share nothing mutable, so
+ * any number of them can run at once on different threads, all executing
+ * the same CompiledScript. Each loads its own copy of the script's code.
+ * One isolate must only be used by one thread at a time, but it may move
+ * between threads from one run to the next.
+ *
+ * Extension functions called from isolates on several threads must be
+ * thread-safe themselves.
+ */
+class Isolate {
+public:
+    explicit Isolate(EngineOptions options = {});
+
+    Isolate(const Isolate&) = delete;
+    Isolate& operator=(const Isolate&) = delete;
+
+    /**
+     * @brief Run a script's top-level code, then its entry point
+     *
+     * Globals persist, so later runs and call() see what this one defined.
+     */
+    RunResult run(const CompiledScript& script, const ScriptInputs& inputs = {});
+
+    /**
+     * @brief Call a global function, typically one defined by an earlier run
+     */
+    RunResult call(const std::string& function, const std::vector<Constant>& args = {});
+
+    VM& vm() { return machine; }
+
+    /**
+     * @brief Runtime errors reported by this isolate's code
+     */
+    DiagnosticManager& reports() { return errors; }
+
+private:
+    Engine engine;
+    DiagnosticManager errors;
+    VM machine;
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_ISOLATE_HPP
@@ -0,0 +1,163 @@
+#ifndef MANASCRIPT_JSON_HPP
+#define MANASCRIPT_JSON_HPP
+
+#include "object.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @file json.hpp
+ * @brief JSON documents read on demand
+ *
+ * Parsing does two passes and builds no tree. The first classifies the
+ * input 64 bytes at a time (simd.hpp): it masks out escaped quotes and the
+ * insides of strings, and records the offset of every structural character,
+ * opening quote and start of a number or literal. The second walks those
+ * offsets once, checks the nesting and punctuation, and links each '{' and
+ * '[' to its closing bracket so a lookup can skip whole values.
+ *
+ * What a script gets back is a view: the document and the index of one
+ * value in it. Strings, numbers and literals are decoded, and checked, only
+ * when a script asks for them.
+ */
+
+namespace mana {
+
+class JsonDocument {
+public:
+    // No such value; see member() and element()
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    // The first value; a document holds exactly one
+    static constexpr uint32_t kRoot = 0;
+
+    enum class Kind {
+        OBJECT,
+        ARRAY,
+        STRING,
+        NUMBER,
+        BOOLEAN,
+        NULL_VALUE
+    };
+
+    /**
+     * @brief Index and check a copy of text; throws RuntimeError with the
+     * byte offset of the first error
+     */
+    static std::shared_ptr<const JsonDocument> parse(std::string_view text);
+
+    /**
+     * @brief Kind of a value; throws RuntimeError for a misspelled literal
+     */
+    Kind kind(uint32_t value) const;
+
+    /**
+     * @return The value of an object's member, or kNone
+     */
+    uint32_t member(uint32_t object, std::string_view key) const;
+
+    /**
+     * @brief Where the last element() lookup on an array ended, so reading
+     * an array in order takes linear time
+     */
+    struct Cursor {
+        size_t position = 0;
+        uint32_t value = kNone;
+    };
+
+    /**
+     * @return The value of an array's element, or kNone
+     */
+    uint32_t element(uint32_t array, size_t position, Cursor& cursor) const;
+
+    /**
+     * @brief Members of an object or elements of an array
+     */
+    size_t size(uint32_t container) const;
+
+    /**
+     * @brief Characters of a string, unescaped into scratch if they have to
+     * be; throws RuntimeError for a bad escape
+     */
+    std::string_view string(uint32_t value, std::string& scratch) const;
+
+    /**
+     * @brief An int if the number has no fraction or exponent and fits,
+     * otherwise a float; throws RuntimeError if it is not a number
+     */
+    Value number(uint32_t value) const;
+
+    bool boolean(uint32_t value) const { return text[offsets[value]] == 't'; }
+
+    /**
+     * @brief The value as it is written in the input
+     */
+    std::string_view raw(uint32_t value) const {
+        uint32_t begin = offsets[value];
+        uint32_t end;
+        if (at(value) == '{' || at(value) == '[') {
+            end = offsets[closers[value]] + 1;
+        } else {
+            // Up to the next token, less the whitespace before it
+            end = value + 1 < count ? offsets[value + 1] : static_cast<uint32_t>(text.size());
+            while (end > begin && (text[end - 1] == ' ' || text[end - 1] == '\t' ||
+                                   text[end - 1] == '\n' || text[end - 1] == '\r')) {
+                end--;
+            }
+        }
+        return std::string_view(text.data() + begin, end - begin);
+    }
+
+private:
+    std::string text;
+    std::unique_ptr<uint32_t[]> offsets;   // Of each token in text
+    std::unique_ptr<uint32_t[]> closers;   // For '{' and '[', the token of their closing bracket
+    uint32_t count = 0;                    // Tokens
+
+    char at(uint32_t token) const { return text[offsets[token]]; }
+    uint32_t skip(uint32_t value) const;
+    uint32_t nextElement(uint32_t value) const;
+    void index();
+    void link();
+    [[noreturn]] void fail(uint32_t offset, const std::string& message) const;
+};
+
+/**
+ * @brief Heap handle of an object or array in a JsonDocument
+ */
+class ObjJson : public Obj {
+public:
+    ObjJson(std::shared_ptr<const JsonDocument> document, uint32_t value)
+        : Obj(ObjType::JSON), document(std::move(document)), value(value) {}
+
+    Obj* moveTo(void* memory) override {
+        ObjJson* moved = new (memory) ObjJson(std::move(document), value);
+        moved->cursor = cursor;
+        return moved;
+    }
+
+    std::shared_ptr<const JsonDocument> document;
+    uint32_t value;
+    JsonDocument::Cursor cursor;
+};
+
+inline bool isJson(Value value) { return isObjType(value, ObjType::JSON); }
+inline ObjJson* asJson(Value value) { return static_cast<ObjJson*>(value.asObj()); }
+
+/**
+ * @brief A value of a document as scripts see it: objects and arrays as
+ * views, everything else decoded
+ */
+Value jsonValue(VM& vm, const std::shared_ptr<const JsonDocument>& document, uint32_t value);
+
+// Builtins; see builtins.cpp
+Value nativeParseJson(VM& vm, int argc, const Value* args);
+Value nativeJsonGet(VM& vm, int argc, const Value* args);
+Value nativeJsonLen(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_JSON_HPP
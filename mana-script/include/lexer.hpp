@@ -3,6 +3,7 @@
 
 #include "token.hpp"
 #include "error.hpp"
+#include "context.hpp"
 #include <string>
 #include <vector>
 #include <memory>
@@ -16,9 +17,12 @@ namespace mana {
  */
 class Lexer {
 private:
-    std::string source;
+    std::string_view source;  // Owned by the SourceManager
     std::string filename;
+    FileId file = 0;
+    SourceLoc base;           // Location of the first character
     std::vector<Token> tokens;
+    DiagnosticManager* reports = &diagnostics;
     
     int start = 0;
     int current = 0;
@@ -26,6 +30,8 @@ private:
     int column = 1;
     
     // Helper methods
+    void load(const std::string& text);
+    void open(FileId buffer);
     bool isAtEnd() const;
     char advance();
     char peek() const;
@@ -42,14 +48,15 @@ private:
     void scanIdentifier();
     
     // Error handling
-    void reportError(const std::string& message);
+    void reportError(DiagnosticCode code, DiagnosticArg arg = {});
     
-    // Source position tracking
-    SourceLocation getCurrentLocation() const;
-    std::string getLineContext() const;
-
 public:
     Lexer(const std::string& source, const std::string& filename = "");
+
+    /**
+     * @brief Lex a source of the given compilation, reporting into its diagnostics
+     */
+    Lexer(const std::string& source, CompilationContext& context);
     
     /**
      * @brief Scans the source code and generates tokens
@@ -0,0 +1,105 @@
+#ifndef MANASCRIPT_LINES_HPP
+#define MANASCRIPT_LINES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @file lines.hpp
+ * @brief Splitting large inputs into lines, for `manascript -n` and `-p`
+ *
+ * A regular file is mapped whole and split in place, so its lines are views
+ * of the mapping and nothing is copied until a script sees them. Pipes and
+ * terminals are read in large blocks instead. Line breaks are found 64 bytes
+ * at a time with SIMD compares, leaving a bit per line break to walk, which
+ * keeps short lines from paying for a memchr() call each; see simd.hpp.
+ */
+
+namespace mana {
+
+/**
+ * @brief Walks the lines of one block of text
+ */
+class LineScanner {
+public:
+    LineScanner() = default;
+    LineScanner(const char* begin, const char* end);
+
+    /**
+     * @brief Find the next line, without its line break or a '\r' before it
+     * @param last Whether the block ends the input, so text after the last
+     *             line break is a line too
+     * @return False once no complete line is left; see rest()
+     */
+    bool next(std::string_view& line, bool last);
+
+    /**
+     * @brief What follows the last line returned
+     */
+    std::string_view rest() const { return std::string_view(start, static_cast<size_t>(end - start)); }
+
+private:
+    const char* start = nullptr;   // Of the next line
+    const char* block = nullptr;   // Start of the bytes mask describes
+    const char* scanned = nullptr; // Past them
+    const char* end = nullptr;
+    uint64_t mask = 0;             // A bit per line break in block not returned yet
+
+    bool scanBlock();
+};
+
+/**
+ * @brief The lines of a file or of standard input
+ */
+class LineInput {
+public:
+    // Pipes are read this much at a time; longer lines grow the buffer
+    static constexpr size_t kBlockSize = 1024 * 1024;
+
+    /**
+     * @brief Open a file; throws RuntimeError if it cannot be
+     */
+    static std::unique_ptr<LineInput> open(const std::string& path);
+
+    /**
+     * @brief Read standard input, mapping it if it is a regular file
+     */
+    static std::unique_ptr<LineInput> standardInput();
+
+    ~LineInput();
+
+    LineInput(const LineInput&) = delete;
+    LineInput& operator=(const LineInput&) = delete;
+
+    /**
+     * @brief The next line, valid until the following call
+     * @return False at the end of the input
+     */
+    bool next(std::string_view& line);
+
+private:
+    LineInput(int fd, std::string name, bool owns_fd);
+
+    int fd;
+    std::string name;
+    bool owns_fd;
+    LineScanner scanner;
+
+    // A mapped file
+    void* mapping = nullptr;
+    size_t mapped_size = 0;
+
+    // A stream, read block by block
+    std::vector<char> buffer;
+    bool at_end = false;
+
+    void refill();
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_LINES_HPP
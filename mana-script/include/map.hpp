@@ -0,0 +1,355 @@
+#ifndef MANASCRIPT_MAP_HPP
+#define MANASCRIPT_MAP_HPP
+
+#include "object.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @file map.hpp
+ * @brief Hash maps stored in flat open-addressing tables
+ *
+ * A table keeps its keys and values in two arrays and, beside them, a
+ * control byte per slot: 0x80 for an empty slot, or 7 bits of the key's
+ * hash for a full one. A lookup starts at the slot the hash picks and
+ * compares the control bytes 16 at a time (simd.hpp); only the slots whose
+ * byte matches have their key compared, and the first group with an empty
+ * slot ends the search. The first 15 control bytes are repeated after the
+ * last, so a group that runs past the end of the table reads the start.
+ *
+ * Keys are placed by linear probing, which lets a deletion move the keys
+ * after it back into the hole instead of leaving a tombstone, so a table
+ * never fills up with deleted slots and lookups never slow down with churn.
+ *
+ * A map keeps its entries in a table specialized for the keys it holds:
+ * 32-bit ints, strings, or, once it holds a mix, any key. String keys are
+ * compared by address first, and identifier-like keys are replaced by the
+ * VM's interned copy, so looking up a constant key usually takes no string
+ * compare.
+ */
+
+namespace mana {
+
+// Spreads the bits of a hash across the word, low bits included
+inline uint64_t mixHash(uint64_t h) {
+    h *= 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+/**
+ * @brief Keys of a table of int keys
+ */
+struct IntKeys {
+    using Key = int32_t;
+    static uint64_t hash(int32_t key) { return mixHash(static_cast<uint32_t>(key)); }
+    static bool equal(int32_t a, int32_t b) { return a == b; }
+};
+
+/**
+ * @brief Keys of a table of flat string keys
+ */
+struct StringKeys {
+    using Key = Value;
+    static uint64_t hash(Value key) { return mixHash(asString(key)->hashCode()); }
+    static bool equal(Value a, Value b) { return a == b || stringsEqual(asString(a), asString(b)); }
+};
+
+/**
+ * @brief Keys of a table of mixed keys: ints, strings, other numbers and
+ * booleans
+ */
+struct ValueKeys {
+    using Key = Value;
+    static uint64_t hash(Value key) { return isString(key) ? StringKeys::hash(key) : mixHash(key.bits()); }
+    static bool equal(Value a, Value b) {
+        return a == b || (isString(a) && isString(b) && stringsEqual(asString(a), asString(b)));
+    }
+};
+
+/**
+ * @brief Open-addressing table from Keys::Key to Value
+ */
+template <typename Keys>
+class FlatTable {
+public:
+    using Key = typename Keys::Key;
+
+    // No such key; see find()
+    static constexpr size_t kNoSlot = SIZE_MAX;
+
+    FlatTable() = default;
+    FlatTable(FlatTable&& other) noexcept { *this = std::move(other); }
+    FlatTable& operator=(FlatTable&& other) noexcept {
+        ctrl = std::move(other.ctrl);
+        keys = std::move(other.keys);
+        values = std::move(other.values);
+        slots = std::exchange(other.slots, 0);
+        count = std::exchange(other.count, 0);
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return slots; }
+
+    /**
+     * @return The slot of key, or kNoSlot
+     */
+    size_t find(Key key) const {
+        if (count == 0) {
+            return kNoSlot;
+        }
+        const uint64_t hash = Keys::hash(key);
+        const uint8_t tag = tagOf(hash);
+        for (size_t group = homeOf(hash);; group = (group + kSimdGroupSize) & mask()) {
+            SimdGroup control(ctrl.get() + group);
+            for (uint32_t hits = control.eq(tag); hits; hits &= hits - 1) {
+                size_t slot = (group + __builtin_ctz(hits)) & mask();
+                if (Keys::equal(keys[slot], key)) {
+                    return slot;
+                }
+            }
+            if (control.highBits()) {
+                return kNoSlot;
+            }
+        }
+    }
+
+    /**
+     * @return The value of key, or nil
+     */
+    Value get(Key key) const {
+        size_t slot = find(key);
+        return slot == kNoSlot ? Value::nil() : values[slot];
+    }
+
+    /**
+     * @return The slot of key, added with a nil value if it was not there
+     */
+    size_t insert(Key key) {
+        size_t slot = find(key);
+        if (slot != kNoSlot) {
+            return slot;
+        }
+        // At most 7/8 full, so a probe always meets an empty slot soon
+        if ((count + 1) * 8 > slots * 7) {
+            grow();
+        }
+        return place(key, Keys::hash(key));
+    }
+
+    /**
+     * @return Whether key was there
+     */
+    bool erase(Key key) {
+        size_t hole = find(key);
+        if (hole == kNoSlot) {
+            return false;
+        }
+        count--;
+
+        // Move back every later key of the run that may sit in the hole:
+        // those whose home slot is not between the hole and themselves
+        for (size_t slot = (hole + 1) & mask(); ctrl[slot] != kEmpty; slot = (slot + 1) & mask()) {
+            size_t home = homeOf(Keys::hash(keys[slot]));
+            if (((slot - home) & mask()) >= ((slot - hole) & mask())) {
+                setControl(hole, ctrl[slot]);
+                keys[hole] = keys[slot];
+                values[hole] = values[slot];
+                hole = slot;
+            }
+        }
+        setControl(hole, kEmpty);
+        keys[hole] = Key();
+        values[hole] = Value::nil();
+        return true;
+    }
+
+    /**
+     * @return The first full slot at or after from, or kNoSlot
+     */
+    size_t next(size_t from) const {
+        for (size_t slot = from; slot < slots; ++slot) {
+            if (ctrl[slot] != kEmpty) {
+                return slot;
+            }
+        }
+        return kNoSlot;
+    }
+
+    Key keyAt(size_t slot) const { return keys[slot]; }
+    Value& valueAt(size_t slot) { return values[slot]; }
+
+    /**
+     * @brief Visit every Value the table holds; string keys may be moved,
+     * since their hash depends only on their characters
+     */
+    void trace(GcTracer& tracer) {
+        for (size_t slot = next(0); slot != kNoSlot; slot = next(slot + 1)) {
+            if constexpr (std::is_same_v<Key, Value>) {
+                tracer.visit(keys[slot]);
+            }
+            tracer.visit(values[slot]);
+        }
+    }
+
+private:
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint32_t kMinCapacity = 16;
+
+    std::unique_ptr<uint8_t[]> ctrl;   // slots control bytes, then the first 15 again
+    std::unique_ptr<Key[]> keys;
+    std::unique_ptr<Value[]> values;
+    uint32_t slots = 0;                // A power of two, or 0
+    size_t count = 0;
+
+    size_t mask() const { return slots - 1; }
+    static uint8_t tagOf(uint64_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+    size_t homeOf(uint64_t hash) const { return static_cast<size_t>(hash >> 7) & mask(); }
+
+    void setControl(size_t slot, uint8_t control) {
+        ctrl[slot] = control;
+        if (slot < kSimdGroupSize - 1) {
+            ctrl[slots + slot] = control;
+        }
+    }
+
+    // Put a key that is not in the table in the first empty slot from its home
+    size_t place(Key key, uint64_t hash) {
+        for (size_t group = homeOf(hash);; group = (group + kSimdGroupSize) & mask()) {
+            uint32_t empty = SimdGroup(ctrl.get() + group).highBits();
+            if (empty) {
+                size_t slot = (group + __builtin_ctz(empty)) & mask();
+                setControl(slot, tagOf(hash));
+                keys[slot] = key;
+                values[slot] = Value::nil();
+                count++;
+                return slot;
+            }
+        }
+    }
+
+    void grow() {
+        std::unique_ptr<uint8_t[]> old_ctrl = std::move(ctrl);
+        std::unique_ptr<Key[]> old_keys = std::move(keys);
+        std::unique_ptr<Value[]> old_values = std::move(values);
+        uint32_t old_slots = slots;
+
+        slots = slots ? slots * 2 : kMinCapacity;
+        ctrl = std::make_unique<uint8_t[]>(slots + kSimdGroupSize - 1);
+        std::fill_n(ctrl.get(), slots + kSimdGroupSize - 1, kEmpty);
+        keys = std::make_unique<Key[]>(slots);
+        values = std::make_unique<Value[]>(slots);
+        count = 0;
+
+        for (size_t slot = 0; slot < old_slots; ++slot) {
+            if (old_ctrl[slot] != kEmpty) {
+                values[place(old_keys[slot], Keys::hash(old_keys[slot]))] = old_values[slot];
+            }
+        }
+    }
+};
+
+/**
+ * @brief Heap handle of a map
+ *
+ * Keys are normalized before they get here; see mapKey().
+ */
+class ObjMap : public Obj {
+public:
+    /**
+     * @brief Which table holds the entries
+     */
+    enum class Layout : uint8_t {
+        EMPTY,    // Nothing stored yet
+        INTS,
+        STRINGS,
+        MIXED     // A key did not fit the first layout
+    };
+
+    ObjMap() : Obj(ObjType::MAP) {}
+
+    void trace(GcTracer& tracer) override {
+        ints.trace(tracer);
+        strings.trace(tracer);
+        mixed.trace(tracer);
+    }
+
+    Obj* moveTo(void* memory) override {
+        ObjMap* moved = new (memory) ObjMap();
+        moved->layout = layout;
+        moved->ints = std::move(ints);
+        moved->strings = std::move(strings);
+        moved->mixed = std::move(mixed);
+        return moved;
+    }
+
+    size_t count() const { return ints.size() + strings.size() + mixed.size(); }
+
+    /**
+     * @return The value of key, or nil
+     */
+    Value get(Value key) const {
+        switch (layout) {
+            case Layout::INTS:    return key.isInt() ? ints.get(key.asInt()) : Value::nil();
+            case Layout::STRINGS: return isString(key) ? strings.get(key) : Value::nil();
+            case Layout::MIXED:   return mixed.get(key);
+            case Layout::EMPTY:   break;
+        }
+        return Value::nil();
+    }
+
+    /**
+     * @brief Store value under key; storing nil removes the key
+     *
+     * The VM's write barrier is the caller's to apply.
+     */
+    void set(Value key, Value value);
+
+    /**
+     * @return Whether key was there
+     */
+    bool remove(Value key);
+
+    /**
+     * @brief The key after key in table order, the first for nil, or nil
+     * after the last; throws RuntimeError if key is not in the map
+     */
+    Value next(Value key) const;
+
+    Layout layout = Layout::EMPTY;
+    FlatTable<IntKeys> ints;
+    FlatTable<StringKeys> strings;
+    FlatTable<ValueKeys> mixed;
+
+private:
+    void spill();
+};
+
+inline bool isMap(Value value) { return isObjType(value, ObjType::MAP); }
+inline ObjMap* asMap(Value value) { return static_cast<ObjMap*>(value.asObj()); }
+
+/**
+ * @brief A value as maps store it as a key: numbers with no fraction that
+ * fit as ints, and strings flat and interned if the VM has them interned;
+ * throws RuntimeError for nil, NaN and other objects, whose addresses
+ * change when they move
+ */
+Value mapKey(VM& vm, const char* name, Value key);
+
+// Builtins; see builtins.cpp
+Value nativeMap(VM& vm, int argc, const Value* args);
+Value nativeMapGet(VM& vm, int argc, const Value* args);
+Value nativeMapSet(VM& vm, int argc, const Value* args);
+Value nativeMapHas(VM& vm, int argc, const Value* args);
+Value nativeMapDelete(VM& vm, int argc, const Value* args);
+Value nativeMapLen(VM& vm, int argc, const Value* args);
+Value nativeMapNext(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_MAP_HPP
@@ -0,0 +1,370 @@
+#ifndef MANASCRIPT_OBJECT_HPP
+#define MANASCRIPT_OBJECT_HPP
+
+#include "value.hpp"
+#include "bytecode.hpp"
+#include "extension.hpp"
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mana {
+
+// Forward declarations
+class VM;
+
+/**
+ * @brief Kinds of heap objects a Value can reference
+ */
+enum class ObjType : uint8_t {
+    STRING,
+    FUNCTION,
+    NATIVE,
+    EXTERN,
+    CHANNEL,  // See task.hpp
+    TASK,
+    FILE,     // See file.hpp
+    JSON,     // See json.hpp
+    CSV,      // See csv.hpp
+    REGEX,    // See regex.hpp
+    MAP       // See map.hpp
+};
+
+/**
+ * @brief Visits every Value slot of an object or root set for the collector
+ *
+ * A visit may rewrite the slot when the object it references has moved.
+ */
+class GcTracer {
+public:
+    virtual ~GcTracer() = default;
+    virtual void visit(Value& slot) = 0;
+};
+
+/**
+ * @brief Base class for all heap-allocated runtime objects
+ *
+ * Objects live in the garbage-collected Heap and are constructed in place by
+ * it. Young objects are moved when they survive a collection, so a raw
+ * pointer to one is only valid until the next safepoint.
+ */
+class Obj {
+public:
+    explicit Obj(ObjType type) : type(type) {}
+    virtual ~Obj() = default;
+
+    Obj(const Obj&) = delete;
+    Obj& operator=(const Obj&) = delete;
+
+    ObjType getType() const { return type; }
+
+    /**
+     * @brief Visit every Value this object references
+     */
+    virtual void trace(GcTracer& tracer) { (void)tracer; }
+
+    /**
+     * @brief Move-construct this object into memory of the same size
+     * @return The new object; this one is left to be destroyed
+     */
+    virtual Obj* moveTo(void* memory) = 0;
+
+    // Whether the object owns nothing outside its own bytes and may be
+    // dropped without running its destructor, as an Arena does
+    static constexpr bool kTrivialStorage = false;
+
+    // Collector state, owned by the Heap
+    uint32_t size = 0;           // Bytes occupied in the heap
+    bool marked = false;         // Reached during the current major collection
+    bool remembered = false;     // Old object in the remembered set
+    Obj* forwarding = nullptr;   // New address of a promoted young object
+
+private:
+    ObjType type;
+};
+
+/**
+ * @brief Immutable runtime string
+ *
+ * A flat string stores its characters right after the object, followed by a
+ * NUL, so it is a single allocation with nothing to free. A rope stores the
+ * two strings it concatenates instead; the VM flattens it the first time its
+ * characters are needed, after which the rope forwards to the flat copy.
+ * Concatenating onto a rope is O(1), so loops that build a string piece by
+ * piece stay linear.
+ *
+ * Construct strings only in memory of allocationSizeFor() bytes; the Heap
+ * does this.
+ */
+class ObjString : public Obj {
+public:
+    static constexpr bool kTrivialStorage = true;
+
+    struct Rope {};
+
+    static size_t allocationSizeFor(std::string_view chars) { return sizeof(ObjString) + chars.size() + 1; }
+    static size_t allocationSizeFor(size_t length) { return sizeof(ObjString) + length + 1; }
+    static size_t allocationSizeFor(Rope, Value, Value, size_t) { return sizeof(ObjString) + 2 * sizeof(Value); }
+
+    explicit ObjString(std::string_view chars)
+        : Obj(ObjType::STRING), length(static_cast<uint32_t>(chars.size())) {
+        std::memcpy(storage(), chars.data(), chars.size());
+        storage()[length] = '\0';
+    }
+
+    /**
+     * @brief A flat string whose characters are written afterwards through
+     * storage()
+     */
+    explicit ObjString(size_t length)
+        : Obj(ObjType::STRING), length(static_cast<uint32_t>(length)) {
+        storage()[length] = '\0';
+    }
+
+    ObjString(Rope, Value left, Value right, size_t length)
+        : Obj(ObjType::STRING), length(static_cast<uint32_t>(length)), kind(Kind::ROPE) {
+        parts()[0] = left;
+        parts()[1] = right;
+    }
+
+    void trace(GcTracer& tracer) override {
+        if (kind != Kind::FLAT) {
+            tracer.visit(parts()[0]);
+            tracer.visit(parts()[1]);
+        }
+    }
+
+    Obj* moveTo(void* memory) override {
+        ObjString* moved = kind == Kind::FLAT ? new (memory) ObjString(view())
+                                              : new (memory) ObjString(Rope{}, parts()[0], parts()[1], length);
+        moved->kind = kind;
+        moved->interned = interned;
+        moved->hash = hash;
+        return moved;
+    }
+
+    bool isRope() const { return kind != Kind::FLAT; }
+
+    /**
+     * @brief The string holding the characters, or nullptr for a rope that
+     * has not been flattened yet
+     */
+    const ObjString* flat() const {
+        if (kind == Kind::FLAT) return this;
+        if (kind == Kind::FLATTENED) return static_cast<const ObjString*>(parts()[0].asObj());
+        return nullptr;
+    }
+    ObjString* flat() { return const_cast<ObjString*>(static_cast<const ObjString*>(this)->flat()); }
+
+    /**
+     * @brief Make a rope forward to its flattened copy
+     */
+    void setFlat(ObjString* copy) {
+        kind = Kind::FLATTENED;
+        parts()[0] = Value::object(copy);
+        parts()[1] = Value::nil();
+    }
+
+    // Only for strings with flat() != nullptr
+    const char* c_str() const { return flat()->storage(); }
+    std::string_view view() const { return std::string_view(c_str(), length); }
+
+    char* storage() { return reinterpret_cast<char*>(this + 1); }
+    const char* storage() const { return reinterpret_cast<const char*>(this + 1); }
+
+    /**
+     * @brief Write all length characters to out, walking ropes without
+     * recursion
+     */
+    void copyTo(char* out) const {
+        std::vector<const ObjString*> pending{this};
+        while (!pending.empty()) {
+            const ObjString* node = pending.back();
+            pending.pop_back();
+            if (const ObjString* chars = node->flat()) {
+                std::memcpy(out, chars->storage(), chars->length);
+                out += chars->length;
+                continue;
+            }
+            pending.push_back(static_cast<const ObjString*>(node->parts()[1].asObj()));
+            pending.push_back(static_cast<const ObjString*>(node->parts()[0].asObj()));
+        }
+    }
+
+    std::string str() const {
+        std::string chars(length, '\0');
+        copyTo(chars.data());
+        return chars;
+    }
+
+    /**
+     * @brief Hash of the characters, computed when first needed, since most
+     * strings are never compared; only for flat strings
+     */
+    uint32_t hashCode() const {
+        if (hash == 0) {
+            hash = hashOf(view());
+        }
+        return hash;
+    }
+
+    // FNV-1a
+    static uint32_t hashOf(std::string_view chars) {
+        uint32_t h = 2166136261u;
+        for (char c : chars) {
+            h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+        return h;
+    }
+
+    uint32_t length;
+    bool interned = false;    // The VM's canonical copy of these characters
+
+private:
+    enum class Kind : uint8_t {
+        FLAT,
+        ROPE,        // parts() are the left and right strings
+        FLATTENED    // parts()[0] is the flat copy
+    };
+
+    Kind kind = Kind::FLAT;
+    mutable uint32_t hash = 0;   // See hashCode(); 0 until computed
+
+    Value* parts() { return reinterpret_cast<Value*>(this + 1); }
+    const Value* parts() const { return reinterpret_cast<const Value*>(this + 1); }
+};
+
+static_assert(sizeof(ObjString) % alignof(Value) == 0, "rope parts follow the object");
+
+/**
+ * @brief Compare the characters of two strings
+ *
+ * Distinct interned strings always differ. Ropes that have not been
+ * flattened are compared through a temporary copy; the VM flattens them
+ * first.
+ */
+inline bool stringsEqual(const ObjString* a, const ObjString* b) {
+    if (a->length != b->length) return false;
+    const ObjString* x = a->flat();
+    const ObjString* y = b->flat();
+    if (x && y) {
+        if (x == y) return true;
+        if (x->interned && y->interned) return false;
+        return x->hashCode() == y->hashCode() && x->view() == y->view();
+    }
+    return a->str() == b->str();
+}
+
+/**
+ * @brief Monomorphic inline cache attached to one GETGLOBAL, SETGLOBAL or
+ * CALL instruction
+ */
+struct InlineCache {
+    uint32_t version = 0;  // Global table version the slot was resolved at; 0 is empty
+    uint32_t slot = 0;     // Resolved global slot
+    Value callee;          // Last function called from this site; nil is empty
+};
+
+/**
+ * @brief A function prototype loaded into a VM
+ *
+ * The prototype is shared and immutable; the instruction stream, the
+ * materialized constant pool and the inline caches belong to this VM.
+ */
+class ObjFunction : public Obj {
+public:
+    explicit ObjFunction(std::shared_ptr<const FunctionProto> proto)
+        : Obj(ObjType::FUNCTION), proto(std::move(proto)) {}
+
+    void trace(GcTracer& tracer) override {
+        for (Value& constant : constants) {
+            tracer.visit(constant);
+        }
+        for (InlineCache& cache : caches) {
+            tracer.visit(cache.callee);
+        }
+    }
+
+    Obj* moveTo(void* memory) override {
+        ObjFunction* moved = new (memory) ObjFunction(std::move(proto));
+        moved->code = std::move(code);
+        moved->constants = std::move(constants);
+        moved->caches = std::move(caches);
+        return moved;
+    }
+
+    std::shared_ptr<const FunctionProto> proto;
+    std::vector<Instruction> code;
+    std::vector<Value> constants;
+    std::vector<InlineCache> caches;
+};
+
+/**
+ * @brief Signature of functions implemented in C++
+ */
+using NativeFn = Value (*)(VM& vm, int argc, const Value* args);
+
+/**
+ * @brief A function implemented in C++
+ */
+class ObjNative : public Obj {
+public:
+    ObjNative(std::string name, int arity, NativeFn function)
+        : Obj(ObjType::NATIVE), name(std::move(name)), arity(arity), function(function) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjNative(std::move(name), arity, function); }
+
+    std::string name;
+    int arity;  // -1 accepts any number of arguments
+    NativeFn function;
+};
+
+/**
+ * @brief Signature of the adapters that call extension functions; see extension.cpp
+ */
+using ExternFn = Value (*)(VM& vm, const ExtFunction& function, const Value* args);
+
+/**
+ * @brief A function exported by a native extension module
+ *
+ * The descriptor lives in the loaded shared object. call converts the
+ * arguments to the raw C parameters the descriptor declares and calls the
+ * function directly.
+ */
+class ObjExtern : public Obj {
+public:
+    ObjExtern(const ExtFunction* function, ExternFn call)
+        : Obj(ObjType::EXTERN), function(function), call(call) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjExtern(function, call); }
+
+    const ExtFunction* function;
+    ExternFn call;
+};
+
+/**
+ * @brief The adapter that calls function with arguments of its declared types
+ * @return nullptr if the signature is not supported
+ */
+ExternFn externCaller(const ExtFunction& function);
+
+inline bool isObjType(Value value, ObjType type) {
+    return value.isObj() && value.asObj()->getType() == type;
+}
+
+inline bool isString(Value value) { return isObjType(value, ObjType::STRING); }
+inline bool isFunction(Value value) { return isObjType(value, ObjType::FUNCTION); }
+inline bool isNative(Value value) { return isObjType(value, ObjType::NATIVE); }
+inline bool isExtern(Value value) { return isObjType(value, ObjType::EXTERN); }
+
+inline ObjString* asString(Value value) { return static_cast<ObjString*>(value.asObj()); }
+inline ObjFunction* asFunction(Value value) { return static_cast<ObjFunction*>(value.asObj()); }
+inline ObjNative* asNative(Value value) { return static_cast<ObjNative*>(value.asObj()); }
+inline ObjExtern* asExtern(Value value) { return static_cast<ObjExtern*>(value.asObj()); }
+
+} // namespace mana
+
+#endif // MANASCRIPT_OBJECT_HPP
@@ -0,0 +1,25 @@
+#ifndef MANASCRIPT_OPTIMIZER_HPP
+#define MANASCRIPT_OPTIMIZER_HPP
+
+#include "bytecode.hpp"
+
+namespace mana {
+
+/**
+ * @brief Peephole pass that fuses common instruction pairs into superinstructions
+ *
+ * The rewrites, applied in this order:
+ *   LOADK t K; ADD/SUB/MUL r x t      ->  ADDK/SUBK/MULK r x K
+ *   OP t ...; MOVE r t                ->  OP r ...
+ *   LT/LE/GT/GE/EQ/NE t x y; JMPIFNOT t  ->  IFLT/IFLE/IFEQ/IFNE x y
+ *
+ * A pair is only fused when the temporary t is written and read exactly once
+ * in the whole function and no jump lands on the second instruction. Jump
+ * offsets and line numbers are rewritten to match. Nested prototypes are left
+ * alone; the compiler optimizes each function as it finishes it.
+ */
+void optimizeBytecode(FunctionProto& proto);
+
+} // namespace mana
+
+#endif // MANASCRIPT_OPTIMIZER_HPP
@@ -0,0 +1,72 @@
+#ifndef MANASCRIPT_OUTPUT_HPP
+#define MANASCRIPT_OUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string_view>
+
+namespace mana {
+
+/**
+ * @brief Buffered writer for script output
+ *
+ * print() writes here instead of going through iostreams. Output collects in
+ * a buffer and is written when the buffer fills, on flush() and when the
+ * writer is destroyed, which for the per-thread writer is at thread exit.
+ * With line buffering on, every newline flushes as well, so interactive
+ * output shows up as it is printed. A full buffer is written up to its last
+ * newline, so lines printed by different threads do not interleave.
+ *
+ * Numbers are formatted with std::to_chars; nothing here allocates after
+ * construction.
+ */
+class OutputBuffer {
+public:
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    /**
+     * @brief The calling thread's writer for stdout, line-buffered if stdout
+     * is a terminal
+     */
+    static OutputBuffer& forThread();
+
+    explicit OutputBuffer(std::FILE* stream, bool line_buffered = false);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(std::string_view text);
+    void write(char c);
+    void write(int32_t value);
+    void write(double value);
+    void write(bool value);
+
+    /**
+     * @brief Write out everything buffered so far
+     */
+    void flush();
+
+    void setLineBuffered(bool enabled) { line_buffered = enabled; }
+
+private:
+    std::FILE* stream;
+    bool line_buffered;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+
+    void makeRoom(size_t size);
+};
+
+} // namespace mana
+
+// Entry points for natively compiled code, which has no OutputBuffer of its own
+extern "C" {
+void mana_print_string(const char* text);
+void mana_print_int(int32_t value);
+void mana_print_double(double value);
+}
+
+#endif // MANASCRIPT_OUTPUT_HPP
@@ -0,0 +1,40 @@
+#ifndef MANASCRIPT_PARALLEL_HPP
+#define MANASCRIPT_PARALLEL_HPP
+
+#include "value.hpp"
+
+/**
+ * @file parallel.hpp
+ * @brief Data-parallel loops over integer ranges
+ *
+ * `parallel for (i = start; i < end) body` compiles its body into a chunk
+ * function that runs the iterations of a subrange, and calls
+ * parallel_for(chunk, start, end, captures...). parallel_reduce(start, end,
+ * identity, map, combine[, deterministic]) folds combine over map(i) for
+ * every i in the range.
+ *
+ * The range is cut into chunks that the calling thread and helper jobs on
+ * its VM's Scheduler claim one at a time. The caller only ever waits for
+ * chunks that are running, never for a helper to start, so loops nest and
+ * run on any number of workers. Helpers run in VMs of their own holding
+ * copies of the caller's globals, as tasks do.
+ *
+ * The caller runs the first iterations itself and times them. The rest are
+ * cut into chunks that take about a fixed time each, but at least a few per
+ * worker. A reduction folds each chunk from identity and then folds the
+ * chunk results in range order; with deterministic set the chunks are cut
+ * from the length of the range alone, so the result is the same on every
+ * run and machine even when combine is not associative, as for floats.
+ */
+
+namespace mana {
+
+class VM;
+
+// Builtins; see builtins.cpp
+Value nativeParallelFor(VM& vm, int argc, const Value* args);
+Value nativeParallelReduce(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_PARALLEL_HPP
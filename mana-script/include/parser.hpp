@@ -4,23 +4,23 @@
 #include "token.hpp"
 #include "ast.hpp"
 #include "error.hpp"
+#include "context.hpp"
 #include <vector>
 #include <memory>
-#include <stdexcept>
 #include <functional>
 
 namespace mana {
 
-/**
- * @brief Exception thrown by the parser when a syntax error is encountered
- */
-class ParseError : public std::runtime_error {
-public:
-    ParseError(const std::string& message) : std::runtime_error(message) {}
-};
-
 /**
  * @brief Recursive Descent Parser for Manascript
+ *
+ * Errors never unwind. The first error in a declaration puts the parser in
+ * panic mode: later errors are not reported, a failed expression becomes an
+ * ErrorExpr and a missing token is treated as present. At the end of the
+ * declaration the parser drops it and skips to the next statement boundary,
+ * so one pass reports the first error of every declaration. A declaration
+ * that recovered from an error in a nested one is dropped too, so back ends
+ * only ever see complete statements.
  */
 class Parser {
 private:
@@ -28,20 +28,26 @@ private:
     int current = 0;
     int max_params = 255;  // Maximum number of parameters in a function
     std::string filename;
+    FileId file = 0;
+    DiagnosticManager* reports = &diagnostics;
+    bool panic_mode = false;
+    int panics = 0;  // Errors that put the parser in panic mode
     
     // Helper methods
     bool isAtEnd() const;
     Token peek() const;
     Token previous() const;
+    bool checkNext(TokenType type) const;
     Token advance();
     bool check(TokenType type) const;
     bool match(TokenType type);
     bool match(std::initializer_list<TokenType> types);
     
     // Error handling
-    ParseError error(const Token& token, const std::string& message);
-    Token consume(TokenType type, const std::string& message);
-    void synchronize();
+    // Messages are usually literals, which diagnostics keep without copying
+    void error(const Token& token, DiagnosticArg message);
+    Token consume(TokenType type, const char* message);
+    void synchronize(int start);
     
     // Recursive descent parsing methods
     ExprPtr expression();
@@ -55,22 +61,39 @@ private:
     ExprPtr unary();
     ExprPtr call();
     ExprPtr primary();
+    ExprPtr integerLiteral();
+    ExprPtr floatLiteral();
     
     StmtPtr declaration();
     StmtPtr varDeclaration(bool is_const = false);
-    StmtPtr functionDeclaration();
+    StmtPtr functionDeclaration(bool is_async = false);
+    StmtPtr importDeclaration();
     StmtPtr statement();
     StmtPtr expressionStatement();
     StmtPtr ifStatement();
     StmtPtr whileStatement();
+    StmtPtr parallelForStatement();
     StmtPtr returnStatement();
     StmtPtr blockStatement();
     
     // Parsing utilities
     ExprPtr finishCall(ExprPtr callee);
+
+    // Construct an AST node located at loc
+    template <typename T, typename... Args>
+    std::shared_ptr<T> node(SourceLoc loc, Args&&... args) {
+        auto result = std::make_shared<T>(std::forward<Args>(args)...);
+        result->setLoc(loc);
+        return result;
+    }
     
 public:
     Parser(const std::vector<Token>& tokens, const std::string& filename = "");
+
+    /**
+     * @brief Parse tokens of the given compilation, reporting into its diagnostics
+     */
+    Parser(const std::vector<Token>& tokens, CompilationContext& context);
     
     /**
      * @brief Parse the tokens into an AST
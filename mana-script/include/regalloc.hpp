@@ -0,0 +1,26 @@
+#ifndef MANASCRIPT_REGALLOC_HPP
+#define MANASCRIPT_REGALLOC_HPP
+
+#include "bytecode.hpp"
+
+namespace mana {
+
+/**
+ * @brief Shrink a function's frame by reusing registers
+ *
+ * The compiler gives every temporary and local a register of its own. This
+ * pass computes liveness over the bytecode, turns it into one live interval
+ * per register and assigns the intervals to as few registers as possible in
+ * linear-scan order. Call windows stay consecutive and are placed above every
+ * value that lives across the call, since the callee's frame overlaps the
+ * registers after the window; builtin windows (CALLB) only need to be
+ * consecutive. Parameters keep their registers. Moves that end
+ * up copying a register onto itself are removed.
+ *
+ * If the constraints cannot be met the prototype is left unchanged.
+ */
+void assignRegisters(FunctionProto& proto);
+
+} // namespace mana
+
+#endif // MANASCRIPT_REGALLOC_HPP
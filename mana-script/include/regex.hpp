@@ -0,0 +1,163 @@
+#ifndef MANASCRIPT_REGEX_HPP
+#define MANASCRIPT_REGEX_HPP
+
+#include "bytecode.hpp"
+#include "object.hpp"
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @file regex.hpp
+ * @brief Regular expressions matched by a lazily built DFA
+ *
+ * A pattern is compiled once into an NFA program, and kept in a process-wide
+ * cache keyed by its text. Matching never backtracks: it runs a DFA whose
+ * states, each a set of NFA instructions, are built the first time the
+ * input reaches them and kept for later input. Time is linear in the input
+ * and memory is bounded, since the state cache is dropped when it fills.
+ *
+ * Before the DFA runs, a pattern that has to begin with a literal string is
+ * looked for with SIMD compares of that string's first and last bytes
+ * (simd.hpp), and the DFA skips to each candidate instead of stepping
+ * through the bytes between them.
+ *
+ * Patterns work on bytes. The syntax is the usual one without the parts
+ * that need backtracking: literals, '.', classes such as [a-z] and [^,],
+ * \\d \\w \\s and their negations, groups, '|', '*', '+', '?', {m,n}, and
+ * '^' and '$' for the ends of the text. A match is the leftmost one and,
+ * of those, the longest.
+ */
+
+namespace mana {
+
+/**
+ * @brief An NFA over bytes
+ */
+struct RegexProgram {
+    enum class Op : uint8_t {
+        BYTES,  // Consume a byte in sets[set], then go to next
+        SPLIT,  // Go to both next and alt
+        BEGIN,  // Go to next at the start of the text
+        END,    // Go to next at the end of the text
+        MATCH
+    };
+
+    struct Inst {
+        Op op;
+        uint16_t set;
+        uint32_t next;
+        uint32_t alt;
+    };
+
+    std::vector<Inst> insts;
+    std::vector<std::bitset<256>> sets;
+    uint32_t start = 0;
+};
+
+class Regex {
+public:
+    /**
+     * @brief The compiled pattern, from the cache if it is there; throws
+     * RuntimeError with the byte offset of the first error
+     */
+    static std::shared_ptr<const Regex> compile(std::string_view pattern);
+
+    const std::string& pattern() const { return text; }
+
+    /**
+     * @brief Reads left to right, and its mirror image, which reads right to
+     * left and finds where the leftmost match begins
+     */
+    RegexProgram forward;
+    RegexProgram reverse;
+
+    // Bytes no instruction tells apart share a class and a DFA column
+    uint8_t classes[256] = {};
+    int class_count = 0;
+
+    std::string prefix;     // Every match begins with these bytes
+    bool literal = false;   // The pattern is prefix and nothing else
+    bool anchored = false;  // Every match begins at the start of the text
+
+private:
+    std::string text;
+};
+
+class Dfa;
+
+/**
+ * @brief A compiled pattern with the DFA states built so far
+ *
+ * Not thread-safe: each VM, and each thread for patterns given as strings,
+ * keeps its own.
+ */
+class RegexMatcher {
+public:
+    explicit RegexMatcher(std::shared_ptr<const Regex> regex);
+    ~RegexMatcher();
+
+    const std::shared_ptr<const Regex>& regex() const { return compiled; }
+
+    /**
+     * @brief Whether the pattern matches anywhere in text
+     */
+    bool search(std::string_view text);
+
+    /**
+     * @brief The leftmost-longest match as [begin, end)
+     * @return False if there is none
+     */
+    bool find(std::string_view text, size_t& begin, size_t& end);
+
+private:
+    std::shared_ptr<const Regex> compiled;
+    std::unique_ptr<Dfa> forward;    // Unanchored: finds whether and where a first match ends
+    std::unique_ptr<Dfa> reverse;    // Unanchored, right to left: finds where the leftmost match begins
+    std::unique_ptr<Dfa> anchored;   // From a given start: finds where the longest match ends
+
+    size_t earliestEnd(std::string_view text, size_t from);
+    size_t leftmostBegin(std::string_view text, size_t lowest);
+    size_t longestEnd(std::string_view text, size_t from);
+};
+
+/**
+ * @brief This thread's matcher for a pattern given as a string
+ */
+RegexMatcher& matcherFor(std::string_view pattern);
+
+/**
+ * @brief Heap handle of a compiled pattern
+ */
+class ObjRegex : public Obj {
+public:
+    explicit ObjRegex(std::unique_ptr<RegexMatcher> matcher)
+        : Obj(ObjType::REGEX), matcher(std::move(matcher)) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjRegex(std::move(matcher)); }
+
+    std::unique_ptr<RegexMatcher> matcher;
+};
+
+inline bool isRegex(Value value) { return isObjType(value, ObjType::REGEX); }
+inline ObjRegex* asRegex(Value value) { return static_cast<ObjRegex*>(value.asObj()); }
+
+/**
+ * @brief Compile a constant pattern while the script is compiled
+ * @return The error in the pattern, if there is one
+ */
+std::optional<std::string> prepareRegex(const Constant& pattern);
+
+// Builtins; see builtins.cpp
+Value nativeRegex(VM& vm, int argc, const Value* args);
+Value nativeRegexMatch(VM& vm, int argc, const Value* args);
+Value nativeRegexFind(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_REGEX_HPP
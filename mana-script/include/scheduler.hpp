@@ -0,0 +1,242 @@
+#ifndef MANASCRIPT_SCHEDULER_HPP
+#define MANASCRIPT_SCHEDULER_HPP
+
+#include "error.hpp"
+#include "task.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace mana {
+
+class VM;
+
+/**
+ * @brief Chase-Lev work-stealing deque of pointers
+ *
+ * The owning thread pushes and pops at the bottom without locking; any other
+ * thread may steal from the top with a single compare-and-swap. The array
+ * grows when full; old arrays are kept until the deque is destroyed, since a
+ * thief may still be reading one.
+ */
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) {
+        arrays.push_back(std::make_unique<Array>(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /**
+     * @brief Add an item at the bottom; owner only
+     */
+    void push(T* item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t >= a->capacity) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Take the most recently pushed item; owner only
+     * @return The item, or nullptr if the deque is empty
+     */
+    T* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_seq_cst);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->get(b);
+        if (t == b) {
+            // The last item: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /**
+     * @brief Take the oldest item; any thread
+     * @return The item, or nullptr if the deque is empty or another thread won it
+     */
+    T* steal() {
+        int64_t t = top.load(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b) {
+            return nullptr;
+        }
+        T* item = array.load(std::memory_order_acquire)->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool empty() const {
+        return top.load(std::memory_order_seq_cst) >= bottom.load(std::memory_order_seq_cst);
+    }
+
+private:
+    struct Array {
+        explicit Array(int64_t capacity) : capacity(capacity), slots(new std::atomic<T*>[capacity]) {}
+
+        T* get(int64_t index) const { return slots[index & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t index, T* item) { slots[index & (capacity - 1)].store(item, std::memory_order_relaxed); }
+
+        int64_t capacity;  // A power of two
+        std::unique_ptr<std::atomic<T*>[]> slots;
+    };
+
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> arrays;  // Touched by the owner only
+
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        arrays.push_back(std::make_unique<Array>(old->capacity * 2));
+        Array* bigger = arrays.back().get();
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+};
+
+/**
+ * @brief M:N scheduler running tasks on a fixed pool of worker threads
+ *
+ * Each worker owns a work-stealing deque. A task spawned on a worker goes to
+ * the bottom of that worker's deque, and the worker takes its next task from
+ * there too, so related tasks run close together in time. Tasks submitted
+ * from other threads go to a shared injection queue. An idle worker steals
+ * from the top of the other workers' deques before going to sleep.
+ *
+ * A task runs in a VM from its worker's pool until it finishes or blocks on
+ * a channel or a join. A blocked task is parked with its frames intact and
+ * its worker moves on; when it is woken it is queued again and resumes on
+ * whichever worker takes it, re-running the call that blocked.
+ *
+ * The runtime also submits jobs, host code such as the helpers of a
+ * parallel loop, which run in a pooled VM the same way.
+ *
+ * The scheduler is also the event loop of async functions: a task that
+ * sleeps is parked on a timer, which the workers fire between tasks and
+ * sleep until when idle, so one worker can keep thousands of sleeping or
+ * waiting calls in flight.
+ */
+class Scheduler {
+public:
+    /**
+     * @brief The scheduler spawn uses unless a VM names another
+     *
+     * Started on first use with the number of workers in the environment
+     * variable MANASCRIPT_WORKERS, or one per hardware thread.
+     */
+    static Scheduler& global();
+
+    explicit Scheduler(unsigned workers);
+
+    /**
+     * @brief Stop the workers once their current tasks finish or block
+     *
+     * Tasks that have not started, or are parked, never run again.
+     */
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * @brief Queue a new task
+     */
+    void submit(const std::shared_ptr<Task>& task);
+
+    unsigned workerCount() const { return static_cast<unsigned>(workers.size()); }
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Wait until a point in time
+     * @param parker Task to park until then instead of blocking the thread, or nullptr
+     * @return DONE, or PARKED if parker must suspend
+     *
+     * A parked task re-runs the call that slept once it is woken, which
+     * returns DONE at once.
+     */
+    Channel::Status sleepUntil(Clock::time_point deadline, Task* parker);
+
+private:
+    friend class Task;
+
+    // Idle VMs a worker keeps for its next tasks
+    static constexpr size_t kMaxPooledVMs = 16;
+    static constexpr size_t kTaskStackSize = 16 * 1024;
+    static constexpr size_t kTaskNurserySize = 64 * 1024;
+
+    struct Timer {
+        Clock::time_point deadline;
+        Task* task;
+
+        bool operator>(const Timer& other) const { return deadline > other.deadline; }
+    };
+
+    struct Worker {
+        Scheduler* owner = nullptr;
+        WorkStealingDeque<Task> deque;
+        std::vector<std::unique_ptr<VM>> idle_vms;
+        DiagnosticManager reports;  // Runtime errors of the tasks it runs
+        std::thread thread;
+        uint64_t seed = 0;           // For picking steal victims
+    };
+
+    // The worker running on this thread, if any
+    static thread_local Worker* current;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex mutex;                 // Guards injected, timers and sleeping
+    std::condition_variable wakeup;
+    std::deque<Task*> injected;
+    std::atomic<size_t> injected_count{0};
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::atomic<int64_t> next_deadline{INT64_MAX};  // Of the earliest timer, in Clock ticks
+    std::atomic<int> sleeping{0};
+    std::atomic<bool> stopping{false};
+
+    void enqueue(Task* task);
+    void fireTimers();
+    void workerLoop(Worker& worker);
+    Task* findTask(Worker& worker);
+    bool hasWork();
+    void runTask(Worker& worker, Task* task);
+    void runJob(Worker& worker, Task* task);
+    std::unique_ptr<VM> acquireVM(Worker& worker);
+    void releaseVM(Worker& worker, std::unique_ptr<VM> vm);
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_SCHEDULER_HPP
@@ -0,0 +1,167 @@
+#ifndef MANASCRIPT_SIMD_HPP
+#define MANASCRIPT_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @file simd.hpp
+ * @brief Byte classification 64 bytes at a time
+ *
+ * Scanners over large inputs (lines.hpp, json.hpp, csv.hpp) turn each
+ * 64-byte block into bit masks, a bit per byte, and then work on the masks
+ * with integer operations instead of going back to the bytes. Compares use
+ * AVX2 when the build enables it and SSE2 on any other x86-64, with a plain
+ * loop elsewhere.
+ *
+ * Hash tables (map.hpp) compare their control bytes 16 at a time in the
+ * same way.
+ */
+
+namespace mana {
+
+constexpr size_t kSimdBlockSize = 64;
+
+/**
+ * @brief 64 bytes loaded once and compared many times
+ */
+class SimdBlock {
+public:
+    explicit SimdBlock(const char* p) {
+#if defined(__AVX2__)
+        parts[0] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        parts[1] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+#elif defined(__SSE2__)
+        for (int i = 0; i < 4; ++i) {
+            parts[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+        }
+#else
+        bytes = p;
+#endif
+    }
+
+    /**
+     * @brief A bit per byte equal to c
+     */
+    uint64_t eq(char c) const {
+#if defined(__AVX2__)
+        const __m256i wanted = _mm256_set1_epi8(c);
+        uint64_t low = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(parts[0], wanted)));
+        uint64_t high = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(parts[1], wanted)));
+        return low | high << 32;
+#elif defined(__SSE2__)
+        const __m128i wanted = _mm_set1_epi8(c);
+        uint64_t mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t part = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(parts[i], wanted)));
+            mask |= part << (16 * i);
+        }
+        return mask;
+#else
+        uint64_t mask = 0;
+        for (size_t i = 0; i < kSimdBlockSize; ++i) {
+            mask |= static_cast<uint64_t>(bytes[i] == c) << i;
+        }
+        return mask;
+#endif
+    }
+
+private:
+#if defined(__AVX2__)
+    __m256i parts[2];
+#elif defined(__SSE2__)
+    __m128i parts[4];
+#else
+    const char* bytes;
+#endif
+};
+
+constexpr size_t kSimdGroupSize = 16;
+
+/**
+ * @brief 16 bytes loaded once and compared many times
+ */
+class SimdGroup {
+public:
+    explicit SimdGroup(const uint8_t* p) {
+#if defined(__SSE2__)
+        bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+#else
+        bytes = p;
+#endif
+    }
+
+    /**
+     * @brief A bit per byte equal to b
+     */
+    uint32_t eq(uint8_t b) const {
+#if defined(__SSE2__)
+        const __m128i wanted = _mm_set1_epi8(static_cast<char>(b));
+        return static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, wanted)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kSimdGroupSize; ++i) {
+            mask |= static_cast<uint32_t>(bytes[i] == b) << i;
+        }
+        return mask;
+#endif
+    }
+
+    /**
+     * @brief A bit per byte with its top bit set
+     */
+    uint32_t highBits() const {
+#if defined(__SSE2__)
+        return static_cast<uint16_t>(_mm_movemask_epi8(bytes));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kSimdGroupSize; ++i) {
+            mask |= static_cast<uint32_t>(bytes[i] >> 7) << i;
+        }
+        return mask;
+#endif
+    }
+
+private:
+#if defined(__SSE2__)
+    __m128i bytes;
+#else
+    const uint8_t* bytes;
+#endif
+};
+
+/**
+ * @brief Bit i of the result is the XOR of bits 0 to i of mask
+ *
+ * Applied to a mask of quotes, gives the bytes from each opening quote up
+ * to, but not including, its closing quote.
+ */
+inline uint64_t prefixXor(uint64_t mask) {
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
+
+/**
+ * @brief Append base plus the position of every set bit to out
+ * @return Past the last position written
+ */
+inline uint32_t* flattenBits(uint64_t mask, uint32_t base, uint32_t* out) {
+    while (mask) {
+        *out++ = base + static_cast<uint32_t>(__builtin_ctzll(mask));
+        mask &= mask - 1;
+    }
+    return out;
+}
+
+} // namespace mana
+
+#endif // MANASCRIPT_SIMD_HPP
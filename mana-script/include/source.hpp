@@ -0,0 +1,172 @@
+#ifndef MANASCRIPT_SOURCE_HPP
+#define MANASCRIPT_SOURCE_HPP
+
+#include "error.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mana {
+
+/**
+ * @brief A position in any loaded source, as one 32-bit offset
+ *
+ * Every buffer added to the SourceManager occupies its own range of a single
+ * address space, so the offset alone identifies both the file and the
+ * position in it. Decoding to file:line:column happens only when a location
+ * is printed. Offset 0 is no location.
+ */
+class SourceLoc {
+public:
+    SourceLoc() = default;
+
+    static SourceLoc fromRaw(uint32_t raw) {
+        SourceLoc loc;
+        loc.offset = raw;
+        return loc;
+    }
+
+    uint32_t raw() const { return offset; }
+    bool isValid() const { return offset != 0; }
+
+    /**
+     * @brief The location chars further on in the same buffer
+     */
+    SourceLoc advanced(uint32_t chars) const { return isValid() ? fromRaw(offset + chars) : SourceLoc(); }
+
+    bool operator==(SourceLoc other) const { return offset == other.offset; }
+    bool operator!=(SourceLoc other) const { return offset != other.offset; }
+
+private:
+    uint32_t offset = 0;
+};
+
+class SourceManager;
+
+/**
+ * @brief A hold on a buffer added with SourceManager::share()
+ *
+ * The buffer's text and range are released when the last hold goes.
+ */
+class SourceBuffer {
+public:
+    SourceBuffer(SourceManager& manager, FileId file) : manager(manager), id(file) {}
+    ~SourceBuffer();
+
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    FileId file() const { return id; }
+
+private:
+    SourceManager& manager;
+    FileId id;
+};
+
+/**
+ * @brief Owns the text of every loaded source and decodes locations in it
+ *
+ * Buffers added with addBuffer() are kept for the life of the process, so
+ * tokens, AST nodes, diagnostics and bytecode line tables can all refer into
+ * them with a bare SourceLoc. Buffers added with share() are kept while a
+ * SourceBuffer holds them; a compilation context and the prototypes compiled
+ * in it hold theirs, so a long-running host that keeps compiling scripts
+ * reuses the ranges of the scripts it has dropped. A released buffer keeps
+ * its name, so diagnostics that name its file still print, but its text and
+ * lines are gone. Files known only by name, such as those named in
+ * diagnostics built from a SourceLocation, get an entry without text.
+ *
+ * Adding a text that a live buffer of the same name and kind already holds
+ * returns that buffer instead of a copy.
+ *
+ * All members are thread-safe. The text of a buffer never changes while it
+ * is live, so views of it stay valid until it is released.
+ */
+class SourceManager {
+public:
+    static SourceManager& global();
+
+    SourceManager();
+
+    SourceManager(const SourceManager&) = delete;
+    SourceManager& operator=(const SourceManager&) = delete;
+
+    /**
+     * @brief Take ownership of a source text
+     *
+     * Once the 4 GiB address space is used up, new buffers get no range and
+     * their locations are invalid.
+     */
+    FileId addBuffer(const std::string& name, std::string text);
+
+    /**
+     * @brief Hold a source text for as long as the returned buffer lives
+     */
+    std::shared_ptr<const SourceBuffer> share(const std::string& name, std::string text);
+
+    /**
+     * @brief The most recent buffer with this name, or a new entry without text
+     */
+    FileId fileNamed(const std::string& name);
+
+    /**
+     * @brief Location of an offset into a buffer
+     */
+    SourceLoc location(FileId file, uint32_t offset) const;
+
+    FileId fileOf(SourceLoc loc) const;
+    const std::string& name(FileId file) const;
+    std::string_view text(FileId file) const;
+
+    /**
+     * @brief File, line and column of a location; an invalid one decodes to line 0
+     */
+    SourceLocation decode(SourceLoc loc) const;
+
+    /**
+     * @brief Decode the file id, line and column without copying the name
+     */
+    void decode(SourceLoc loc, FileId& file, int& line, int& column) const;
+
+    /**
+     * @brief Text of a line without its newline; empty if the file has no text
+     */
+    std::string_view lineText(FileId file, int line) const;
+
+private:
+    friend class SourceBuffer;
+
+    struct Buffer {
+        std::string name;
+        std::string text;
+        uint32_t start = 0;              // First offset of the range, 0 if it has none
+        std::vector<uint32_t> line_starts;  // Offset into text of each line
+        bool shared = false;             // Added with share()
+        std::weak_ptr<const SourceBuffer> holder;
+    };
+
+    mutable std::mutex mutex;
+    std::deque<Buffer> buffers;          // Indexed by FileId; entry 0 is no file
+    std::vector<FileId> by_start;        // Buffers with a range, in address order
+    std::unordered_map<std::string, FileId> latest;
+    std::unordered_multimap<size_t, FileId> by_content;  // Live buffers by hash of name and text
+    std::map<uint32_t, uint32_t> free_ranges;            // Start to size of released ranges
+    uint64_t next_offset = 1;
+
+    FileId findLocked(SourceLoc loc) const;
+    FileId findContentLocked(size_t hash, const std::string& name, const std::string& text, bool held) const;
+    FileId addLocked(size_t hash, Buffer buffer);
+    uint32_t allocateLocked(uint64_t size);
+    void release(FileId file);
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_SOURCE_HPP
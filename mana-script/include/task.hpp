@@ -0,0 +1,323 @@
+#ifndef MANASCRIPT_TASK_HPP
+#define MANASCRIPT_TASK_HPP
+
+#include "bytecode.hpp"
+#include "object.hpp"
+#include "value.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/**
+ * @file task.hpp
+ * @brief Tasks started with spawn and the channels they talk over
+ *
+ * Every task runs in a VM of its own, so nothing a script can reach is
+ * shared between tasks except channels and task handles. Values cross from
+ * one VM to another as Messages: numbers, booleans and nil as they are,
+ * strings as copies of their characters, functions as the prototype (or
+ * native) they were loaded from, maps as copies of their entries, and
+ * channels, tasks, files, JSON views, CSV tables and compiled patterns as a
+ * new handle to the same object.
+ */
+
+namespace mana {
+
+class Channel;
+class CsvTable;
+class File;
+class JsonDocument;
+struct MapMessage;
+class Regex;
+class Scheduler;
+class Task;
+class VM;
+
+/**
+ * @brief A native function as it can be defined in any VM
+ */
+struct NativeMessage {
+    std::string name;
+    int arity;
+    NativeFn function;
+};
+
+/**
+ * @brief An extension function as it can be defined in any VM
+ */
+struct ExternMessage {
+    const ExtFunction* function;
+    ExternFn call;
+};
+
+/**
+ * @brief An object or array of a parsed JSON document
+ */
+struct JsonMessage {
+    std::shared_ptr<const JsonDocument> document;
+    uint32_t value;
+};
+
+/**
+ * @brief A value on its way from one VM to another
+ */
+using Message = std::variant<std::nullptr_t, bool, int32_t, double, std::string,
+                             std::shared_ptr<const FunctionProto>, NativeMessage, ExternMessage,
+                             std::shared_ptr<Channel>, std::shared_ptr<Task>, std::shared_ptr<File>,
+                             JsonMessage, std::shared_ptr<const CsvTable>, std::shared_ptr<const Regex>,
+                             std::shared_ptr<const MapMessage>>;
+
+/**
+ * @brief The entries of a map, keys as the map stores them
+ */
+struct MapMessage {
+    std::vector<std::pair<Message, Message>> entries;
+};
+
+/**
+ * @brief Copy a value out of its VM
+ */
+Message toMessage(Value value);
+
+/**
+ * @brief Recreate a message as a value owned by vm
+ *
+ * A string is young; see VM::newString().
+ */
+Value fromMessage(VM& vm, const Message& message);
+
+/**
+ * @brief Copy the globals, except builtins, that code reachable from roots
+ * may use, for a VM that runs that code on its behalf
+ *
+ * Each prototype lists the globals it names, so the copy follows the
+ * functions in roots, the globals they name, the functions those hold, and
+ * the functions stored in any map on the way. Globals no code reaches, such
+ * as a large table only the spawner reads, are not copied.
+ */
+std::vector<std::pair<std::string, Message>> copyGlobals(VM& vm, const std::vector<Value>& roots);
+
+/**
+ * @brief The task to park on a wait list instead of blocking the thread, if
+ * vm can suspend it; see VM::canSuspend()
+ */
+Task* parkerFor(VM& vm);
+
+/**
+ * @brief The result of a task that await waits for; throws RuntimeError if
+ * the task failed
+ */
+Value awaitTask(VM& vm, Task& task);
+
+/**
+ * @brief Tasks parked on a channel or task, and threads blocked on it
+ *
+ * Guarded by the mutex of its owner.
+ */
+struct WaitList {
+    std::vector<Task*> parked;
+    std::condition_variable threads;
+    int blocked_threads = 0;
+
+    /**
+     * @brief Resume the parked tasks and wake the blocked threads; every
+     * waiter checks again whether it can proceed
+     */
+    void notifyAll(std::unique_lock<std::mutex>& lock);
+};
+
+/**
+ * @brief A bounded FIFO of messages
+ *
+ * Sending to a full channel and receiving from an empty one block. A task
+ * that blocks is parked and its worker moves on to other tasks; any other
+ * caller blocks its thread. Receiving from a closed channel drains what is
+ * left and then returns nil. A channel may restrict what it carries to one
+ * type name, as reported by Value::typeName(), or to "number".
+ */
+class Channel {
+public:
+    Channel(size_t capacity, std::string element_type)
+        : capacity(capacity), element_type(std::move(element_type)) {}
+
+    /**
+     * @brief Outcome of an operation that may have to wait
+     */
+    enum class Status {
+        DONE,
+        PARKED,   // The task was added to the waiters; suspend it
+        CLOSED    // Sending to a closed channel
+    };
+
+    /**
+     * @brief Add a message, waiting for room
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     */
+    Status send(Message message, Task* parker);
+
+    /**
+     * @brief Take the oldest message, waiting for one; nil once closed and drained
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     */
+    Status receive(Message& message, Task* parker);
+
+    /**
+     * @brief Whether send() or receive() would go ahead without waiting now
+     */
+    bool ready(bool sending);
+
+    void close();
+
+    const std::string& elementType() const { return element_type; }
+
+    /**
+     * @brief Whether a value's type is one the channel carries
+     */
+    bool accepts(Value value) const;
+
+private:
+    std::mutex mutex;
+    std::deque<Message> items;
+    size_t capacity;
+    std::string element_type;  // Empty for any type
+    bool closed = false;
+    WaitList senders;
+    WaitList receivers;
+};
+
+/**
+ * @brief A call running on a Scheduler, and its result once it finishes
+ *
+ * The task keeps itself alive from submission until it finishes, so a
+ * script may drop its handle without stopping it.
+ */
+class Task : public std::enable_shared_from_this<Task> {
+public:
+    Task(Message callee, std::vector<Message> args, std::vector<std::pair<std::string, Message>> globals);
+
+    /**
+     * @brief A task that runs host code in a pooled VM instead of a script call
+     *
+     * The VM has only the builtins defined, and the job cannot suspend.
+     */
+    explicit Task(std::function<void(VM&)> job);
+
+    /**
+     * @brief A task for an async call, which runs in its caller's VM instead
+     * of on a Scheduler; that VM finishes it
+     */
+    Task();
+    ~Task();
+
+    /**
+     * @brief Wait for the task to finish
+     * @param parker Task to park instead of blocking the thread, or nullptr
+     * @return DONE, or PARKED if parker must suspend
+     */
+    Channel::Status join(Task* parker);
+
+    /**
+     * @brief Whether the task has finished, without waiting
+     */
+    bool finished();
+
+    /**
+     * @brief The result of a finished task
+     * @return Whether the task finished without a runtime error
+     */
+    bool result(Message& value, std::string& error_message);
+
+    /**
+     * @brief Make a parked task runnable again
+     *
+     * A task being suspended is resumed as soon as it has been.
+     */
+    void wake();
+
+private:
+    friend class Scheduler;
+    friend class VM;
+
+    // Where the task is between runs on a worker
+    enum State : int {
+        RUNNING,
+        PARKED,
+        NOTIFIED   // Woken while it was still suspending
+    };
+
+    // What to run, consumed when the task starts
+    Message callee;
+    std::vector<Message> args;
+    std::vector<std::pair<std::string, Message>> globals;
+    std::function<void(VM&)> job;
+
+    Scheduler* scheduler = nullptr;
+    std::shared_ptr<Task> self;       // Set from submission until the task finishes
+    std::unique_ptr<VM> vm;           // From the first run until the task finishes
+    std::atomic<int> state{RUNNING};
+    bool asleep = false;              // Parked on a timer; see Scheduler::sleepUntil()
+
+    std::mutex mutex;
+    bool done = false;
+    bool failed = false;
+    Message value;
+    std::string error;
+    WaitList joiners;
+
+    void finish(bool ok, Message result, std::string message);
+};
+
+/**
+ * @brief Heap handle of a Channel
+ */
+class ObjChannel : public Obj {
+public:
+    explicit ObjChannel(std::shared_ptr<Channel> channel)
+        : Obj(ObjType::CHANNEL), channel(std::move(channel)) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjChannel(std::move(channel)); }
+
+    std::shared_ptr<Channel> channel;
+};
+
+/**
+ * @brief Heap handle of a Task
+ */
+class ObjTask : public Obj {
+public:
+    explicit ObjTask(std::shared_ptr<Task> task)
+        : Obj(ObjType::TASK), task(std::move(task)) {}
+
+    Obj* moveTo(void* memory) override { return new (memory) ObjTask(std::move(task)); }
+
+    std::shared_ptr<Task> task;
+};
+
+inline bool isChannel(Value value) { return isObjType(value, ObjType::CHANNEL); }
+inline bool isTask(Value value) { return isObjType(value, ObjType::TASK); }
+
+inline ObjChannel* asChannel(Value value) { return static_cast<ObjChannel*>(value.asObj()); }
+inline ObjTask* asTask(Value value) { return static_cast<ObjTask*>(value.asObj()); }
+
+// Builtins; see builtins.cpp
+Value nativeSpawn(VM& vm, int argc, const Value* args);
+Value nativeJoin(VM& vm, int argc, const Value* args);
+Value nativeChannel(VM& vm, int argc, const Value* args);
+Value nativeSend(VM& vm, int argc, const Value* args);
+Value nativeRecv(VM& vm, int argc, const Value* args);
+Value nativeClose(VM& vm, int argc, const Value* args);
+Value nativeAwait(VM& vm, int argc, const Value* args);
+Value nativeSleep(VM& vm, int argc, const Value* args);
+
+} // namespace mana
+
+#endif // MANASCRIPT_TASK_HPP
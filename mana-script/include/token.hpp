@@ -1,6 +1,8 @@
 #ifndef MANASCRIPT_TOKEN_HPP
 #define MANASCRIPT_TOKEN_HPP
 
+#include "source.hpp"
+
 #include <string>
 #include <unordered_map>
 #include <iostream>
@@ -36,6 +38,10 @@ enum class TokenType {
     TRUE,
     FALSE,
     NIL,
+    IMPORT,
+    SPAWN,
+    ASYNC,
+    AWAIT,
     
     // Operators
     PLUS,          // +
@@ -78,9 +84,10 @@ public:
     std::string lexeme;
     int line;
     int column;
+    SourceLoc loc;  // Start of the token in its buffer
     
-    Token(TokenType type, const std::string& lexeme, int line, int column)
-        : type(type), lexeme(lexeme), line(line), column(column) {}
+    Token(TokenType type, const std::string& lexeme, int line, int column, SourceLoc loc = {})
+        : type(type), lexeme(lexeme), line(line), column(column), loc(loc) {}
     
     std::string toString() const;
 };
@@ -2,6 +2,7 @@
 #define MANASCRIPT_TRANSPILER_HPP
 
 #include "ast.hpp"
+#include "context.hpp"
 #include <string>
 #include <sstream>
 #include <unordered_map>
@@ -18,6 +19,9 @@ private:
     int indent_level = 0;
     std::unordered_map<std::string, std::string> type_map;
     std::vector<std::string> current_var_decls;
+    std::unordered_map<std::string, std::string> extern_wrappers;  // Extension function -> C++ wrapper
+    std::string filename;
+    DiagnosticManager* reports = &diagnostics;
     
     // Helper methods
     void indent();
@@ -27,6 +31,11 @@ private:
     
 public:
     Transpiler();
+
+    /**
+     * @brief Transpile the given compilation's AST, reporting into its diagnostics
+     */
+    explicit Transpiler(CompilationContext& context);
     
     /**
      * @brief Transpile AST to C++ code
@@ -43,6 +52,8 @@ public:
     void visitVariableExpr(VariableExpr& expr) override;
     void visitAssignExpr(AssignExpr& expr) override;
     void visitCallExpr(CallExpr& expr) override;
+    void visitSpawnExpr(SpawnExpr& expr) override;
+    void visitAwaitExpr(AwaitExpr& expr) override;
     
     // Statement visitors
     void visitExpressionStmt(ExpressionStmt& stmt) override;
@@ -50,8 +61,10 @@ public:
     void visitBlockStmt(BlockStmt& stmt) override;
     void visitIfStmt(IfStmt& stmt) override;
     void visitWhileStmt(WhileStmt& stmt) override;
+    void visitParallelForStmt(ParallelForStmt& stmt) override;
     void visitFunctionStmt(FunctionStmt& stmt) override;
     void visitReturnStmt(ReturnStmt& stmt) override;
+    void visitImportStmt(ImportStmt& stmt) override;
 };
 
 } // namespace mana
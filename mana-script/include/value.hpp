@@ -0,0 +1,176 @@
+#ifndef MANASCRIPT_VALUE_HPP
+#define MANASCRIPT_VALUE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace mana {
+
+// Forward declarations
+class Obj;
+
+/**
+ * @brief NaN-boxed runtime value
+ *
+ * Every runtime value fits in 64 bits. Doubles are stored unchanged; every
+ * other kind lives in the payload of a negative quiet NaN and is selected by
+ * the top 16 bits:
+ *
+ *   0xFFF9  nil
+ *   0xFFFA  bool    (payload bit 0)
+ *   0xFFFB  int32   (payload low 32 bits)
+ *   0xFFFC  object  (payload is a 48-bit Obj pointer)
+ *
+ * NaNs produced by arithmetic are canonicalized to 0x7FF8000000000000 so a
+ * double can never alias a tagged value, and "is this a double" is a single
+ * unsigned compare.
+ */
+class Value {
+public:
+    Value() : bits_(kNilBits) {}
+
+    static Value nil() { return fromBits(kNilBits); }
+    static Value boolean(bool b) { return fromBits(b ? kTrueBits : kFalseBits); }
+    static Value integer(int32_t i) { return fromBits(kIntTag | static_cast<uint32_t>(i)); }
+    static Value object(Obj* obj) {
+        return fromBits(kObjTag | (reinterpret_cast<uint64_t>(obj) & kPayloadMask));
+    }
+    static Value number(double d) {
+        if (d != d) return fromBits(kCanonicalNaN);
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return fromBits(bits);
+    }
+    static Value fromBits(uint64_t bits) {
+        Value v;
+        v.bits_ = bits;
+        return v;
+    }
+
+    // Tag checks
+    bool isDouble() const { return bits_ < kNilBits; }
+    bool isNil() const { return bits_ == kNilBits; }
+    bool isBool() const { return (bits_ | 1) == kTrueBits; }
+    bool isInt() const { return (bits_ >> 32) == (kIntTag >> 32); }
+    bool isObj() const { return (bits_ & kTagMask) == kObjTag; }
+    bool isNumber() const { return isDouble() || isInt(); }
+
+    // Unchecked accessors; callers test the tag first
+    bool asBool() const { return bits_ == kTrueBits; }
+    int32_t asInt() const { return static_cast<int32_t>(static_cast<uint32_t>(bits_)); }
+    double asDouble() const {
+        double d;
+        std::memcpy(&d, &bits_, sizeof(d));
+        return d;
+    }
+    double asNumber() const { return isInt() ? static_cast<double>(asInt()) : asDouble(); }
+    Obj* asObj() const { return reinterpret_cast<Obj*>(bits_ & kPayloadMask); }
+
+    uint64_t bits() const { return bits_; }
+
+    /**
+     * @brief nil, false, 0 and 0.0 are falsey; everything else is truthy
+     */
+    bool isFalsey() const {
+        return bits_ == kNilBits || bits_ == kFalseBits || bits_ == kIntTag ||
+               (bits_ << 1) == 0;
+    }
+
+    /**
+     * @brief Identity comparison on the raw bits
+     */
+    bool operator==(const Value& other) const { return bits_ == other.bits_; }
+    bool operator!=(const Value& other) const { return bits_ != other.bits_; }
+
+    /**
+     * @brief Get a human-readable name of the value's type
+     */
+    const char* typeName() const;
+
+    /**
+     * @brief Format the value the way print() shows it
+     */
+    std::string toString() const;
+
+    static constexpr uint64_t kCanonicalNaN = 0x7FF8000000000000ULL;
+    static constexpr uint64_t kTagMask      = 0xFFFF000000000000ULL;
+    static constexpr uint64_t kPayloadMask  = 0x0000FFFFFFFFFFFFULL;
+    static constexpr uint64_t kNilBits      = 0xFFF9000000000000ULL;
+    static constexpr uint64_t kFalseBits    = 0xFFFA000000000000ULL;
+    static constexpr uint64_t kTrueBits     = 0xFFFA000000000001ULL;
+    static constexpr uint64_t kIntTag       = 0xFFFB000000000000ULL;
+    static constexpr uint64_t kObjTag       = 0xFFFC000000000000ULL;
+
+private:
+    uint64_t bits_;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay a single machine word");
+
+/**
+ * @brief Longest text formatNumber() writes
+ */
+constexpr size_t kMaxNumberChars = 32;
+
+/**
+ * @brief Write the text of an int or double value without allocating
+ *
+ * Doubles use 14 significant digits, like printf's "%.14g".
+ *
+ * @return One past the last character written
+ */
+char* formatNumber(Value value, char* out);
+
+/**
+ * @brief Semantic equality: numbers compare by value, strings by contents
+ */
+bool valuesEqual(Value a, Value b);
+
+// Arithmetic fast paths. Integer results that overflow int32 widen to double
+// instead of wrapping. Callers must check isNumber() on both operands first.
+
+inline Value fromInt64(int64_t r) {
+    if (r >= INT32_MIN && r <= INT32_MAX) {
+        return Value::integer(static_cast<int32_t>(r));
+    }
+    return Value::number(static_cast<double>(r));
+}
+
+inline Value addNumbers(Value a, Value b) {
+    if (a.isInt() && b.isInt()) {
+        return fromInt64(static_cast<int64_t>(a.asInt()) + b.asInt());
+    }
+    return Value::number(a.asNumber() + b.asNumber());
+}
+
+inline Value subNumbers(Value a, Value b) {
+    if (a.isInt() && b.isInt()) {
+        return fromInt64(static_cast<int64_t>(a.asInt()) - b.asInt());
+    }
+    return Value::number(a.asNumber() - b.asNumber());
+}
+
+inline Value mulNumbers(Value a, Value b) {
+    if (a.isInt() && b.isInt()) {
+        return fromInt64(static_cast<int64_t>(a.asInt()) * b.asInt());
+    }
+    return Value::number(a.asNumber() * b.asNumber());
+}
+
+/**
+ * @brief Ordering on numbers without converting int pairs to double
+ */
+inline bool lessNumbers(Value a, Value b) {
+    if (a.isInt() && b.isInt()) return a.asInt() < b.asInt();
+    return a.asNumber() < b.asNumber();
+}
+
+inline bool lessEqualNumbers(Value a, Value b) {
+    if (a.isInt() && b.isInt()) return a.asInt() <= b.asInt();
+    return a.asNumber() <= b.asNumber();
+}
+
+} // namespace mana
+
+#endif // MANASCRIPT_VALUE_HPP
@@ -0,0 +1,498 @@
+#ifndef MANASCRIPT_VM_HPP
+#define MANASCRIPT_VM_HPP
+
+#include "value.hpp"
+#include "object.hpp"
+#include "bytecode.hpp"
+#include "error.hpp"
+#include "gc.hpp"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mana {
+
+class Scheduler;
+class Task;
+
+/**
+ * @brief Outcome of running code in the VM
+ */
+enum class InterpretResult {
+    OK,
+    RUNTIME_ERROR,
+    SUSPENDED   // A task blocked; see VM::resume()
+};
+
+/**
+ * @brief Where a call allocates its objects
+ */
+enum class AllocationMode {
+    HEAP,   // The garbage-collected heap
+    ARENA   // The thread's Arena, reset when the call returns
+};
+
+/**
+ * @brief How often one opcode directly followed another during execution
+ */
+struct OpcodePairCount {
+    OpCode first;
+    OpCode second;
+    uint64_t count;
+};
+
+/**
+ * @brief Exception thrown inside the VM when a runtime error is encountered
+ */
+class RuntimeError : public std::runtime_error {
+public:
+    RuntimeError(const std::string& message) : std::runtime_error(message) {}
+};
+
+/**
+ * @brief Thrown by VM::suspend() to unwind a blocked task out of the interpreter
+ */
+struct TaskSuspended {};
+
+/**
+ * @brief Thrown by VM::park() to unwind an async call out of the interpreter
+ */
+struct CallParked {};
+
+/**
+ * @brief Register-based bytecode interpreter
+ *
+ * Each call frame owns a window of the register stack. A call places the
+ * callee and its arguments in consecutive registers of the caller; the
+ * callee's frame starts at the first argument, so arguments become its
+ * parameter registers without copying and the result is written back to the
+ * register that held the callee.
+ *
+ * Objects live in a generational Heap. Collections only happen at
+ * safepoints (calls and loop back-edges), where the roots are exactly the
+ * registers of the active frames, the globals and the loaded functions.
+ *
+ * Concatenating long strings builds ropes, which are flattened when their
+ * characters are first needed: by a comparison or print. Identifier-like
+ * string constants are interned, and new strings with the same characters
+ * reuse the interned copy.
+ *
+ * A call in AllocationMode::ARENA bump-allocates its strings in the thread's
+ * Arena and never collects. When it returns, the result and anything stored
+ * in a global are copied into the heap and the arena is reset at once. Calls
+ * made while an arena call is running share its arena; if another VM on the
+ * thread holds the arena, the call falls back to the heap.
+ *
+ * A VM running a task of a Scheduler can suspend in the middle of a call: a
+ * native that has to wait arranges to be woken and calls suspend(). The
+ * frames stay where they are, the calling instruction is rewound, and
+ * resume() later runs it again.
+ *
+ * The body of an async function runs in its caller's VM, as an async call
+ * with a Task for its result, so it shares the caller's globals. It runs at
+ * once, until it returns or a native in it has to wait. In that case the
+ * call parks: its frames and registers move off the stack, the waiting
+ * instruction is rewound, and the caller gets the task. Awaiting the task
+ * moves the frames back above the awaiting frame and runs them to the end.
+ * A call that is being awaited waits the way its awaiter would. Calls that
+ * nothing awaits are finished before the outermost host call returns.
+ */
+class VM {
+private:
+    struct CallFrame {
+        ObjFunction* function;
+        Instruction* pc;        // Next instruction to execute
+        Value* base;            // Register 0 of the frame
+    };
+
+    /**
+     * Globals live in stable slots. Inline caches remember the slot a name
+     * resolved to together with the table version at that time; every
+     * definition bumps the version, so redefining a name invalidates all
+     * cached lookups at once.
+     */
+    struct GlobalTable {
+        std::unordered_map<std::string, uint32_t> slots;
+        std::vector<Value> values;
+        uint32_t version = 1;
+    };
+
+    // Reserved up front and never reallocated, since frames point into it;
+    // sized to the deepest frame so far, so a suspended task only holds on
+    // to the registers it has used
+    std::vector<Value> stack;
+    std::vector<CallFrame> frames;
+    GlobalTable globals;
+
+    Heap heap;
+    std::unordered_map<const FunctionProto*, ObjFunction*> loaded_functions;
+
+    // Canonical copies of identifier-like string constants, keyed by their
+    // own characters
+    std::unordered_map<std::string_view, ObjString*> interned;
+
+    // Implementations of the builtins, indexed like builtins(), for CALLB
+    std::vector<NativeFn> builtin_table;
+
+    // Executed opcode pairs, kOpCodeCount * kOpCodeCount; empty unless profiling
+    std::vector<uint64_t> pair_counts;
+
+    // Values the host holds between calls; see pushRoot()
+    std::vector<Value> host_roots;
+
+    // Where runtime errors are reported
+    DiagnosticManager* reports = &diagnostics;
+
+    // The task this VM is running, and where spawn sends new ones
+    Task* current_task = nullptr;
+    Scheduler* task_scheduler = nullptr;
+
+    // Calls from the host in progress; only the outermost can suspend
+    int invoke_depth = 0;
+    size_t suspended_depth = 0;
+    Value* suspended_window = nullptr;
+
+    // An async call with frames on the stack
+    struct AsyncCall {
+        std::shared_ptr<Task> task;
+        size_t depth;          // Frames below its first
+        size_t window;         // Stack index of the register its result goes to
+        int invoke_depth;      // Host calls in progress when it started or resumed
+        bool detached;         // Not awaited yet, so a wait parks it
+        bool asleep;           // Parked in sleep(); see keepWakeTime()
+        std::chrono::steady_clock::time_point wake_at;
+    };
+
+    // An async call moved off the stack, with the calls it was awaiting;
+    // bases, depths and windows count from its window
+    struct ParkedFrame {
+        ObjFunction* function;
+        size_t pc;
+        size_t base;
+    };
+    struct ParkedCall {
+        std::vector<Value> registers;
+        std::vector<ParkedFrame> frames;
+        std::vector<AsyncCall> calls;
+    };
+
+    std::vector<AsyncCall> async_calls;                     // Innermost last
+    std::map<uint64_t, ParkedCall> parked;                  // In the order they parked
+    std::unordered_map<const Task*, uint64_t> parked_tasks;  // Every call a parked one holds
+    uint64_t parked_count = 0;
+
+    Value materialize(const Constant& constant);
+
+    // Execution
+    InterpretResult invoke(Value callee, const std::vector<Value>& args, Value* result);
+    void leaveArena(Value& result);
+    InterpretResult finish(size_t depth, Value* window, Value* result);
+    void run(size_t exit_depth);
+    template <bool kProfile>
+    void execute(size_t exit_depth);
+    void callValue(Value* window, int argc, InlineCache* cache = nullptr);
+    void pushFrame(ObjFunction* function, Value* window, int argc);
+    void startAsyncCall(Value* window, int argc);
+    void returnAsyncCall(Value& result);
+    void failAsyncCall(const std::string& message);
+    void parkAsyncCall();
+    bool resumeAsyncCall(const Task& task, Value* window);
+    void abandonAsyncCalls(const std::string& message);
+    void resolveGlobal(const std::string& name, InlineCache& cache);
+    ObjString* intern(std::string_view chars);
+    ObjString* toStringObject(Value value);
+    Value concatenate(Value left, Value right);
+    bool compareStrings(Value left, Value right, bool or_equal);
+    bool equalValues(Value left, Value right);
+    Value* stackTop();
+    bool growStack(Value* end);
+
+    // Error handling
+    [[noreturn]] void runtimeError(const std::string& message);
+    void reportRuntimeError(const RuntimeError& error, size_t exit_depth);
+
+    void defineBuiltins();
+    void traceRoots(GcTracer& tracer);
+
+public:
+    static constexpr size_t kDefaultStackSize = 1 << 18;
+
+    /**
+     * @param nursery_size Bytes of young-object space between minor collections
+     * @param stack_size Registers shared by all frames
+     */
+    explicit VM(size_t nursery_size = Heap::kDefaultNurserySize, size_t stack_size = kDefaultStackSize);
+    ~VM();
+
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    /**
+     * @brief Run the top-level code of a compiled script
+     * @param script Script prototype produced by BytecodeCompiler
+     * @param mode Where the script allocates; see call()
+     * @return Whether execution completed without a runtime error
+     */
+    InterpretResult interpret(const std::shared_ptr<const FunctionProto>& script,
+                              AllocationMode mode = AllocationMode::HEAP);
+
+    /**
+     * @brief Call a script or native function from the host
+     * @param callee Function value to call
+     * @param args Arguments to pass
+     * @param result Receives the return value if not null
+     * @param mode ARENA suits short calls that allocate temporaries and
+     *             keep little: they skip both the collector and malloc
+     * @return Whether the call completed without a runtime error
+     */
+    InterpretResult call(Value callee, const std::vector<Value>& args, Value* result = nullptr,
+                         AllocationMode mode = AllocationMode::HEAP);
+
+    // Calls made by callEach() between resets of its arena
+    static constexpr size_t kCallsPerArena = 1024;
+
+    /**
+     * @brief Call a function once per string, passing the string as its
+     * only argument
+     *
+     * In ARENA mode the calls share one arena, which is left and reset only
+     * every kCallsPerArena calls, so each string costs a pointer bump and
+     * short-lived results are never collected.
+     *
+     * @param next Yields the next string, or returns false when none is left
+     * @param take Called with each result before the next call, if not null
+     * @return Whether every call completed without a runtime error; the
+     *         calls stop at the first that does not
+     */
+    InterpretResult callEach(Value callee, const std::function<bool(std::string_view&)>& next,
+                             const std::function<void(Value)>& take, AllocationMode mode);
+
+    /**
+     * @brief Continue a call that returned SUSPENDED
+     * @param result Receives the return value if not null
+     */
+    InterpretResult resume(Value* result = nullptr);
+
+    /**
+     * @brief Whether a native running now may suspend()
+     *
+     * Only a VM running a task can, only from a call made by script code,
+     * and only when no host call into it is in progress, since the host's
+     * C++ frames cannot be parked. Arena calls cannot suspend either.
+     */
+    bool canSuspend() const {
+        return current_task && invoke_depth == 1 && !frames.empty() && !heap.inArena();
+    }
+
+    /**
+     * @brief Park the running task; the native that calls this is run again
+     * with the same arguments on resume()
+     */
+    [[noreturn]] void suspend();
+
+    /**
+     * @brief Whether a native running now may park()
+     *
+     * Only an async call that nothing awaits yet can park, and only from a
+     * native that its own code calls. Arena calls cannot park.
+     */
+    bool canPark() const;
+
+    /**
+     * @brief Park the innermost async call that nothing awaits; the native
+     * that calls this runs again with the same arguments once the call is
+     * awaited
+     */
+    [[noreturn]] void park();
+
+    /**
+     * @brief park() from sleep(), remembering when it was due to wake
+     */
+    [[noreturn]] void parkUntil(std::chrono::steady_clock::time_point wake_at);
+
+    /**
+     * @brief In a sleep() run again after parkUntil(), replace deadline with
+     * the one it parked with
+     */
+    void keepWakeTime(std::chrono::steady_clock::time_point& deadline);
+
+    /**
+     * @brief Run a parked async call of this VM to its end, for a native
+     * waiting on its task
+     * @param in_use End of the registers the native still reads
+     * @return Whether task was a parked call of this VM
+     */
+    bool finishAsyncCall(const Task& task, const Value* in_use);
+
+    /**
+     * @brief Run the oldest parked async call of this VM to its end, for a
+     * native about to wait on something that call may provide
+     * @param in_use End of the registers the native still reads
+     * @return Whether there was one
+     */
+    bool finishParkedCall(const Value* in_use);
+
+    /**
+     * @brief Whether task is an async call with frames on the stack, which
+     * cannot finish before the code above it does
+     */
+    bool runsAsyncCall(const Task& task) const;
+
+    void setTask(Task* task) { current_task = task; }
+    Task* task() const { return current_task; }
+
+    /**
+     * @brief Where spawn starts tasks; Scheduler::global() unless set
+     */
+    void setScheduler(Scheduler& scheduler) { task_scheduler = &scheduler; }
+    Scheduler& scheduler() const;
+
+    /**
+     * @brief Load a function prototype; every load of one prototype returns
+     * the same function
+     */
+    ObjFunction* loadFunction(const std::shared_ptr<const FunctionProto>& proto);
+
+    /**
+     * @brief Construct an object in this VM's heap
+     *
+     * A young object is only valid until the next collection; see newString().
+     */
+    template <typename T, typename... Args>
+    T* allocate(Generation generation, Args&&... args) {
+        return heap.allocate<T>(generation, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Define or overwrite a global variable
+     */
+    void defineGlobal(const std::string& name, Value value);
+
+    /**
+     * @brief Keep a value the host holds between calls alive
+     *
+     * Collections trace the root and update it when they move its object, so
+     * read it back with root() after every call. Roots are released in
+     * reverse order.
+     * @return Index of the root
+     */
+    size_t pushRoot(Value value) {
+        host_roots.push_back(value);
+        return host_roots.size() - 1;
+    }
+    Value root(size_t index) const { return host_roots[index]; }
+    void setRoot(size_t index, Value value) { host_roots[index] = value; }
+    void popRoots(size_t count) { host_roots.resize(host_roots.size() - count); }
+
+    /**
+     * @brief Visit every global variable, builtins included
+     */
+    void forEachGlobal(const std::function<void(const std::string& name, Value value)>& visit) const;
+
+    /**
+     * @brief Remove every global but the builtins, and free the functions
+     * the VM has loaded
+     */
+    void resetGlobals();
+
+    /**
+     * @brief Look up a global variable
+     * @return The value, or nil if it is not defined
+     */
+    Value getGlobal(const std::string& name) const;
+
+    /**
+     * @brief Look up a global variable
+     * @return Whether it is defined
+     */
+    bool findGlobal(const std::string& name, Value& value) const;
+
+    /**
+     * @brief Register a native function as a global
+     * @param arity Number of arguments, or -1 for any number
+     */
+    void defineNative(const std::string& name, int arity, NativeFn function);
+
+    /**
+     * @brief Load a native extension module and define its functions as globals
+     * @param path Shared object to load; see extension.hpp
+     * @throws RuntimeError if the module cannot be loaded
+     */
+    void importExtension(const std::string& path);
+
+    /**
+     * @brief Report runtime errors to sink instead of the global diagnostics
+     *
+     * VMs running on different threads need sinks of their own.
+     */
+    void setDiagnostics(DiagnosticManager& sink) { reports = &sink; }
+    DiagnosticManager& diagnosticSink() const { return *reports; }
+
+    /**
+     * @brief Start or stop counting executed opcode pairs
+     *
+     * Enabling resets the counts. The interpreter loop is compiled twice, so
+     * the counting costs nothing while it is off.
+     */
+    void setOpcodeProfiling(bool enabled);
+
+    /**
+     * @brief Opcode pairs executed since profiling was enabled, most frequent first
+     *
+     * Quickened opcodes are counted as their generic form.
+     */
+    std::vector<OpcodePairCount> opcodePairs() const;
+
+    /**
+     * @brief Allocate a new string owned by this VM
+     *
+     * The string is young: the pointer is only valid until the next
+     * collection, so keep it in a Value the VM can see (a global or an
+     * argument) before running code. If the characters match an interned
+     * string, that string is returned instead.
+     */
+    ObjString* newString(std::string_view chars);
+
+    /**
+     * @brief The flat string holding the characters of a string
+     *
+     * A rope is flattened on its first call and forwards to the copy after
+     * that; a flat string is returned as is.
+     */
+    ObjString* flatten(ObjString* string);
+
+    /**
+     * @brief The interned string with the characters of a flat string, if
+     * there is one, so comparing it to others is a pointer compare; the
+     * string itself otherwise
+     */
+    ObjString* canonical(ObjString* string);
+
+    /**
+     * @brief Record that owner now references value; natives that store a
+     * value in an object they did not just allocate call this
+     */
+    void writeBarrier(Obj* owner, Value value) { heap.writeBarrier(owner, value); }
+
+    /**
+     * @brief Collect garbage now
+     * @param major Also mark and sweep the old space
+     */
+    void collectGarbage(bool major = false);
+
+    /**
+     * @brief Collector counters and pause histograms
+     */
+    const GcStats& gcStats() const { return heap.stats(); }
+};
+
+} // namespace mana
+
+#endif // MANASCRIPT_VM_HPP
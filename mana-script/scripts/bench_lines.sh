@@ -0,0 +1,35 @@
+#!/bin/sh
+# Filter a large generated log with manascript -p, awk and a shell
+# `while read` loop. The shell loop is timed on the first 100000 lines only.
+# Usage: scripts/bench_lines.sh [path/to/manascript] [size in GB] [log file]
+
+MANASCRIPT=${1:-build/manascript}
+SIZE_GB=${2:-10}
+LOG=${3:-/tmp/manascript_bench.log}
+
+if [ ! -f "$LOG" ]; then
+    echo "Writing $SIZE_GB GB to $LOG"
+    awk 'BEGIN { for (i = 0; ; i++) print "2026-10-17 host" i % 50 " GET /path/" i " " (i % 7 ? 200 : 500) }' \
+        | head -c $((SIZE_GB * 1024 * 1024 * 1024)) > "$LOG"
+fi
+
+time_ms() {
+    start=$(date +%s%N)
+    "$@" > /dev/null || exit 1
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 )) ms"
+}
+
+echo "manascript -p: $(time_ms "$MANASCRIPT" -p examples/lines.mana "$LOG")"
+echo "awk:           $(time_ms awk '{ n++; b += length($0) } length($0) > 40 { print } END { print n, b }' "$LOG")"
+
+shell_loop() {
+    n=0
+    head -n 100000 "$LOG" | while IFS= read -r line; do
+        n=$((n + 1))
+        if [ ${#line} -gt 40 ]; then
+            echo "$line"
+        fi
+    done
+}
+echo "while read:    $(time_ms shell_loop) (100000 lines)"
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Time a script (examples/spawn.mana by default, or examples/parallel.mana)
+# with 1 to 64 worker threads.
+# Usage: scripts/bench_spawn.sh [path/to/manascript] [script]
+
+MANASCRIPT=${1:-build/manascript}
+SCRIPT=${2:-examples/spawn.mana}
+
+for workers in 1 2 4 8 16 32 64; do
+    start=$(date +%s%N)
+    MANASCRIPT_WORKERS=$workers "$MANASCRIPT" "$SCRIPT" > /dev/null || exit 1
+    end=$(date +%s%N)
+    echo "$workers workers: $(( (end - start) / 1000000 )) ms"
+done
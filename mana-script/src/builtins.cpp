@@ -0,0 +1,206 @@
+#include "builtins.hpp"
+#include "csv.hpp"
+#include "file.hpp"
+#include "json.hpp"
+#include "map.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "regex.hpp"
+#include "task.hpp"
+#include "vm.hpp"
+#include <climits>
+#include <cmath>
+
+namespace mana {
+
+namespace {
+
+Value expectNumber(const char* name, Value value) {
+    if (!value.isNumber()) {
+        throw RuntimeError(std::string(name) + "() expects a number, not " + value.typeName());
+    }
+    return value;
+}
+
+// Runtime implementations
+
+Value nativePrint(VM& vm, int argc, const Value* args) {
+    OutputBuffer& output = OutputBuffer::forThread();
+    for (int i = 0; i < argc; ++i) {
+        if (i > 0) {
+            output.write(' ');
+        }
+
+        Value arg = args[i];
+        if (arg.isInt()) {
+            output.write(arg.asInt());
+        } else if (arg.isDouble()) {
+            output.write(arg.asDouble());
+        } else if (arg.isBool()) {
+            output.write(arg.asBool());
+        } else if (isString(arg)) {
+            output.write(vm.flatten(asString(arg))->view());
+        } else {
+            output.write(arg.toString());
+        }
+    }
+    output.write('\n');
+    return Value::nil();
+}
+
+Value nativeAbs(VM&, int, const Value* args) {
+    Value x = expectNumber("abs", args[0]);
+    if (x.isInt()) {
+        return x.asInt() < 0 ? fromInt64(-static_cast<int64_t>(x.asInt())) : x;
+    }
+    return Value::number(std::fabs(x.asDouble()));
+}
+
+Value nativeMin(VM&, int, const Value* args) {
+    Value x = expectNumber("min", args[0]);
+    Value y = expectNumber("min", args[1]);
+    return lessNumbers(y, x) ? y : x;
+}
+
+Value nativeMax(VM&, int, const Value* args) {
+    Value x = expectNumber("max", args[0]);
+    Value y = expectNumber("max", args[1]);
+    return lessNumbers(x, y) ? y : x;
+}
+
+Value nativeSqrt(VM&, int, const Value* args) {
+    return Value::number(std::sqrt(expectNumber("sqrt", args[0]).asNumber()));
+}
+
+Value nativeLen(VM&, int, const Value* args) {
+    if (!isString(args[0])) {
+        throw RuntimeError(std::string("len() expects a string, not ") + args[0].typeName());
+    }
+    return Value::integer(static_cast<int32_t>(asString(args[0])->length));
+}
+
+// Compile-time evaluation, matching the runtime results exactly
+
+bool isNumber(const Constant& constant) {
+    return std::holds_alternative<int>(constant) || std::holds_alternative<double>(constant);
+}
+
+double numberOf(const Constant& constant) {
+    return std::holds_alternative<int>(constant) ? std::get<int>(constant) : std::get<double>(constant);
+}
+
+std::optional<Constant> foldAbs(const std::vector<Constant>& args) {
+    if (std::holds_alternative<int>(args[0])) {
+        int x = std::get<int>(args[0]);
+        if (x == INT_MIN) {
+            return Constant(-static_cast<double>(x));
+        }
+        return Constant(x < 0 ? -x : x);
+    }
+    if (std::holds_alternative<double>(args[0])) {
+        return Constant(std::fabs(std::get<double>(args[0])));
+    }
+    return std::nullopt;
+}
+
+std::optional<Constant> foldMin(const std::vector<Constant>& args) {
+    if (!isNumber(args[0]) || !isNumber(args[1])) {
+        return std::nullopt;
+    }
+    return numberOf(args[1]) < numberOf(args[0]) ? args[1] : args[0];
+}
+
+std::optional<Constant> foldMax(const std::vector<Constant>& args) {
+    if (!isNumber(args[0]) || !isNumber(args[1])) {
+        return std::nullopt;
+    }
+    return numberOf(args[0]) < numberOf(args[1]) ? args[1] : args[0];
+}
+
+std::optional<Constant> foldSqrt(const std::vector<Constant>& args) {
+    if (!isNumber(args[0])) {
+        return std::nullopt;
+    }
+    return Constant(std::sqrt(numberOf(args[0])));
+}
+
+std::optional<Constant> foldLen(const std::vector<Constant>& args) {
+    if (!std::holds_alternative<std::string>(args[0])) {
+        return std::nullopt;
+    }
+    return Constant(static_cast<int>(std::get<std::string>(args[0]).size()));
+}
+
+} // namespace
+
+const std::vector<Builtin>& builtins() {
+    static const std::vector<Builtin> registry = {
+        {"print", -1, BuiltinType::ANY, BuiltinType::NIL, false, true, nativePrint, nullptr, "print"},
+        {"abs", 1, BuiltinType::NUMBER, BuiltinType::NUMBER, true, true, nativeAbs, foldAbs, "std::abs"},
+        {"min", 2, BuiltinType::NUMBER, BuiltinType::NUMBER, true, true, nativeMin, foldMin, "mana_min"},
+        {"max", 2, BuiltinType::NUMBER, BuiltinType::NUMBER, true, true, nativeMax, foldMax, "mana_max"},
+        {"sqrt", 1, BuiltinType::NUMBER, BuiltinType::NUMBER, true, true, nativeSqrt, foldSqrt, "std::sqrt"},
+        {"len", 1, BuiltinType::STRING, BuiltinType::NUMBER, true, true, nativeLen, foldLen, "mana_len"},
+        // Tasks and channels; see task.hpp. The transpiler has no spelling for them
+        {"spawn", -1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeSpawn, nullptr, nullptr},
+        {"join", 1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeJoin, nullptr, nullptr},
+        {"channel", -1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeChannel, nullptr, nullptr},
+        {"send", 2, BuiltinType::ANY, BuiltinType::NIL, false, true, nativeSend, nullptr, nullptr},
+        {"recv", 1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeRecv, nullptr, nullptr},
+        {"close", 1, BuiltinType::ANY, BuiltinType::NIL, false, true, nativeClose, nullptr, nullptr},
+        // What 'await' compiles to; scripts cannot name it
+        {"await", 1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeAwait, nullptr, nullptr},
+        {"sleep", 1, BuiltinType::NUMBER, BuiltinType::NIL, false, true, nativeSleep, nullptr, "mana_sleep"},
+        // Files; see file.hpp
+        {"open", -1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeOpen, nullptr, nullptr},
+        {"read", -1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeRead, nullptr, nullptr},
+        {"read_line", 1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeReadLine, nullptr, nullptr},
+        {"write", 2, BuiltinType::ANY, BuiltinType::NIL, false, true, nativeWrite, nullptr, nullptr},
+        // Data formats; see json.hpp and csv.hpp
+        {"parse_json", 1, BuiltinType::STRING, BuiltinType::ANY, false, true, nativeParseJson, nullptr, nullptr},
+        {"json_get", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeJsonGet, nullptr, nullptr},
+        {"json_len", 1, BuiltinType::ANY, BuiltinType::NUMBER, false, true, nativeJsonLen, nullptr, nullptr},
+        {"parse_csv", 1, BuiltinType::STRING, BuiltinType::ANY, false, true, nativeParseCsv, nullptr, nullptr},
+        {"csv_rows", 1, BuiltinType::ANY, BuiltinType::NUMBER, false, true, nativeCsvRows, nullptr, nullptr},
+        {"csv_get", 3, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeCsvGet, nullptr, nullptr},
+        {"csv_number", 3, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeCsvNumber, nullptr, nullptr},
+        // Regular expressions; see regex.hpp. Constant patterns are compiled with the script
+        {"regex", 1, BuiltinType::STRING, BuiltinType::ANY, false, true, nativeRegex, nullptr, nullptr, prepareRegex},
+        {"regex_match", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeRegexMatch, nullptr, nullptr, prepareRegex},
+        {"regex_find", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeRegexFind, nullptr, nullptr, prepareRegex},
+        // Maps; see map.hpp. Calls with a constant key compile to GETMAPK and SETMAPK
+        {"map", 0, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeMap, nullptr, nullptr},
+        {"map_get", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeMapGet, nullptr, nullptr},
+        {"map_set", 3, BuiltinType::ANY, BuiltinType::NIL, false, true, nativeMapSet, nullptr, nullptr},
+        {"map_has", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeMapHas, nullptr, nullptr},
+        {"map_delete", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeMapDelete, nullptr, nullptr},
+        {"map_len", 1, BuiltinType::ANY, BuiltinType::NUMBER, false, true, nativeMapLen, nullptr, nullptr},
+        {"map_next", 2, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeMapNext, nullptr, nullptr},
+        // Parallel loops; see parallel.hpp. parallel_for is what 'parallel for' compiles to
+        {"parallel_for", -1, BuiltinType::ANY, BuiltinType::NIL, false, true, nativeParallelFor, nullptr, nullptr},
+        {"parallel_reduce", -1, BuiltinType::ANY, BuiltinType::ANY, false, true, nativeParallelReduce, nullptr, nullptr},
+    };
+    return registry;
+}
+
+int findBuiltin(std::string_view name) {
+    const std::vector<Builtin>& registry = builtins();
+    for (size_t i = 0; i < registry.size(); ++i) {
+        if (name == registry[i].name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+const char* builtinTypeName(BuiltinType type) {
+    switch (type) {
+        case BuiltinType::ANY:    return "any";
+        case BuiltinType::NUMBER: return "number";
+        case BuiltinType::STRING: return "string";
+        case BuiltinType::NIL:    return "nil";
+    }
+    return "any";
+}
+
+} // namespace mana
@@ -0,0 +1,322 @@
+#include "bytecode.hpp"
+#include "builtins.hpp"
+#include "value.hpp"
+#include <iomanip>
+#include <sstream>
+
+namespace mana {
+
+const char* opcodeName(OpCode op) {
+    switch (op) {
+        case OpCode::LOADK:     return "LOADK";
+        case OpCode::LOADNIL:   return "LOADNIL";
+        case OpCode::LOADTRUE:  return "LOADTRUE";
+        case OpCode::LOADFALSE: return "LOADFALSE";
+        case OpCode::MOVE:      return "MOVE";
+        case OpCode::GETGLOBAL: return "GETGLOBAL";
+        case OpCode::SETGLOBAL: return "SETGLOBAL";
+        case OpCode::DEFGLOBAL: return "DEFGLOBAL";
+        case OpCode::IMPORT:    return "IMPORT";
+        case OpCode::ADD:       return "ADD";
+        case OpCode::SUB:       return "SUB";
+        case OpCode::MUL:       return "MUL";
+        case OpCode::DIV:       return "DIV";
+        case OpCode::MOD:       return "MOD";
+        case OpCode::NEG:       return "NEG";
+        case OpCode::NOT:       return "NOT";
+        case OpCode::EQ:        return "EQ";
+        case OpCode::NE:        return "NE";
+        case OpCode::LT:        return "LT";
+        case OpCode::LE:        return "LE";
+        case OpCode::GT:        return "GT";
+        case OpCode::GE:        return "GE";
+        case OpCode::JMP:       return "JMP";
+        case OpCode::JMPIF:     return "JMPIF";
+        case OpCode::JMPIFNOT:  return "JMPIFNOT";
+        case OpCode::CALL:      return "CALL";
+        case OpCode::CALLB:     return "CALLB";
+        case OpCode::ASYNC:     return "ASYNC";
+        case OpCode::AWAIT:     return "AWAIT";
+        case OpCode::FUNC:      return "FUNC";
+        case OpCode::RETURN:    return "RETURN";
+        case OpCode::RETURNNIL: return "RETURNNIL";
+        case OpCode::GETMAPK:   return "GETMAPK";
+        case OpCode::SETMAPK:   return "SETMAPK";
+        case OpCode::ADDK:      return "ADDK";
+        case OpCode::SUBK:      return "SUBK";
+        case OpCode::MULK:      return "MULK";
+        case OpCode::IFLT:      return "IFLT";
+        case OpCode::IFLE:      return "IFLE";
+        case OpCode::IFEQ:      return "IFEQ";
+        case OpCode::IFNE:      return "IFNE";
+        case OpCode::ADD_II:    return "ADD_II";
+        case OpCode::ADD_DD:    return "ADD_DD";
+        case OpCode::SUB_II:    return "SUB_II";
+        case OpCode::SUB_DD:    return "SUB_DD";
+        case OpCode::MUL_II:    return "MUL_II";
+        case OpCode::MUL_DD:    return "MUL_DD";
+        case OpCode::DIV_II:    return "DIV_II";
+        case OpCode::DIV_DD:    return "DIV_DD";
+        case OpCode::MOD_II:    return "MOD_II";
+        case OpCode::EQ_II:     return "EQ_II";
+        case OpCode::NE_II:     return "NE_II";
+        case OpCode::LT_II:     return "LT_II";
+        case OpCode::LT_DD:     return "LT_DD";
+        case OpCode::LE_II:     return "LE_II";
+        case OpCode::LE_DD:     return "LE_DD";
+        case OpCode::GT_II:     return "GT_II";
+        case OpCode::GT_DD:     return "GT_DD";
+        case OpCode::GE_II:     return "GE_II";
+        case OpCode::GE_DD:     return "GE_DD";
+        case OpCode::IFLT_II:   return "IFLT_II";
+        case OpCode::IFLT_DD:   return "IFLT_DD";
+        case OpCode::IFLE_II:   return "IFLE_II";
+        case OpCode::IFLE_DD:   return "IFLE_DD";
+        default: return "UNKNOWN";
+    }
+}
+
+OpCode genericOpcode(OpCode op) {
+    switch (op) {
+        case OpCode::ADD_II: case OpCode::ADD_DD: return OpCode::ADD;
+        case OpCode::SUB_II: case OpCode::SUB_DD: return OpCode::SUB;
+        case OpCode::MUL_II: case OpCode::MUL_DD: return OpCode::MUL;
+        case OpCode::DIV_II: case OpCode::DIV_DD: return OpCode::DIV;
+        case OpCode::MOD_II: return OpCode::MOD;
+        case OpCode::EQ_II:  return OpCode::EQ;
+        case OpCode::NE_II:  return OpCode::NE;
+        case OpCode::LT_II: case OpCode::LT_DD: return OpCode::LT;
+        case OpCode::LE_II: case OpCode::LE_DD: return OpCode::LE;
+        case OpCode::GT_II: case OpCode::GT_DD: return OpCode::GT;
+        case OpCode::GE_II: case OpCode::GE_DD: return OpCode::GE;
+        case OpCode::IFLT_II: case OpCode::IFLT_DD: return OpCode::IFLT;
+        case OpCode::IFLE_II: case OpCode::IFLE_DD: return OpCode::IFLE;
+        default: return op;
+    }
+}
+
+bool isJump(OpCode op) {
+    switch (genericOpcode(op)) {
+        case OpCode::JMP:
+        case OpCode::JMPIF:
+        case OpCode::JMPIFNOT:
+        case OpCode::IFLT:
+        case OpCode::IFLE:
+        case OpCode::IFEQ:
+        case OpCode::IFNE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void instructionReads(const Instruction& ins, std::vector<uint16_t>& registers) {
+    switch (genericOpcode(ins.op)) {
+        case OpCode::LOADK:
+        case OpCode::LOADNIL:
+        case OpCode::LOADTRUE:
+        case OpCode::LOADFALSE:
+        case OpCode::GETGLOBAL:
+        case OpCode::FUNC:
+        case OpCode::JMP:
+        case OpCode::RETURNNIL:
+        case OpCode::IMPORT:
+            break;
+        case OpCode::MOVE:
+        case OpCode::NEG:
+        case OpCode::NOT:
+        case OpCode::ADDK:
+        case OpCode::SUBK:
+        case OpCode::MULK:
+        case OpCode::GETMAPK:
+        case OpCode::AWAIT:
+            registers.push_back(ins.b);
+            break;
+        case OpCode::SETMAPK:
+            registers.push_back(ins.a);
+            registers.push_back(ins.c);
+            break;
+        case OpCode::SETGLOBAL:
+        case OpCode::DEFGLOBAL:
+        case OpCode::JMPIF:
+        case OpCode::JMPIFNOT:
+        case OpCode::RETURN:
+            registers.push_back(ins.a);
+            break;
+        case OpCode::IFLT:
+        case OpCode::IFLE:
+        case OpCode::IFEQ:
+        case OpCode::IFNE:
+            registers.push_back(ins.a);
+            registers.push_back(ins.b);
+            break;
+        case OpCode::CALL:
+        case OpCode::ASYNC:
+            for (int i = 0; i <= ins.b; ++i) {
+                registers.push_back(static_cast<uint16_t>(ins.a + i));
+            }
+            break;
+        case OpCode::CALLB:
+            for (int i = 1; i <= ins.b; ++i) {
+                registers.push_back(static_cast<uint16_t>(ins.a + i));
+            }
+            break;
+        default:
+            // Binary arithmetic and comparisons
+            registers.push_back(ins.b);
+            registers.push_back(ins.c);
+            break;
+    }
+}
+
+int instructionWrite(const Instruction& ins) {
+    switch (genericOpcode(ins.op)) {
+        case OpCode::SETGLOBAL:
+        case OpCode::DEFGLOBAL:
+        case OpCode::JMP:
+        case OpCode::JMPIF:
+        case OpCode::JMPIFNOT:
+        case OpCode::IFLT:
+        case OpCode::IFLE:
+        case OpCode::IFEQ:
+        case OpCode::IFNE:
+        case OpCode::RETURN:
+        case OpCode::RETURNNIL:
+        case OpCode::IMPORT:
+        case OpCode::SETMAPK:
+            return -1;
+        default:
+            return ins.a;
+    }
+}
+
+namespace {
+
+std::string constantToString(const Constant& constant) {
+    if (std::holds_alternative<int>(constant)) {
+        return std::to_string(std::get<int>(constant));
+    }
+    if (std::holds_alternative<double>(constant)) {
+        std::ostringstream ss;
+        ss << std::get<double>(constant);
+        return ss.str();
+    }
+    if (std::holds_alternative<std::string>(constant)) {
+        return "\"" + std::get<std::string>(constant) + "\"";
+    }
+    if (std::holds_alternative<bool>(constant)) {
+        return std::get<bool>(constant) ? "true" : "false";
+    }
+    return "nil";
+}
+
+void disassembleInstruction(std::ostream& os, const FunctionProto& proto, size_t offset) {
+    const Instruction& ins = proto.code[offset];
+
+    os << std::setw(4) << std::setfill('0') << offset << std::setfill(' ') << "  ";
+    int line = SourceManager::global().decode(proto.locations[offset]).line;
+    if (offset > 0 && line == SourceManager::global().decode(proto.locations[offset - 1]).line) {
+        os << "   | ";
+    } else {
+        os << std::setw(4) << line << " ";
+    }
+    os << std::left << std::setw(10) << opcodeName(ins.op) << std::right;
+
+    auto jumpTarget = [&]() { return static_cast<long>(offset) + 1 + ins.sC(); };
+
+    switch (ins.op) {
+        case OpCode::LOADK:
+        case OpCode::DEFGLOBAL:
+            os << " R" << ins.a << " K" << ins.b << "  ; "
+               << constantToString(proto.constants[ins.b]);
+            break;
+        case OpCode::GETGLOBAL:
+        case OpCode::SETGLOBAL:
+            os << " R" << ins.a << " K" << ins.b << " IC" << ins.c << "  ; "
+               << constantToString(proto.constants[ins.b]);
+            break;
+        case OpCode::LOADNIL:
+        case OpCode::LOADTRUE:
+        case OpCode::LOADFALSE:
+        case OpCode::RETURN:
+            os << " R" << ins.a;
+            break;
+        case OpCode::MOVE:
+        case OpCode::NEG:
+        case OpCode::NOT:
+        case OpCode::AWAIT:
+            os << " R" << ins.a << " R" << ins.b;
+            break;
+        case OpCode::JMP:
+            os << " -> " << jumpTarget();
+            break;
+        case OpCode::IMPORT:
+            os << " K" << ins.b << "  ; " << constantToString(proto.constants[ins.b]);
+            break;
+        case OpCode::JMPIF:
+        case OpCode::JMPIFNOT:
+            os << " R" << ins.a << " -> " << jumpTarget();
+            break;
+        case OpCode::ADDK:
+        case OpCode::SUBK:
+        case OpCode::MULK:
+        case OpCode::GETMAPK:
+            os << " R" << ins.a << " R" << ins.b << " K" << ins.c << "  ; "
+               << constantToString(proto.constants[ins.c]);
+            break;
+        case OpCode::SETMAPK:
+            os << " R" << ins.a << " K" << ins.b << " R" << ins.c << "  ; "
+               << constantToString(proto.constants[ins.b]);
+            break;
+        case OpCode::IFLT:
+        case OpCode::IFLE:
+        case OpCode::IFEQ:
+        case OpCode::IFNE:
+            os << " R" << ins.a << " R" << ins.b << " -> " << jumpTarget();
+            break;
+        case OpCode::CALL:
+            os << " R" << ins.a << " " << ins.b << " args IC" << ins.c;
+            break;
+        case OpCode::CALLB:
+            os << " R" << ins.a << " " << ins.b << " args B" << ins.c << "  ; "
+               << builtins()[ins.c].name;
+            break;
+        case OpCode::ASYNC:
+            os << " R" << ins.a << " " << ins.b << " args";
+            break;
+        case OpCode::FUNC:
+            os << " R" << ins.a << " P" << ins.b << "  ; " << proto.functions[ins.b]->name;
+            break;
+        case OpCode::RETURNNIL:
+            break;
+        default:
+            os << " R" << ins.a << " R" << ins.b << " R" << ins.c;
+            break;
+    }
+    os << "\n";
+}
+
+void disassembleProto(std::ostream& os, const FunctionProto& proto) {
+    os << "== " << proto.name << " (arity " << proto.arity
+       << ", registers " << proto.num_registers
+       << ", frame " << proto.num_registers * sizeof(Value) << " bytes) ==\n";
+
+    for (size_t offset = 0; offset < proto.code.size(); ++offset) {
+        disassembleInstruction(os, proto, offset);
+    }
+
+    for (const auto& nested : proto.functions) {
+        os << "\n";
+        disassembleProto(os, *nested);
+    }
+}
+
+} // namespace
+
+std::string disassemble(const FunctionProto& proto) {
+    std::ostringstream ss;
+    disassembleProto(ss, proto);
+    return ss.str();
+}
+
+} // namespace mana
@@ -1,4 +1,6 @@
 #include "codegen.hpp"
+#include "builtins.hpp"
+#include <llvm/IR/Intrinsics.h>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -7,6 +9,8 @@ namespace mana {
 
 CodeGenerator::CodeGenerator() {}
 
+CodeGenerator::CodeGenerator(CompilationContext& compilation) : reports(&compilation.reports()) {}
+
 void CodeGenerator::initialize(const std::string& module_name) {
     context = std::make_unique<llvm::LLVMContext>();
     module = std::make_unique<llvm::Module>(module_name, *context);
@@ -47,26 +51,23 @@ void CodeGenerator::generate(const std::vector<StmtPtr>& statements) {
     std::string error_info;
     llvm::raw_string_ostream error_stream(error_info);
     if (llvm::verifyModule(*module, &error_stream)) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "LLVM IR verification failed: " + error_stream.str(),
-            SourceLocation()
-        );
+        error(SourceLoc(), "LLVM IR verification failed: " + error_stream.str());
     }
 }
 
 void CodeGenerator::createPrintFunction() {
-    // Declare printf function
-    std::vector<llvm::Type*> printf_args;
-    printf_args.push_back(llvm::Type::getInt8PtrTy(*context));
-    llvm::FunctionType* printf_type = llvm::FunctionType::get(
-        getIntType(), printf_args, true
+    // The host runtime buffers output (see output.hpp); the message is text,
+    // never a format string
+    std::vector<llvm::Type*> runtime_args;
+    runtime_args.push_back(llvm::Type::getInt8PtrTy(*context));
+    llvm::FunctionType* runtime_type = llvm::FunctionType::get(
+        getVoidType(), runtime_args, false
     );
     llvm::Function::Create(
-        printf_type, llvm::Function::ExternalLinkage, "printf", module.get()
+        runtime_type, llvm::Function::ExternalLinkage, "mana_print_string", module.get()
     );
     
-    // Create print function that wraps printf
+    // Create print function that forwards to the runtime
     std::vector<llvm::Type*> print_args;
     print_args.push_back(llvm::Type::getInt8PtrTy(*context));
     llvm::FunctionType* print_type = llvm::FunctionType::get(
@@ -77,19 +78,17 @@ void CodeGenerator::createPrintFunction() {
     );
     
     // Set argument name
-    print_func->arg_begin()->setName("format");
+    print_func->arg_begin()->setName("message");
     
     // Create basic block
     llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", print_func);
     builder->SetInsertPoint(entry);
     
-    // Get printf function
-    llvm::Function* printf_func = module->getFunction("printf");
-    
-    // Call printf with the format string
+    // Call the runtime with the message
+    llvm::Function* runtime_func = module->getFunction("mana_print_string");
     std::vector<llvm::Value*> args;
     args.push_back(print_func->arg_begin());
-    builder->CreateCall(printf_func, args);
+    builder->CreateCall(runtime_func, args);
     
     // Return from print
     builder->CreateRetVoid();
@@ -151,6 +150,10 @@ llvm::Value* CodeGenerator::getCurrentValue() {
     return value_stack.back();
 }
 
+void CodeGenerator::error(SourceLoc loc, std::string message) {
+    reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, loc, std::move(message));
+}
+
 std::string CodeGenerator::dumpIR() const {
     std::string ir;
     llvm::raw_string_ostream os(ir);
@@ -204,11 +207,7 @@ void CodeGenerator::visitUnaryExpr(UnaryExpr& expr) {
     llvm::Value* operand = popValue();
     
     if (!operand) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Invalid operand for unary operator",
-            SourceLocation()
-        );
+        error(expr.getLoc(), "Invalid operand for unary operator");
         pushValue(nullptr);
         return;
     }
@@ -223,11 +222,7 @@ void CodeGenerator::visitUnaryExpr(UnaryExpr& expr) {
             pushValue(builder->CreateFNeg(operand, "fneg"));
         }
         else {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Invalid operand type for unary minus",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Invalid operand type for unary minus");
             pushValue(nullptr);
         }
     }
@@ -240,11 +235,7 @@ void CodeGenerator::visitUnaryExpr(UnaryExpr& expr) {
             pushValue(builder->CreateNot(bool_val, "not"));
         }
         else {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Invalid operand type for logical not",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Invalid operand type for logical not");
             pushValue(nullptr);
         }
     }
@@ -265,11 +256,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
         llvm::Value* left = popValue();
         
         if (!left || !left->getType()->isIntegerTy()) {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Left operand of logical operator must be a boolean",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Left operand of logical operator must be a boolean");
             pushValue(nullptr);
             return;
         }
@@ -296,11 +283,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
         llvm::Value* right = popValue();
         
         if (!right || !right->getType()->isIntegerTy()) {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Right operand of logical operator must be a boolean",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Right operand of logical operator must be a boolean");
             pushValue(nullptr);
             return;
         }
@@ -339,11 +322,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
     llvm::Value* right = popValue();
     
     if (!left || !right) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Invalid operands for binary operation",
-            SourceLocation()
-        );
+        error(expr.getLoc(), "Invalid operands for binary operation");
         pushValue(nullptr);
         return;
     }
@@ -368,11 +347,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateAdd(left, right, "add"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for addition",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for addition");
                 pushValue(nullptr);
             }
             break;
@@ -383,11 +358,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateSub(left, right, "sub"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for subtraction",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for subtraction");
                 pushValue(nullptr);
             }
             break;
@@ -398,11 +369,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateMul(left, right, "mul"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for multiplication",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for multiplication");
                 pushValue(nullptr);
             }
             break;
@@ -413,11 +380,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateSDiv(left, right, "div"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for division",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for division");
                 pushValue(nullptr);
             }
             break;
@@ -426,11 +389,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             if (is_integer_op) {
                 pushValue(builder->CreateSRem(left, right, "rem"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Modulo operator requires integer operands",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Modulo operator requires integer operands");
                 pushValue(nullptr);
             }
             break;
@@ -442,11 +401,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpEQ(left, right, "eq"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for equality comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for equality comparison");
                 pushValue(nullptr);
             }
             break;
@@ -457,11 +412,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpNE(left, right, "ne"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for inequality comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for inequality comparison");
                 pushValue(nullptr);
             }
             break;
@@ -472,11 +423,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpSLT(left, right, "lt"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for less-than comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for less-than comparison");
                 pushValue(nullptr);
             }
             break;
@@ -487,11 +434,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpSLE(left, right, "le"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for less-than-or-equal comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for less-than-or-equal comparison");
                 pushValue(nullptr);
             }
             break;
@@ -502,11 +445,7 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpSGT(left, right, "gt"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for greater-than comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for greater-than comparison");
                 pushValue(nullptr);
             }
             break;
@@ -517,21 +456,13 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr& expr) {
             } else if (is_integer_op) {
                 pushValue(builder->CreateICmpSGE(left, right, "ge"));
             } else {
-                diagnostics.report(
-                    DiagnosticSeverity::ERROR,
-                    "Invalid operands for greater-than-or-equal comparison",
-                    SourceLocation()
-                );
+                error(expr.getLoc(), "Invalid operands for greater-than-or-equal comparison");
                 pushValue(nullptr);
             }
             break;
             
         default:
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Unknown binary operator",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Unknown binary operator");
             pushValue(nullptr);
             break;
     }
@@ -547,11 +478,7 @@ void CodeGenerator::visitVariableExpr(VariableExpr& expr) {
     auto it = named_values.find(name);
     
     if (it == named_values.end()) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Unknown variable name: " + name,
-            SourceLocation()
-        );
+        error(expr.getLoc(), "Unknown variable name: " + name);
         pushValue(nullptr);
         return;
     }
@@ -570,11 +497,7 @@ void CodeGenerator::visitAssignExpr(AssignExpr& expr) {
     auto it = named_values.find(name);
     
     if (it == named_values.end()) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Unknown variable name: " + name,
-            SourceLocation()
-        );
+        error(expr.getLoc(), "Unknown variable name: " + name);
         pushValue(nullptr);
         return;
     }
@@ -583,20 +506,53 @@ void CodeGenerator::visitAssignExpr(AssignExpr& expr) {
     pushValue(value);
 }
 
+void CodeGenerator::visitSpawnExpr(SpawnExpr& expr) {
+    // Tasks need the VM's scheduler, which compiled code does not link against
+    error(expr.getLoc(), "spawn is not supported in compiled code");
+    pushValue(nullptr);
+}
+
+void CodeGenerator::visitAwaitExpr(AwaitExpr& expr) {
+    // Async functions compile to plain functions that run to completion, so
+    // the awaited value is already the result
+    expr.getValue()->accept(*this);
+}
+
 void CodeGenerator::visitCallExpr(CallExpr& expr) {
     llvm::Function* callee = nullptr;
     
     // Handle direct function calls
     if (auto* var_expr = dynamic_cast<VariableExpr*>(expr.getCallee().get())) {
         std::string func_name = var_expr->getName().lexeme;
+
+        int id = findBuiltin(func_name);
+        if (id >= 0 && builtins()[id].pure) {
+            std::vector<llvm::Value*> args;
+            for (const auto& arg : expr.getArguments()) {
+                arg->accept(*this);
+                args.push_back(popValue());
+            }
+            current_loc = expr.getLoc();
+            pushValue(emitInlineBuiltin(func_name, args));
+            return;
+        }
+
+        auto ext = extern_functions.find(func_name);
+        if (ext != extern_functions.end()) {
+            std::vector<llvm::Value*> args;
+            for (const auto& arg : expr.getArguments()) {
+                arg->accept(*this);
+                args.push_back(popValue());
+            }
+            current_loc = expr.getLoc();
+            pushValue(emitExternCall(*ext->second, args));
+            return;
+        }
+
         callee = module->getFunction(func_name);
         
         if (!callee) {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Unknown function name: " + func_name,
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Unknown function name: " + func_name);
             pushValue(nullptr);
             return;
         }
@@ -607,11 +563,7 @@ void CodeGenerator::visitCallExpr(CallExpr& expr) {
         llvm::Value* callee_val = popValue();
         
         if (!callee_val || !callee_val->getType()->isPointerTy()) {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Expression is not callable",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Expression is not callable");
             pushValue(nullptr);
             return;
         }
@@ -626,11 +578,7 @@ void CodeGenerator::visitCallExpr(CallExpr& expr) {
                 "callee"
             );
         } else {
-            diagnostics.report(
-                DiagnosticSeverity::ERROR,
-                "Expression is not callable",
-                SourceLocation()
-            );
+            error(expr.getLoc(), "Expression is not callable");
             pushValue(nullptr);
             return;
         }
@@ -648,6 +596,130 @@ void CodeGenerator::visitCallExpr(CallExpr& expr) {
     pushValue(call);
 }
 
+llvm::Value* CodeGenerator::emitInlineBuiltin(const std::string& name, std::vector<llvm::Value*>& args) {
+    const Builtin& builtin = builtins()[findBuiltin(name)];
+    if (args.size() != static_cast<size_t>(builtin.arity)) {
+        error(current_loc, "Expected " + std::to_string(builtin.arity) + " arguments but got " + std::to_string(args.size()) + " in call to " + name + "()");
+        return nullptr;
+    }
+    for (llvm::Value* arg : args) {
+        if (!arg) {
+            return nullptr;
+        }
+    }
+
+    if (name == "len") {
+        llvm::FunctionCallee strlen_func = module->getOrInsertFunction(
+            "strlen", llvm::FunctionType::get(builder->getInt64Ty(), {getStringType()}, false));
+        llvm::Value* length = builder->CreateCall(strlen_func, {args[0]}, "len");
+        return builder->CreateTrunc(length, getIntType(), "len");
+    }
+
+    // Mixed operands are compared and returned as doubles, like in the VM
+    bool is_float = false;
+    for (llvm::Value* arg : args) {
+        is_float = is_float || arg->getType()->isDoubleTy();
+    }
+    if (is_float || name == "sqrt") {
+        for (llvm::Value*& arg : args) {
+            if (arg->getType()->isIntegerTy()) {
+                arg = builder->CreateSIToFP(arg, getFloatType(), "int2float");
+            }
+        }
+        is_float = true;
+    }
+
+    if (name == "sqrt") {
+        llvm::Function* sqrt_func = llvm::Intrinsic::getDeclaration(
+            module.get(), llvm::Intrinsic::sqrt, {getFloatType()});
+        return builder->CreateCall(sqrt_func, {args[0]}, "sqrt");
+    }
+    if (name == "abs") {
+        if (is_float) {
+            llvm::Function* fabs_func = llvm::Intrinsic::getDeclaration(
+                module.get(), llvm::Intrinsic::fabs, {getFloatType()});
+            return builder->CreateCall(fabs_func, {args[0]}, "abs");
+        }
+        llvm::Value* negative = builder->CreateICmpSLT(args[0], llvm::ConstantInt::get(getIntType(), 0), "isneg");
+        return builder->CreateSelect(negative, builder->CreateNeg(args[0], "neg"), args[0], "abs");
+    }
+
+    // min and max keep the first operand on ties
+    llvm::Value* less = nullptr;
+    if (name == "min") {
+        less = is_float ? builder->CreateFCmpOLT(args[1], args[0], "lt") : builder->CreateICmpSLT(args[1], args[0], "lt");
+    } else {
+        less = is_float ? builder->CreateFCmpOLT(args[0], args[1], "lt") : builder->CreateICmpSLT(args[0], args[1], "lt");
+    }
+    return builder->CreateSelect(less, args[1], args[0], name);
+}
+
+llvm::Value* CodeGenerator::emitExternCall(const ExtFunction& function, std::vector<llvm::Value*>& args) {
+    if (args.size() != static_cast<size_t>(function.arity)) {
+        error(current_loc, "Expected " + std::to_string(function.arity) + " arguments but got " + std::to_string(args.size()) + " in call to " + function.name + "()");
+        return nullptr;
+    }
+    if (function.result == ExtType::STRING) {
+        // Strings here are NUL-terminated, and an extension's result need not be
+        error(current_loc, std::string("Extension function ") + function.name + "() returns a string, which compiled code cannot use yet");
+        return nullptr;
+    }
+
+    llvm::Type* int64 = builder->getInt64Ty();
+    std::vector<llvm::Type*> param_types;
+    std::vector<llvm::Value*> call_args;
+    for (size_t i = 0; i < args.size(); ++i) {
+        llvm::Value* arg = args[i];
+        if (!arg) {
+            return nullptr;
+        }
+        switch (function.params[i]) {
+            case ExtType::INT:
+                param_types.push_back(int64);
+                call_args.push_back(builder->CreateSExt(arg, int64, "arg"));
+                break;
+            case ExtType::DOUBLE:
+                param_types.push_back(getFloatType());
+                call_args.push_back(arg->getType()->isIntegerTy()
+                                        ? builder->CreateSIToFP(arg, getFloatType(), "int2float")
+                                        : arg);
+                break;
+            case ExtType::BOOL:
+                param_types.push_back(getBoolType());
+                call_args.push_back(arg);
+                break;
+            case ExtType::STRING: {
+                llvm::FunctionCallee strlen_func = module->getOrInsertFunction(
+                    "strlen", llvm::FunctionType::get(int64, {getStringType()}, false));
+                param_types.push_back(getStringType());
+                param_types.push_back(int64);
+                call_args.push_back(arg);
+                call_args.push_back(builder->CreateCall(strlen_func, {arg}, "len"));
+                break;
+            }
+            default:
+                return nullptr;
+        }
+    }
+
+    llvm::Type* result_type = getVoidType();
+    switch (function.result) {
+        case ExtType::INT:    result_type = int64; break;
+        case ExtType::DOUBLE: result_type = getFloatType(); break;
+        case ExtType::BOOL:   result_type = getBoolType(); break;
+        default: break;
+    }
+
+    // The module was loaded with RTLD_GLOBAL, so the JIT resolves the symbol
+    llvm::FunctionCallee callee = module->getOrInsertFunction(
+        function.symbol, llvm::FunctionType::get(result_type, param_types, false));
+    llvm::Value* result = builder->CreateCall(callee, call_args);
+    if (function.result == ExtType::INT) {
+        return builder->CreateTrunc(result, getIntType(), "ext");
+    }
+    return function.result == ExtType::VOID ? nullptr : result;
+}
+
 // Statement visitors
 void CodeGenerator::visitExpressionStmt(ExpressionStmt& stmt) {
     stmt.getExpression()->accept(*this);
@@ -795,6 +867,54 @@ void CodeGenerator::visitWhileStmt(WhileStmt& stmt) {
     builder->SetInsertPoint(exit_bb);
 }
 
+void CodeGenerator::visitParallelForStmt(ParallelForStmt& stmt) {
+    // Iterations are independent, so running them in order is one valid
+    // schedule; compiled code does not link against the scheduler
+    std::string name = stmt.getVariable().lexeme;
+    stmt.getStart()->accept(*this);
+    llvm::Value* start_val = popValue();
+    stmt.getEnd()->accept(*this);
+    llvm::Value* end_val = popValue();
+    if (!start_val || !end_val) {
+        return;
+    }
+
+    symbol_table.enterScope();
+    llvm::AllocaInst* index = createEntryBlockAlloca(current_function, name, start_val->getType());
+    builder->CreateStore(start_val, index);
+    llvm::AllocaInst* shadowed = named_values.count(name) ? named_values[name] : nullptr;
+    named_values[name] = index;
+    symbol_table.define(name, Symbol::Kind::VARIABLE);
+
+    llvm::Function* function = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock* cond_bb = llvm::BasicBlock::Create(*context, "pfor.cond", function);
+    llvm::BasicBlock* body_bb = llvm::BasicBlock::Create(*context, "pfor.body");
+    llvm::BasicBlock* exit_bb = llvm::BasicBlock::Create(*context, "pfor.exit");
+
+    builder->CreateBr(cond_bb);
+    builder->SetInsertPoint(cond_bb);
+    llvm::Value* current_val = builder->CreateLoad(index->getAllocatedType(), index, name);
+    builder->CreateCondBr(builder->CreateICmpSLT(current_val, end_val, "pfor.test"), body_bb, exit_bb);
+
+    function->getBasicBlockList().push_back(body_bb);
+    builder->SetInsertPoint(body_bb);
+    stmt.getBody()->accept(*this);
+    current_val = builder->CreateLoad(index->getAllocatedType(), index, name);
+    builder->CreateStore(builder->CreateAdd(current_val, llvm::ConstantInt::get(current_val->getType(), 1), "pfor.next"),
+                         index);
+    builder->CreateBr(cond_bb);
+
+    function->getBasicBlockList().push_back(exit_bb);
+    builder->SetInsertPoint(exit_bb);
+
+    if (shadowed) {
+        named_values[name] = shadowed;
+    } else {
+        named_values.erase(name);
+    }
+    symbol_table.exitScope();
+}
+
 void CodeGenerator::visitFunctionStmt(FunctionStmt& stmt) {
     std::string name = stmt.getName().lexeme;
     
@@ -867,21 +987,13 @@ void CodeGenerator::visitFunctionStmt(FunctionStmt& stmt) {
         function->eraseFromParent();
         functions.erase(name);
         
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Function verification failed: " + name,
-            SourceLocation()
-        );
+        error(stmt.getLoc(), "Function verification failed: " + name);
     }
 }
 
 void CodeGenerator::visitReturnStmt(ReturnStmt& stmt) {
     if (!current_function) {
-        diagnostics.report(
-            DiagnosticSeverity::ERROR,
-            "Return statement outside of function",
-            SourceLocation()
-        );
+        error(stmt.getLoc(), "Return statement outside of function");
         return;
     }
     
@@ -902,4 +1014,18 @@ void CodeGenerator::visitReturnStmt(ReturnStmt& stmt) {
     }
 }
 
+void CodeGenerator::visitImportStmt(ImportStmt& stmt) {
+    std::string error;
+    const ExtModule* ext = loadExtension(stmt.getPath(), error);
+    if (!ext) {
+        this->error(stmt.getLoc(), "Cannot import " + error);
+        return;
+    }
+    for (uint32_t i = 0; i < ext->count; ++i) {
+        if (ext->functions[i].symbol) {
+            extern_functions[ext->functions[i].name] = &ext->functions[i];
+        }
+    }
+}
+
 } // namespace mana
\ No newline at end of file
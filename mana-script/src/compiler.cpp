@@ -0,0 +1,823 @@
+#include "compiler.hpp"
+#include "builtins.hpp"
+#include "optimizer.hpp"
+#include "regalloc.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+
+namespace mana {
+
+namespace {
+
+constexpr int kMaxRegisters = UINT16_MAX;
+constexpr int kMaxConstants = UINT16_MAX;
+constexpr int kMaxCaches = UINT16_MAX;
+
+} // namespace
+
+BytecodeCompiler::BytecodeCompiler(const std::string& filename, bool optimize)
+    : filename(filename), optimize(optimize) {}
+
+BytecodeCompiler::BytecodeCompiler(CompilationContext& context, bool optimize)
+    : filename(context.filename()), optimize(optimize), reports(&context.reports()),
+      sources(context.sources()) {}
+
+std::shared_ptr<FunctionProto> BytecodeCompiler::compile(const std::vector<StmtPtr>& statements) {
+    FunctionState script;
+    script.proto = std::make_shared<FunctionProto>();
+    script.proto->name = "<script>";
+    script.proto->filename = filename;
+    script.proto->sources = sources;
+    current = &script;
+
+    for (const auto& stmt : statements) {
+        if (stmt) {
+            stmt->accept(*this);
+        }
+    }
+
+    emit(OpCode::RETURNNIL);
+    if (optimize) {
+        optimizeBytecode(*script.proto);
+        assignRegisters(*script.proto);
+    }
+    current = nullptr;
+    return script.proto;
+}
+
+// Emission helpers
+size_t BytecodeCompiler::emit(OpCode op, uint16_t a, uint16_t b, uint16_t c) {
+    current->proto->code.emplace_back(op, a, b, c);
+    current->proto->locations.push_back(current_loc);
+    return current->proto->code.size() - 1;
+}
+
+size_t BytecodeCompiler::emitJump(OpCode op, uint16_t a) {
+    return emit(op, a, 0, 0);
+}
+
+void BytecodeCompiler::patchJump(size_t offset) {
+    long jump = static_cast<long>(current->proto->code.size()) - static_cast<long>(offset) - 1;
+    if (jump > INT16_MAX) {
+        error("Too much code to jump over");
+    }
+    current->proto->code[offset].c = static_cast<uint16_t>(static_cast<int16_t>(jump));
+}
+
+void BytecodeCompiler::emitLoop(size_t loop_start) {
+    long jump = static_cast<long>(loop_start) - static_cast<long>(current->proto->code.size()) - 1;
+    if (jump < INT16_MIN) {
+        error("Loop body too large");
+    }
+    emit(OpCode::JMP, 0, 0, static_cast<uint16_t>(static_cast<int16_t>(jump)));
+}
+
+uint16_t BytecodeCompiler::addConstant(const Constant& constant) {
+    auto& constants = current->proto->constants;
+    auto it = std::find(constants.begin(), constants.end(), constant);
+    if (it != constants.end()) {
+        return static_cast<uint16_t>(it - constants.begin());
+    }
+
+    if (constants.size() >= kMaxConstants) {
+        error("Too many constants in one function");
+        return 0;
+    }
+    constants.push_back(constant);
+    return static_cast<uint16_t>(constants.size() - 1);
+}
+
+// A constant naming a global, recorded so a spawn copies only the globals
+// its code can reach
+uint16_t BytecodeCompiler::addGlobal(const std::string& name) {
+    if (current->globals.insert(name).second) {
+        current->proto->globals.push_back(name);
+    }
+    return addConstant(name);
+}
+
+uint16_t BytecodeCompiler::addCache() {
+    int& count = current->proto->num_caches;
+    if (count >= kMaxCaches) {
+        error("Too many global references and calls in one function");
+        return 0;
+    }
+    return static_cast<uint16_t>(count++);
+}
+
+void BytecodeCompiler::emitConstant(uint16_t reg, const Constant& constant) {
+    if (std::holds_alternative<bool>(constant)) {
+        emit(std::get<bool>(constant) ? OpCode::LOADTRUE : OpCode::LOADFALSE, reg);
+    }
+    else if (std::holds_alternative<std::nullptr_t>(constant)) {
+        emit(OpCode::LOADNIL, reg);
+    }
+    else {
+        emit(OpCode::LOADK, reg, addConstant(constant));
+    }
+}
+
+// Register and scope management
+uint16_t BytecodeCompiler::allocateRegister() {
+    return allocateRegisters(1);
+}
+
+uint16_t BytecodeCompiler::allocateRegisters(int count) {
+    int first = current->next_register;
+    if (first + count > kMaxRegisters) {
+        error("Too many registers in one function");
+        return 0;
+    }
+
+    current->next_register += count;
+    current->proto->num_registers = std::max(current->proto->num_registers,
+                                             current->next_register);
+    return static_cast<uint16_t>(first);
+}
+
+uint16_t BytecodeCompiler::compileExpression(const ExprPtr& expr) {
+    expr->accept(*this);
+    return result_register;
+}
+
+const BytecodeCompiler::Local* BytecodeCompiler::resolveLocal(const std::string& name) const {
+    for (auto it = current->locals.rbegin(); it != current->locals.rend(); ++it) {
+        if (it->name == name) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+void BytecodeCompiler::declareLocal(const Token& name, uint16_t reg, bool is_const) {
+    for (auto it = current->locals.rbegin(); it != current->locals.rend(); ++it) {
+        if (it->depth < current->scope_depth) {
+            break;
+        }
+        if (it->name == name.lexeme) {
+            error(name, "Variable '" + name.lexeme + "' is already declared in this scope");
+            return;
+        }
+    }
+    current->locals.push_back({name.lexeme, current->scope_depth, reg, is_const});
+}
+
+bool BytecodeCompiler::isGlobalScope() const {
+    return current->enclosing == nullptr && current->scope_depth == 0;
+}
+
+void BytecodeCompiler::beginScope() {
+    current->scope_depth++;
+}
+
+void BytecodeCompiler::endScope() {
+    current->scope_depth--;
+    auto& locals = current->locals;
+    while (!locals.empty() && locals.back().depth > current->scope_depth) {
+        locals.pop_back();
+    }
+}
+
+int BytecodeCompiler::resolveBuiltin(const Expression& callee) const {
+    auto* variable = dynamic_cast<const VariableExpr*>(&callee);
+    if (!variable || resolveLocal(variable->getName().lexeme)) {
+        return -1;
+    }
+    return findBuiltin(variable->getName().lexeme);
+}
+
+std::optional<Constant> BytecodeCompiler::constantValue(const Expression& expr) const {
+    if (auto* literal = dynamic_cast<const LiteralExpr*>(&expr)) {
+        return literal->getValue();
+    }
+    if (auto* grouping = dynamic_cast<const GroupingExpr*>(&expr)) {
+        return constantValue(*grouping->getExpression());
+    }
+
+    if (auto* unary = dynamic_cast<const UnaryExpr*>(&expr)) {
+        std::optional<Constant> operand = constantValue(*unary->getRight());
+        if (!operand || unary->getOperator().type != TokenType::MINUS) {
+            return std::nullopt;
+        }
+        if (std::holds_alternative<int>(*operand)) {
+            int x = std::get<int>(*operand);
+            return x == INT_MIN ? Constant(-static_cast<double>(x)) : Constant(-x);
+        }
+        if (std::holds_alternative<double>(*operand)) {
+            return Constant(-std::get<double>(*operand));
+        }
+        return std::nullopt;
+    }
+
+    if (auto* call = dynamic_cast<const CallExpr*>(&expr)) {
+        int id = resolveBuiltin(*call->getCallee());
+        if (id < 0 || !builtins()[id].fold ||
+            call->getArguments().size() != static_cast<size_t>(builtins()[id].arity)) {
+            return std::nullopt;
+        }
+        std::vector<Constant> args;
+        for (const ExprPtr& arg : call->getArguments()) {
+            std::optional<Constant> value = constantValue(*arg);
+            if (!value) {
+                return std::nullopt;
+            }
+            args.push_back(std::move(*value));
+        }
+        return builtins()[id].fold(args);
+    }
+    return std::nullopt;
+}
+
+void BytecodeCompiler::checkNotBuiltin(const Token& name) {
+    if (findBuiltin(name.lexeme) >= 0) {
+        error(name, "Cannot redefine builtin '" + name.lexeme + "'");
+    }
+}
+
+// Error handling
+void BytecodeCompiler::error(const Token& token, const std::string& message) {
+    if (token.loc.isValid()) {
+        reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, token.loc, message);
+        return;
+    }
+    reports->report(DiagnosticSeverity::ERROR, message,
+                    SourceLocation(filename, token.line, token.column));
+}
+
+void BytecodeCompiler::error(const std::string& message) {
+    reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, current_loc, message);
+}
+
+bool BytecodeCompiler::assignsRegister(const Expression& expr, uint16_t reg) const {
+    if (auto* assign = dynamic_cast<const AssignExpr*>(&expr)) {
+        const Local* local = resolveLocal(assign->getName().lexeme);
+        return (local && local->reg == reg) || assignsRegister(*assign->getValue(), reg);
+    }
+    if (auto* grouping = dynamic_cast<const GroupingExpr*>(&expr)) {
+        return assignsRegister(*grouping->getExpression(), reg);
+    }
+    if (auto* unary = dynamic_cast<const UnaryExpr*>(&expr)) {
+        return assignsRegister(*unary->getRight(), reg);
+    }
+    if (auto* binary = dynamic_cast<const BinaryExpr*>(&expr)) {
+        return assignsRegister(*binary->getLeft(), reg) || assignsRegister(*binary->getRight(), reg);
+    }
+    if (auto* call = dynamic_cast<const CallExpr*>(&expr)) {
+        for (const ExprPtr& arg : call->getArguments()) {
+            if (assignsRegister(*arg, reg)) {
+                return true;
+            }
+        }
+        return assignsRegister(*call->getCallee(), reg);
+    }
+    if (auto* spawn = dynamic_cast<const SpawnExpr*>(&expr)) {
+        return assignsRegister(*spawn->getCall(), reg);
+    }
+    if (auto* await = dynamic_cast<const AwaitExpr*>(&expr)) {
+        return assignsRegister(*await->getValue(), reg);
+    }
+    return false;
+}
+
+uint16_t BytecodeCompiler::keepOperand(uint16_t operand, const Expression& later) {
+    // A local is its own operand register, so an assignment to it in a later
+    // operand would change the value already read; operands are evaluated
+    // left to right, as they are for globals
+    if (!assignsRegister(later, operand)) {
+        return operand;
+    }
+    uint16_t copy = allocateRegister();
+    emit(OpCode::MOVE, copy, operand);
+    return copy;
+}
+
+// Expression visitors
+void BytecodeCompiler::visitLiteralExpr(LiteralExpr& expr) {
+    uint16_t reg = allocateRegister();
+    emitConstant(reg, expr.getValue());
+    result_register = reg;
+}
+
+void BytecodeCompiler::visitUnaryExpr(UnaryExpr& expr) {
+    uint16_t operand = compileExpression(expr.getRight());
+    current_loc = expr.getOperator().loc;
+
+    uint16_t reg = allocateRegister();
+    switch (expr.getOperator().type) {
+        case TokenType::MINUS: emit(OpCode::NEG, reg, operand); break;
+        case TokenType::BANG:  emit(OpCode::NOT, reg, operand); break;
+        default:
+            error(expr.getOperator(), "Unknown unary operator");
+            break;
+    }
+
+    result_register = reg;
+}
+
+void BytecodeCompiler::visitBinaryExpr(BinaryExpr& expr) {
+    TokenType op = expr.getOperator().type;
+
+    // Logical operators short-circuit and yield the deciding operand
+    if (op == TokenType::AND || op == TokenType::OR) {
+        uint16_t reg = allocateRegister();
+        uint16_t left = compileExpression(expr.getLeft());
+        current_loc = expr.getOperator().loc;
+        emit(OpCode::MOVE, reg, left);
+
+        size_t skip = emitJump(op == TokenType::AND ? OpCode::JMPIFNOT : OpCode::JMPIF, reg);
+        uint16_t right = compileExpression(expr.getRight());
+        emit(OpCode::MOVE, reg, right);
+        patchJump(skip);
+
+        result_register = reg;
+        return;
+    }
+
+    uint16_t left = keepOperand(compileExpression(expr.getLeft()), *expr.getRight());
+    uint16_t right = compileExpression(expr.getRight());
+    current_loc = expr.getOperator().loc;
+
+    uint16_t reg = allocateRegister();
+    switch (op) {
+        case TokenType::PLUS:          emit(OpCode::ADD, reg, left, right); break;
+        case TokenType::MINUS:         emit(OpCode::SUB, reg, left, right); break;
+        case TokenType::STAR:          emit(OpCode::MUL, reg, left, right); break;
+        case TokenType::SLASH:         emit(OpCode::DIV, reg, left, right); break;
+        case TokenType::PERCENT:       emit(OpCode::MOD, reg, left, right); break;
+        case TokenType::EQUAL_EQUAL:   emit(OpCode::EQ, reg, left, right); break;
+        case TokenType::BANG_EQUAL:    emit(OpCode::NE, reg, left, right); break;
+        case TokenType::LESS:          emit(OpCode::LT, reg, left, right); break;
+        case TokenType::LESS_EQUAL:    emit(OpCode::LE, reg, left, right); break;
+        case TokenType::GREATER:       emit(OpCode::GT, reg, left, right); break;
+        case TokenType::GREATER_EQUAL: emit(OpCode::GE, reg, left, right); break;
+        default:
+            error(expr.getOperator(), "Unknown binary operator");
+            break;
+    }
+
+    result_register = reg;
+}
+
+void BytecodeCompiler::visitGroupingExpr(GroupingExpr& expr) {
+    expr.getExpression()->accept(*this);
+    // Result register is already set
+}
+
+void BytecodeCompiler::visitVariableExpr(VariableExpr& expr) {
+    const Token& name = expr.getName();
+    current_loc = name.loc;
+
+    if (const Local* local = resolveLocal(name.lexeme)) {
+        result_register = local->reg;
+        return;
+    }
+
+    uint16_t reg = allocateRegister();
+    emit(OpCode::GETGLOBAL, reg, addGlobal(name.lexeme), addCache());
+    result_register = reg;
+}
+
+void BytecodeCompiler::visitAssignExpr(AssignExpr& expr) {
+    uint16_t value = compileExpression(expr.getValue());
+    const Token& name = expr.getName();
+    current_loc = name.loc;
+
+    if (const Local* local = resolveLocal(name.lexeme)) {
+        if (local->is_const) {
+            error(name, "Cannot assign to constant '" + name.lexeme + "'");
+        } else if (local->captured) {
+            error(name, "Cannot assign to '" + name.lexeme + "' inside parallel for; each iteration has a copy");
+        }
+        emit(OpCode::MOVE, local->reg, value);
+        result_register = local->reg;
+        return;
+    }
+
+    if (const_globals.count(name.lexeme)) {
+        error(name, "Cannot assign to constant '" + name.lexeme + "'");
+    }
+    if (current->parallel_body) {
+        error(name, "Cannot assign to global '" + name.lexeme + "' inside parallel for");
+    }
+    checkNotBuiltin(name);
+    emit(OpCode::SETGLOBAL, value, addGlobal(name.lexeme), addCache());
+    result_register = value;
+}
+
+void BytecodeCompiler::visitCallExpr(CallExpr& expr) {
+    const auto& args = expr.getArguments();
+    int id = resolveBuiltin(*expr.getCallee());
+    if (id >= 0 && compileBuiltinCall(expr, id)) {
+        return;
+    }
+
+    // The callee and its arguments must sit in consecutive registers
+    uint16_t base = allocateRegisters(static_cast<int>(args.size()) + 1);
+
+    uint16_t callee = compileExpression(expr.getCallee());
+    emit(OpCode::MOVE, base, callee);
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        uint16_t arg = compileExpression(args[i]);
+        emit(OpCode::MOVE, static_cast<uint16_t>(base + 1 + i), arg);
+    }
+
+    current_loc = expr.getParen().loc;
+    emit(OpCode::CALL, base, static_cast<uint16_t>(args.size()), addCache());
+    result_register = base;
+}
+
+void BytecodeCompiler::visitSpawnExpr(SpawnExpr& expr) {
+    static const int spawn = findBuiltin("spawn");
+    CallExpr& call = *expr.getCall();
+    const auto& args = call.getArguments();
+
+    // A CALLB window for spawn(callee, args...)
+    uint16_t base = allocateRegisters(static_cast<int>(args.size()) + 2);
+
+    uint16_t callee = compileExpression(call.getCallee());
+    emit(OpCode::MOVE, static_cast<uint16_t>(base + 1), callee);
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        uint16_t arg = compileExpression(args[i]);
+        emit(OpCode::MOVE, static_cast<uint16_t>(base + 2 + i), arg);
+    }
+
+    current_loc = expr.getKeyword().loc;
+    emit(OpCode::CALLB, base, static_cast<uint16_t>(args.size() + 1), static_cast<uint16_t>(spawn));
+    result_register = base;
+}
+
+void BytecodeCompiler::visitAwaitExpr(AwaitExpr& expr) {
+    uint16_t value = compileExpression(expr.getValue());
+    uint16_t reg = allocateRegister();
+
+    current_loc = expr.getKeyword().loc;
+    emit(OpCode::AWAIT, reg, value);
+    result_register = reg;
+}
+
+bool BytecodeCompiler::compileBuiltinCall(CallExpr& expr, int id) {
+    const Builtin& builtin = builtins()[id];
+    const auto& args = expr.getArguments();
+    current_loc = expr.getParen().loc;
+
+    if (builtin.arity >= 0 && args.size() != static_cast<size_t>(builtin.arity)) {
+        error(expr.getParen(), "Expected " + std::to_string(builtin.arity) + " arguments but got " +
+                               std::to_string(args.size()) + " in call to " + builtin.name + "()");
+        return false;
+    }
+
+    // Constant arguments of the wrong type would only fail at runtime
+    std::vector<Constant> constants;
+    for (const ExprPtr& arg : args) {
+        std::optional<Constant> value = constantValue(*arg);
+        if (!value) {
+            continue;
+        }
+        bool number = std::holds_alternative<int>(*value) || std::holds_alternative<double>(*value);
+        bool string = std::holds_alternative<std::string>(*value);
+        if ((builtin.params == BuiltinType::NUMBER && !number) ||
+            (builtin.params == BuiltinType::STRING && !string)) {
+            error(expr.getParen(), std::string(builtin.name) + "() expects a " +
+                                   builtinTypeName(builtin.params) + " argument");
+            return false;
+        }
+        constants.push_back(std::move(*value));
+    }
+
+    if (builtin.prepare && !args.empty()) {
+        if (std::optional<Constant> first = constantValue(*args[0])) {
+            if (std::optional<std::string> problem = builtin.prepare(*first)) {
+                error(expr.getParen(), *problem);
+                return false;
+            }
+        }
+    }
+
+    if (builtin.fold && constants.size() == args.size()) {
+        if (std::optional<Constant> folded = builtin.fold(constants)) {
+            uint16_t reg = allocateRegister();
+            emitConstant(reg, *folded);
+            result_register = reg;
+            return true;
+        }
+    }
+    if (!builtin.inlined) {
+        return false;
+    }
+
+    // A constant int or string key is already what the map stores, so the
+    // lookup needs no call and no key conversion
+    static const int map_get = findBuiltin("map_get");
+    static const int map_set = findBuiltin("map_set");
+    if (id == map_get || id == map_set) {
+        std::optional<Constant> key = constantValue(*args[1]);
+        if (key && (std::holds_alternative<int>(*key) || std::holds_alternative<std::string>(*key))) {
+            uint16_t map = compileExpression(args[0]);
+            if (id == map_set) {
+                map = keepOperand(map, *args[2]);
+            }
+            uint16_t constant = addConstant(*key);
+            uint16_t reg;
+            if (id == map_get) {
+                reg = allocateRegister();
+                current_loc = expr.getParen().loc;
+                emit(OpCode::GETMAPK, reg, map, constant);
+            } else {
+                uint16_t value = compileExpression(args[2]);
+                current_loc = expr.getParen().loc;
+                emit(OpCode::SETMAPK, map, constant, value);
+                reg = allocateRegister();
+                emit(OpCode::LOADNIL, reg);
+            }
+            result_register = reg;
+            return true;
+        }
+    }
+
+    // Same window as CALL, minus the callee
+    uint16_t base = allocateRegisters(static_cast<int>(args.size()) + 1);
+    for (size_t i = 0; i < args.size(); ++i) {
+        uint16_t arg = compileExpression(args[i]);
+        emit(OpCode::MOVE, static_cast<uint16_t>(base + 1 + i), arg);
+    }
+
+    current_loc = expr.getParen().loc;
+    emit(OpCode::CALLB, base, static_cast<uint16_t>(args.size()), static_cast<uint16_t>(id));
+    result_register = base;
+    return true;
+}
+
+// Statement visitors
+void BytecodeCompiler::visitExpressionStmt(ExpressionStmt& stmt) {
+    compileExpression(stmt.getExpression());
+}
+
+void BytecodeCompiler::visitVarDeclStmt(VarDeclStmt& stmt) {
+    const Token& name = stmt.getName();
+    current_loc = name.loc;
+
+    uint16_t value;
+    if (stmt.getInitializer()) {
+        value = compileExpression(stmt.getInitializer());
+    } else {
+        value = allocateRegister();
+        emit(OpCode::LOADNIL, value);
+    }
+    current_loc = name.loc;
+
+    if (isGlobalScope()) {
+        checkNotBuiltin(name);
+        if (stmt.isConst()) {
+            const_globals.insert(name.lexeme);
+        } else {
+            const_globals.erase(name.lexeme);
+        }
+        emit(OpCode::DEFGLOBAL, value, addGlobal(name.lexeme));
+        return;
+    }
+
+    // Locals own their register; the initializer's may be shared with another local
+    uint16_t reg = allocateRegister();
+    emit(OpCode::MOVE, reg, value);
+    declareLocal(name, reg, stmt.isConst());
+}
+
+void BytecodeCompiler::visitBlockStmt(BlockStmt& stmt) {
+    beginScope();
+
+    for (const auto& s : stmt.getStatements()) {
+        if (s) {
+            s->accept(*this);
+        }
+    }
+
+    endScope();
+}
+
+void BytecodeCompiler::visitIfStmt(IfStmt& stmt) {
+    uint16_t cond = compileExpression(stmt.getCondition());
+    size_t then_jump = emitJump(OpCode::JMPIFNOT, cond);
+
+    stmt.getThenBranch()->accept(*this);
+
+    if (stmt.getElseBranch()) {
+        size_t else_jump = emitJump(OpCode::JMP);
+        patchJump(then_jump);
+        stmt.getElseBranch()->accept(*this);
+        patchJump(else_jump);
+    } else {
+        patchJump(then_jump);
+    }
+}
+
+void BytecodeCompiler::visitWhileStmt(WhileStmt& stmt) {
+    size_t loop_start = current->proto->code.size();
+
+    uint16_t cond = compileExpression(stmt.getCondition());
+    size_t exit_jump = emitJump(OpCode::JMPIFNOT, cond);
+
+    stmt.getBody()->accept(*this);
+    emitLoop(loop_start);
+
+    patchJump(exit_jump);
+}
+
+void BytecodeCompiler::visitParallelForStmt(ParallelForStmt& stmt) {
+    static const int parallel_for = findBuiltin("parallel_for");
+
+    // The body sees a copy of every enclosing local; the innermost one of each name
+    std::vector<Local> captures;
+    for (auto it = current->locals.rbegin(); it != current->locals.rend(); ++it) {
+        bool shadowed = it->name == stmt.getVariable().lexeme ||
+                        std::any_of(captures.begin(), captures.end(),
+                                    [&](const Local& capture) { return capture.name == it->name; });
+        if (!shadowed) {
+            captures.push_back(*it);
+        }
+    }
+    std::shared_ptr<FunctionProto> chunk = compileParallelBody(stmt, captures);
+
+    // parallel_for(chunk, start, end, captures...) in a CALLB window
+    int argc = 3 + static_cast<int>(captures.size());
+    uint16_t base = allocateRegisters(argc + 1);
+
+    current_loc = stmt.getKeyword().loc;
+    auto& functions = current->proto->functions;
+    functions.push_back(chunk);
+    emit(OpCode::FUNC, static_cast<uint16_t>(base + 1), static_cast<uint16_t>(functions.size() - 1));
+
+    uint16_t start = compileExpression(stmt.getStart());
+    emit(OpCode::MOVE, static_cast<uint16_t>(base + 2), start);
+    uint16_t end = compileExpression(stmt.getEnd());
+    emit(OpCode::MOVE, static_cast<uint16_t>(base + 3), end);
+    for (size_t i = 0; i < captures.size(); ++i) {
+        emit(OpCode::MOVE, static_cast<uint16_t>(base + 4 + i), captures[i].reg);
+    }
+
+    current_loc = stmt.getKeyword().loc;
+    emit(OpCode::CALLB, base, static_cast<uint16_t>(argc), static_cast<uint16_t>(parallel_for));
+}
+
+// Compile the body into chunk(first, end, captures...), which runs the
+// iterations from first up to end
+std::shared_ptr<FunctionProto> BytecodeCompiler::compileParallelBody(ParallelForStmt& stmt,
+                                                                     const std::vector<Local>& captures) {
+    FunctionState state;
+    state.proto = std::make_shared<FunctionProto>();
+    state.proto->name = "<parallel for>";
+    state.proto->filename = filename;
+    state.proto->sources = sources;
+    state.proto->arity = 2 + static_cast<int>(captures.size());
+    state.enclosing = current;
+    state.scope_depth = 1;
+    state.parallel_body = true;
+    current = &state;
+
+    uint16_t index = allocateRegister();
+    state.locals.push_back({stmt.getVariable().lexeme, 1, index, false, true});
+    uint16_t end = allocateRegister();
+    for (const Local& capture : captures) {
+        state.locals.push_back({capture.name, 1, allocateRegister(), capture.is_const, true});
+    }
+
+    current_loc = stmt.getKeyword().loc;
+    size_t loop_start = current->proto->code.size();
+    uint16_t cond = allocateRegister();
+    emit(OpCode::LT, cond, index, end);
+    size_t exit_jump = emitJump(OpCode::JMPIFNOT, cond);
+
+    stmt.getBody()->accept(*this);
+
+    current_loc = stmt.getKeyword().loc;
+    uint16_t one = allocateRegister();
+    emitConstant(one, Constant(1));
+    emit(OpCode::ADD, index, index, one);
+    emitLoop(loop_start);
+    patchJump(exit_jump);
+
+    emit(OpCode::RETURNNIL);
+    if (optimize) {
+        optimizeBytecode(*state.proto);
+        assignRegisters(*state.proto);
+    }
+    current = state.enclosing;
+    return state.proto;
+}
+
+std::shared_ptr<FunctionProto> BytecodeCompiler::compileFunction(FunctionStmt& stmt) {
+    FunctionState state;
+    state.proto = std::make_shared<FunctionProto>();
+    state.proto->name = stmt.getName().lexeme;
+    state.proto->filename = filename;
+    state.proto->sources = sources;
+    state.proto->arity = static_cast<int>(stmt.getParams().size());
+    state.enclosing = current;
+    state.scope_depth = 1;
+    current = &state;
+
+    // Parameters occupy the first registers of the frame
+    for (const auto& param : stmt.getParams()) {
+        declareLocal(param, allocateRegister(), false);
+    }
+
+    for (const auto& s : stmt.getBody()) {
+        if (s) {
+            s->accept(*this);
+        }
+    }
+
+    emit(OpCode::RETURNNIL);
+    if (optimize) {
+        optimizeBytecode(*state.proto);
+        assignRegisters(*state.proto);
+    }
+    current = state.enclosing;
+    return state.proto;
+}
+
+// An async function is the body compiled as usual, wrapped in a function
+// that starts it as an async call: f(a, b) runs ASYNC <body of f>(a, b)
+std::shared_ptr<FunctionProto> BytecodeCompiler::compileAsyncFunction(FunctionStmt& stmt) {
+    std::shared_ptr<FunctionProto> body = compileFunction(stmt);
+
+    FunctionState state;
+    state.proto = std::make_shared<FunctionProto>();
+    state.proto->name = stmt.getName().lexeme;
+    state.proto->filename = filename;
+    state.proto->sources = sources;
+    state.proto->arity = body->arity;
+    state.enclosing = current;
+    state.scope_depth = 1;
+    current = &state;
+
+    for (const auto& param : stmt.getParams()) {
+        declareLocal(param, allocateRegister(), false);
+    }
+
+    current_loc = stmt.getName().loc;
+    int argc = body->arity;
+    uint16_t base = allocateRegisters(argc + 1);
+    state.proto->functions.push_back(body);
+    emit(OpCode::FUNC, base, 0);
+    for (int i = 0; i < argc; ++i) {
+        emit(OpCode::MOVE, static_cast<uint16_t>(base + 1 + i), static_cast<uint16_t>(i));
+    }
+    emit(OpCode::ASYNC, base, static_cast<uint16_t>(argc));
+    emit(OpCode::RETURN, base);
+
+    if (optimize) {
+        optimizeBytecode(*state.proto);
+        assignRegisters(*state.proto);
+    }
+    current = state.enclosing;
+    return state.proto;
+}
+
+void BytecodeCompiler::visitFunctionStmt(FunctionStmt& stmt) {
+    const Token& name = stmt.getName();
+    std::shared_ptr<FunctionProto> proto = stmt.isAsync() ? compileAsyncFunction(stmt) : compileFunction(stmt);
+    current_loc = name.loc;
+
+    auto& functions = current->proto->functions;
+    functions.push_back(proto);
+
+    uint16_t reg = allocateRegister();
+    emit(OpCode::FUNC, reg, static_cast<uint16_t>(functions.size() - 1));
+
+    if (isGlobalScope()) {
+        checkNotBuiltin(name);
+        const_globals.erase(name.lexeme);
+        emit(OpCode::DEFGLOBAL, reg, addGlobal(name.lexeme));
+    } else {
+        declareLocal(name, reg, false);
+    }
+}
+
+void BytecodeCompiler::visitReturnStmt(ReturnStmt& stmt) {
+    if (current->parallel_body) {
+        error(stmt.getKeyword(), "Cannot return from inside parallel for");
+        return;
+    }
+    if (stmt.getValue()) {
+        uint16_t value = compileExpression(stmt.getValue());
+        current_loc = stmt.getKeyword().loc;
+        emit(OpCode::RETURN, value);
+    } else {
+        current_loc = stmt.getKeyword().loc;
+        emit(OpCode::RETURNNIL);
+    }
+}
+
+void BytecodeCompiler::visitImportStmt(ImportStmt& stmt) {
+    current_loc = stmt.getKeyword().loc;
+    if (!isGlobalScope()) {
+        error(stmt.getKeyword(), "Imports must be at the top level of a script");
+        return;
+    }
+    emit(OpCode::IMPORT, 0, addConstant(stmt.getPath()));
+}
+
+} // namespace mana
@@ -0,0 +1,196 @@
+#include "csv.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+
+#include <charconv>
+#include <climits>
+#include <cstring>
+
+namespace mana {
+
+namespace {
+
+const CsvTable& expectTable(const char* name, Value value) {
+    if (!isCsv(value)) {
+        throw RuntimeError(std::string(name) + "() expects a CSV table, not " + value.typeName());
+    }
+    return *asCsv(value)->table;
+}
+
+// A column given by number or by its name in the first row; -1 for none
+int expectColumn(const char* name, const CsvTable& table, VM& vm, Value column) {
+    if (column.isInt()) {
+        return column.asInt() < 0 ? -1 : column.asInt();
+    }
+    if (!isString(column)) {
+        throw RuntimeError(std::string(name) + "() expects a column number or name, not " + column.typeName());
+    }
+    std::string_view wanted = vm.flatten(asString(column))->view();
+    int index = table.column(wanted);
+    if (index < 0) {
+        throw RuntimeError(std::string(name) + "() found no column named '" + std::string(wanted) + "'");
+    }
+    return index;
+}
+
+// The field at args[1], args[2]; false if there is none
+bool expectField(const char* name, VM& vm, const Value* args, std::string_view& chars, std::string& scratch) {
+    const CsvTable& table = expectTable(name, args[0]);
+    if (!args[1].isInt()) {
+        throw RuntimeError(std::string(name) + "() expects a row number, not " + args[1].typeName());
+    }
+    int column = expectColumn(name, table, vm, args[2]);
+    if (args[1].asInt() < 0 || column < 0) {
+        return false;
+    }
+    return table.field(static_cast<size_t>(args[1].asInt()), static_cast<size_t>(column), chars, scratch);
+}
+
+} // namespace
+
+std::shared_ptr<const CsvTable> CsvTable::parse(std::string_view text) {
+    if (text.size() >= UINT32_MAX) {
+        throw RuntimeError("Invalid CSV: the input is 4 GB or more");
+    }
+    auto table = std::make_shared<CsvTable>();
+    table->text.assign(text);
+    table->index();
+
+    std::string scratch;
+    std::string_view name;
+    for (size_t column = 0; table->rows() > 0 && table->field(0, column, name, scratch); ++column) {
+        table->header.emplace(std::string(name), static_cast<int>(column));
+    }
+    return table;
+}
+
+// Separators are commas and line breaks outside quotes
+void CsvTable::index() {
+    const size_t size = text.size();
+    ends.reserve(size / 8);
+    row_starts.push_back(0);
+
+    uint64_t quote_carry = 0;   // All ones while quotes go on into the next block
+    char tail[kSimdBlockSize];
+    for (size_t base = 0; base < size; base += kSimdBlockSize) {
+        const char* p = text.data() + base;
+        if (size - base < kSimdBlockSize) {
+            std::memset(tail, 0, sizeof(tail));
+            std::memcpy(tail, p, size - base);
+            p = tail;
+        }
+
+        SimdBlock block(p);
+        uint64_t in_quotes = prefixXor(block.eq('"')) ^ quote_carry;
+        quote_carry = static_cast<uint64_t>(static_cast<int64_t>(in_quotes) >> 63);
+        uint64_t line_breaks = block.eq('\n') & ~in_quotes;
+        uint64_t separators = (block.eq(',') & ~in_quotes) | line_breaks;
+
+        while (separators) {
+            int i = __builtin_ctzll(separators);
+            ends.push_back(static_cast<uint32_t>(base + i));
+            if (line_breaks >> i & 1) {
+                row_starts.push_back(static_cast<uint32_t>(ends.size()));
+            }
+            separators &= separators - 1;
+        }
+    }
+
+    if (quote_carry) {
+        throw RuntimeError("Invalid CSV: a quoted field is not closed");
+    }
+    // The last line need not end in a line break
+    if (size > 0 && text[size - 1] != '\n') {
+        ends.push_back(static_cast<uint32_t>(size));
+        row_starts.push_back(static_cast<uint32_t>(ends.size()));
+    }
+}
+
+int CsvTable::column(std::string_view name) const {
+    auto it = header.find(std::string(name));
+    return it != header.end() ? it->second : -1;
+}
+
+bool CsvTable::field(size_t row, size_t column, std::string_view& chars, std::string& scratch) const {
+    if (row >= rows()) {
+        return false;
+    }
+    size_t index = row_starts[row] + column;
+    if (index >= row_starts[row + 1]) {
+        return false;
+    }
+
+    uint32_t begin = index == 0 ? 0 : ends[index - 1] + 1;
+    uint32_t end = ends[index];
+    if (end > begin && text[end - 1] == '\r' && (end == text.size() || text[end] == '\n')) {
+        end--;
+    }
+    chars = std::string_view(text.data() + begin, end - begin);
+    if (chars.empty() || chars[0] != '"') {
+        return true;
+    }
+
+    // Between the quotes, with each doubled quote standing for one
+    size_t closing = chars.rfind('"');
+    chars = chars.substr(1, closing > 0 ? closing - 1 : std::string_view::npos);
+    if (chars.find('"') == std::string_view::npos) {
+        return true;
+    }
+    scratch.clear();
+    for (size_t i = 0; i < chars.size(); ++i) {
+        scratch += chars[i];
+        if (chars[i] == '"' && i + 1 < chars.size() && chars[i + 1] == '"') {
+            i++;
+        }
+    }
+    chars = scratch;
+    return true;
+}
+
+// Builtins
+
+Value nativeParseCsv(VM& vm, int, const Value* args) {
+    if (!isString(args[0])) {
+        throw RuntimeError(std::string("parse_csv() expects a string, not ") + args[0].typeName());
+    }
+    auto table = CsvTable::parse(vm.flatten(asString(args[0]))->view());
+    return Value::object(vm.allocate<ObjCsv>(Generation::YOUNG, table));
+}
+
+Value nativeCsvRows(VM&, int, const Value* args) {
+    return Value::integer(static_cast<int32_t>(expectTable("csv_rows", args[0]).rows()));
+}
+
+Value nativeCsvGet(VM& vm, int, const Value* args) {
+    std::string_view chars;
+    std::string scratch;
+    if (!expectField("csv_get", vm, args, chars, scratch)) {
+        return Value::nil();
+    }
+    return Value::object(vm.newString(chars));
+}
+
+Value nativeCsvNumber(VM& vm, int, const Value* args) {
+    std::string_view chars;
+    std::string scratch;
+    if (!expectField("csv_number", vm, args, chars, scratch) || chars.empty()) {
+        return Value::nil();
+    }
+
+    const char* begin = chars.data();
+    const char* end = begin + chars.size();
+    int64_t integer = 0;
+    auto whole = std::from_chars(begin, end, integer);
+    if (whole.ec == std::errc() && whole.ptr == end && integer >= INT32_MIN && integer <= INT32_MAX) {
+        return Value::integer(static_cast<int32_t>(integer));
+    }
+    double number = 0;
+    auto result = std::from_chars(begin, end, number);
+    if (result.ec != std::errc() || result.ptr != end) {
+        throw RuntimeError("csv_number() found '" + std::string(chars) + "' in row " +
+                           std::to_string(args[1].asInt()) + ", which is not a number");
+    }
+    return Value::number(number);
+}
+
+} // namespace mana
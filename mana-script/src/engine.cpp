@@ -0,0 +1,122 @@
+#include "engine.hpp"
+#include "compiler.hpp"
+#include "error.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "task.hpp"
+
+#include <fstream>
+#include <iterator>
+
+namespace mana {
+
+Value toValue(VM& vm, const Constant& input) {
+    if (std::holds_alternative<int>(input)) {
+        return Value::integer(std::get<int>(input));
+    }
+    if (std::holds_alternative<double>(input)) {
+        return Value::number(std::get<double>(input));
+    }
+    if (std::holds_alternative<bool>(input)) {
+        return Value::boolean(std::get<bool>(input));
+    }
+    if (std::holds_alternative<std::string>(input)) {
+        return Value::object(vm.newString(std::get<std::string>(input)));
+    }
+    return Value::nil();
+}
+
+Constant toConstant(Value value) {
+    if (value.isInt()) {
+        return static_cast<int>(value.asInt());
+    }
+    if (value.isDouble()) {
+        return value.asDouble();
+    }
+    if (value.isBool()) {
+        return value.asBool();
+    }
+    if (value.isNil()) {
+        return nullptr;
+    }
+    return value.toString();
+}
+
+std::shared_ptr<const CompiledScript> Engine::compile(const std::string& source,
+                                                      CompilationContext& context) const {
+    Lexer lexer(source, context);
+    auto tokens = lexer.scanTokens();
+
+    Parser parser(tokens, context);
+    auto statements = parser.parse();
+    if (context.hasErrors()) {
+        return nullptr;
+    }
+
+    BytecodeCompiler compiler(context, engine_options.optimize);
+    std::shared_ptr<const FunctionProto> bytecode = compiler.compile(statements);
+    if (context.hasErrors()) {
+        return nullptr;
+    }
+    return std::make_shared<const CompiledScript>(std::move(bytecode), context.filename());
+}
+
+std::shared_ptr<const CompiledScript> Engine::compile(const std::string& source,
+                                                      const std::string& filename) const {
+    CompilationContext context(filename, diagnostics);
+    return compile(source, context);
+}
+
+std::shared_ptr<const CompiledScript> Engine::compileFile(CompilationContext& context) const {
+    std::ifstream file(context.filename());
+    if (!file.is_open()) {
+        context.reports().report(DiagnosticSeverity::ERROR,
+                                 "Could not open file '" + context.filename() + "'",
+                                 SourceLocation(context.filename()));
+        return nullptr;
+    }
+
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return compile(source, context);
+}
+
+std::shared_ptr<const CompiledScript> Engine::compileFile(const std::string& path) const {
+    CompilationContext context(path, diagnostics);
+    return compileFile(context);
+}
+
+RunResult Engine::run(const CompiledScript& script, const ScriptInputs& inputs) const {
+    VM vm(engine_options.nursery_size);
+    return run(script, vm, inputs);
+}
+
+RunResult Engine::run(const CompiledScript& script, VM& vm, const ScriptInputs& inputs) const {
+    for (const auto& [name, input] : inputs) {
+        vm.defineGlobal(name, toValue(vm, input));
+    }
+
+    size_t reported = vm.diagnosticSink().getDiagnostics().size();
+    RunResult result;
+    result.status = vm.interpret(script.bytecode());
+
+    Value entry = engine_options.entry.empty() ? Value::nil() : vm.getGlobal(engine_options.entry);
+    if (result.ok() && isFunction(entry)) {
+        Value value;
+        result.status = vm.call(entry, {}, &value, engine_options.allocation);
+        if (result.ok() && isTask(value)) {
+            // An async entry point has only started; wait for it
+            result.status = vm.call(vm.getGlobal("await"), {value}, &value);
+        }
+        if (result.ok()) {
+            result.value = toConstant(value);
+        }
+    }
+
+    const auto& reports = vm.diagnosticSink().getDiagnostics();
+    if (!result.ok() && reports.size() > reported) {
+        result.error = reports.back().getMessage();
+    }
+    return result;
+}
+
+} // namespace mana
@@ -1,4 +1,5 @@
 #include "error.hpp"
+#include "source.hpp"
 #include <sstream>
 
 namespace mana {
@@ -6,6 +7,34 @@ namespace mana {
 // Initialize the global diagnostic manager
 DiagnosticManager diagnostics;
 
+const char* diagnosticFormat(DiagnosticCode code) {
+    switch (code) {
+        case DiagnosticCode::TEXT:                 return "{0}";
+        case DiagnosticCode::UNEXPECTED_CHARACTER: return "Unexpected character '{0}'";
+        case DiagnosticCode::INVALID_ESCAPE:       return "Invalid escape sequence '\\{0}'";
+        case DiagnosticCode::UNTERMINATED_STRING:  return "Unterminated string";
+        case DiagnosticCode::UNTERMINATED_COMMENT: return "Unterminated comment";
+        case DiagnosticCode::INVALID_NUMBER:       return "Invalid {0} number";
+        case DiagnosticCode::INVALID_EXPONENT:     return "Invalid scientific notation";
+        case DiagnosticCode::SYNTAX:               return "{0} at '{1}'";
+        case DiagnosticCode::SYNTAX_AT_END:        return "{0} at end of file";
+    }
+    return "{0}";
+}
+
+std::string Diagnostic::getMessage() const {
+    std::string message;
+    for (const char* c = diagnosticFormat(code); *c; ++c) {
+        if (c[0] == '{' && (c[1] == '0' || c[1] == '1') && c[2] == '}') {
+            message += args[c[1] - '0'].view();
+            c += 2;
+        } else {
+            message += *c;
+        }
+    }
+    return message;
+}
+
 std::string SourceLocation::toString() const {
     std::stringstream ss;
     if (!filename.empty()) {
@@ -26,14 +55,15 @@ std::string Diagnostic::toString() const {
     }
     
     std::stringstream ss;
-    ss << location.toString() << ": " << severity_str << ": " << message;
+    ss << getLocation().toString() << ": " << severity_str << ": " << getMessage();
     
-    if (!code_context.empty()) {
-        ss << "\n" << code_context;
+    std::string context = getCodeContext();
+    if (!context.empty()) {
+        ss << "\n" << context;
         
         // Add a caret pointing to the column position
-        if (location.column > 0) {
-            ss << "\n" << std::string(location.column - 1, ' ') << "^";
+        if (column > 0) {
+            ss << "\n" << std::string(column - 1, ' ') << "^";
         }
     }
     
@@ -56,6 +86,36 @@ void DiagnosticManager::report(DiagnosticSeverity severity,
     report(Diagnostic(severity, message, location, code_context));
 }
 
+std::string Diagnostic::getCodeContext() const {
+    if (!code_context.empty()) {
+        return code_context;
+    }
+    return std::string(SourceManager::global().lineText(file, line));
+}
+
+void DiagnosticManager::report(DiagnosticSeverity severity, DiagnosticCode code, SourceLoc loc,
+                               DiagnosticArg first, DiagnosticArg second) {
+    FileId file;
+    int line;
+    int column;
+    SourceManager::global().decode(loc, file, line, column);
+    report(severity, code, file, line, column, std::move(first), std::move(second));
+}
+
+void DiagnosticManager::report(DiagnosticSeverity severity, DiagnosticCode code, FileId file, int line,
+                               int column, DiagnosticArg first, DiagnosticArg second,
+                               std::string code_context) {
+    // Copy the line now; the buffer may be released before it is printed
+    if (code_context.empty()) {
+        code_context = std::string(SourceManager::global().lineText(file, line));
+    }
+    diagnostics.emplace_back(severity, code, file, line, column, std::move(first), std::move(second),
+                             std::move(code_context));
+    if (severity == DiagnosticSeverity::ERROR || severity == DiagnosticSeverity::FATAL) {
+        has_errors = true;
+    }
+}
+
 void DiagnosticManager::printDiagnostics(std::ostream& os) const {
     for (const auto& diagnostic : diagnostics) {
         os << diagnostic.toString() << std::endl;
@@ -0,0 +1,213 @@
+#include "extension.hpp"
+#include "vm.hpp"
+#include <cmath>
+#include <dlfcn.h>
+#include <tuple>
+#include <utility>
+
+namespace mana {
+
+namespace {
+
+[[noreturn]] void argumentError(const ExtFunction& function, int index, ExtType expected, Value actual) {
+    throw RuntimeError(std::string(function.name) + "() expects " + extTypeName(expected) +
+                       " for argument " + std::to_string(index + 1) + ", not " + actual.typeName());
+}
+
+// Conversion of one argument into the C parameters of its declared type
+
+template <ExtType T>
+struct ExtArg;
+
+template <>
+struct ExtArg<ExtType::INT> {
+    static std::tuple<int64_t> convert(VM&, const ExtFunction& function, int index, Value value) {
+        if (value.isInt()) {
+            return {value.asInt()};
+        }
+        // Ints that overflowed into doubles are still ints to the extension
+        if (value.isDouble() && std::trunc(value.asDouble()) == value.asDouble() &&
+            std::fabs(value.asDouble()) < 9.2e18) {
+            return {static_cast<int64_t>(value.asDouble())};
+        }
+        argumentError(function, index, ExtType::INT, value);
+    }
+};
+
+template <>
+struct ExtArg<ExtType::DOUBLE> {
+    static std::tuple<double> convert(VM&, const ExtFunction& function, int index, Value value) {
+        if (!value.isNumber()) {
+            argumentError(function, index, ExtType::DOUBLE, value);
+        }
+        return {value.asNumber()};
+    }
+};
+
+template <>
+struct ExtArg<ExtType::BOOL> {
+    static std::tuple<bool> convert(VM&, const ExtFunction& function, int index, Value value) {
+        if (!value.isBool()) {
+            argumentError(function, index, ExtType::BOOL, value);
+        }
+        return {value.asBool()};
+    }
+};
+
+template <>
+struct ExtArg<ExtType::STRING> {
+    // A view of the script's characters; nothing collects before the call returns
+    static std::tuple<const char*, size_t> convert(VM& vm, const ExtFunction& function, int index,
+                                                   Value value) {
+        if (!isString(value)) {
+            argumentError(function, index, ExtType::STRING, value);
+        }
+        ObjString* flat = vm.flatten(asString(value));
+        return {flat->c_str(), flat->length};
+    }
+};
+
+// Conversion of the C result back into a Value
+
+template <ExtType T>
+struct ExtResult;
+
+template <>
+struct ExtResult<ExtType::VOID> {
+    using Type = void;
+};
+
+template <>
+struct ExtResult<ExtType::INT> {
+    using Type = int64_t;
+    static Value wrap(VM&, int64_t result) { return fromInt64(result); }
+};
+
+template <>
+struct ExtResult<ExtType::DOUBLE> {
+    using Type = double;
+    static Value wrap(VM&, double result) { return Value::number(result); }
+};
+
+template <>
+struct ExtResult<ExtType::BOOL> {
+    using Type = bool;
+    static Value wrap(VM&, bool result) { return Value::boolean(result); }
+};
+
+template <>
+struct ExtResult<ExtType::STRING> {
+    using Type = ExtString;
+    static Value wrap(VM& vm, ExtString result) {
+        if (!result.data) {
+            return Value::nil();
+        }
+        return Value::object(vm.newString(std::string_view(result.data, result.length)));
+    }
+};
+
+template <typename Result, typename Params>
+struct CFunction;
+
+template <typename Result, typename... Params>
+struct CFunction<Result, std::tuple<Params...>> {
+    using Type = Result (*)(Params...);
+};
+
+template <ExtType R, ExtType... P, size_t... I>
+Value invokeExtern(VM& vm, const ExtFunction& function, const Value* args, std::index_sequence<I...>) {
+    auto params = std::tuple_cat(ExtArg<P>::convert(vm, function, static_cast<int>(I), args[I])...);
+    using Fn = typename CFunction<typename ExtResult<R>::Type, decltype(params)>::Type;
+    Fn fn = reinterpret_cast<Fn>(function.function);
+
+    if constexpr (R == ExtType::VOID) {
+        std::apply(fn, params);
+        return Value::nil();
+    } else {
+        return ExtResult<R>::wrap(vm, std::apply(fn, params));
+    }
+}
+
+template <ExtType R, ExtType... P>
+Value callExtern(VM& vm, const ExtFunction& function, const Value* args) {
+    return invokeExtern<R, P...>(vm, function, args, std::make_index_sequence<sizeof...(P)>());
+}
+
+// Walk the declared parameter types to the adapter instantiated for exactly them
+template <ExtType R, ExtType... P>
+ExternFn selectCaller(const ExtFunction& function) {
+    if (function.arity == sizeof...(P)) {
+        return callExtern<R, P...>;
+    }
+    if constexpr (sizeof...(P) < kMaxExtensionParams) {
+        switch (function.params[sizeof...(P)]) {
+            case ExtType::INT:    return selectCaller<R, P..., ExtType::INT>(function);
+            case ExtType::DOUBLE: return selectCaller<R, P..., ExtType::DOUBLE>(function);
+            case ExtType::BOOL:   return selectCaller<R, P..., ExtType::BOOL>(function);
+            case ExtType::STRING: return selectCaller<R, P..., ExtType::STRING>(function);
+            default: break;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+ExternFn externCaller(const ExtFunction& function) {
+    if (function.arity > kMaxExtensionParams || !function.function) {
+        return nullptr;
+    }
+    switch (function.result) {
+        case ExtType::VOID:   return selectCaller<ExtType::VOID>(function);
+        case ExtType::INT:    return selectCaller<ExtType::INT>(function);
+        case ExtType::DOUBLE: return selectCaller<ExtType::DOUBLE>(function);
+        case ExtType::BOOL:   return selectCaller<ExtType::BOOL>(function);
+        case ExtType::STRING: return selectCaller<ExtType::STRING>(function);
+    }
+    return nullptr;
+}
+
+const ExtModule* loadExtension(const std::string& path, std::string& error) {
+    // RTLD_GLOBAL lets JIT-compiled code resolve the functions by symbol
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_GLOBAL);
+    if (!handle) {
+        error = dlerror();
+        return nullptr;
+    }
+
+    auto entry = reinterpret_cast<ExtModuleEntry>(dlsym(handle, kExtensionEntry));
+    if (!entry) {
+        error = "'" + path + "' is not a Manascript extension: it does not export " + kExtensionEntry;
+        dlclose(handle);
+        return nullptr;
+    }
+
+    const ExtModule* module = entry();
+    if (!module || module->abi_version != kExtensionAbiVersion) {
+        error = "'" + path + "' was built for a different extension ABI";
+        dlclose(handle);
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < module->count; ++i) {
+        const ExtFunction& function = module->functions[i];
+        if (!function.name || !function.function || function.arity > kMaxExtensionParams) {
+            error = "'" + path + "' has an invalid entry for function " + std::to_string(i);
+            dlclose(handle);
+            return nullptr;
+        }
+    }
+    return module;
+}
+
+const char* extTypeName(ExtType type) {
+    switch (type) {
+        case ExtType::VOID:   return "void";
+        case ExtType::INT:    return "int";
+        case ExtType::DOUBLE: return "float";
+        case ExtType::BOOL:   return "bool";
+        case ExtType::STRING: return "string";
+    }
+    return "void";
+}
+
+} // namespace mana
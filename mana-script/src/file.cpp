@@ -0,0 +1,311 @@
+#include "file.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mana {
+
+namespace {
+
+File& expectFile(const char* name, Value value) {
+    if (!isFile(value)) {
+        throw RuntimeError(std::string(name) + "() expects a file, not " + value.typeName());
+    }
+    return *asFile(value)->file;
+}
+
+File::Mode parseMode(std::string_view mode) {
+    if (mode == "r") {
+        return File::Mode::READ;
+    }
+    if (mode == "w") {
+        return File::Mode::WRITE;
+    }
+    if (mode == "a") {
+        return File::Mode::APPEND;
+    }
+    throw RuntimeError("open() expects the mode \"r\", \"w\" or \"a\", not \"" + std::string(mode) + "\"");
+}
+
+} // namespace
+
+std::shared_ptr<File> File::open(const std::string& path, Mode mode, IoService& io) {
+    int flags = O_RDONLY;
+    if (mode != Mode::READ) {
+        flags = O_WRONLY | O_CREAT | (mode == Mode::APPEND ? O_APPEND : O_TRUNC);
+    }
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw RuntimeError("Cannot open '" + path + "': " + std::strerror(errno));
+    }
+    if (mode == Mode::READ) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return std::shared_ptr<File>(new File(path, mode, fd, io));
+}
+
+File::File(std::string path, Mode mode, int fd, IoService& io)
+    : file_path(std::move(path)), mode(mode), fd(fd), io(io) {
+    if (mode == Mode::READ) {
+        struct stat info;
+        stream = fstat(fd, &info) == 0 && !S_ISREG(info.st_mode) && !S_ISBLK(info.st_mode);
+        chunks[0].buffer = io.acquireBuffer();
+        chunks[1].buffer = io.acquireBuffer();
+        // A pipe read waits for a writer; see fill()
+        if (!stream) {
+            start(chunks[0]);
+        }
+    }
+}
+
+File::~File() {
+    if (!closed) {
+        try {
+            flush();
+        } catch (const RuntimeError&) {
+            // Nobody is left to report it to
+        }
+        release();
+    }
+}
+
+Channel::Status File::readLine(const Reader& take, Task* parker) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed || mode != Mode::READ) {
+        throw RuntimeError("Cannot read '" + file_path + "': " + (closed ? "it is closed" : "it is open for writing"));
+    }
+
+    while (true) {
+        if (fill(parker) == Channel::Status::PARKED) {
+            return Channel::Status::PARKED;
+        }
+        if (at_end) {
+            // What follows the last line break, if anything
+            if (!partial.empty()) {
+                take(partial);
+                partial.clear();
+            }
+            return Channel::Status::DONE;
+        }
+
+        const char* data = chunks[current].buffer.data;
+        const char* begin = data + position;
+        const char* end = data + length;
+        auto* newline = static_cast<const char*>(std::memchr(begin, '\n', static_cast<size_t>(end - begin)));
+        if (!newline) {
+            partial.append(begin, end);
+            position = length;
+            continue;
+        }
+
+        position = static_cast<size_t>(newline - data) + 1;
+        std::string_view line(begin, static_cast<size_t>(newline - begin));
+        if (!partial.empty()) {
+            partial.append(line);
+            line = partial;
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        take(line);
+        partial.clear();
+        return Channel::Status::DONE;
+    }
+}
+
+Channel::Status File::read(size_t max, const Reader& take, Task* parker) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed || mode != Mode::READ) {
+        throw RuntimeError("Cannot read '" + file_path + "': " + (closed ? "it is closed" : "it is open for writing"));
+    }
+
+    if (fill(parker) == Channel::Status::PARKED) {
+        return Channel::Status::PARKED;
+    }
+    if (at_end) {
+        return Channel::Status::DONE;
+    }
+    size_t count = std::min(max, length - position);
+    take(std::string_view(chunks[current].buffer.data + position, count));
+    position += count;
+    return Channel::Status::DONE;
+}
+
+void File::write(std::string_view text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed || mode == Mode::READ) {
+        throw RuntimeError("Cannot write '" + file_path + "': " + (closed ? "it is closed" : "it is open for reading"));
+    }
+    pending.append(text);
+    if (pending.size() >= kWriteBufferSize) {
+        flush();
+    }
+}
+
+void File::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+        return;
+    }
+    closed = true;
+    try {
+        flush();
+    } catch (const RuntimeError&) {
+        release();
+        throw;
+    }
+    release();
+}
+
+// Make the current chunk hold bytes not used yet, unless the file has ended
+Channel::Status File::fill(Task* parker) {
+    while (!at_end && position == length) {
+        Chunk& chunk = chunks[current];
+        if (chunk.started && length > 0) {
+            // Used up; the next read may be on its way already
+            chunk.started = false;
+            current ^= 1;
+            position = length = 0;
+            continue;
+        }
+
+        if (!chunk.started) {
+            start(chunk);
+        }
+        if (chunk.request.wait(parker) == Channel::Status::PARKED) {
+            return Channel::Status::PARKED;
+        }
+        ssize_t bytes = chunk.request.result();
+        if (bytes < 0) {
+            fail("read", static_cast<int>(-bytes));
+        }
+        if (bytes == 0) {
+            chunk.started = false;
+            at_end = true;
+            break;
+        }
+        // A short read is not the end: a pipe returns what its writers have
+        // sent so far, and only a read of nothing means there is no more
+        length = static_cast<size_t>(bytes);
+        next_offset += length;
+
+        // Keep the next read in flight while this chunk is used. A pipe read
+        // waits for a writer, which would hold up a blocking read and a
+        // close, so it starts only when its bytes are wanted
+        Chunk& next = chunks[current ^ 1];
+        if (!next.started && !stream) {
+            start(next);
+        }
+    }
+    return Channel::Status::DONE;
+}
+
+void File::start(Chunk& chunk) {
+    chunk.request.reset();
+    chunk.started = true;
+    io.read(fd, chunk.buffer, stream ? IoService::kStream : next_offset, chunk.request);
+}
+
+void File::flush() {
+    size_t written = 0;
+    while (written < pending.size()) {
+        ssize_t count = ::write(fd, pending.data() + written, pending.size() - written);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int error = errno;
+            pending.clear();
+            fail("write", error);
+        }
+        written += static_cast<size_t>(count);
+    }
+    pending.clear();
+}
+
+// Wait out the reads in flight, which still write to the buffers
+void File::release() {
+    for (Chunk& chunk : chunks) {
+        if (chunk.buffer.data) {
+            if (chunk.started) {
+                chunk.request.wait(nullptr);
+            }
+            io.releaseBuffer(chunk.buffer);
+            chunk.buffer = IoService::Buffer();
+        }
+    }
+    ::close(fd);
+}
+
+void File::fail(const char* action, int error) const {
+    throw RuntimeError(std::string("Cannot ") + action + " '" + file_path + "': " + std::strerror(error));
+}
+
+// Builtins
+
+Value nativeOpen(VM& vm, int argc, const Value* args) {
+    if (argc < 1 || argc > 2) {
+        throw RuntimeError("Expected 1 or 2 arguments but got " + std::to_string(argc));
+    }
+    if (!isString(args[0])) {
+        throw RuntimeError(std::string("open() expects a path, not ") + args[0].typeName());
+    }
+    File::Mode mode = File::Mode::READ;
+    if (argc == 2) {
+        if (!isString(args[1])) {
+            throw RuntimeError(std::string("open() expects a mode, not ") + args[1].typeName());
+        }
+        mode = parseMode(vm.flatten(asString(args[1]))->view());
+    }
+
+    std::string path(vm.flatten(asString(args[0]))->view());
+    return Value::object(vm.allocate<ObjFile>(Generation::YOUNG, File::open(path, mode)));
+}
+
+Value nativeRead(VM& vm, int argc, const Value* args) {
+    if (argc < 1 || argc > 2) {
+        throw RuntimeError("Expected 1 or 2 arguments but got " + std::to_string(argc));
+    }
+    File& file = expectFile("read", args[0]);
+    size_t max = IoService::kBufferSize;
+    if (argc == 2) {
+        if (!args[1].isInt() || args[1].asInt() < 1) {
+            throw RuntimeError("read() expects a byte count of at least 1");
+        }
+        max = static_cast<size_t>(args[1].asInt());
+    }
+
+    Value chunk = Value::nil();
+    auto take = [&](std::string_view bytes) { chunk = Value::object(vm.newString(bytes)); };
+    if (file.read(max, take, parkerFor(vm)) == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+    return chunk;
+}
+
+Value nativeReadLine(VM& vm, int, const Value* args) {
+    File& file = expectFile("read_line", args[0]);
+    Value line = Value::nil();
+    auto take = [&](std::string_view text) { line = Value::object(vm.newString(text)); };
+    if (file.readLine(take, parkerFor(vm)) == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+    return line;
+}
+
+Value nativeWrite(VM& vm, int, const Value* args) {
+    File& file = expectFile("write", args[0]);
+    if (isString(args[1])) {
+        file.write(vm.flatten(asString(args[1]))->view());
+    } else {
+        file.write(args[1].toString());
+    }
+    return Value::nil();
+}
+
+} // namespace mana
@@ -0,0 +1,413 @@
+#include "gc.hpp"
+#include <algorithm>
+
+namespace mana {
+
+namespace {
+
+/**
+ * @brief Moves every young object it reaches into the old space
+ */
+class Promoter : public GcTracer {
+public:
+    using PromoteFn = std::function<Obj*(Obj*)>;
+
+    Promoter(const Heap& heap, PromoteFn promote) : heap(heap), promote(std::move(promote)) {}
+
+    void visit(Value& slot) override {
+        if (slot.isObj() && heap.isYoung(slot.asObj())) {
+            slot = Value::object(promote(slot.asObj()));
+        }
+    }
+
+private:
+    const Heap& heap;
+    PromoteFn promote;
+};
+
+/**
+ * @brief Copies every arena object it reaches into the heap
+ */
+class Evacuator : public GcTracer {
+public:
+    using EvacuateFn = std::function<Obj*(Obj*)>;
+
+    Evacuator(Heap& heap, const Arena& arena, EvacuateFn evacuate)
+        : heap(heap), arena(arena), evacuate(std::move(evacuate)) {}
+
+    void visit(Value& slot) override {
+        if (slot.isObj() && arena.contains(slot.asObj())) {
+            slot = Value::object(evacuate(slot.asObj()));
+        }
+        // A copy may land in the old space and point at young objects
+        if (owner) {
+            heap.writeBarrier(owner, slot);
+        }
+    }
+
+    void traceObject(Obj* object) {
+        owner = object;
+        object->trace(*this);
+        owner = nullptr;
+    }
+
+private:
+    Heap& heap;
+    const Arena& arena;
+    EvacuateFn evacuate;
+    Obj* owner = nullptr;
+};
+
+/**
+ * @brief Marks every object it reaches and queues it for tracing
+ */
+class Marker : public GcTracer {
+public:
+    void visit(Value& slot) override {
+        if (slot.isObj() && !slot.asObj()->marked) {
+            slot.asObj()->marked = true;
+            gray.push_back(slot.asObj());
+        }
+    }
+
+    void drain() {
+        while (!gray.empty()) {
+            Obj* object = gray.back();
+            gray.pop_back();
+            object->trace(*this);
+        }
+    }
+
+private:
+    std::vector<Obj*> gray;
+};
+
+} // namespace
+
+void PauseHistogram::record(std::chrono::nanoseconds pause) {
+    uint64_t ns = static_cast<uint64_t>(pause.count());
+    uint64_t us = ns / 1000;
+
+    size_t bucket = 0;
+    while (bucket < kBucketLimitsUs.size() && us >= kBucketLimitsUs[bucket]) {
+        bucket++;
+    }
+    buckets[bucket]++;
+
+    count++;
+    total_ns += ns;
+    max_ns = std::max(max_ns, ns);
+}
+
+Arena& Arena::forThread() {
+    thread_local Arena arena;
+    return arena;
+}
+
+bool Arena::acquire(const void* owner) {
+    if (holder && holder != owner) {
+        return false;
+    }
+    holder = owner;
+    return true;
+}
+
+void Arena::nextChunk(size_t size) {
+    // Reuse the chunks kept by earlier resets before growing
+    while (current + 1 < chunks.size()) {
+        current++;
+        if (chunks[current].size >= size) {
+            top = chunks[current].memory.get();
+            limit = top + chunks[current].size;
+            return;
+        }
+    }
+
+    size_t chunk_size = chunks.empty() ? kInitialChunkSize : chunks.back().size * 2;
+    chunk_size = std::max(chunk_size, size);
+    chunks.push_back({std::unique_ptr<uint8_t[]>(new uint8_t[chunk_size]), chunk_size});
+    current = chunks.size() - 1;
+    top = chunks[current].memory.get();
+    limit = top + chunk_size;
+}
+
+bool Arena::contains(const void* address) const {
+    auto byte = static_cast<const uint8_t*>(address);
+    for (size_t i = 0; i <= current && i < chunks.size(); ++i) {
+        const uint8_t* begin = chunks[i].memory.get();
+        if (byte >= begin && byte < begin + chunks[i].size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Arena::reset() {
+    current = 0;
+    top = chunks.empty() ? nullptr : chunks[0].memory.get();
+    limit = chunks.empty() ? nullptr : top + chunks[0].size;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Chunk& chunk : chunks) {
+        total += chunk.size;
+    }
+    return total;
+}
+
+Heap::Heap(size_t nursery_size)
+    : nursery(new uint8_t[nursery_size]),
+      nursery_end(nursery.get() + nursery_size),
+      nursery_top(nursery.get()) {}
+
+Heap::~Heap() {
+    for (uint8_t* address = nursery.get(); address < nursery_top;) {
+        Obj* object = reinterpret_cast<Obj*>(address);
+        address += object->size;
+        object->~Obj();
+    }
+    for (const auto& block : blocks) {
+        for (Obj* object : block->objects) {
+            object->~Obj();
+        }
+    }
+}
+
+void* Heap::allocateYoung(size_t size) {
+    if (static_cast<size_t>(nursery_end - nursery_top) < size) {
+        // Spill into the old space until the owner reaches a safepoint
+        minor_pending = true;
+        return nullptr;
+    }
+    void* memory = nursery_top;
+    nursery_top += size;
+    return memory;
+}
+
+void* Heap::allocateOld(size_t size, Block*& block) {
+    if (size > kBlockSize) {
+        return allocateLarge(size, block);
+    }
+    if (static_cast<size_t>(old_limit - old_top) < size && !nextHole(size)) {
+        blocks.push_back(std::make_unique<Block>());
+        blocks.back()->memory.reset(new uint8_t[kBlockSize]);
+        alloc_block = blocks.size() - 1;
+        alloc_line = 0;
+        nextHole(size);
+    }
+
+    void* memory = old_top;
+    old_top += size;
+    block = blocks[alloc_block].get();
+
+    gc_stats.old_bytes += size;
+    if (gc_stats.old_bytes > major_threshold) {
+        major_pending = true;
+    }
+    return memory;
+}
+
+void* Heap::allocateLarge(size_t size, Block*& block) {
+    blocks.push_back(std::make_unique<Block>());
+    block = blocks.back().get();
+    block->memory.reset(new uint8_t[size]);
+    block->large = true;
+
+    gc_stats.old_bytes += size;
+    if (gc_stats.old_bytes > major_threshold) {
+        major_pending = true;
+    }
+    return block->memory.get();
+}
+
+bool Heap::nextHole(size_t size) {
+    while (alloc_block < blocks.size()) {
+        Block& block = *blocks[alloc_block];
+        if (block.large) {
+            alloc_block++;
+            alloc_line = 0;
+            continue;
+        }
+
+        while (alloc_line < kLinesPerBlock) {
+            if (block.line_used[alloc_line]) {
+                alloc_line++;
+                continue;
+            }
+
+            size_t first = alloc_line;
+            while (alloc_line < kLinesPerBlock && !block.line_used[alloc_line]) {
+                alloc_line++;
+            }
+            if ((alloc_line - first) * kLineSize >= size) {
+                old_top = block.memory.get() + first * kLineSize;
+                old_limit = block.memory.get() + alloc_line * kLineSize;
+                return true;
+            }
+        }
+
+        alloc_block++;
+        alloc_line = 0;
+    }
+    return false;
+}
+
+Obj* Heap::promote(Obj* object, std::vector<Obj*>& worklist) {
+    if (object->forwarding) {
+        return object->forwarding;
+    }
+
+    Block* block = nullptr;
+    void* memory = allocateOld(object->size, block);
+    Obj* moved = object->moveTo(memory);
+    moved->size = object->size;
+    block->objects.push_back(moved);
+
+    object->forwarding = moved;
+    worklist.push_back(moved);
+    gc_stats.promoted_bytes += object->size;
+    return moved;
+}
+
+Obj* Heap::evacuate(Obj* object, std::vector<Obj*>& worklist) {
+    if (object->forwarding) {
+        return object->forwarding;
+    }
+
+    Block* block = nullptr;
+    void* memory = allocateYoung(object->size);
+    if (!memory) {
+        memory = allocateOld(object->size, block);
+    }
+    Obj* moved = object->moveTo(memory);
+    moved->size = object->size;
+    if (block) {
+        block->objects.push_back(moved);
+    }
+
+    object->forwarding = moved;
+    worklist.push_back(moved);
+    gc_stats.evacuated_bytes += object->size;
+    return moved;
+}
+
+void Heap::enterArena(Arena& region) {
+    arena = &region;
+}
+
+void Heap::leaveArena(const RootSource& roots) {
+    Arena& region = *arena;
+    arena = nullptr;
+
+    std::vector<Obj*> worklist;
+    Evacuator evacuator(*this, region, [&](Obj* object) { return evacuate(object, worklist); });
+    roots(evacuator);
+    for (Obj* owner : arena_owners) {
+        evacuator.traceObject(owner);
+    }
+    arena_owners.clear();
+    while (!worklist.empty()) {
+        Obj* object = worklist.back();
+        worklist.pop_back();
+        evacuator.traceObject(object);
+    }
+
+    region.reset();
+}
+
+void Heap::collect(bool major, const RootSource& roots) {
+    auto start = std::chrono::steady_clock::now();
+
+    if (major) {
+        majorCollection(roots);
+    } else {
+        minorCollection(roots);
+    }
+
+    auto pause = std::chrono::steady_clock::now() - start;
+    (major ? gc_stats.major : gc_stats.minor).record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(pause));
+}
+
+void Heap::minorCollection(const RootSource& roots) {
+    std::vector<Obj*> worklist;
+    Promoter promoter(*this, [&](Obj* object) { return promote(object, worklist); });
+
+    roots(promoter);
+    for (Obj* object : remembered) {
+        object->remembered = false;
+        object->trace(promoter);
+    }
+    remembered.clear();
+
+    // Promoted objects may still point into the nursery
+    while (!worklist.empty()) {
+        Obj* object = worklist.back();
+        worklist.pop_back();
+        object->trace(promoter);
+    }
+
+    // Survivors were moved out; what is left are moved-from shells and garbage
+    for (uint8_t* address = nursery.get(); address < nursery_top;) {
+        Obj* object = reinterpret_cast<Obj*>(address);
+        address += object->size;
+        object->~Obj();
+    }
+    nursery_top = nursery.get();
+    minor_pending = false;
+}
+
+void Heap::majorCollection(const RootSource& roots) {
+    // With the nursery empty every live object is in the old space
+    minorCollection(roots);
+
+    Marker marker;
+    roots(marker);
+    marker.drain();
+
+    sweep();
+    major_threshold = std::max(kInitialMajorThreshold, gc_stats.old_bytes * 2);
+    major_pending = false;
+}
+
+void Heap::sweep() {
+    gc_stats.old_bytes = 0;
+
+    for (const auto& block : blocks) {
+        block->line_used.fill(false);
+
+        std::vector<Obj*> live;
+        for (Obj* object : block->objects) {
+            if (!object->marked) {
+                object->~Obj();
+                continue;
+            }
+
+            object->marked = false;
+            gc_stats.old_bytes += object->size;
+            live.push_back(object);
+            if (block->large) {
+                continue;
+            }
+
+            size_t offset = static_cast<size_t>(reinterpret_cast<uint8_t*>(object) - block->memory.get());
+            size_t last = (offset + object->size - 1) / kLineSize;
+            for (size_t line = offset / kLineSize; line <= last; ++line) {
+                block->line_used[line] = true;
+            }
+        }
+        block->objects.swap(live);
+    }
+
+    // Give empty blocks back and restart allocation from the first hole
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                                [](const std::unique_ptr<Block>& block) { return block->objects.empty(); }),
+                 blocks.end());
+    alloc_block = 0;
+    alloc_line = 0;
+    old_top = nullptr;
+    old_limit = nullptr;
+}
+
+} // namespace mana
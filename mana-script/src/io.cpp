@@ -0,0 +1,303 @@
+#include "io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef MANASCRIPT_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+namespace mana {
+
+namespace {
+
+// Submission queue entries; completions get twice as many
+constexpr unsigned kRingEntries = 256;
+
+bool ringWanted() {
+    const char* setting = std::getenv("MANASCRIPT_IO_URING");
+    return !setting || std::strcmp(setting, "0") != 0;
+}
+
+// The ring's indices are shared with the kernel
+unsigned loadAcquire(const unsigned* index) {
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* index, unsigned value) {
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+void* mapRing(int fd, size_t size, off_t offset) {
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+} // namespace
+
+// Requests
+
+Channel::Status IoRequest::wait(Task* parker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!done) {
+        if (parker) {
+            waiters.parked.push_back(parker);
+            return Channel::Status::PARKED;
+        }
+        waiters.blocked_threads++;
+        waiters.threads.wait(lock);
+        waiters.blocked_threads--;
+    }
+    return Channel::Status::DONE;
+}
+
+ssize_t IoRequest::result() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+void IoRequest::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = false;
+    bytes = 0;
+}
+
+void IoRequest::complete(ssize_t result) {
+    // Once unlocked, a waiter may destroy the request, so it is not touched again
+    std::vector<Task*> woken;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        bytes = result;
+        woken.swap(waiters.parked);
+        if (waiters.blocked_threads > 0) {
+            waiters.threads.notify_all();
+        }
+    }
+    for (Task* task : woken) {
+        task->wake();
+    }
+}
+
+// Service
+
+IoService& IoService::global() {
+    static IoService* service = new IoService(ringWanted());
+    return *service;
+}
+
+IoService::IoService(bool use_ring) {
+    registered = static_cast<char*>(std::aligned_alloc(4096, kBufferSize * kRegisteredBuffers));
+    for (int i = kRegisteredBuffers - 1; i >= 0; --i) {
+        free_buffers.push_back(i);
+    }
+    if (use_ring && setupRing()) {
+        reaper = std::thread([this] { reap(); });
+    }
+}
+
+IoService::~IoService() {
+    if (ring_fd >= 0) {
+        // A no-op (opcode 0) completing without a request stops the reaper
+        submit(0, -1, Buffer(), 0, 0);
+        reaper.join();
+        teardownRing();
+    }
+    std::free(registered);
+}
+
+IoService::Buffer IoService::acquireBuffer() {
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    if (free_buffers.empty()) {
+        return {new char[kBufferSize], -1};
+    }
+    int index = free_buffers.back();
+    free_buffers.pop_back();
+    return {registered + static_cast<size_t>(index) * kBufferSize, index};
+}
+
+void IoService::releaseBuffer(Buffer buffer) {
+    if (buffer.index < 0) {
+        delete[] buffer.data;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(buffer_mutex);
+    free_buffers.push_back(buffer.index);
+}
+
+void IoService::read(int fd, const Buffer& buffer, uint64_t offset, IoRequest& request) {
+    if (ring_fd < 0) {
+        ssize_t bytes;
+        do {
+            bytes = offset == kStream ? ::read(fd, buffer.data, kBufferSize)
+                                      : pread(fd, buffer.data, kBufferSize, static_cast<off_t>(offset));
+        } while (bytes < 0 && errno == EINTR);
+        if (bytes < 0) {
+            bytes = -errno;
+        } else if (bytes > 0 && offset != kStream) {
+            // Have the kernel fetch the next chunk while this one is used
+            posix_fadvise(fd, static_cast<off_t>(offset) + bytes, kBufferSize, POSIX_FADV_WILLNEED);
+        }
+        request.complete(bytes);
+        return;
+    }
+
+#ifdef MANASCRIPT_HAVE_IO_URING
+    uint8_t opcode = buffers_registered && buffer.index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    int error = submit(opcode, fd, buffer, offset, reinterpret_cast<uint64_t>(&request));
+    if (error < 0) {
+        request.complete(error);
+    }
+#endif
+}
+
+bool IoService::setupRing() {
+#ifdef MANASCRIPT_HAVE_IO_URING
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, kRingEntries, &params));
+    if (fd < 0) {
+        return false;
+    }
+    ring_fd = fd;
+
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map) {
+        ring.sq_size = ring.cq_size = std::max(ring.sq_size, ring.cq_size);
+    }
+    ring.sq_memory = mapRing(fd, ring.sq_size, IORING_OFF_SQ_RING);
+    ring.cq_memory = single_map ? ring.sq_memory : mapRing(fd, ring.cq_size, IORING_OFF_CQ_RING);
+    ring.sqe_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqe_memory = mapRing(fd, ring.sqe_size, IORING_OFF_SQES);
+    if (!ring.sq_memory || !ring.cq_memory || !ring.sqe_memory) {
+        teardownRing();
+        return false;
+    }
+
+    auto* sq = static_cast<char*>(ring.sq_memory);
+    auto* cq = static_cast<char*>(ring.cq_memory);
+    ring.sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring.sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring.sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring.cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring.cqes = cq + params.cq_off.cqes;
+    ring.sqes = ring.sqe_memory;
+
+    // Pinning the pool once saves pinning its pages on every read; without
+    // enough lockable memory reads into it work unregistered
+    std::vector<iovec> buffers(kRegisteredBuffers);
+    for (unsigned i = 0; i < kRegisteredBuffers; ++i) {
+        buffers[i] = {registered + i * kBufferSize, kBufferSize};
+    }
+    buffers_registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(),
+                                 kRegisteredBuffers) == 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IoService::teardownRing() {
+    if (ring.sqe_memory) {
+        munmap(ring.sqe_memory, ring.sqe_size);
+    }
+    if (ring.cq_memory && ring.cq_memory != ring.sq_memory) {
+        munmap(ring.cq_memory, ring.cq_size);
+    }
+    if (ring.sq_memory) {
+        munmap(ring.sq_memory, ring.sq_size);
+    }
+    ring = Ring();
+    close(ring_fd);
+    ring_fd = -1;
+}
+
+int IoService::submit(uint8_t opcode, int fd, const Buffer& buffer, uint64_t offset, uint64_t user_data) {
+#ifdef MANASCRIPT_HAVE_IO_URING
+    std::lock_guard<std::mutex> lock(submit_mutex);
+
+    // Only submitters move the tail, and only under the lock
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & ring.sq_mask;
+    io_uring_sqe* entry = static_cast<io_uring_sqe*>(ring.sqes) + index;
+    std::memset(entry, 0, sizeof(*entry));
+    entry->opcode = opcode;
+    entry->fd = fd;
+    entry->off = offset;
+    entry->user_data = user_data;
+    if (buffer.data) {
+        entry->addr = reinterpret_cast<uint64_t>(buffer.data);
+        entry->len = kBufferSize;
+        entry->buf_index = static_cast<uint16_t>(buffer.index < 0 ? 0 : buffer.index);
+    }
+    ring.sq_array[index] = index;
+    storeRelease(ring.sq_tail, tail + 1);
+    submitted.fetch_add(1, std::memory_order_release);
+
+    // Busy while the reaper catches up with the completions
+    while (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            int error = -errno;
+            // An entry the kernel has taken completes through the reaper.
+            // One it has not must leave the ring, or the next submit would
+            // hand it over for a request the caller has already completed
+            if (loadAcquire(ring.sq_head) != tail + 1) {
+                storeRelease(ring.sq_tail, tail);
+                return error;
+            }
+            return 0;
+        }
+        std::this_thread::yield();
+    }
+    return 0;
+#else
+    (void)opcode, (void)fd, (void)buffer, (void)offset, (void)user_data;
+    return -ENOSYS;
+#endif
+}
+
+void IoService::reap() {
+#ifdef MANASCRIPT_HAVE_IO_URING
+    while (true) {
+        if (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = loadAcquire(ring.cq_tail);
+        // The kernel orders completions after their submissions, but only
+        // this makes the requests' setup visible as far as C++ is concerned
+        submitted.load(std::memory_order_acquire);
+        bool stop = false;
+        for (; head != tail; ++head) {
+            const io_uring_cqe& entry = static_cast<io_uring_cqe*>(ring.cqes)[head & ring.cq_mask];
+            uint64_t user_data = entry.user_data;
+            int32_t result = entry.res;
+            if (user_data == 0) {
+                stop = true;
+            } else {
+                reinterpret_cast<IoRequest*>(user_data)->complete(result);
+            }
+        }
+        storeRelease(ring.cq_head, head);
+        if (stop) {
+            return;
+        }
+    }
+#endif
+}
+
+} // namespace mana
@@ -0,0 +1,33 @@
+#include "isolate.hpp"
+
+namespace mana {
+
+Isolate::Isolate(EngineOptions options)
+    : engine(std::move(options)), machine(engine.options().nursery_size) {
+    machine.setDiagnostics(errors);
+}
+
+RunResult Isolate::run(const CompiledScript& script, const ScriptInputs& inputs) {
+    return engine.run(script, machine, inputs);
+}
+
+RunResult Isolate::call(const std::string& function, const std::vector<Constant>& args) {
+    std::vector<Value> values;
+    values.reserve(args.size());
+    for (const Constant& arg : args) {
+        values.push_back(toValue(machine, arg));
+    }
+
+    size_t reported = errors.getDiagnostics().size();
+    RunResult result;
+    Value value;
+    result.status = machine.call(machine.getGlobal(function), values, &value, engine.options().allocation);
+    if (result.ok()) {
+        result.value = toConstant(value);
+    } else if (errors.getDiagnostics().size() > reported) {
+        result.error = errors.getDiagnostics().back().getMessage();
+    }
+    return result;
+}
+
+} // namespace mana
@@ -0,0 +1,420 @@
+#include "json.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+namespace mana {
+
+namespace {
+
+// Bytes escaped by a backslash; carry says the previous block ended in one
+uint64_t escapedBytes(uint64_t backslashes, uint64_t& carry) {
+    uint64_t escaped = carry;
+    backslashes &= ~carry;   // An escaped backslash escapes nothing
+    carry = 0;
+    while (backslashes) {
+        int i = __builtin_ctzll(backslashes);
+        if (i == 63) {
+            carry = 1;
+            break;
+        }
+        escaped |= 2ULL << i;
+        backslashes &= ~(3ULL << i);
+    }
+    return escaped;
+}
+
+void appendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | code >> 6);
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | code >> 12);
+        out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | code >> 18);
+        out += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+        out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// Four hex digits at p, or -1
+int32_t hexQuad(const char* p) {
+    uint32_t code = 0;
+    auto result = std::from_chars(p, p + 4, code, 16);
+    return result.ptr == p + 4 ? static_cast<int32_t>(code) : -1;
+}
+
+} // namespace
+
+std::shared_ptr<const JsonDocument> JsonDocument::parse(std::string_view text) {
+    auto document = std::make_shared<JsonDocument>();
+    if (text.size() >= UINT32_MAX) {
+        document->fail(0, "the input is 4 GB or more");
+    }
+    document->text.assign(text);
+    document->index();
+    document->link();
+    return document;
+}
+
+// Stage one: the offset of every token, from masks of each 64-byte block
+void JsonDocument::index() {
+    const size_t size = text.size();
+    size_t capacity = size / 4 + kSimdBlockSize;
+    offsets.reset(new uint32_t[capacity]);
+
+    uint64_t escape_carry = 0;
+    uint64_t string_carry = 0;   // All ones while a string goes on into the next block
+    uint64_t scalar_carry = 0;
+    char tail[kSimdBlockSize];
+    for (size_t base = 0; base < size; base += kSimdBlockSize) {
+        const char* p = text.data() + base;
+        if (size - base < kSimdBlockSize) {
+            // Pad the last block with spaces, which are never tokens
+            std::memset(tail, ' ', sizeof(tail));
+            std::memcpy(tail, p, size - base);
+            p = tail;
+        }
+
+        SimdBlock block(p);
+        uint64_t escaped = escapedBytes(block.eq('\\'), escape_carry);
+        uint64_t quotes = block.eq('"') & ~escaped;
+        uint64_t in_string = prefixXor(quotes) ^ string_carry;
+        string_carry = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+        uint64_t string_bytes = in_string | quotes;
+
+        uint64_t operators = block.eq('{') | block.eq('}') | block.eq('[') | block.eq(']') |
+                             block.eq(':') | block.eq(',');
+        uint64_t spaces = block.eq(' ') | block.eq('\t') | block.eq('\n') | block.eq('\r');
+
+        // Numbers and literals start where a run of other bytes does
+        uint64_t scalars = ~(operators | spaces | string_bytes);
+        uint64_t scalar_starts = scalars & ~(scalars << 1 | scalar_carry);
+        scalar_carry = scalars >> 63;
+
+        uint64_t tokens = (operators & ~string_bytes) | (quotes & in_string) | scalar_starts;
+        if (capacity - count < kSimdBlockSize) {
+            capacity *= 2;
+            std::unique_ptr<uint32_t[]> grown(new uint32_t[capacity]);
+            std::memcpy(grown.get(), offsets.get(), count * sizeof(uint32_t));
+            offsets = std::move(grown);
+        }
+        count = static_cast<uint32_t>(flattenBits(tokens, static_cast<uint32_t>(base), offsets.get() + count) -
+                                      offsets.get());
+    }
+
+    if (string_carry) {
+        fail(static_cast<uint32_t>(size), "a string is not closed");
+    }
+}
+
+// Stage two: check the grammar over the tokens and link brackets
+void JsonDocument::link() {
+    enum class Expect { VALUE, FIRST_VALUE, FIRST_KEY, KEY, COLON, NEXT, END };
+
+    closers.reset(new uint32_t[count]);
+    std::vector<uint32_t> open;
+    Expect expect = Expect::VALUE;
+    auto afterValue = [&] { return open.empty() ? Expect::END : Expect::NEXT; };
+    auto close = [&](uint32_t token) {
+        char opener = open.empty() ? 0 : at(open.back());
+        if ((at(token) == '}' && opener != '{') || (at(token) == ']' && opener != '[')) {
+            fail(offsets[token], std::string("unexpected '") + at(token) + "'");
+        }
+        closers[open.back()] = token;
+        open.pop_back();
+        expect = afterValue();
+    };
+
+    for (uint32_t token = 0; token < count; ++token) {
+        char c = at(token);
+        switch (expect) {
+            case Expect::FIRST_KEY:
+                if (c == '}') {
+                    close(token);
+                    break;
+                }
+                [[fallthrough]];
+            case Expect::KEY:
+                if (c != '"') {
+                    fail(offsets[token], "expected a string key");
+                }
+                expect = Expect::COLON;
+                break;
+            case Expect::COLON:
+                if (c != ':') {
+                    fail(offsets[token], "expected ':'");
+                }
+                expect = Expect::VALUE;
+                break;
+            case Expect::FIRST_VALUE:
+                if (c == ']') {
+                    close(token);
+                    break;
+                }
+                [[fallthrough]];
+            case Expect::VALUE:
+                if (c == '{' || c == '[') {
+                    open.push_back(token);
+                    expect = c == '{' ? Expect::FIRST_KEY : Expect::FIRST_VALUE;
+                } else if (c == '}' || c == ']' || c == ':' || c == ',') {
+                    fail(offsets[token], "expected a value");
+                } else {
+                    expect = afterValue();
+                }
+                break;
+            case Expect::NEXT:
+                if (c == ',') {
+                    expect = at(open.back()) == '{' ? Expect::KEY : Expect::VALUE;
+                } else if (c == '}' || c == ']') {
+                    close(token);
+                } else {
+                    fail(offsets[token], "expected ',' or a closing bracket");
+                }
+                break;
+            case Expect::END:
+                fail(offsets[token], "unexpected text after the value");
+        }
+    }
+
+    if (count == 0) {
+        fail(0, "no value");
+    }
+    if (expect != Expect::END) {
+        fail(static_cast<uint32_t>(text.size()), open.empty() ? "unexpected end" : "a bracket is not closed");
+    }
+}
+
+JsonDocument::Kind JsonDocument::kind(uint32_t value) const {
+    switch (at(value)) {
+        case '{': return Kind::OBJECT;
+        case '[': return Kind::ARRAY;
+        case '"': return Kind::STRING;
+        case 't':
+        case 'f':
+        case 'n': {
+            std::string_view literal = raw(value);
+            if (literal == "true" || literal == "false") {
+                return Kind::BOOLEAN;
+            }
+            if (literal == "null") {
+                return Kind::NULL_VALUE;
+            }
+            fail(offsets[value], "unknown literal '" + std::string(literal) + "'");
+        }
+        default:
+            return Kind::NUMBER;
+    }
+}
+
+uint32_t JsonDocument::member(uint32_t object, std::string_view key) const {
+    std::string scratch;
+    uint32_t token = object + 1;
+    while (at(token) != '}') {
+        // A key, its ':' and its value
+        if (string(token, scratch) == key) {
+            return token + 2;
+        }
+        uint32_t next = skip(token + 2);
+        token = at(next) == ',' ? next + 1 : next;
+    }
+    return kNone;
+}
+
+uint32_t JsonDocument::element(uint32_t array, size_t position, Cursor& cursor) const {
+    size_t at_position = 0;
+    uint32_t token = array + 1;
+    if (cursor.value != kNone && cursor.position <= position) {
+        at_position = cursor.position;
+        token = cursor.value;
+    } else if (at(token) == ']') {
+        return kNone;
+    }
+
+    while (at_position < position) {
+        token = nextElement(token);
+        if (token == kNone) {
+            return kNone;
+        }
+        at_position++;
+    }
+    cursor.position = at_position;
+    cursor.value = token;
+    return token;
+}
+
+size_t JsonDocument::size(uint32_t container) const {
+    uint32_t token = container + 1;
+    if (at(token) == '}' || at(token) == ']') {
+        return 0;
+    }
+    bool object = at(container) == '{';
+    size_t members = 1;
+    // Members are a key, its ':' and its value
+    while ((token = nextElement(object ? token + 2 : token)) != kNone) {
+        members++;
+    }
+    return members;
+}
+
+std::string_view JsonDocument::string(uint32_t value, std::string& scratch) const {
+    std::string_view quoted = raw(value);
+    std::string_view chars = quoted.substr(1, quoted.size() - 2);
+    if (chars.find('\\') == std::string_view::npos) {
+        return chars;
+    }
+
+    scratch.clear();
+    for (size_t i = 0; i < chars.size(); ++i) {
+        if (chars[i] != '\\') {
+            scratch += chars[i];
+            continue;
+        }
+        uint32_t offset = offsets[value] + 1 + static_cast<uint32_t>(i);
+        char escape = ++i < chars.size() ? chars[i] : 0;
+        switch (escape) {
+            case '"':  scratch += '"'; break;
+            case '\\': scratch += '\\'; break;
+            case '/':  scratch += '/'; break;
+            case 'b':  scratch += '\b'; break;
+            case 'f':  scratch += '\f'; break;
+            case 'n':  scratch += '\n'; break;
+            case 'r':  scratch += '\r'; break;
+            case 't':  scratch += '\t'; break;
+            case 'u': {
+                int32_t code = i + 4 < chars.size() ? hexQuad(chars.data() + i + 1) : -1;
+                if (code < 0) {
+                    fail(offset, "bad \\u escape");
+                }
+                i += 4;
+                // A surrogate pair spells one character past the first 64K
+                if (code >= 0xD800 && code < 0xDC00 && i + 6 < chars.size() &&
+                    chars[i + 1] == '\\' && chars[i + 2] == 'u') {
+                    int32_t low = hexQuad(chars.data() + i + 3);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                appendUtf8(scratch, static_cast<uint32_t>(code));
+                break;
+            }
+            default:
+                fail(offset, "bad escape");
+        }
+    }
+    return scratch;
+}
+
+Value JsonDocument::number(uint32_t value) const {
+    std::string_view chars = raw(value);
+    const char* begin = chars.data();
+    const char* end = begin + chars.size();
+    if (*begin != '-' && (*begin < '0' || *begin > '9')) {
+        fail(offsets[value], "unexpected '" + std::string(chars) + "'");
+    }
+
+    if (chars.find_first_of(".eE") == std::string_view::npos) {
+        int64_t integer = 0;
+        auto result = std::from_chars(begin, end, integer);
+        if (result.ec == std::errc() && result.ptr == end && integer >= INT32_MIN && integer <= INT32_MAX) {
+            return Value::integer(static_cast<int32_t>(integer));
+        }
+    }
+    double number = 0;
+    auto result = std::from_chars(begin, end, number);
+    if (result.ec != std::errc() || result.ptr != end) {
+        fail(offsets[value], "bad number '" + std::string(chars) + "'");
+    }
+    return Value::number(number);
+}
+
+// The token after a value
+uint32_t JsonDocument::skip(uint32_t value) const {
+    return at(value) == '{' || at(value) == '[' ? closers[value] + 1 : value + 1;
+}
+
+// The element after this one in an array, or in an object the key after
+// this value; kNone at the end
+uint32_t JsonDocument::nextElement(uint32_t value) const {
+    uint32_t next = skip(value);
+    return at(next) == ',' ? next + 1 : kNone;
+}
+
+void JsonDocument::fail(uint32_t offset, const std::string& message) const {
+    throw RuntimeError("Invalid JSON at byte " + std::to_string(offset) + ": " + message);
+}
+
+Value jsonValue(VM& vm, const std::shared_ptr<const JsonDocument>& document, uint32_t value) {
+    switch (document->kind(value)) {
+        case JsonDocument::Kind::OBJECT:
+        case JsonDocument::Kind::ARRAY:
+            return Value::object(vm.allocate<ObjJson>(Generation::YOUNG, document, value));
+        case JsonDocument::Kind::STRING: {
+            std::string scratch;
+            return Value::object(vm.newString(document->string(value, scratch)));
+        }
+        case JsonDocument::Kind::NUMBER:
+            return document->number(value);
+        case JsonDocument::Kind::BOOLEAN:
+            return Value::boolean(document->boolean(value));
+        case JsonDocument::Kind::NULL_VALUE:
+            break;
+    }
+    return Value::nil();
+}
+
+// Builtins
+
+Value nativeParseJson(VM& vm, int, const Value* args) {
+    if (!isString(args[0])) {
+        throw RuntimeError(std::string("parse_json() expects a string, not ") + args[0].typeName());
+    }
+    auto document = JsonDocument::parse(vm.flatten(asString(args[0]))->view());
+    return jsonValue(vm, document, JsonDocument::kRoot);
+}
+
+Value nativeJsonGet(VM& vm, int, const Value* args) {
+    if (!isJson(args[0])) {
+        throw RuntimeError(std::string("json_get() expects a JSON object or array, not ") + args[0].typeName());
+    }
+    ObjJson* view = asJson(args[0]);
+    std::shared_ptr<const JsonDocument> document = view->document;
+
+    uint32_t found;
+    if (document->kind(view->value) == JsonDocument::Kind::OBJECT) {
+        if (!isString(args[1])) {
+            throw RuntimeError(std::string("json_get() expects a key for a JSON object, not ") + args[1].typeName());
+        }
+        found = document->member(view->value, vm.flatten(asString(args[1]))->view());
+    } else {
+        if (!args[1].isInt()) {
+            throw RuntimeError(std::string("json_get() expects an index for a JSON array, not ") +
+                               args[1].typeName());
+        }
+        if (args[1].asInt() < 0) {
+            return Value::nil();
+        }
+        found = document->element(view->value, static_cast<size_t>(args[1].asInt()), view->cursor);
+    }
+    return found == JsonDocument::kNone ? Value::nil() : jsonValue(vm, document, found);
+}
+
+Value nativeJsonLen(VM&, int, const Value* args) {
+    if (!isJson(args[0])) {
+        throw RuntimeError(std::string("json_len() expects a JSON object or array, not ") + args[0].typeName());
+    }
+    ObjJson* view = asJson(args[0]);
+    return Value::integer(static_cast<int32_t>(view->document->size(view->value)));
+}
+
+} // namespace mana
@@ -7,7 +7,30 @@
 namespace mana {
 
 Lexer::Lexer(const std::string& source, const std::string& filename)
-    : source(source), filename(filename) {}
+    : filename(filename) {
+    load(source);
+}
+
+Lexer::Lexer(const std::string& source, CompilationContext& context)
+    : filename(context.filename()), reports(&context.reports()) {
+    // Held by the context and the prototypes compiled in it, not forever
+    std::shared_ptr<const SourceBuffer> buffer = SourceManager::global().share(filename, source);
+    context.keepSource(buffer);
+    file = buffer->file();
+    open(file);
+}
+
+// The SourceManager keeps the text for as long as tokens may point into it
+void Lexer::load(const std::string& text) {
+    file = SourceManager::global().addBuffer(filename, text);
+    open(file);
+}
+
+void Lexer::open(FileId buffer) {
+    SourceManager& sources = SourceManager::global();
+    source = sources.text(buffer);
+    base = sources.location(buffer, 0);
+}
 
 std::vector<Token> Lexer::scanTokens() {
     tokens.clear();
@@ -22,7 +45,7 @@ std::vector<Token> Lexer::scanTokens() {
     }
     
     // Add EOF token
-    tokens.emplace_back(TokenType::END_OF_FILE, "", line, column);
+    tokens.emplace_back(TokenType::END_OF_FILE, "", line, column, base.advanced(current));
     return tokens;
 }
 
@@ -54,12 +77,12 @@ bool Lexer::match(char expected) {
 }
 
 void Lexer::addToken(TokenType type) {
-    std::string lexeme = source.substr(start, current - start);
-    tokens.emplace_back(type, lexeme, line, column - lexeme.length());
+    std::string lexeme(source.substr(start, current - start));
+    tokens.emplace_back(type, lexeme, line, column - lexeme.length(), base.advanced(start));
 }
 
 void Lexer::addToken(TokenType type, const std::string& lexeme) {
-    tokens.emplace_back(type, lexeme, line, column - lexeme.length());
+    tokens.emplace_back(type, lexeme, line, column - lexeme.length(), base.advanced(start));
 }
 
 void Lexer::scanToken() {
@@ -93,14 +116,14 @@ void Lexer::scanToken() {
             if (match('&')) {
                 addToken(TokenType::AND);
             } else {
-                reportError("Unexpected character '&'");
+                reportError(DiagnosticCode::UNEXPECTED_CHARACTER, "&");
             }
             break;
         case '|': 
             if (match('|')) {
                 addToken(TokenType::OR);
             } else {
-                reportError("Unexpected character '|'");
+                reportError(DiagnosticCode::UNEXPECTED_CHARACTER, "|");
             }
             break;
         
@@ -133,7 +156,7 @@ void Lexer::scanToken() {
                 }
                 
                 if (nesting > 0) {
-                    reportError("Unterminated comment");
+                    reportError(DiagnosticCode::UNTERMINATED_COMMENT);
                 }
             } else {
                 addToken(TokenType::SLASH);
@@ -162,7 +185,7 @@ void Lexer::scanToken() {
             } else if (std::isalpha(c) || c == '_') {
                 scanIdentifier();
             } else {
-                reportError(std::string("Unexpected character '") + c + "'");
+                reportError(DiagnosticCode::UNEXPECTED_CHARACTER, c);
             }
             break;
     }
@@ -188,7 +211,7 @@ void Lexer::scanString() {
                 case '\\': value += '\\'; break;
                 case '"': value += '"'; break;
                 default:
-                    reportError(std::string("Invalid escape sequence '\\") + peek() + "'");
+                    reportError(DiagnosticCode::INVALID_ESCAPE, peek());
                     break;
             }
             advance();
@@ -198,7 +221,7 @@ void Lexer::scanString() {
     }
     
     if (isAtEnd()) {
-        reportError("Unterminated string");
+        reportError(DiagnosticCode::UNTERMINATED_STRING);
         return;
     }
     
@@ -219,7 +242,7 @@ void Lexer::scanNumber() {
             hasDigits = true;
         }
         if (!hasDigits) {
-            reportError("Invalid hexadecimal number");
+            reportError(DiagnosticCode::INVALID_NUMBER, "hexadecimal");
             return;
         }
         addToken(TokenType::INTEGER_LITERAL);
@@ -235,7 +258,7 @@ void Lexer::scanNumber() {
             hasDigits = true;
         }
         if (!hasDigits) {
-            reportError("Invalid binary number");
+            reportError(DiagnosticCode::INVALID_NUMBER, "binary");
             return;
         }
         addToken(TokenType::INTEGER_LITERAL);
@@ -268,7 +291,7 @@ void Lexer::scanNumber() {
             
             // Must have at least one digit after 'e'
             if (!std::isdigit(peek())) {
-                reportError("Invalid scientific notation");
+                reportError(DiagnosticCode::INVALID_EXPONENT);
                 return;
             }
             
@@ -290,7 +313,7 @@ void Lexer::scanIdentifier() {
     }
     
     // Check if the identifier is a keyword
-    std::string text = source.substr(start, current - start);
+    std::string text(source.substr(start, current - start));
     TokenType type = Keywords::getKeyword(text);
     
     if (type == TokenType::TRUE || type == TokenType::FALSE) {
@@ -300,39 +323,12 @@ void Lexer::scanIdentifier() {
     }
 }
 
-void Lexer::reportError(const std::string& message) {
-    SourceLocation location = getCurrentLocation();
-    std::string context = getLineContext();
-    
-    diagnostics.report(
-        DiagnosticSeverity::ERROR,
-        message,
-        location,
-        context
-    );
-    
-    // Add an error token
-    tokens.emplace_back(TokenType::ERROR, message, line, column);
-}
-
-SourceLocation Lexer::getCurrentLocation() const {
-    return SourceLocation(filename, line, column);
-}
-
-std::string Lexer::getLineContext() const {
-    // Find the start of the current line
-    int lineStart = start;
-    while (lineStart > 0 && source[lineStart - 1] != '\n') {
-        lineStart--;
-    }
-    
-    // Find the end of the current line
-    int lineEnd = current;
-    while (lineEnd < static_cast<int>(source.length()) && source[lineEnd] != '\n') {
-        lineEnd++;
-    }
+void Lexer::reportError(DiagnosticCode code, DiagnosticArg arg) {
+    reports->report(DiagnosticSeverity::ERROR, code, file, line, column, std::move(arg));
     
-    return source.substr(lineStart, lineEnd - lineStart);
+    // Add an error token holding the offending text
+    tokens.emplace_back(TokenType::ERROR, std::string(source.substr(start, current - start)), line, column,
+                        base.advanced(start));
 }
 
 } // namespace mana
\ No newline at end of file
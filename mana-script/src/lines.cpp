@@ -0,0 +1,148 @@
+#include "lines.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mana {
+
+namespace {
+
+std::string_view withoutCarriageReturn(const char* begin, const char* end) {
+    if (end > begin && end[-1] == '\r') {
+        --end;
+    }
+    return std::string_view(begin, static_cast<size_t>(end - begin));
+}
+
+} // namespace
+
+// Scanner
+
+LineScanner::LineScanner(const char* begin, const char* end)
+    : start(begin), block(begin), scanned(begin), end(end) {}
+
+bool LineScanner::next(std::string_view& line, bool last) {
+    while (mask == 0) {
+        if (!scanBlock()) {
+            if (last && start < end) {
+                line = withoutCarriageReturn(start, end);
+                start = end;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    // The lowest bit is the first line break not returned yet
+    const char* newline = block + __builtin_ctzll(mask);
+    mask &= mask - 1;
+    line = withoutCarriageReturn(start, newline);
+    start = newline + 1;
+    return true;
+}
+
+// Describe the next 64 bytes, or however many are left, in mask
+bool LineScanner::scanBlock() {
+    if (scanned >= end) {
+        return false;
+    }
+    block = scanned;
+    size_t left = std::min(static_cast<size_t>(end - block), kSimdBlockSize);
+    if (left == kSimdBlockSize) {
+        mask = SimdBlock(block).eq('\n');
+    } else {
+        for (size_t i = 0; i < left; ++i) {
+            mask |= static_cast<uint64_t>(block[i] == '\n') << i;
+        }
+    }
+    scanned = block + left;
+    return true;
+}
+
+// Input
+
+std::unique_ptr<LineInput> LineInput::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw RuntimeError("Cannot open '" + path + "': " + std::strerror(errno));
+    }
+    return std::unique_ptr<LineInput>(new LineInput(fd, path, true));
+}
+
+std::unique_ptr<LineInput> LineInput::standardInput() {
+    return std::unique_ptr<LineInput>(new LineInput(STDIN_FILENO, "<stdin>", false));
+}
+
+LineInput::LineInput(int fd, std::string name, bool owns_fd)
+    : fd(fd), name(std::move(name)), owns_fd(owns_fd) {
+    // Files that report no size, as under /proc, are read like pipes
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        size_t size = static_cast<size_t>(info.st_size);
+        void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory != MAP_FAILED) {
+            madvise(memory, size, MADV_SEQUENTIAL);
+            mapping = memory;
+            mapped_size = size;
+            const char* text = static_cast<const char*>(memory);
+            scanner = LineScanner(text, text + size);
+            return;
+        }
+    }
+    buffer.resize(kBlockSize);
+}
+
+LineInput::~LineInput() {
+    if (mapping) {
+        munmap(mapping, mapped_size);
+    }
+    if (owns_fd) {
+        ::close(fd);
+    }
+}
+
+bool LineInput::next(std::string_view& line) {
+    while (!scanner.next(line, false)) {
+        if (!mapping && !at_end) {
+            refill();
+            continue;
+        }
+        // The text after the last line break, from a mapping or a pipe alike,
+        // loses a trailing '\r' the way every other line does
+        return scanner.next(line, true);
+    }
+    return true;
+}
+
+// Keep the unfinished line and read more after it
+void LineInput::refill() {
+    std::string_view rest = scanner.rest();
+    size_t kept = rest.size();
+    if (kept > 0) {
+        std::memmove(buffer.data(), rest.data(), kept);
+    }
+    if (kept == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    ssize_t count;
+    do {
+        count = ::read(fd, buffer.data() + kept, buffer.size() - kept);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        throw RuntimeError("Cannot read '" + name + "': " + std::strerror(errno));
+    }
+    at_end = count == 0;
+
+    size_t filled = kept + static_cast<size_t>(count);
+    scanner = LineScanner(buffer.data(), buffer.data() + filled);
+}
+
+} // namespace mana
@@ -7,9 +7,14 @@
 #include "parser.hpp"
 #include "ast.hpp"
 #include "transpiler.hpp"
+#include "engine.hpp"
+#include "vm.hpp"
+#include "output.hpp"
 #include "error.hpp"
 #include "token.hpp"
+#include "lines.hpp"
 
+#include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -28,11 +33,22 @@ void printUsage() {
               << "  -h, --help     Show this help message\n"
               << "  -v, --version  Show version information\n"
               << "  -i, --interactive  Start interactive mode\n"
-              << "  -t, --tokenize Show tokenized output\n\n"
+              << "  -t, --tokenize Show tokenized output\n"
+              << "  -d, --disassemble  Show compiled bytecode\n"
+              << "  --opcode-pairs Run unoptimized bytecode and report executed opcode pairs\n"
+              << "  --gc-stats     Run and report garbage collector pauses\n"
+              << "  --arena        Run main() in a per-call arena and report garbage collector use\n"
+              << "  -n script [input]  Call each(line) for every line of input or stdin\n"
+              << "  -p script [input]  Like -n, printing what each(line) returns unless nil\n\n"
               << "Examples:\n"
               << "  manascript script.ms        Run a script file\n"
               << "  manascript -i              Start interactive mode\n"
-              << "  manascript -t script.ms    Show tokenized output\n";
+              << "  manascript -t script.ms    Show tokenized output\n"
+              << "  manascript -d script.ms    Show compiled bytecode\n"
+              << "  manascript --opcode-pairs script.ms  Profile opcode pairs\n"
+              << "  manascript --gc-stats script.ms      Show GC pause histograms\n"
+              << "  manascript --arena script.ms         Run main() without collecting\n"
+              << "  manascript -p filter.ms big.log      Filter a file line by line\n";
 }
 
 void printVersion() {
@@ -51,15 +67,92 @@ void printTokens(const std::vector<Token>& tokens) {
     std::cout << "----------------\n";
 }
 
+/**
+ * @brief How runFile() should treat the script
+ */
+enum class RunMode {
+    EXECUTE,
+    TOKENIZE,
+    DISASSEMBLE,
+    PROFILE_PAIRS,
+    GC_STATS,
+    ARENA
+};
+
+/**
+ * @brief Print the most frequent opcode pairs to stderr
+ */
+void printOpcodePairs(const std::vector<OpcodePairCount>& pairs, size_t limit) {
+    uint64_t total = 0;
+    for (const auto& pair : pairs) {
+        total += pair.count;
+    }
+
+    std::cerr << "\nOpcode pairs (" << total << " executed):\n";
+    for (size_t i = 0; i < pairs.size() && i < limit; ++i) {
+        const OpcodePairCount& pair = pairs[i];
+        std::string name = std::string(opcodeName(pair.first)) + " -> " + opcodeName(pair.second);
+        std::cerr << "  " << std::left << std::setw(24) << name << std::right
+                  << std::setw(14) << pair.count << "  "
+                  << std::fixed << std::setprecision(2)
+                  << 100.0 * static_cast<double>(pair.count) / static_cast<double>(total) << "%\n";
+    }
+}
+
+void printPauseHistogram(const char* name, const PauseHistogram& histogram) {
+    if (histogram.count == 0) {
+        std::cerr << name << " collections: none\n";
+        return;
+    }
+
+    std::cerr << name << " collections: " << histogram.count
+              << " (mean " << histogram.total_ns / histogram.count / 1000 << "us"
+              << ", max " << histogram.max_ns / 1000 << "us)\n";
+
+    uint64_t lower = 0;
+    for (size_t i = 0; i < histogram.buckets.size(); ++i) {
+        std::string range = i < PauseHistogram::kBucketLimitsUs.size()
+            ? std::to_string(lower) + "-" + std::to_string(PauseHistogram::kBucketLimitsUs[i]) + "us"
+            : ">=" + std::to_string(lower) + "us";
+        std::cerr << "  " << std::left << std::setw(14) << range << std::right
+                  << std::setw(10) << histogram.buckets[i] << "\n";
+        if (i < PauseHistogram::kBucketLimitsUs.size()) {
+            lower = PauseHistogram::kBucketLimitsUs[i];
+        }
+    }
+}
+
+/**
+ * @brief Print collector pauses and heap usage to stderr
+ */
+void printGcStats(const GcStats& stats) {
+    std::cerr << "\nGC: " << stats.promoted_bytes / 1024 << " KB promoted, "
+              << stats.old_bytes / 1024 << " KB in old space\n";
+    if (stats.arena_bytes > 0) {
+        std::cerr << "Arena: " << stats.arena_bytes / 1024 << " KB allocated, "
+                  << stats.evacuated_bytes / 1024 << " KB copied out\n";
+    }
+    printPauseHistogram("Minor", stats.minor);
+    printPauseHistogram("Major", stats.major);
+}
+
 void runInteractiveMode() {
     std::cout << "ManaScript Interactive Mode\n"
               << "Type 'exit' or 'quit' to exit\n"
               << "Type 'help' for help\n\n";
 
+    // Globals persist from one line to the next; a line never calls main()
+    EngineOptions options;
+    options.entry.clear();
+    Engine engine(options);
+    VM vm;
+
     std::string line;
     while (true) {
         std::cout << "> ";
-        std::getline(std::cin, line);
+        if (!std::getline(std::cin, line)) {
+            break;
+        }
 
         if (line == "exit" || line == "quit") {
             break;
@@ -84,38 +177,147 @@ void runInteractiveMode() {
         }
 
         try {
-            Lexer lexer(line);
-            auto tokens = lexer.scanTokens();
-            printTokens(tokens);
+            auto script = engine.compile(line);
+            if (script) {
+                engine.run(*script, vm);
+            }
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << "\n";
         }
+
+        // Script output goes before its errors and the next prompt
+        OutputBuffer::forThread().flush();
+        diagnostics.printDiagnostics();
+        diagnostics.clear();
     }
 }
 
-void runFile(const std::string& filename, bool showTokens) {
+int runFile(const std::string& filename, RunMode mode) {
     try {
         std::ifstream file(filename);
         if (!file.is_open()) {
             std::cerr << "Error: Could not open file '" << filename << "'\n";
-            return;
+            return 1;
         }
 
         std::string content((std::istreambuf_iterator<char>(file)),
                            std::istreambuf_iterator<char>());
         
-        Lexer lexer(content, filename);
-        auto tokens = lexer.scanTokens();
+        if (mode == RunMode::TOKENIZE) {
+            Lexer lexer(content, filename);
+            printTokens(lexer.scanTokens());
+            return 0;
+        }
+
+        // Pair counts are for choosing superinstructions, so they are taken
+        // on the code as the compiler emits it, before the peephole pass
+        EngineOptions options;
+        options.optimize = mode != RunMode::PROFILE_PAIRS;
+        options.allocation = mode == RunMode::ARENA ? AllocationMode::ARENA : AllocationMode::HEAP;
+        Engine engine(options);
+
+        auto script = engine.compile(content, filename);
+        if (!script) {
+            diagnostics.printDiagnostics();
+            return 1;
+        }
+
+        if (mode == RunMode::DISASSEMBLE) {
+            std::cout << disassemble(*script->bytecode());
+            return 0;
+        }
+
+        // Scripts written around an entry point get it called after top-level code
+        VM vm(options.nursery_size);
+        vm.setOpcodeProfiling(mode == RunMode::PROFILE_PAIRS);
+        RunResult result = engine.run(*script, vm);
+        OutputBuffer::forThread().flush();
+
+        if (mode == RunMode::PROFILE_PAIRS) {
+            printOpcodePairs(vm.opcodePairs(), 20);
+        }
+        if (mode == RunMode::GC_STATS || mode == RunMode::ARENA) {
+            printGcStats(vm.gcStats());
+        }
 
-        if (showTokens) {
-            printTokens(tokens);
-        } else {
-            // TODO: Add parser and interpreter here
-            std::cout << "Running script: " << filename << "\n";
+        if (!result.ok()) {
+            diagnostics.printDiagnostics();
+            return 1;
         }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
+        return 1;
     }
+    return 0;
+}
+
+/**
+ * @brief Stream lines through a script, awk-style
+ *
+ * The script is compiled once and its top-level code runs first. Then its
+ * each(line) function is called for every line, in one arena that is reset
+ * every so often, and its end() function, if it has one, once the input is
+ * used up.
+ */
+int runLines(const std::string& filename, const std::string& input_path, bool print_results) {
+    try {
+        EngineOptions options;
+        options.entry.clear();
+        Engine engine(options);
+        auto script = engine.compileFile(filename);
+        if (!script) {
+            diagnostics.printDiagnostics();
+            return 1;
+        }
+
+        VM vm(options.nursery_size);
+        RunResult result = engine.run(*script, vm);
+        Value each = vm.getGlobal("each");
+        if (result.ok() && !isFunction(each)) {
+            std::cerr << "Error: '" << filename << "' has no each(line) function\n";
+            return 1;
+        }
+
+        if (result.ok()) {
+            auto input = input_path.empty() ? LineInput::standardInput() : LineInput::open(input_path);
+            OutputBuffer& output = OutputBuffer::forThread();
+            auto next = [&](std::string_view& line) { return input->next(line); };
+            auto print = [&](Value value) {
+                if (value.isNil()) {
+                    return;
+                }
+                if (isString(value)) {
+                    output.write(vm.flatten(asString(value))->view());
+                } else if (value.isInt()) {
+                    output.write(value.asInt());
+                } else if (value.isDouble()) {
+                    output.write(value.asDouble());
+                } else {
+                    output.write(value.toString());
+                }
+                output.write('\n');
+            };
+            InterpretResult status = vm.callEach(each, next, print_results ? print : std::function<void(Value)>(),
+                                                 AllocationMode::ARENA);
+
+            Value end = vm.getGlobal("end");
+            if (status == InterpretResult::OK && isFunction(end)) {
+                status = vm.call(end, {});
+            }
+            result.status = status;
+        }
+        OutputBuffer::forThread().flush();
+
+        if (!result.ok()) {
+            diagnostics.printDiagnostics();
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        OutputBuffer::forThread().flush();
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
 }
 
 } // namespace mana
@@ -143,18 +345,48 @@ int main(int argc, char* argv[]) {
         return 0;
     }
     
-    bool showTokens = false;
-    if (arg == "-t" || arg == "--tokenize") {
-        showTokens = true;
+    if (arg == "-t" || arg == "--tokenize" || arg == "-d" || arg == "--disassemble") {
         if (argc < 3) {
             std::cerr << "Error: No input file specified\n";
             return 1;
         }
-        mana::runFile(argv[2], showTokens);
-        return 0;
+        bool tokenize = arg == "-t" || arg == "--tokenize";
+        return mana::runFile(argv[2], tokenize ? mana::RunMode::TOKENIZE
+                                               : mana::RunMode::DISASSEMBLE);
     }
     
+    if (arg == "--opcode-pairs") {
+        if (argc < 3) {
+            std::cerr << "Error: No input file specified\n";
+            return 1;
+        }
+        return mana::runFile(argv[2], mana::RunMode::PROFILE_PAIRS);
+    }
+
+    if (arg == "--gc-stats") {
+        if (argc < 3) {
+            std::cerr << "Error: No input file specified\n";
+            return 1;
+        }
+        return mana::runFile(argv[2], mana::RunMode::GC_STATS);
+    }
+
+    if (arg == "--arena") {
+        if (argc < 3) {
+            std::cerr << "Error: No input file specified\n";
+            return 1;
+        }
+        return mana::runFile(argv[2], mana::RunMode::ARENA);
+    }
+
+    if (arg == "-n" || arg == "-p") {
+        if (argc < 3) {
+            std::cerr << "Error: No script specified\n";
+            return 1;
+        }
+        return mana::runLines(argv[2], argc > 3 ? argv[3] : "", arg == "-p");
+    }
+
     // If no special flags, treat as a file
-    mana::runFile(arg, showTokens);
-    return 0;
+    return mana::runFile(arg, mana::RunMode::EXECUTE);
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "map.hpp"
+#include "vm.hpp"
+
+#include <cstdint>
+
+namespace mana {
+
+void ObjMap::set(Value key, Value value) {
+    if (value.isNil()) {
+        remove(key);
+        return;
+    }
+
+    Layout wanted = key.isInt() ? Layout::INTS : isString(key) ? Layout::STRINGS : Layout::MIXED;
+    if (layout != wanted && count() == 0) {
+        // Nothing to keep, so start over in the layout the key wants
+        ints = FlatTable<IntKeys>();
+        strings = FlatTable<StringKeys>();
+        mixed = FlatTable<ValueKeys>();
+        layout = wanted;
+    } else if (layout != wanted && layout != Layout::MIXED) {
+        spill();
+    }
+
+    switch (layout) {
+        case Layout::INTS:
+            ints.valueAt(ints.insert(key.asInt())) = value;
+            break;
+        case Layout::STRINGS:
+            strings.valueAt(strings.insert(key)) = value;
+            break;
+        default:
+            mixed.valueAt(mixed.insert(key)) = value;
+            break;
+    }
+}
+
+bool ObjMap::remove(Value key) {
+    switch (layout) {
+        case Layout::INTS:    return key.isInt() && ints.erase(key.asInt());
+        case Layout::STRINGS: return isString(key) && strings.erase(key);
+        case Layout::MIXED:   return mixed.erase(key);
+        case Layout::EMPTY:   break;
+    }
+    return false;
+}
+
+Value ObjMap::next(Value key) const {
+    size_t from = 0;
+    if (!key.isNil()) {
+        size_t slot = FlatTable<ValueKeys>::kNoSlot;
+        switch (layout) {
+            case Layout::INTS:    slot = key.isInt() ? ints.find(key.asInt()) : slot; break;
+            case Layout::STRINGS: slot = isString(key) ? strings.find(key) : slot; break;
+            case Layout::MIXED:   slot = mixed.find(key); break;
+            case Layout::EMPTY:   break;
+        }
+        if (slot == FlatTable<ValueKeys>::kNoSlot) {
+            throw RuntimeError("map_next() was given a key that is not in the map");
+        }
+        from = slot + 1;
+    }
+
+    switch (layout) {
+        case Layout::INTS: {
+            size_t slot = ints.next(from);
+            return slot == FlatTable<IntKeys>::kNoSlot ? Value::nil() : Value::integer(ints.keyAt(slot));
+        }
+        case Layout::STRINGS: {
+            size_t slot = strings.next(from);
+            return slot == FlatTable<StringKeys>::kNoSlot ? Value::nil() : strings.keyAt(slot);
+        }
+        case Layout::MIXED: {
+            size_t slot = mixed.next(from);
+            return slot == FlatTable<ValueKeys>::kNoSlot ? Value::nil() : mixed.keyAt(slot);
+        }
+        case Layout::EMPTY:
+            break;
+    }
+    return Value::nil();
+}
+
+void ObjMap::spill() {
+    for (size_t slot = ints.next(0); slot != FlatTable<IntKeys>::kNoSlot; slot = ints.next(slot + 1)) {
+        mixed.valueAt(mixed.insert(Value::integer(ints.keyAt(slot)))) = ints.valueAt(slot);
+    }
+    for (size_t slot = strings.next(0); slot != FlatTable<StringKeys>::kNoSlot; slot = strings.next(slot + 1)) {
+        mixed.valueAt(mixed.insert(strings.keyAt(slot))) = strings.valueAt(slot);
+    }
+    ints = FlatTable<IntKeys>();
+    strings = FlatTable<StringKeys>();
+    layout = Layout::MIXED;
+}
+
+Value mapKey(VM& vm, const char* name, Value key) {
+    if (key.isInt() || key.isBool()) {
+        return key;
+    }
+    if (key.isDouble()) {
+        double number = key.asDouble();
+        if (number != number) {
+            throw RuntimeError(std::string(name) + "() cannot use NaN as a key");
+        }
+        // So 2.0 and 2 are the same key
+        if (number >= INT32_MIN && number <= INT32_MAX && number == static_cast<int32_t>(number)) {
+            return Value::integer(static_cast<int32_t>(number));
+        }
+        return key;
+    }
+    if (isString(key)) {
+        return Value::object(vm.canonical(vm.flatten(asString(key))));
+    }
+    if (key.isNil()) {
+        throw RuntimeError(std::string(name) + "() cannot use nil as a key");
+    }
+    throw RuntimeError(std::string(name) + "() keys must be numbers, strings or booleans, not " + key.typeName());
+}
+
+// Builtins
+
+namespace {
+
+ObjMap* expectMap(const char* name, Value value) {
+    if (!isMap(value)) {
+        throw RuntimeError(std::string(name) + "() expects a map, not " + value.typeName());
+    }
+    return asMap(value);
+}
+
+} // namespace
+
+Value nativeMap(VM& vm, int, const Value*) {
+    return Value::object(vm.allocate<ObjMap>(Generation::YOUNG));
+}
+
+Value nativeMapGet(VM& vm, int, const Value* args) {
+    ObjMap* map = expectMap("map_get", args[0]);
+    return map->get(mapKey(vm, "map_get", args[1]));
+}
+
+Value nativeMapSet(VM& vm, int, const Value* args) {
+    ObjMap* map = expectMap("map_set", args[0]);
+    Value key = mapKey(vm, "map_set", args[1]);
+    map->set(key, args[2]);
+    vm.writeBarrier(map, key);
+    vm.writeBarrier(map, args[2]);
+    return Value::nil();
+}
+
+Value nativeMapHas(VM& vm, int, const Value* args) {
+    ObjMap* map = expectMap("map_has", args[0]);
+    return Value::boolean(!map->get(mapKey(vm, "map_has", args[1])).isNil());
+}
+
+Value nativeMapDelete(VM& vm, int, const Value* args) {
+    ObjMap* map = expectMap("map_delete", args[0]);
+    return Value::boolean(map->remove(mapKey(vm, "map_delete", args[1])));
+}
+
+Value nativeMapLen(VM&, int, const Value* args) {
+    return Value::integer(static_cast<int32_t>(expectMap("map_len", args[0])->count()));
+}
+
+Value nativeMapNext(VM& vm, int, const Value* args) {
+    ObjMap* map = expectMap("map_next", args[0]);
+    return map->next(args[1].isNil() ? args[1] : mapKey(vm, "map_next", args[1]));
+}
+
+} // namespace mana
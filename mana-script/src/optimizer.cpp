@@ -0,0 +1,182 @@
+#include "optimizer.hpp"
+#include <optional>
+
+namespace mana {
+
+namespace {
+
+/**
+ * @brief Register access counts and jump targets of one function
+ */
+struct CodeInfo {
+    std::vector<int> reads;
+    std::vector<int> writes;
+    std::vector<bool> targets;  // Indexed by instruction; one past the end included
+
+    explicit CodeInfo(const FunctionProto& proto);
+
+    // Written by one instruction and read by one instruction, like the
+    // compiler's expression temporaries
+    bool isTemporary(int reg) const { return reads[reg] == 1 && writes[reg] == 1; }
+};
+
+CodeInfo::CodeInfo(const FunctionProto& proto)
+    : reads(proto.num_registers, 0),
+      writes(proto.num_registers, 0),
+      targets(proto.code.size() + 1, false) {
+    // Parameters arrive already written by the caller
+    for (int i = 0; i < proto.arity; ++i) {
+        writes[i]++;
+    }
+
+    std::vector<uint16_t> registers;
+    for (size_t i = 0; i < proto.code.size(); ++i) {
+        const Instruction& ins = proto.code[i];
+
+        registers.clear();
+        instructionReads(ins, registers);
+        for (uint16_t reg : registers) {
+            reads[reg]++;
+        }
+
+        int written = instructionWrite(ins);
+        if (written >= 0) {
+            writes[written]++;
+        }
+
+        if (isJump(ins.op)) {
+            targets[i + 1 + ins.sC()] = true;
+        }
+    }
+}
+
+/**
+ * @brief Result of fusing two adjacent instructions
+ */
+struct Fusion {
+    Instruction ins;
+    bool second_line;  // Report errors at the second instruction's line
+};
+
+using PairRule = std::optional<Fusion> (*)(const Instruction& first, const Instruction& second,
+                                           const CodeInfo& info);
+
+// LOADK t K; ADD r x t  ->  ADDK r x K
+std::optional<Fusion> foldConstantOperand(const Instruction& first, const Instruction& second,
+                                          const CodeInfo& info) {
+    if (first.op != OpCode::LOADK || !info.isTemporary(first.a)) {
+        return std::nullopt;
+    }
+
+    uint16_t temp = first.a;
+    OpCode fused;
+    switch (second.op) {
+        case OpCode::ADD: fused = OpCode::ADDK; break;
+        case OpCode::SUB: fused = OpCode::SUBK; break;
+        case OpCode::MUL: fused = OpCode::MULK; break;
+        default: return std::nullopt;
+    }
+
+    if (second.c == temp) {
+        return Fusion{Instruction(fused, second.a, second.b, first.b), true};
+    }
+    // Only multiplication commutes; '+' also concatenates strings
+    if (second.op == OpCode::MUL && second.b == temp) {
+        return Fusion{Instruction(fused, second.a, second.c, first.b), true};
+    }
+    return std::nullopt;
+}
+
+// OP t ...; MOVE r t  ->  OP r ...
+std::optional<Fusion> retargetMove(const Instruction& first, const Instruction& second,
+                                   const CodeInfo& info) {
+    int temp = instructionWrite(first);
+    if (second.op != OpCode::MOVE || temp < 0 || second.b != temp ||
+        first.op == OpCode::CALL || first.op == OpCode::CALLB || first.op == OpCode::ASYNC ||
+        !info.isTemporary(temp)) {
+        return std::nullopt;
+    }
+
+    Instruction fused = first;
+    fused.a = second.a;
+    return Fusion{fused, false};
+}
+
+// LT t x y; JMPIFNOT t  ->  IFLT x y
+std::optional<Fusion> fuseBranch(const Instruction& first, const Instruction& second,
+                                 const CodeInfo& info) {
+    if (second.op != OpCode::JMPIFNOT || second.a != first.a || !info.isTemporary(first.a)) {
+        return std::nullopt;
+    }
+
+    // GT and GE become IFLT and IFLE with the operands swapped
+    switch (first.op) {
+        case OpCode::LT: return Fusion{Instruction(OpCode::IFLT, first.b, first.c, second.c), false};
+        case OpCode::LE: return Fusion{Instruction(OpCode::IFLE, first.b, first.c, second.c), false};
+        case OpCode::GT: return Fusion{Instruction(OpCode::IFLT, first.c, first.b, second.c), false};
+        case OpCode::GE: return Fusion{Instruction(OpCode::IFLE, first.c, first.b, second.c), false};
+        case OpCode::EQ: return Fusion{Instruction(OpCode::IFEQ, first.b, first.c, second.c), false};
+        case OpCode::NE: return Fusion{Instruction(OpCode::IFNE, first.b, first.c, second.c), false};
+        default: return std::nullopt;
+    }
+}
+
+long jumpTarget(const Instruction& ins, size_t offset) {
+    return static_cast<long>(offset) + 1 + ins.sC();
+}
+
+/**
+ * @brief Apply one rule to every adjacent pair in a single forward sweep
+ */
+void applyRule(FunctionProto& proto, PairRule rule) {
+    CodeInfo info(proto);
+    const std::vector<Instruction>& code = proto.code;
+
+    std::vector<Instruction> out;
+    std::vector<SourceLoc> locations;
+    std::vector<long> old_targets;  // Original jump target of each output instruction, or -1
+    std::vector<size_t> new_index(code.size() + 1);
+
+    out.reserve(code.size());
+    for (size_t i = 0; i < code.size(); ) {
+        new_index[i] = out.size();
+
+        if (i + 1 < code.size() && !info.targets[i + 1]) {
+            if (std::optional<Fusion> fusion = rule(code[i], code[i + 1], info)) {
+                new_index[i + 1] = out.size();
+                out.push_back(fusion->ins);
+                locations.push_back(proto.locations[fusion->second_line ? i + 1 : i]);
+                old_targets.push_back(isJump(code[i + 1].op) ? jumpTarget(code[i + 1], i + 1) : -1);
+                i += 2;
+                continue;
+            }
+        }
+
+        out.push_back(code[i]);
+        locations.push_back(proto.locations[i]);
+        old_targets.push_back(isJump(code[i].op) ? jumpTarget(code[i], i) : -1);
+        i++;
+    }
+    new_index[code.size()] = out.size();
+
+    // Fusion only shrinks the code, so every offset still fits
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (old_targets[i] >= 0) {
+            long offset = static_cast<long>(new_index[old_targets[i]]) - static_cast<long>(i) - 1;
+            out[i].c = static_cast<uint16_t>(static_cast<int16_t>(offset));
+        }
+    }
+
+    proto.code = std::move(out);
+    proto.locations = std::move(locations);
+}
+
+} // namespace
+
+void optimizeBytecode(FunctionProto& proto) {
+    applyRule(proto, foldConstantOperand);
+    applyRule(proto, retargetMove);
+    applyRule(proto, fuseBranch);
+}
+
+} // namespace mana
@@ -0,0 +1,111 @@
+#include "output.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+namespace mana {
+
+OutputBuffer& OutputBuffer::forThread() {
+    thread_local OutputBuffer output(stdout, isatty(fileno(stdout)) != 0);
+    return output;
+}
+
+OutputBuffer::OutputBuffer(std::FILE* stream, bool line_buffered)
+    : stream(stream), line_buffered(line_buffered), buffer(new char[kBufferSize]) {}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::flush() {
+    if (used > 0) {
+        std::fwrite(buffer.get(), 1, used, stream);
+        used = 0;
+    }
+    std::fflush(stream);
+}
+
+void OutputBuffer::makeRoom(size_t size) {
+    if (kBufferSize - used >= size) {
+        return;
+    }
+
+    // Keep a trailing partial line so it is written together with its end
+    const char* end = buffer.get() + used;
+    const char* last_newline = nullptr;
+    for (const char* p = end; p > buffer.get(); --p) {
+        if (p[-1] == '\n') {
+            last_newline = p;
+            break;
+        }
+    }
+    size_t complete = last_newline ? static_cast<size_t>(last_newline - buffer.get()) : used;
+    if (kBufferSize - (used - complete) < size) {
+        complete = used;
+    }
+
+    std::fwrite(buffer.get(), 1, complete, stream);
+    std::memmove(buffer.get(), buffer.get() + complete, used - complete);
+    used -= complete;
+}
+
+void OutputBuffer::write(std::string_view text) {
+    if (text.size() > kBufferSize) {
+        flush();
+        std::fwrite(text.data(), 1, text.size(), stream);
+    } else {
+        makeRoom(text.size());
+        std::memcpy(buffer.get() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    if (line_buffered && text.find('\n') != std::string_view::npos) {
+        flush();
+    }
+}
+
+void OutputBuffer::write(char c) {
+    makeRoom(1);
+    buffer[used++] = c;
+    if (line_buffered && c == '\n') {
+        flush();
+    }
+}
+
+void OutputBuffer::write(int32_t value) {
+    char digits[kMaxNumberChars];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    write(std::string_view(digits, static_cast<size_t>(end - digits)));
+}
+
+void OutputBuffer::write(double value) {
+    char digits[kMaxNumberChars];
+    char* end = formatNumber(Value::number(value), digits);
+    write(std::string_view(digits, static_cast<size_t>(end - digits)));
+}
+
+void OutputBuffer::write(bool value) {
+    write(value ? std::string_view("true") : std::string_view("false"));
+}
+
+} // namespace mana
+
+void mana_print_string(const char* text) {
+    mana::OutputBuffer& output = mana::OutputBuffer::forThread();
+    output.write(std::string_view(text));
+    output.write('\n');
+}
+
+void mana_print_int(int32_t value) {
+    mana::OutputBuffer& output = mana::OutputBuffer::forThread();
+    output.write(value);
+    output.write('\n');
+}
+
+void mana_print_double(double value) {
+    mana::OutputBuffer& output = mana::OutputBuffer::forThread();
+    output.write(value);
+    output.write('\n');
+}
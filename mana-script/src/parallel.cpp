@@ -0,0 +1,294 @@
+#include "parallel.hpp"
+#include "scheduler.hpp"
+#include "task.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace mana {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A chunk should take about this long: enough to hide claiming it and
+// passing its result, little enough to balance the load
+constexpr int64_t kTargetChunkNanos = 200 * 1000;
+
+// The caller times iterations until they add up to this
+constexpr int64_t kProbeNanos = 20 * 1000;
+
+// The rest of the range is cut into at least this many chunks per worker
+constexpr int64_t kChunksPerWorker = 4;
+
+// Chunks of a deterministic reduction, on any machine
+constexpr int64_t kDeterministicChunks = 256;
+
+/**
+ * One loop, shared by the caller and its helpers
+ */
+struct Loop {
+    // chunk(first, end, captures...) for parallel for; for parallel_reduce
+    // map(i) folded with combine, starting from identity
+    bool reduce = false;
+    Message function;
+    Message combine;
+    Message identity;
+    std::vector<Message> captures;
+    size_t capture_count = 0;
+    std::vector<std::pair<std::string, Message>> globals;
+
+    // Chunk k covers first + k * size up to the next chunk or end
+    int64_t first = 0;
+    int64_t end = 0;
+    int64_t size = 1;
+    int64_t chunks = 0;
+    std::atomic<int64_t> next{0};
+    std::atomic<bool> stop{false};
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    int64_t done = 0;                 // Claimed chunks that have finished
+    std::vector<Message> partials;    // Result of each chunk of a reduction
+    std::string error;                // The first runtime error
+};
+
+// Roots a participant keeps the loop's values in, from its base index on
+enum RootSlot : size_t {
+    FUNCTION,
+    COMBINE,
+    IDENTITY,
+    CAPTURES
+};
+
+std::string takeError(DiagnosticManager& reports) {
+    const auto& reported = reports.getDiagnostics();
+    std::string error = reported.empty() ? "Runtime error" : reported.back().getMessage();
+    reports.clear();
+    return error;
+}
+
+// Run the iterations from `from` up to `to` in vm; a reduction's result goes
+// to partial. Errors are reported to vm's diagnostics.
+bool runRange(VM& vm, const Loop& loop, size_t base, int64_t from, int64_t to, Message& partial) {
+    if (!loop.reduce) {
+        std::vector<Value> args = {Value::integer(static_cast<int32_t>(from)),
+                                   Value::integer(static_cast<int32_t>(to))};
+        for (size_t i = 0; i < loop.capture_count; ++i) {
+            args.push_back(vm.root(base + CAPTURES + i));
+        }
+        return vm.call(vm.root(base + FUNCTION), args) == InterpretResult::OK;
+    }
+
+    // Every call may collect, so the accumulator lives in a root
+    size_t acc = vm.pushRoot(vm.root(base + IDENTITY));
+    std::vector<Value> index(1);
+    std::vector<Value> pair(2);
+    bool ok = true;
+    for (int64_t i = from; ok && i < to; ++i) {
+        index[0] = Value::integer(static_cast<int32_t>(i));
+        Value value;
+        ok = vm.call(vm.root(base + FUNCTION), index, &value) == InterpretResult::OK;
+        if (ok) {
+            pair[0] = vm.root(acc);
+            pair[1] = value;
+            ok = vm.call(vm.root(base + COMBINE), pair, &value) == InterpretResult::OK;
+            vm.setRoot(acc, value);
+        }
+    }
+    partial = toMessage(vm.root(acc));
+    vm.popRoots(1);
+    return ok;
+}
+
+// Claim and run chunks until none are left
+void work(VM& vm, Loop& loop, size_t base) {
+    while (true) {
+        int64_t k = loop.next.fetch_add(1);
+        if (k >= loop.chunks) {
+            return;
+        }
+        int64_t from = loop.first + k * loop.size;
+        int64_t to = std::min(from + loop.size, loop.end);
+
+        Message partial;
+        bool ok = loop.stop.load() || runRange(vm, loop, base, from, to, partial);
+        std::string error = ok ? std::string() : takeError(vm.diagnosticSink());
+
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        if (!ok && !loop.stop.exchange(true)) {
+            loop.error = std::move(error);
+        }
+        if (loop.reduce) {
+            loop.partials[k] = std::move(partial);
+        }
+        if (++loop.done == loop.chunks) {
+            loop.finished.notify_all();
+        }
+    }
+}
+
+// A helper: the loop's values and the caller's globals, then chunks
+void help(VM& vm, const std::shared_ptr<Loop>& loop) {
+    for (const auto& [name, message] : loop->globals) {
+        vm.defineGlobal(name, fromMessage(vm, message));
+    }
+    size_t base = vm.pushRoot(fromMessage(vm, loop->function));
+    vm.pushRoot(fromMessage(vm, loop->combine));
+    vm.pushRoot(fromMessage(vm, loop->identity));
+    for (const Message& capture : loop->captures) {
+        vm.pushRoot(fromMessage(vm, capture));
+    }
+    work(vm, *loop, base);
+    vm.popRoots(CAPTURES + loop->capture_count);
+}
+
+// Restores a VM's diagnostics when the loop is left
+class ReportsGuard {
+public:
+    ReportsGuard(VM& vm, DiagnosticManager& reports) : vm(vm), saved(vm.diagnosticSink()) {
+        vm.setDiagnostics(reports);
+    }
+    ~ReportsGuard() { vm.setDiagnostics(saved); }
+
+private:
+    VM& vm;
+    DiagnosticManager& saved;
+};
+
+int32_t expectIndex(const char* name, Value value) {
+    if (!value.isInt()) {
+        throw RuntimeError(std::string(name) + " expects integer bounds, not " + value.typeName());
+    }
+    return value.asInt();
+}
+
+Value runLoop(VM& vm, std::shared_ptr<Loop> loop, Value function, Value combine, Value identity, int64_t start,
+              const Value* captures, int capture_count, bool deterministic) {
+    const char* name = loop->reduce ? "parallel_reduce" : "parallel for";
+
+    size_t base = vm.pushRoot(function);
+    vm.pushRoot(combine);
+    vm.pushRoot(identity);
+    for (int i = 0; i < capture_count; ++i) {
+        vm.pushRoot(captures[i]);
+    }
+    size_t roots = CAPTURES + static_cast<size_t>(capture_count);
+    loop->capture_count = static_cast<size_t>(capture_count);
+
+    // The caller's own runtime errors are raised again as the loop's
+    DiagnosticManager reports;
+    std::string error;
+    std::vector<Message> probed;
+    Value result = Value::nil();
+    {
+        ReportsGuard guard(vm, reports);
+
+        // Time the first iterations, in doubling steps
+        int64_t position = start;
+        if (!deterministic) {
+            int64_t elapsed = 0;
+            for (int64_t step = 1; position < loop->end && elapsed < kProbeNanos; step *= 2) {
+                int64_t to = std::min(position + step, loop->end);
+                Clock::time_point began = Clock::now();
+                Message partial;
+                if (!runRange(vm, *loop, base, position, to, partial)) {
+                    error = takeError(reports);
+                    break;
+                }
+                elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - began).count();
+                probed.push_back(std::move(partial));
+                position = to;
+            }
+
+            int64_t remaining = loop->end - position;
+            int64_t per_iteration = std::max<int64_t>(1, elapsed / std::max<int64_t>(1, position - start));
+            int64_t balanced = remaining / (kChunksPerWorker * vm.scheduler().workerCount());
+            loop->size = std::max<int64_t>(1, std::min(kTargetChunkNanos / per_iteration, balanced));
+        } else {
+            loop->size = std::max<int64_t>(1, (loop->end - start + kDeterministicChunks - 1) / kDeterministicChunks);
+        }
+
+        loop->first = position;
+        loop->chunks = error.empty() ? (loop->end - position + loop->size - 1) / loop->size : 0;
+        if (loop->chunks > 0) {
+            loop->function = toMessage(function);
+            loop->combine = toMessage(combine);
+            loop->identity = toMessage(identity);
+            for (int i = 0; i < capture_count; ++i) {
+                loop->captures.push_back(toMessage(captures[i]));
+            }
+            std::vector<Value> roots{function, combine, identity};
+            roots.insert(roots.end(), captures, captures + capture_count);
+            loop->globals = copyGlobals(vm, roots);
+            loop->partials.resize(static_cast<size_t>(loop->chunks));
+
+            Scheduler& scheduler = vm.scheduler();
+            int64_t helpers = std::min<int64_t>(scheduler.workerCount(), loop->chunks - 1);
+            for (int64_t i = 0; i < helpers; ++i) {
+                scheduler.submit(std::make_shared<Task>([loop](VM& helper) { help(helper, loop); }));
+            }
+            work(vm, *loop, base);
+
+            std::unique_lock<std::mutex> lock(loop->mutex);
+            loop->finished.wait(lock, [&] { return loop->done == loop->chunks; });
+            error = loop->error;
+        }
+
+        // Fold the chunk results in range order
+        if (loop->reduce && error.empty()) {
+            probed.insert(probed.end(), std::make_move_iterator(loop->partials.begin()),
+                          std::make_move_iterator(loop->partials.end()));
+            size_t acc = vm.pushRoot(identity);
+            roots++;
+            std::vector<Value> pair(2);
+            for (const Message& partial : probed) {
+                pair[0] = vm.root(acc);
+                pair[1] = fromMessage(vm, partial);
+                Value value;
+                if (vm.call(vm.root(base + COMBINE), pair, &value) != InterpretResult::OK) {
+                    error = takeError(reports);
+                    break;
+                }
+                vm.setRoot(acc, value);
+            }
+            result = vm.root(acc);
+        }
+    }
+
+    vm.popRoots(roots);
+    if (!error.empty()) {
+        throw RuntimeError(std::string(name) + " failed: " + error);
+    }
+    return result;
+}
+
+} // namespace
+
+Value nativeParallelFor(VM& vm, int argc, const Value* args) {
+    if (argc < 3 || !isFunction(args[0])) {
+        throw RuntimeError("parallel_for() expects a chunk function and bounds");
+    }
+    auto loop = std::make_shared<Loop>();
+    int32_t start = expectIndex("parallel for", args[1]);
+    loop->end = std::max(start, expectIndex("parallel for", args[2]));
+    return runLoop(vm, std::move(loop), args[0], Value::nil(), Value::nil(), start, args + 3, argc - 3, false);
+}
+
+Value nativeParallelReduce(VM& vm, int argc, const Value* args) {
+    if (argc != 5 && argc != 6) {
+        throw RuntimeError("Expected 5 or 6 arguments but got " + std::to_string(argc));
+    }
+    auto loop = std::make_shared<Loop>();
+    loop->reduce = true;
+    int32_t start = expectIndex("parallel_reduce()", args[0]);
+    loop->end = std::max(start, expectIndex("parallel_reduce()", args[1]));
+    bool deterministic = argc == 6 && !args[5].isFalsey();
+    return runLoop(vm, std::move(loop), args[3], args[4], args[2], start, nullptr, 0, deterministic);
+}
+
+} // namespace mana
@@ -1,19 +1,22 @@
 #include "parser.hpp"
 
+#include <charconv>
+
 namespace mana {
 
 Parser::Parser(const std::vector<Token>& tokens, const std::string& filename)
-    : tokens(tokens), filename(filename) {}
+    : tokens(tokens), filename(filename), file(fileId(filename)) {}
+
+Parser::Parser(const std::vector<Token>& tokens, CompilationContext& context)
+    : tokens(tokens), filename(context.filename()), file(fileId(filename)), reports(&context.reports()) {}
 
 std::vector<StmtPtr> Parser::parse() {
     std::vector<StmtPtr> statements;
     
-    try {
-        while (!isAtEnd()) {
-            statements.push_back(declaration());
+    while (!isAtEnd()) {
+        if (StmtPtr stmt = declaration()) {
+            statements.push_back(stmt);
         }
-    } catch (const ParseError& error) {
-        // Error recovery is handled by synchronize()
     }
     
     return statements;
@@ -41,6 +44,10 @@ bool Parser::check(TokenType type) const {
     return peek().type == type;
 }
 
+bool Parser::checkNext(TokenType type) const {
+    return !isAtEnd() && tokens[current + 1].type == type;
+}
+
 bool Parser::match(TokenType type) {
     if (check(type)) {
         advance();
@@ -59,39 +66,53 @@ bool Parser::match(std::initializer_list<TokenType> types) {
     return false;
 }
 
-ParseError Parser::error(const Token& token, const std::string& message) {
-    SourceLocation location(filename, token.line, token.column);
+void Parser::error(const Token& token, DiagnosticArg message) {
+    // Report only the first error of a declaration; the rest are usually its echoes
+    if (panic_mode) return;
+    panic_mode = true;
+    panics++;
+    
+    // The lexer has already reported what is wrong with its error tokens
+    if (token.type == TokenType::ERROR) return;
     
     if (token.type == TokenType::END_OF_FILE) {
-        diagnostics.report(DiagnosticSeverity::ERROR, message + " at end of file", location);
+        reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::SYNTAX_AT_END, file, token.line,
+                        token.column, std::move(message));
     } else {
-        diagnostics.report(DiagnosticSeverity::ERROR, 
-                          message + " at '" + token.lexeme + "'", location);
+        reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::SYNTAX, file, token.line,
+                        token.column, std::move(message), token.lexeme);
     }
-    
-    return ParseError(message);
 }
 
-Token Parser::consume(TokenType type, const std::string& message) {
+// A missing token is reported and then treated as present, so the caller
+// carries on without checking
+Token Parser::consume(TokenType type, const char* message) {
     if (check(type)) return advance();
     
-    throw error(peek(), message);
+    error(peek(), message);
+    return peek();
 }
 
-void Parser::synchronize() {
-    advance();
+void Parser::synchronize(int start) {
+    panic_mode = false;
+    
+    // Always make progress, even when the declaration consumed nothing
+    if (current == start && !isAtEnd()) advance();
     
     while (!isAtEnd()) {
         if (previous().type == TokenType::SEMICOLON) return;
         
         switch (peek().type) {
+            case TokenType::RIGHT_BRACE:
             case TokenType::FUNCTION:
+            case TokenType::ASYNC:
             case TokenType::VAR:
             case TokenType::CONST:
             case TokenType::FOR:
             case TokenType::IF:
             case TokenType::WHILE:
             case TokenType::RETURN:
+            case TokenType::IMPORT:
                 return;
             default:
                 break;
@@ -114,7 +135,7 @@ ExprPtr Parser::assignment() {
         
         if (auto* varExpr = dynamic_cast<VariableExpr*>(expr.get())) {
             Token name = varExpr->getName();
-            return std::make_shared<AssignExpr>(name, value);
+            return node<AssignExpr>(name.loc, name, value);
         }
         
         error(equals, "Invalid assignment target");
@@ -129,7 +150,7 @@ ExprPtr Parser::logicalOr() {
     while (match(TokenType::OR)) {
         Token op = previous();
         ExprPtr right = logicalAnd();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -141,7 +162,7 @@ ExprPtr Parser::logicalAnd() {
     while (match(TokenType::AND)) {
         Token op = previous();
         ExprPtr right = equality();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -153,7 +174,7 @@ ExprPtr Parser::equality() {
     while (match({TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL})) {
         Token op = previous();
         ExprPtr right = comparison();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -166,7 +187,7 @@ ExprPtr Parser::comparison() {
                   TokenType::LESS, TokenType::LESS_EQUAL})) {
         Token op = previous();
         ExprPtr right = term();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -178,7 +199,7 @@ ExprPtr Parser::term() {
     while (match({TokenType::MINUS, TokenType::PLUS})) {
         Token op = previous();
         ExprPtr right = factor();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -190,7 +211,7 @@ ExprPtr Parser::factor() {
     while (match({TokenType::SLASH, TokenType::STAR, TokenType::PERCENT})) {
         Token op = previous();
         ExprPtr right = unary();
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = node<BinaryExpr>(op.loc, expr, op, right);
     }
     
     return expr;
@@ -200,7 +221,24 @@ ExprPtr Parser::unary() {
     if (match({TokenType::BANG, TokenType::MINUS})) {
         Token op = previous();
         ExprPtr right = unary();
-        return std::make_shared<UnaryExpr>(op, right);
+        return node<UnaryExpr>(op.loc, op, right);
+    }
+
+    if (match(TokenType::SPAWN)) {
+        Token keyword = previous();
+        ExprPtr expr = call();
+        auto spawned = std::dynamic_pointer_cast<CallExpr>(expr);
+        if (!spawned) {
+            error(keyword, "Expect a call after 'spawn'");
+            return node<ErrorExpr>(keyword.loc, keyword);
+        }
+        return node<SpawnExpr>(keyword.loc, keyword, spawned);
+    }
+
+    if (match(TokenType::AWAIT)) {
+        Token keyword = previous();
+        ExprPtr value = unary();
+        return node<AwaitExpr>(keyword.loc, keyword, value);
     }
     
     return call();
@@ -236,77 +274,111 @@ ExprPtr Parser::finishCall(ExprPtr callee) {
     
     Token paren = consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments");
     
-    return std::make_shared<CallExpr>(callee, paren, arguments);
+    return node<CallExpr>(paren.loc, callee, paren, arguments);
 }
 
 ExprPtr Parser::primary() {
     if (match(TokenType::FALSE)) {
-        return std::make_shared<LiteralExpr>(false);
+        return node<LiteralExpr>(previous().loc, false);
     }
     if (match(TokenType::TRUE)) {
-        return std::make_shared<LiteralExpr>(true);
+        return node<LiteralExpr>(previous().loc, true);
     }
     if (match(TokenType::NIL)) {
-        return std::make_shared<LiteralExpr>(nullptr);
+        return node<LiteralExpr>(previous().loc, nullptr);
+    }
+    if (match(TokenType::BOOL_LITERAL)) {
+        return node<LiteralExpr>(previous().loc, previous().lexeme == "true");
     }
     
     if (match(TokenType::INTEGER_LITERAL)) {
-        try {
-            int value = std::stoi(previous().lexeme);
-            return std::make_shared<LiteralExpr>(value);
-        } catch (const std::exception& e) {
-            error(previous(), "Invalid integer literal");
-            return std::make_shared<LiteralExpr>(0);
-        }
+        return integerLiteral();
     }
     
     if (match(TokenType::FLOAT_LITERAL)) {
-        try {
-            double value = std::stod(previous().lexeme);
-            return std::make_shared<LiteralExpr>(value);
-        } catch (const std::exception& e) {
-            error(previous(), "Invalid float literal");
-            return std::make_shared<LiteralExpr>(0.0);
-        }
+        return floatLiteral();
     }
     
     if (match(TokenType::STRING_LITERAL)) {
-        return std::make_shared<LiteralExpr>(previous().lexeme);
+        return node<LiteralExpr>(previous().loc, previous().lexeme);
     }
     
     if (match(TokenType::IDENTIFIER)) {
-        return std::make_shared<VariableExpr>(previous());
+        return node<VariableExpr>(previous().loc, previous());
     }
     
     if (match(TokenType::LEFT_PAREN)) {
         ExprPtr expr = expression();
         consume(TokenType::RIGHT_PAREN, "Expect ')' after expression");
-        return std::make_shared<GroupingExpr>(expr);
+        return node<GroupingExpr>(expr->getLoc(), expr);
+    }
+    
+    error(peek(), "Expect expression");
+    return node<ErrorExpr>(peek().loc, peek());
+}
+
+// The lexer only produces well-formed digits, so a literal fails to convert
+// only when it is out of range
+ExprPtr Parser::integerLiteral() {
+    const Token& literal = previous();
+    const char* first = literal.lexeme.data();
+    const char* last = first + literal.lexeme.size();
+    int base = 10;
+    if (literal.lexeme.size() > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'b')) {
+        base = first[1] == 'x' ? 16 : 2;
+        first += 2;
+    }
+    
+    int value = 0;
+    auto [end, status] = std::from_chars(first, last, value, base);
+    if (status != std::errc() || end != last) {
+        error(literal, "Invalid integer literal");
+        return node<ErrorExpr>(literal.loc, literal);
     }
+    return node<LiteralExpr>(literal.loc, value);
+}
+
+ExprPtr Parser::floatLiteral() {
+    const Token& literal = previous();
+    const char* first = literal.lexeme.data();
+    const char* last = first + literal.lexeme.size();
     
-    throw error(peek(), "Expect expression");
+    double value = 0.0;
+    auto [end, status] = std::from_chars(first, last, value);
+    if (status != std::errc() || end != last) {
+        error(literal, "Invalid float literal");
+        return node<ErrorExpr>(literal.loc, literal);
+    }
+    return node<LiteralExpr>(literal.loc, value);
 }
 
 StmtPtr Parser::declaration() {
-    try {
-        if (match(TokenType::FUNCTION)) {
-            return functionDeclaration();
-        }
-        if (match(TokenType::VAR)) {
-            return varDeclaration();
-        }
-        if (match(TokenType::CONST)) {
-            return varDeclaration(true);
-        }
-        
-        return statement();
-    } catch (const ParseError& error) {
-        synchronize();
+    int start = current;
+    int panics_before = panics;
+    StmtPtr stmt;
+    if (match(TokenType::FUNCTION)) {
+        stmt = functionDeclaration();
+    } else if (match(TokenType::ASYNC)) {
+        consume(TokenType::FUNCTION, "Expect 'function' after 'async'");
+        stmt = functionDeclaration(true);
+    } else if (match(TokenType::VAR)) {
+        stmt = varDeclaration();
+    } else if (match(TokenType::CONST)) {
+        stmt = varDeclaration(true);
+    } else if (match(TokenType::IMPORT)) {
+        stmt = importDeclaration();
+    } else {
+        stmt = statement();
+    }
+    
+    if (panic_mode) {
+        synchronize(start);
         return nullptr;
     }
+    return panics == panics_before ? stmt : nullptr;
 }
 
-StmtPtr Parser::functionDeclaration() {
+StmtPtr Parser::functionDeclaration(bool is_async) {
     Token name = consume(TokenType::IDENTIFIER, "Expect function name");
     
     consume(TokenType::LEFT_PAREN, "Expect '(' after function name");
@@ -329,12 +401,14 @@ StmtPtr Parser::functionDeclaration() {
     std::vector<StmtPtr> body;
     
     while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
-        body.push_back(declaration());
+        if (StmtPtr stmt = declaration()) {
+            body.push_back(stmt);
+        }
     }
     
     consume(TokenType::RIGHT_BRACE, "Expect '}' after function body");
     
-    return std::make_shared<FunctionStmt>(name, parameters, body);
+    return node<FunctionStmt>(name.loc, name, parameters, body, is_async);
 }
 
 StmtPtr Parser::varDeclaration(bool is_const) {
@@ -344,11 +418,18 @@ StmtPtr Parser::varDeclaration(bool is_const) {
     if (match(TokenType::EQUAL)) {
         initializer = expression();
     } else if (is_const) {
-        throw error(name, "Const declarations must have an initializer");
+        error(name, "Const declarations must have an initializer");
     }
     
     consume(TokenType::SEMICOLON, "Expect ';' after variable declaration");
-    return std::make_shared<VarDeclStmt>(name, initializer, is_const);
+    return node<VarDeclStmt>(name.loc, name, initializer, is_const);
+}
+
+StmtPtr Parser::importDeclaration() {
+    Token keyword = previous();
+    Token path = consume(TokenType::STRING_LITERAL, "Expect module path after 'import'");
+    consume(TokenType::SEMICOLON, "Expect ';' after import");
+    return node<ImportStmt>(keyword.loc, keyword, path.lexeme);
 }
 
 StmtPtr Parser::statement() {
@@ -358,6 +439,10 @@ StmtPtr Parser::statement() {
     if (match(TokenType::WHILE)) {
         return whileStatement();
     }
+    // 'parallel' stays an ordinary identifier anywhere else
+    if (check(TokenType::IDENTIFIER) && peek().lexeme == "parallel" && checkNext(TokenType::FOR)) {
+        return parallelForStatement();
+    }
     if (match(TokenType::RETURN)) {
         return returnStatement();
     }
@@ -369,6 +454,7 @@ StmtPtr Parser::statement() {
 }
 
 StmtPtr Parser::ifStatement() {
+    SourceLoc loc = previous().loc;
     consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'");
     ExprPtr condition = expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition");
@@ -380,17 +466,39 @@ StmtPtr Parser::ifStatement() {
         elseBranch = statement();
     }
     
-    return std::make_shared<IfStmt>(condition, thenBranch, elseBranch);
+    return node<IfStmt>(loc, condition, thenBranch, elseBranch);
 }
 
 StmtPtr Parser::whileStatement() {
+    SourceLoc loc = previous().loc;
     consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'");
     ExprPtr condition = expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after while condition");
     
     StmtPtr body = statement();
     
-    return std::make_shared<WhileStmt>(condition, body);
+    return node<WhileStmt>(loc, condition, body);
+}
+
+StmtPtr Parser::parallelForStatement() {
+    Token keyword = advance();
+    advance();
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'parallel for'");
+    Token variable = consume(TokenType::IDENTIFIER, "Expect loop variable name");
+    consume(TokenType::EQUAL, "Expect '=' after loop variable");
+    ExprPtr start = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after loop start");
+
+    Token bound = consume(TokenType::IDENTIFIER, "Expect loop variable in condition");
+    if (bound.lexeme != variable.lexeme) {
+        error(bound, "Expect the loop variable in condition");
+    }
+    consume(TokenType::LESS, "Expect '<' after loop variable");
+    ExprPtr end = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after loop condition");
+
+    StmtPtr body = statement();
+    return node<ParallelForStmt>(keyword.loc, keyword, variable, start, end, body);
 }
 
 StmtPtr Parser::returnStatement() {
@@ -402,24 +510,27 @@ StmtPtr Parser::returnStatement() {
     }
     
     consume(TokenType::SEMICOLON, "Expect ';' after return value");
-    return std::make_shared<ReturnStmt>(keyword, value);
+    return node<ReturnStmt>(keyword.loc, keyword, value);
 }
 
 StmtPtr Parser::blockStatement() {
+    SourceLoc loc = previous().loc;
     std::vector<StmtPtr> statements;
     
     while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
-        statements.push_back(declaration());
+        if (StmtPtr stmt = declaration()) {
+            statements.push_back(stmt);
+        }
     }
     
     consume(TokenType::RIGHT_BRACE, "Expect '}' after block");
-    return std::make_shared<BlockStmt>(statements);
+    return node<BlockStmt>(loc, statements);
 }
 
 StmtPtr Parser::expressionStatement() {
     ExprPtr expr = expression();
     consume(TokenType::SEMICOLON, "Expect ';' after expression");
-    return std::make_shared<ExpressionStmt>(expr);
+    return node<ExpressionStmt>(expr->getLoc(), expr);
 }
 
 } // namespace mana
\ No newline at end of file
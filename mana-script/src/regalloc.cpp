@@ -0,0 +1,389 @@
+#include "regalloc.hpp"
+#include <algorithm>
+#include <climits>
+
+namespace mana {
+
+namespace {
+
+/**
+ * @brief Positions where one register is live
+ *
+ * Lifetime holes are ignored, so a value live anywhere in a loop is live
+ * across the whole loop. Parameters and values read before any write start
+ * at -1, before the first instruction.
+ */
+struct Interval {
+    int start = INT_MAX;
+    int end = INT_MIN;
+    int reg = -1;      // Assigned register
+    int window = -1;   // Position of the CALL, CALLB or ASYNC whose window holds this register
+
+    bool empty() const { return start > end; }
+
+    void extend(int pos) {
+        start = std::min(start, pos);
+        end = std::max(end, pos);
+    }
+};
+
+/**
+ * @brief Registers of one call window, assigned together
+ */
+struct AllocationUnit {
+    int start;
+    int call;  // Position of the CALL, CALLB or ASYNC, or -1 for a single register
+    std::vector<uint16_t> registers;
+};
+
+void successors(const FunctionProto& proto, size_t i, std::vector<size_t>& out) {
+    const Instruction& ins = proto.code[i];
+    OpCode op = genericOpcode(ins.op);
+    size_t target = static_cast<size_t>(static_cast<long>(i) + 1 + ins.sC());
+
+    out.clear();
+    if (op == OpCode::RETURN || op == OpCode::RETURNNIL) {
+        return;
+    }
+    if (op == OpCode::JMP) {
+        out.push_back(target);
+        return;
+    }
+    if (i + 1 < proto.code.size()) {
+        out.push_back(i + 1);
+    }
+    if (isJump(op)) {
+        out.push_back(target);
+    }
+}
+
+std::vector<Interval> buildIntervals(const FunctionProto& proto) {
+    size_t count = proto.code.size();
+    size_t words = (static_cast<size_t>(proto.num_registers) + 63) / 64;
+
+    std::vector<std::vector<uint16_t>> uses(count);
+    std::vector<int> defs(count);
+    for (size_t i = 0; i < count; ++i) {
+        instructionReads(proto.code[i], uses[i]);
+        defs[i] = instructionWrite(proto.code[i]);
+    }
+
+    // Backward dataflow: live_in[i] = uses(i) + (live_out(i) - def(i))
+    std::vector<uint64_t> live_in(count * words, 0);
+    std::vector<uint64_t> live(words);
+    std::vector<size_t> next;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = count; i-- > 0;) {
+            std::fill(live.begin(), live.end(), 0);
+            successors(proto, i, next);
+            for (size_t succ : next) {
+                for (size_t w = 0; w < words; ++w) {
+                    live[w] |= live_in[succ * words + w];
+                }
+            }
+            if (defs[i] >= 0) {
+                live[defs[i] / 64] &= ~(uint64_t(1) << (defs[i] % 64));
+            }
+            for (uint16_t reg : uses[i]) {
+                live[reg / 64] |= uint64_t(1) << (reg % 64);
+            }
+
+            if (!std::equal(live.begin(), live.end(), live_in.begin() + i * words)) {
+                std::copy(live.begin(), live.end(), live_in.begin() + i * words);
+                changed = true;
+            }
+        }
+    }
+
+    std::vector<Interval> intervals(proto.num_registers);
+    for (int param = 0; param < proto.arity; ++param) {
+        intervals[param].extend(-1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t w = 0; w < words; ++w) {
+            for (uint64_t bits = live_in[i * words + w]; bits; bits &= bits - 1) {
+                size_t reg = w * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+                intervals[reg].extend(i == 0 ? -1 : static_cast<int>(i));
+                intervals[reg].extend(static_cast<int>(i));
+            }
+        }
+        if (defs[i] >= 0) {
+            intervals[defs[i]].extend(static_cast<int>(i));
+        }
+    }
+    return intervals;
+}
+
+/**
+ * @brief Which registers hold which live ranges
+ */
+class RegisterFile {
+    std::vector<std::vector<std::pair<int, int>>> ranges;
+
+public:
+    // A range ending where another starts may share its register: every
+    // instruction reads its operands before writing its result
+    bool isFree(int reg, const Interval& interval) const {
+        if (reg >= static_cast<int>(ranges.size())) {
+            return true;
+        }
+        for (const auto& [start, end] : ranges[reg]) {
+            if (interval.start < end && start < interval.end) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void assign(int reg, Interval& interval) {
+        if (reg >= static_cast<int>(ranges.size())) {
+            ranges.resize(reg + 1);
+        }
+        ranges[reg].emplace_back(interval.start, interval.end);
+        interval.reg = reg;
+    }
+
+    int size() const { return static_cast<int>(ranges.size()); }
+};
+
+// Registers read by the instruction that starts the interval. Reusing one of
+// them turns a copy of a dying value into a move onto itself.
+int preferredRegister(const FunctionProto& proto, const std::vector<Interval>& intervals,
+                      const Interval& interval, const RegisterFile& file) {
+    if (interval.start < 0) {
+        return -1;
+    }
+
+    std::vector<uint16_t> reads;
+    instructionReads(proto.code[interval.start], reads);
+    for (uint16_t source : reads) {
+        const Interval& from = intervals[source];
+        if (from.reg >= 0 && from.end == interval.start && file.isFree(from.reg, interval)) {
+            return from.reg;
+        }
+    }
+    return -1;
+}
+
+bool allocate(const FunctionProto& proto, std::vector<Interval>& intervals) {
+    std::vector<AllocationUnit> units;
+
+    for (size_t i = 0; i < proto.code.size(); ++i) {
+        const Instruction& ins = proto.code[i];
+        if (ins.op != OpCode::CALL && ins.op != OpCode::CALLB && ins.op != OpCode::ASYNC) {
+            continue;
+        }
+
+        AllocationUnit unit{INT_MAX, static_cast<int>(i), {}};
+        for (int k = 0; k <= ins.b; ++k) {
+            uint16_t reg = static_cast<uint16_t>(ins.a + k);
+            Interval& interval = intervals[reg];
+            if (interval.window >= 0 || reg < proto.arity) {
+                return false;
+            }
+            interval.window = static_cast<int>(i);
+            unit.start = std::min(unit.start, interval.start);
+            unit.registers.push_back(reg);
+        }
+        units.push_back(std::move(unit));
+    }
+
+    for (int reg = proto.arity; reg < proto.num_registers; ++reg) {
+        const Interval& interval = intervals[reg];
+        if (!interval.empty() && interval.window < 0) {
+            units.push_back({interval.start, -1, {static_cast<uint16_t>(reg)}});
+        }
+    }
+
+    std::stable_sort(units.begin(), units.end(), [](const AllocationUnit& x, const AllocationUnit& y) {
+        return x.start < y.start;
+    });
+
+    RegisterFile file;
+    for (int param = 0; param < proto.arity; ++param) {
+        file.assign(param, intervals[param]);
+    }
+
+    for (const AllocationUnit& unit : units) {
+        if (unit.call < 0) {
+            Interval& interval = intervals[unit.registers[0]];
+            int reg = preferredRegister(proto, intervals, interval, file);
+            if (reg < 0) {
+                reg = 0;
+                while (!file.isFree(reg, interval)) {
+                    reg++;
+                }
+            }
+            file.assign(reg, interval);
+            continue;
+        }
+
+        // The callee's frame starts right after the window's first register,
+        // so everything live across the call has to sit below it. A builtin
+        // pushes no frame and only needs its window to be consecutive.
+        int base = 0;
+        for (const Interval& interval : intervals) {
+            if (proto.code[unit.call].op == OpCode::CALL && interval.reg >= 0 &&
+                interval.window != unit.call && interval.start < unit.call && interval.end > unit.call) {
+                base = std::max(base, interval.reg + 1);
+            }
+        }
+
+        auto fits = [&](int candidate) {
+            for (size_t k = 0; k < unit.registers.size(); ++k) {
+                if (!file.isFree(candidate + static_cast<int>(k), intervals[unit.registers[k]])) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        while (!fits(base)) {
+            base++;
+        }
+        for (size_t k = 0; k < unit.registers.size(); ++k) {
+            file.assign(base + static_cast<int>(k), intervals[unit.registers[k]]);
+        }
+    }
+
+    // Values assigned after a window was placed may still have landed above it
+    for (size_t i = 0; i < proto.code.size(); ++i) {
+        const Instruction& ins = proto.code[i];
+        if (genericOpcode(ins.op) != OpCode::CALL) {
+            continue;
+        }
+        int base = intervals[ins.a].reg;
+        for (const Interval& interval : intervals) {
+            if (interval.reg >= base && interval.window != static_cast<int>(i) &&
+                interval.start < static_cast<int>(i) && interval.end > static_cast<int>(i)) {
+                return false;
+            }
+        }
+    }
+
+    if (file.size() > UINT16_MAX) {
+        return false;
+    }
+    return true;
+}
+
+void renameRegisters(Instruction& ins, const std::vector<Interval>& intervals) {
+    auto rename = [&](uint16_t& reg) { reg = static_cast<uint16_t>(intervals[reg].reg); };
+
+    switch (genericOpcode(ins.op)) {
+        case OpCode::JMP:
+        case OpCode::RETURNNIL:
+        case OpCode::IMPORT:
+            break;
+        case OpCode::LOADK:
+        case OpCode::LOADNIL:
+        case OpCode::LOADTRUE:
+        case OpCode::LOADFALSE:
+        case OpCode::GETGLOBAL:
+        case OpCode::SETGLOBAL:
+        case OpCode::DEFGLOBAL:
+        case OpCode::FUNC:
+        case OpCode::JMPIF:
+        case OpCode::JMPIFNOT:
+        case OpCode::RETURN:
+        case OpCode::CALL:
+        case OpCode::CALLB:
+        case OpCode::ASYNC:
+            rename(ins.a);
+            break;
+        case OpCode::MOVE:
+        case OpCode::NEG:
+        case OpCode::NOT:
+        case OpCode::AWAIT:
+        case OpCode::ADDK:
+        case OpCode::SUBK:
+        case OpCode::MULK:
+        case OpCode::GETMAPK:
+        case OpCode::IFLT:
+        case OpCode::IFLE:
+        case OpCode::IFEQ:
+        case OpCode::IFNE:
+            rename(ins.a);
+            rename(ins.b);
+            break;
+        case OpCode::SETMAPK:
+            rename(ins.a);
+            rename(ins.c);
+            break;
+        default:
+            rename(ins.a);
+            rename(ins.b);
+            rename(ins.c);
+            break;
+    }
+}
+
+// Drop instructions and fix up jumps; a jump to a removed instruction lands
+// on the next one kept
+void removeInstructions(FunctionProto& proto, const std::vector<bool>& removed) {
+    size_t count = proto.code.size();
+
+    // Instructions kept before each position, which is also where a removed
+    // instruction's successor ends up
+    std::vector<size_t> new_index(count + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        new_index[i + 1] = new_index[i] + (removed[i] ? 0 : 1);
+    }
+
+    std::vector<Instruction> code;
+    std::vector<SourceLoc> locations;
+    for (size_t i = 0; i < count; ++i) {
+        if (removed[i]) {
+            continue;
+        }
+        Instruction ins = proto.code[i];
+        if (isJump(ins.op)) {
+            size_t target = static_cast<size_t>(static_cast<long>(i) + 1 + ins.sC());
+            long offset = static_cast<long>(new_index[target]) - static_cast<long>(new_index[i]) - 1;
+            ins.c = static_cast<uint16_t>(static_cast<int16_t>(offset));
+        }
+        code.push_back(ins);
+        locations.push_back(proto.locations[i]);
+    }
+
+    proto.code = std::move(code);
+    proto.locations = std::move(locations);
+}
+
+} // namespace
+
+void assignRegisters(FunctionProto& proto) {
+    if (proto.num_registers == 0) {
+        return;
+    }
+
+    std::vector<Interval> intervals = buildIntervals(proto);
+    if (!allocate(proto, intervals)) {
+        return;
+    }
+
+    int frame_size = proto.arity;
+    std::vector<bool> removed(proto.code.size(), false);
+    for (size_t i = 0; i < proto.code.size(); ++i) {
+        Instruction& ins = proto.code[i];
+        renameRegisters(ins, intervals);
+
+        if (ins.op == OpCode::MOVE && ins.a == ins.b) {
+            removed[i] = true;
+            continue;
+        }
+
+        std::vector<uint16_t> registers;
+        instructionReads(ins, registers);
+        for (uint16_t reg : registers) {
+            frame_size = std::max(frame_size, reg + 1);
+        }
+        frame_size = std::max(frame_size, instructionWrite(ins) + 1);
+    }
+
+    proto.num_registers = frame_size;
+    removeInstructions(proto, removed);
+}
+
+} // namespace mana
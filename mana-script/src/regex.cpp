@@ -0,0 +1,850 @@
+#include "regex.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace mana {
+
+namespace {
+
+constexpr size_t kMaxRepeat = 1000;      // Largest count in {m,n}
+constexpr size_t kMaxNesting = 1000;     // Of groups
+constexpr size_t kMaxInsts = 100000;     // Per program
+constexpr size_t kMaxStates = 4096;      // DFA states kept before the cache is dropped
+constexpr size_t kMaxPatterns = 1024;    // Cached patterns, process-wide and per thread
+constexpr size_t kUnbounded = SIZE_MAX;
+
+using Bytes = std::bitset<256>;
+
+struct Node;
+using NodePtr = std::shared_ptr<const Node>;
+
+struct Node {
+    enum class Kind {
+        BYTES,
+        CONCAT,  // With no children, matches the empty string
+        ALT,
+        STAR,
+        QUEST,
+        BEGIN,
+        END
+    };
+
+    Kind kind;
+    Bytes bytes;
+    std::vector<NodePtr> children;
+};
+
+NodePtr makeNode(Node::Kind kind, std::vector<NodePtr> children = {}, Bytes bytes = {}) {
+    return std::make_shared<const Node>(Node{kind, bytes, std::move(children)});
+}
+
+// The byte in a set of one, or -1
+int single(const Bytes& bytes) {
+    if (bytes.count() != 1) {
+        return -1;
+    }
+    for (int b = 0; b < 256; ++b) {
+        if (bytes[b]) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+Bytes range(unsigned char low, unsigned char high) {
+    Bytes bytes;
+    for (int b = low; b <= high; ++b) {
+        bytes.set(b);
+    }
+    return bytes;
+}
+
+[[noreturn]] void fail(size_t offset, const std::string& message) {
+    throw RuntimeError("Invalid regex at byte " + std::to_string(offset) + ": " + message);
+}
+
+class PatternParser {
+public:
+    explicit PatternParser(std::string_view pattern) : pattern(pattern) {}
+
+    NodePtr parse() {
+        NodePtr root = alternation();
+        if (more()) {
+            fail(pos, "unmatched ')'");
+        }
+        return root;
+    }
+
+private:
+    std::string_view pattern;
+    size_t pos = 0;
+    size_t depth = 0;
+
+    bool more() const { return pos < pattern.size(); }
+
+    NodePtr alternation() {
+        std::vector<NodePtr> branches{concatenation()};
+        while (more() && pattern[pos] == '|') {
+            pos++;
+            branches.push_back(concatenation());
+        }
+        return branches.size() == 1 ? branches[0] : makeNode(Node::Kind::ALT, std::move(branches));
+    }
+
+    NodePtr concatenation() {
+        std::vector<NodePtr> items;
+        while (more() && pattern[pos] != '|' && pattern[pos] != ')') {
+            NodePtr item = repetition();
+            if (item->kind == Node::Kind::CONCAT) {
+                items.insert(items.end(), item->children.begin(), item->children.end());
+            } else {
+                items.push_back(item);
+            }
+        }
+        return items.size() == 1 ? items[0] : makeNode(Node::Kind::CONCAT, std::move(items));
+    }
+
+    NodePtr repetition() {
+        NodePtr item = atom();
+        bool repeated = false;
+        while (more()) {
+            size_t at = pos;
+            size_t min = 0;
+            size_t max = kUnbounded;
+            char c = pattern[pos];
+            if (c == '*') {
+                pos++;
+            } else if (c == '+') {
+                min = 1;
+                pos++;
+            } else if (c == '?') {
+                max = 1;
+                pos++;
+            } else if (c == '{' && pos + 1 < pattern.size() && isdigit(static_cast<unsigned char>(pattern[pos + 1]))) {
+                counts(min, max);
+            } else {
+                break;
+            }
+
+            if (repeated) {
+                fail(at, c == '?' ? "lazy quantifiers are not supported" : "nothing to repeat");
+            }
+            repeated = true;
+            item = repeat(item, min, max);
+        }
+        return item;
+    }
+
+    // {m}, {m,} or {m,n}
+    void counts(size_t& min, size_t& max) {
+        size_t open = pos++;
+        min = number(open);
+        max = min;
+        if (more() && pattern[pos] == ',') {
+            pos++;
+            max = more() && pattern[pos] == '}' ? kUnbounded : number(open);
+        }
+        if (!more() || pattern[pos] != '}') {
+            fail(open, "unclosed '{'");
+        }
+        pos++;
+        if (max < min) {
+            fail(open, "the counts are out of order");
+        }
+    }
+
+    size_t number(size_t open) {
+        if (!more() || !isdigit(static_cast<unsigned char>(pattern[pos]))) {
+            fail(open, "expected a count");
+        }
+        size_t value = 0;
+        while (more() && isdigit(static_cast<unsigned char>(pattern[pos]))) {
+            value = value * 10 + static_cast<size_t>(pattern[pos++] - '0');
+            if (value > kMaxRepeat) {
+                fail(open, "a count is over " + std::to_string(kMaxRepeat));
+            }
+        }
+        return value;
+    }
+
+    static NodePtr repeat(const NodePtr& item, size_t min, size_t max) {
+        std::vector<NodePtr> items(min, item);
+        if (max == kUnbounded) {
+            items.push_back(makeNode(Node::Kind::STAR, {item}));
+        } else {
+            for (size_t i = min; i < max; ++i) {
+                items.push_back(makeNode(Node::Kind::QUEST, {item}));
+            }
+        }
+        return items.size() == 1 ? items[0] : makeNode(Node::Kind::CONCAT, std::move(items));
+    }
+
+    NodePtr atom() {
+        size_t at = pos;
+        char c = pattern[pos];
+        switch (c) {
+            case '(': {
+                pos++;
+                if (pos + 1 < pattern.size() && pattern[pos] == '?' && pattern[pos + 1] == ':') {
+                    pos += 2;
+                } else if (more() && pattern[pos] == '?') {
+                    fail(at, "only (?:...) groups are supported");
+                }
+                if (++depth > kMaxNesting) {
+                    fail(at, "groups are nested too deeply");
+                }
+                NodePtr inner = alternation();
+                depth--;
+                if (!more() || pattern[pos] != ')') {
+                    fail(at, "unclosed '('");
+                }
+                pos++;
+                return inner;
+            }
+            case '[':
+                return makeNode(Node::Kind::BYTES, {}, bracket());
+            case '.': {
+                pos++;
+                Bytes bytes;
+                bytes.set();
+                bytes.reset('\n');
+                return makeNode(Node::Kind::BYTES, {}, bytes);
+            }
+            case '^':
+                pos++;
+                return makeNode(Node::Kind::BEGIN);
+            case '$':
+                pos++;
+                return makeNode(Node::Kind::END);
+            case '*':
+            case '+':
+            case '?':
+                fail(at, "nothing to repeat");
+            case '\\':
+                return makeNode(Node::Kind::BYTES, {}, escape());
+            default: {
+                pos++;
+                Bytes bytes;
+                bytes.set(static_cast<unsigned char>(c));
+                return makeNode(Node::Kind::BYTES, {}, bytes);
+            }
+        }
+    }
+
+    Bytes escape() {
+        size_t at = pos++;
+        if (!more()) {
+            fail(at, "the pattern ends in a backslash");
+        }
+        char c = pattern[pos++];
+        Bytes digits = range('0', '9');
+        Bytes word = digits | range('a', 'z') | range('A', 'Z');
+        word.set('_');
+        Bytes space;
+        for (char s : {' ', '\t', '\n', '\r', '\f', '\v'}) {
+            space.set(static_cast<unsigned char>(s));
+        }
+
+        Bytes bytes;
+        switch (c) {
+            case 'd': return digits;
+            case 'D': return ~digits;
+            case 'w': return word;
+            case 'W': return ~word;
+            case 's': return space;
+            case 'S': return ~space;
+            case 'n': bytes.set('\n'); return bytes;
+            case 't': bytes.set('\t'); return bytes;
+            case 'r': bytes.set('\r'); return bytes;
+            case 'f': bytes.set('\f'); return bytes;
+            case 'v': bytes.set('\v'); return bytes;
+            default:
+                break;
+        }
+        if (isdigit(static_cast<unsigned char>(c))) {
+            fail(at, "backreferences are not supported");
+        }
+        if (isalpha(static_cast<unsigned char>(c))) {
+            fail(at, std::string("unknown escape '\\") + c + "'");
+        }
+        bytes.set(static_cast<unsigned char>(c));
+        return bytes;
+    }
+
+    // [...] or [^...]; a ']' first is taken literally
+    Bytes bracket() {
+        size_t open = pos++;
+        bool negated = more() && pattern[pos] == '^';
+        if (negated) {
+            pos++;
+        }
+
+        Bytes bytes;
+        bool first = true;
+        while (true) {
+            if (!more()) {
+                fail(open, "unclosed '['");
+            }
+            if (pattern[pos] == ']' && !first) {
+                pos++;
+                break;
+            }
+            first = false;
+
+            size_t at = pos;
+            int low = member(bytes);
+            if (low < 0) {
+                continue;
+            }
+            if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']') {
+                pos++;
+                int high = member(bytes);
+                if (high < low) {
+                    fail(at, "invalid range");
+                }
+                bytes |= range(static_cast<unsigned char>(low), static_cast<unsigned char>(high));
+            } else {
+                bytes.set(static_cast<size_t>(low));
+            }
+        }
+        return negated ? ~bytes : bytes;
+    }
+
+    // One byte of a bracket, or -1 after adding a class such as \d to bytes
+    int member(Bytes& bytes) {
+        if (pattern[pos] != '\\') {
+            return static_cast<unsigned char>(pattern[pos++]);
+        }
+        Bytes escaped = escape();
+        int byte = single(escaped);
+        if (byte < 0) {
+            bytes |= escaped;
+        }
+        return byte;
+    }
+};
+
+// Builds a program back to front, so each node is emitted knowing where it goes next
+class ProgramBuilder {
+public:
+    ProgramBuilder(RegexProgram& program, bool reversed) : program(program), reversed(reversed) {}
+
+    void build(const Node& root) {
+        program.insts.push_back({RegexProgram::Op::MATCH, 0, 0, 0});
+        program.start = emit(root, 0);
+    }
+
+private:
+    RegexProgram& program;
+    bool reversed;
+    std::unordered_map<Bytes, uint16_t> set_ids;
+
+    uint32_t push(RegexProgram::Inst inst) {
+        if (program.insts.size() >= kMaxInsts) {
+            throw RuntimeError("Invalid regex: the pattern is too large");
+        }
+        program.insts.push_back(inst);
+        return static_cast<uint32_t>(program.insts.size() - 1);
+    }
+
+    uint16_t setId(const Bytes& bytes) {
+        auto it = set_ids.find(bytes);
+        if (it != set_ids.end()) {
+            return it->second;
+        }
+        uint16_t id = static_cast<uint16_t>(program.sets.size());
+        program.sets.push_back(bytes);
+        set_ids.emplace(bytes, id);
+        return id;
+    }
+
+    uint32_t emit(const Node& node, uint32_t next) {
+        using Op = RegexProgram::Op;
+        switch (node.kind) {
+            case Node::Kind::BYTES:
+                return push({Op::BYTES, setId(node.bytes), next, 0});
+            case Node::Kind::CONCAT:
+                if (reversed) {
+                    for (const NodePtr& child : node.children) {
+                        next = emit(*child, next);
+                    }
+                } else {
+                    for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                        next = emit(**it, next);
+                    }
+                }
+                return next;
+            case Node::Kind::ALT: {
+                uint32_t entry = emit(*node.children.back(), next);
+                for (size_t i = node.children.size() - 1; i-- > 0;) {
+                    uint32_t branch = emit(*node.children[i], next);
+                    entry = push({Op::SPLIT, 0, branch, entry});
+                }
+                return entry;
+            }
+            case Node::Kind::STAR: {
+                uint32_t loop = push({Op::SPLIT, 0, 0, next});
+                uint32_t body = emit(*node.children[0], loop);
+                program.insts[loop].next = body;
+                return loop;
+            }
+            case Node::Kind::QUEST:
+                return push({Op::SPLIT, 0, emit(*node.children[0], next), next});
+            case Node::Kind::BEGIN:
+                return push({reversed ? Op::END : Op::BEGIN, 0, next, 0});
+            case Node::Kind::END:
+                return push({reversed ? Op::BEGIN : Op::END, 0, next, 0});
+        }
+        return next;
+    }
+};
+
+// First occurrence of literal at or after from, or npos
+size_t findLiteral(std::string_view text, size_t from, std::string_view literal) {
+    size_t size = literal.size();
+    if (size < 2) {
+        return text.find(literal, from);
+    }
+
+    // Candidates have the first byte and, size - 1 bytes on, the last
+    const char* p = text.data();
+    const size_t last = size - 1;
+    size_t i = from;
+    for (; i + last + kSimdBlockSize <= text.size(); i += kSimdBlockSize) {
+        uint64_t candidates = SimdBlock(p + i).eq(literal[0]) & SimdBlock(p + i + last).eq(literal[last]);
+        while (candidates) {
+            size_t at = i + static_cast<size_t>(__builtin_ctzll(candidates));
+            if (std::memcmp(p + at + 1, literal.data() + 1, size - 2) == 0) {
+                return at;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return text.find(literal, i);
+}
+
+struct PatternCache {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const Regex>> patterns;
+};
+
+PatternCache& patternCache() {
+    static PatternCache cache;
+    return cache;
+}
+
+} // namespace
+
+/**
+ * @brief DFA states built as the input reaches them
+ *
+ * A state is the set of NFA instructions that are waiting for a byte, or
+ * that match, after the input so far. Its row of transitions, a column per
+ * byte class, starts out unknown and is filled in the first time each class
+ * is read there.
+ */
+class Dfa {
+public:
+    static constexpr int kDead = 0;
+
+    Dfa(const Regex& regex, const RegexProgram& program, bool unanchored)
+        : regex(regex), program(program), unanchored(unanchored),
+          columns(static_cast<size_t>(regex.class_count)), marks(program.insts.size(), 0) {
+        reset();
+    }
+
+    int start(bool at_begin) {
+        int& id = starts[at_begin];
+        if (id < 0) {
+            std::vector<uint32_t> insts;
+            closure({program.start}, at_begin, false, insts);
+            id = add(std::move(insts), at_begin);
+        }
+        return id;
+    }
+
+    // Whether state is the start away from the beginning, where nothing has matched in part
+    bool isStart(int state) const { return state == starts[0]; }
+
+    int step(int state, unsigned char byte) {
+        int32_t target = next[static_cast<size_t>(state) + regex.classes[byte]];
+        return target >= 0 ? target : build(state, byte);
+    }
+
+    bool matches(int state) const { return flags[static_cast<size_t>(state)] & kMatch; }
+    bool matchesAtEnd(int state) const { return flags[static_cast<size_t>(state)] & kMatchAtEnd; }
+
+private:
+    static constexpr uint8_t kMatch = 1;
+    static constexpr uint8_t kMatchAtEnd = 2;
+
+    const Regex& regex;
+    const RegexProgram& program;
+    bool unanchored;  // Every position may begin a match
+    size_t columns;
+
+    // A state is named by where its row starts in next, which saves the
+    // scan loops a multiply per byte
+    std::vector<std::vector<uint32_t>> states;  // Sorted instructions by row; MATCH is instruction 0
+    std::vector<int32_t> next;                  // A row of columns entries per state; -1 until built
+    std::vector<uint8_t> flags;                 // At the first entry of each row
+    std::unordered_map<std::string, int> ids;
+    int starts[2] = {-1, -1};
+    size_t resets = 0;
+
+    std::vector<uint32_t> marks;  // Last closure() to visit each instruction
+    uint32_t mark = 0;
+    std::vector<uint32_t> stack;
+
+    void reset() {
+        states.clear();
+        flags.clear();
+        next.clear();
+        ids.clear();
+        starts[0] = starts[1] = -1;
+        resets++;
+        add({}, false);
+    }
+
+    // The instructions reachable from roots without reading a byte
+    void closure(const std::vector<uint32_t>& roots, bool at_begin, bool at_end, std::vector<uint32_t>& out) {
+        if (++mark == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            mark = 1;
+        }
+        stack.assign(roots.begin(), roots.end());
+        while (!stack.empty()) {
+            uint32_t pc = stack.back();
+            stack.pop_back();
+            if (marks[pc] == mark) {
+                continue;
+            }
+            marks[pc] = mark;
+
+            const RegexProgram::Inst& inst = program.insts[pc];
+            switch (inst.op) {
+                case RegexProgram::Op::SPLIT:
+                    stack.push_back(inst.alt);
+                    stack.push_back(inst.next);
+                    break;
+                case RegexProgram::Op::BEGIN:
+                    if (at_begin) {
+                        stack.push_back(inst.next);
+                    }
+                    break;
+                case RegexProgram::Op::END:
+                    if (at_end) {
+                        stack.push_back(inst.next);
+                    } else {
+                        out.push_back(pc);
+                    }
+                    break;
+                default:
+                    out.push_back(pc);
+                    break;
+            }
+        }
+        std::sort(out.begin(), out.end());
+    }
+
+    int add(std::vector<uint32_t> insts, bool at_begin) {
+        std::string key(1, at_begin ? '^' : '.');
+        key.append(reinterpret_cast<const char*>(insts.data()), insts.size() * sizeof(uint32_t));
+        auto it = ids.find(key);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        if (states.size() >= kMaxStates) {
+            reset();
+        }
+
+        bool match = !insts.empty() && insts[0] == 0;
+        bool match_at_end = match;
+        for (uint32_t pc : insts) {
+            if (program.insts[pc].op == RegexProgram::Op::END) {
+                std::vector<uint32_t> ending;
+                closure(insts, at_begin, true, ending);
+                match_at_end = !ending.empty() && ending[0] == 0;
+                break;
+            }
+        }
+
+        int id = static_cast<int>(next.size());
+        states.push_back(std::move(insts));
+        next.resize(next.size() + columns, -1);
+        flags.resize(next.size(), 0);
+        flags[static_cast<size_t>(id)] = static_cast<uint8_t>((match ? kMatch : 0) | (match_at_end ? kMatchAtEnd : 0));
+        ids.emplace(std::move(key), id);
+        return id;
+    }
+
+    int build(int state, unsigned char byte) {
+        std::vector<uint32_t> roots;
+        for (uint32_t pc : states[static_cast<size_t>(state) / columns]) {
+            const RegexProgram::Inst& inst = program.insts[pc];
+            if (inst.op == RegexProgram::Op::BYTES && program.sets[inst.set][byte]) {
+                roots.push_back(inst.next);
+            }
+        }
+        if (unanchored) {
+            roots.push_back(program.start);
+        }
+
+        std::vector<uint32_t> insts;
+        closure(roots, false, false, insts);
+        size_t generation = resets;
+        int target = add(std::move(insts), false);
+        // A reset renumbered the states, and state is gone
+        if (resets == generation) {
+            next[static_cast<size_t>(state) + regex.classes[byte]] = target;
+        }
+        return target;
+    }
+};
+
+std::shared_ptr<const Regex> Regex::compile(std::string_view pattern) {
+    PatternCache& cache = patternCache();
+    std::string key(pattern);
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.patterns.find(key);
+        if (it != cache.patterns.end()) {
+            return it->second;
+        }
+    }
+
+    NodePtr root = PatternParser(pattern).parse();
+    auto regex = std::make_shared<Regex>();
+    regex->text = key;
+    ProgramBuilder(regex->forward, false).build(*root);
+    ProgramBuilder(regex->reverse, true).build(*root);
+
+    // Byte classes: a new class wherever some set changes from one byte to the next
+    int current = 0;
+    for (int b = 0; b < 256; ++b) {
+        if (b > 0) {
+            for (const Bytes& bytes : regex->forward.sets) {
+                if (bytes[b] != bytes[b - 1]) {
+                    current++;
+                    break;
+                }
+            }
+        }
+        regex->classes[b] = static_cast<uint8_t>(current);
+    }
+    regex->class_count = current + 1;
+
+    // What every match has to begin with
+    std::vector<NodePtr> items = root->kind == Node::Kind::CONCAT ? root->children : std::vector<NodePtr>{root};
+    size_t literal_items = 0;
+    for (const NodePtr& item : items) {
+        int byte = item->kind == Node::Kind::BYTES ? single(item->bytes) : -1;
+        if (byte < 0) {
+            break;
+        }
+        regex->prefix += static_cast<char>(byte);
+        literal_items++;
+    }
+    regex->literal = literal_items == items.size();
+    regex->anchored = !items.empty() && items[0]->kind == Node::Kind::BEGIN;
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.patterns.size() >= kMaxPatterns) {
+        cache.patterns.clear();
+    }
+    return cache.patterns.emplace(std::move(key), regex).first->second;
+}
+
+RegexMatcher::RegexMatcher(std::shared_ptr<const Regex> regex) : compiled(std::move(regex)) {}
+
+RegexMatcher::~RegexMatcher() = default;
+
+bool RegexMatcher::search(std::string_view text) {
+    if (compiled->literal) {
+        return findLiteral(text, 0, compiled->prefix) != std::string_view::npos;
+    }
+    return earliestEnd(text, 0) != std::string_view::npos;
+}
+
+bool RegexMatcher::find(std::string_view text, size_t& begin, size_t& end) {
+    const Regex& regex = *compiled;
+    if (regex.literal) {
+        begin = findLiteral(text, 0, regex.prefix);
+        end = begin + regex.prefix.size();
+        return begin != std::string_view::npos;
+    }
+    if (earliestEnd(text, 0) == std::string_view::npos) {
+        return false;
+    }
+
+    // Matches may begin left of the one that ends first, and the reverse
+    // scan finds the leftmost; then the longest from there
+    if (regex.anchored) {
+        begin = 0;
+    } else {
+        size_t lowest = regex.prefix.empty() ? 0 : findLiteral(text, 0, regex.prefix);
+        begin = leftmostBegin(text, lowest);
+    }
+    end = longestEnd(text, begin);
+    return true;
+}
+
+size_t RegexMatcher::earliestEnd(std::string_view text, size_t from) {
+    const Regex& regex = *compiled;
+    std::unique_ptr<Dfa>& dfa = regex.anchored ? anchored : forward;
+    if (!dfa) {
+        dfa = std::make_unique<Dfa>(regex, regex.forward, !regex.anchored);
+    }
+
+    size_t i = from;
+    if (!regex.prefix.empty()) {
+        i = findLiteral(text, i, regex.prefix);
+        if (i == std::string_view::npos) {
+            return i;
+        }
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t size = text.size();
+    dfa->start(false);
+    int state = dfa->start(i == 0);
+    for (; i < size; ++i) {
+        if (dfa->matches(state)) {
+            return i;
+        }
+        // Nothing under way: skip to where the prefix next occurs
+        if (!regex.prefix.empty() && dfa->isStart(state)) {
+            i = findLiteral(text, i, regex.prefix);
+            if (i == std::string_view::npos) {
+                return i;
+            }
+        }
+        state = dfa->step(state, bytes[i]);
+        if (state == Dfa::kDead) {
+            return std::string_view::npos;
+        }
+    }
+    return dfa->matches(state) || dfa->matchesAtEnd(state) ? size : std::string_view::npos;
+}
+
+size_t RegexMatcher::leftmostBegin(std::string_view text, size_t lowest) {
+    if (!reverse) {
+        reverse = std::make_unique<Dfa>(*compiled, compiled->reverse, true);
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    size_t best = std::string_view::npos;
+    int state = reverse->start(true);
+    for (size_t i = text.size(); i > lowest; --i) {
+        if (reverse->matches(state)) {
+            best = i;
+        }
+        state = reverse->step(state, bytes[i - 1]);
+    }
+    // The reverse program's end of the text is the real beginning
+    if (reverse->matches(state) || (lowest == 0 && reverse->matchesAtEnd(state))) {
+        best = lowest;
+    }
+    return best;
+}
+
+size_t RegexMatcher::longestEnd(std::string_view text, size_t from) {
+    if (!anchored) {
+        anchored = std::make_unique<Dfa>(*compiled, compiled->forward, false);
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    size_t best = std::string_view::npos;
+    int state = anchored->start(from == 0);
+    for (size_t i = from; i < text.size(); ++i) {
+        if (anchored->matches(state)) {
+            best = i;
+        }
+        state = anchored->step(state, bytes[i]);
+        if (state == Dfa::kDead) {
+            return best;
+        }
+    }
+    return anchored->matches(state) || anchored->matchesAtEnd(state) ? text.size() : best;
+}
+
+RegexMatcher& matcherFor(std::string_view pattern) {
+    thread_local std::unordered_map<std::string, std::unique_ptr<RegexMatcher>> matchers;
+    std::string key(pattern);
+    auto it = matchers.find(key);
+    if (it != matchers.end()) {
+        return *it->second;
+    }
+    auto matcher = std::make_unique<RegexMatcher>(Regex::compile(pattern));
+    if (matchers.size() >= kMaxPatterns) {
+        matchers.clear();
+    }
+    return *matchers.emplace(std::move(key), std::move(matcher)).first->second;
+}
+
+std::optional<std::string> prepareRegex(const Constant& pattern) {
+    if (!std::holds_alternative<std::string>(pattern)) {
+        return std::nullopt;
+    }
+    try {
+        Regex::compile(std::get<std::string>(pattern));
+    } catch (const RuntimeError& error) {
+        return std::string(error.what());
+    }
+    return std::nullopt;
+}
+
+// Builtins
+
+namespace {
+
+RegexMatcher& expectMatcher(const char* name, VM& vm, Value value) {
+    if (isRegex(value)) {
+        return *asRegex(value)->matcher;
+    }
+    if (!isString(value)) {
+        throw RuntimeError(std::string(name) + "() expects a regex or a pattern, not " + value.typeName());
+    }
+    return matcherFor(vm.flatten(asString(value))->view());
+}
+
+std::string_view expectText(const char* name, VM& vm, Value value) {
+    if (!isString(value)) {
+        throw RuntimeError(std::string(name) + "() expects a string to match, not " + value.typeName());
+    }
+    return vm.flatten(asString(value))->view();
+}
+
+} // namespace
+
+Value nativeRegex(VM& vm, int, const Value* args) {
+    if (!isString(args[0])) {
+        throw RuntimeError(std::string("regex() expects a pattern string, not ") + args[0].typeName());
+    }
+    auto matcher = std::make_unique<RegexMatcher>(Regex::compile(vm.flatten(asString(args[0]))->view()));
+    return Value::object(vm.allocate<ObjRegex>(Generation::YOUNG, std::move(matcher)));
+}
+
+Value nativeRegexMatch(VM& vm, int, const Value* args) {
+    RegexMatcher& matcher = expectMatcher("regex_match", vm, args[0]);
+    return Value::boolean(matcher.search(expectText("regex_match", vm, args[1])));
+}
+
+Value nativeRegexFind(VM& vm, int, const Value* args) {
+    RegexMatcher& matcher = expectMatcher("regex_find", vm, args[0]);
+    std::string_view text = expectText("regex_find", vm, args[1]);
+    size_t begin = 0;
+    size_t end = 0;
+    if (!matcher.find(text, begin, end)) {
+        return Value::nil();
+    }
+    return Value::object(vm.newString(text.substr(begin, end - begin)));
+}
+
+} // namespace mana
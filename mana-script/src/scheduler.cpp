@@ -0,0 +1,292 @@
+#include "scheduler.hpp"
+#include "output.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace mana {
+
+namespace {
+
+unsigned defaultWorkerCount() {
+    if (const char* setting = std::getenv("MANASCRIPT_WORKERS")) {
+        long count = std::strtol(setting, nullptr, 10);
+        if (count > 0) {
+            return static_cast<unsigned>(count);
+        }
+    }
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+} // namespace
+
+thread_local Scheduler::Worker* Scheduler::current = nullptr;
+
+Scheduler& Scheduler::global() {
+    static Scheduler scheduler(defaultWorkerCount());
+    return scheduler;
+}
+
+Scheduler::Scheduler(unsigned count) {
+    // Every worker exists before any starts, since they steal from each other
+    for (unsigned i = 0; i < std::max(count, 1u); ++i) {
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->owner = this;
+        workers.back()->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    for (auto& worker : workers) {
+        Worker* self = worker.get();
+        worker->thread = std::thread([this, self] { workerLoop(*self); });
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+void Scheduler::submit(const std::shared_ptr<Task>& task) {
+    task->scheduler = this;
+    task->self = task;
+    enqueue(task.get());
+}
+
+void Scheduler::enqueue(Task* task) {
+    if (current && current->owner == this) {
+        current->deque.push(task);
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        injected.push_back(task);
+        injected_count++;
+    }
+
+    // Pairs with the increment of sleeping before a worker checks for work
+    // one last time, so either it sees this task or we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_one();
+    }
+}
+
+Channel::Status Scheduler::sleepUntil(Clock::time_point deadline, Task* parker) {
+    if (!parker) {
+        std::this_thread::sleep_until(deadline);
+        return Channel::Status::DONE;
+    }
+
+    // Only its timer wakes a task parked here, so this is the call re-run
+    if (parker->asleep) {
+        parker->asleep = false;
+        return Channel::Status::DONE;
+    }
+    parker->asleep = true;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.push({deadline, parker});
+    if (timers.top().task == parker) {
+        // Idle workers sleep until the earliest timer, which this now is
+        next_deadline.store(deadline.time_since_epoch().count());
+        if (sleeping.load() > 0) {
+            wakeup.notify_one();
+        }
+    }
+    return Channel::Status::PARKED;
+}
+
+void Scheduler::fireTimers() {
+    if (Clock::now().time_since_epoch().count() < next_deadline.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::vector<Task*> due;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        while (!timers.empty() && timers.top().deadline <= now) {
+            due.push_back(timers.top().task);
+            timers.pop();
+        }
+        next_deadline.store(timers.empty() ? INT64_MAX : timers.top().deadline.time_since_epoch().count());
+    }
+    for (Task* task : due) {
+        task->wake();
+    }
+}
+
+void Scheduler::workerLoop(Worker& worker) {
+    current = &worker;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        fireTimers();
+        if (Task* task = findTask(worker)) {
+            runTask(worker, task);
+            continue;
+        }
+
+        // Any wakeup goes round the loop again, to fire timers and look for work
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping++;
+        if (!stopping.load() && !hasWork()) {
+            if (timers.empty()) {
+                wakeup.wait(lock);
+            } else {
+                wakeup.wait_until(lock, timers.top().deadline);
+            }
+        }
+        sleeping--;
+    }
+    current = nullptr;
+}
+
+Task* Scheduler::findTask(Worker& worker) {
+    if (Task* task = worker.deque.pop()) {
+        return task;
+    }
+
+    if (injected_count.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!injected.empty()) {
+            Task* task = injected.front();
+            injected.pop_front();
+            injected_count--;
+            return task;
+        }
+    }
+
+    // Start at a random victim so idle workers spread over the busy ones
+    worker.seed ^= worker.seed << 13;
+    worker.seed ^= worker.seed >> 7;
+    worker.seed ^= worker.seed << 17;
+    size_t start = static_cast<size_t>(worker.seed % workers.size());
+    for (size_t i = 0; i < workers.size(); ++i) {
+        Worker& victim = *workers[(start + i) % workers.size()];
+        if (&victim == &worker) {
+            continue;
+        }
+        if (Task* task = victim.deque.steal()) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::hasWork() {
+    if (injected_count.load() > 0) {
+        return true;
+    }
+    for (const auto& worker : workers) {
+        if (!worker->deque.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::runTask(Worker& worker, Task* task) {
+    if (task->job) {
+        runJob(worker, task);
+        return;
+    }
+    task->state.store(Task::RUNNING);
+
+    InterpretResult status;
+    Value result = Value::nil();
+    if (!task->vm) {
+        task->vm = acquireVM(worker);
+        VM& vm = *task->vm;
+        vm.setTask(task);
+        vm.setScheduler(*this);
+        vm.setDiagnostics(worker.reports);
+
+        // Nothing collects before the call starts, so young values are safe here
+        for (const auto& [name, message] : task->globals) {
+            vm.defineGlobal(name, fromMessage(vm, message));
+        }
+        std::vector<Value> args;
+        args.reserve(task->args.size());
+        for (const Message& message : task->args) {
+            args.push_back(fromMessage(vm, message));
+        }
+        Value callee = fromMessage(vm, task->callee);
+        task->globals.clear();
+        task->args.clear();
+        task->callee = nullptr;
+
+        status = vm.call(callee, args, &result);
+    } else {
+        task->vm->setDiagnostics(worker.reports);
+        status = task->vm->resume(&result);
+    }
+
+    while (status == InterpretResult::SUSPENDED) {
+        // Output is buffered per thread, and the task may resume on another
+        OutputBuffer::forThread().flush();
+
+        int expected = Task::RUNNING;
+        if (task->state.compare_exchange_strong(expected, Task::PARKED)) {
+            // Whoever wakes it queues it again; it may already be running elsewhere
+            return;
+        }
+        // Woken while suspending: carry on at once
+        task->state.store(Task::RUNNING);
+        status = task->vm->resume(&result);
+    }
+
+    OutputBuffer::forThread().flush();
+
+    bool ok = status == InterpretResult::OK;
+    Message value;
+    std::string error;
+    if (ok) {
+        value = toMessage(result);
+    } else {
+        const auto& reported = worker.reports.getDiagnostics();
+        error = reported.empty() ? "Runtime error" : reported.back().getMessage();
+        worker.reports.clear();
+    }
+    releaseVM(worker, std::move(task->vm));
+
+    std::shared_ptr<Task> self = std::move(task->self);
+    task->finish(ok, std::move(value), std::move(error));
+}
+
+void Scheduler::runJob(Worker& worker, Task* task) {
+    std::unique_ptr<VM> vm = acquireVM(worker);
+    vm->setScheduler(*this);
+    vm->setDiagnostics(worker.reports);
+    task->job(*vm);
+    worker.reports.clear();
+    OutputBuffer::forThread().flush();
+    releaseVM(worker, std::move(vm));
+
+    std::shared_ptr<Task> self = std::move(task->self);
+    task->finish(true, nullptr, "");
+}
+
+std::unique_ptr<VM> Scheduler::acquireVM(Worker& worker) {
+    if (worker.idle_vms.empty()) {
+        return std::make_unique<VM>(kTaskNurserySize, kTaskStackSize);
+    }
+    std::unique_ptr<VM> vm = std::move(worker.idle_vms.back());
+    worker.idle_vms.pop_back();
+    return vm;
+}
+
+void Scheduler::releaseVM(Worker& worker, std::unique_ptr<VM> vm) {
+    if (worker.idle_vms.size() >= kMaxPooledVMs) {
+        return;
+    }
+    vm->setTask(nullptr);
+    vm->resetGlobals();
+    worker.idle_vms.push_back(std::move(vm));
+}
+
+} // namespace mana
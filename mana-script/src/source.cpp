@@ -0,0 +1,264 @@
+#include "source.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+
+namespace mana {
+
+SourceManager& SourceManager::global() {
+    static SourceManager manager;
+    return manager;
+}
+
+SourceManager::SourceManager() {
+    buffers.emplace_back();
+}
+
+namespace {
+
+size_t contentHash(const std::string& name, const std::string& text) {
+    return std::hash<std::string>()(text) * 31 + std::hash<std::string>()(name);
+}
+
+} // namespace
+
+SourceBuffer::~SourceBuffer() {
+    manager.release(id);
+}
+
+FileId SourceManager::addBuffer(const std::string& name, std::string text) {
+    size_t hash = contentHash(name, text);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (FileId file = findContentLocked(hash, name, text, false)) {
+        latest[name] = file;
+        return file;
+    }
+
+    Buffer buffer;
+    buffer.name = name;
+    buffer.text = std::move(text);
+    return addLocked(hash, std::move(buffer));
+}
+
+std::shared_ptr<const SourceBuffer> SourceManager::share(const std::string& name, std::string text) {
+    size_t hash = contentHash(name, text);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (FileId file = findContentLocked(hash, name, text, true)) {
+        // Null if its last holder is on the way out; then add a new one
+        if (auto holder = buffers[file].holder.lock()) {
+            latest[name] = file;
+            return holder;
+        }
+    }
+
+    Buffer buffer;
+    buffer.name = name;
+    buffer.text = std::move(text);
+    FileId file = addLocked(hash, std::move(buffer));
+    auto holder = std::make_shared<const SourceBuffer>(*this, file);
+    buffers[file].shared = true;
+    buffers[file].holder = holder;
+    return holder;
+}
+
+FileId SourceManager::findContentLocked(size_t hash, const std::string& name, const std::string& text,
+                                        bool held) const {
+    auto [begin, end] = by_content.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        const Buffer& buffer = buffers[it->second];
+        if (buffer.shared == held && buffer.name == name && buffer.text == text) {
+            return it->second;
+        }
+    }
+    return 0;
+}
+
+FileId SourceManager::addLocked(size_t hash, Buffer buffer) {
+    buffer.line_starts.push_back(0);
+    for (const char* at = buffer.text.data(), *end = at + buffer.text.size();
+         (at = static_cast<const char*>(std::memchr(at, '\n', end - at))) != nullptr; ++at) {
+        buffer.line_starts.push_back(static_cast<uint32_t>(at - buffer.text.data() + 1));
+    }
+
+    FileId file = static_cast<FileId>(buffers.size());
+    // One past the end is a location too, for the end-of-file token
+    buffer.start = allocateLocked(buffer.text.size() + 1);
+    if (buffer.start != 0) {
+        auto at = std::upper_bound(by_start.begin(), by_start.end(), buffer.start,
+                                   [&](uint32_t start, FileId other) { return start < buffers[other].start; });
+        by_start.insert(at, file);
+    }
+    latest[buffer.name] = file;
+    buffers.push_back(std::move(buffer));
+    by_content.emplace(hash, file);
+    return file;
+}
+
+uint32_t SourceManager::allocateLocked(uint64_t size) {
+    // First fit among released ranges, then the untouched end of the space
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if (it->second >= size) {
+            uint32_t start = it->first;
+            uint32_t rest = it->second - static_cast<uint32_t>(size);
+            free_ranges.erase(it);
+            if (rest != 0) {
+                free_ranges.emplace(start + static_cast<uint32_t>(size), rest);
+            }
+            return start;
+        }
+    }
+    if (next_offset + size > UINT32_MAX) {
+        return 0;
+    }
+    uint32_t start = static_cast<uint32_t>(next_offset);
+    next_offset += size;
+    return start;
+}
+
+void SourceManager::release(FileId file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Buffer& buffer = buffers[file];
+    for (auto [it, end] = by_content.equal_range(contentHash(buffer.name, buffer.text)); it != end; ++it) {
+        if (it->second == file) {
+            by_content.erase(it);
+            break;
+        }
+    }
+
+    if (buffer.start != 0) {
+        auto at = std::lower_bound(by_start.begin(), by_start.end(), buffer.start,
+                                   [&](FileId other, uint32_t start) { return buffers[other].start < start; });
+        by_start.erase(at);
+
+        // Give the range back, merged with free neighbours
+        uint32_t start = buffer.start;
+        uint64_t size = buffer.text.size() + 1;
+        auto next = free_ranges.lower_bound(start);
+        if (next != free_ranges.end() && start + size == next->first) {
+            size += next->second;
+            next = free_ranges.erase(next);
+        }
+        if (next != free_ranges.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + uint64_t(previous->second) == start) {
+                start = previous->first;
+                size += previous->second;
+                free_ranges.erase(previous);
+            }
+        }
+        if (start + size == next_offset) {
+            next_offset = start;
+        } else {
+            free_ranges.emplace(start, static_cast<uint32_t>(size));
+        }
+    }
+
+    // The name stays, for diagnostics that refer to the file
+    buffer.start = 0;
+    std::string().swap(buffer.text);
+    buffer.line_starts.assign(1, 0);
+    buffer.shared = false;
+    buffer.holder.reset();
+}
+
+FileId SourceManager::fileNamed(const std::string& name) {
+    if (name.empty()) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [it, inserted] = latest.try_emplace(name, static_cast<FileId>(buffers.size()));
+    if (inserted) {
+        buffers.emplace_back();
+        buffers.back().name = name;
+        buffers.back().line_starts.push_back(0);
+    }
+    return it->second;
+}
+
+SourceLoc SourceManager::location(FileId file, uint32_t offset) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file >= buffers.size() || buffers[file].start == 0 || offset > buffers[file].text.size()) {
+        return SourceLoc();
+    }
+    return SourceLoc::fromRaw(buffers[file].start + offset);
+}
+
+FileId SourceManager::findLocked(SourceLoc loc) const {
+    if (!loc.isValid()) {
+        return 0;
+    }
+    // Last buffer starting at or before the location
+    auto it = std::upper_bound(by_start.begin(), by_start.end(), loc.raw(),
+                               [&](uint32_t raw, FileId file) { return raw < buffers[file].start; });
+    if (it == by_start.begin()) {
+        return 0;
+    }
+    FileId file = *(it - 1);
+    return loc.raw() - buffers[file].start <= buffers[file].text.size() ? file : 0;
+}
+
+FileId SourceManager::fileOf(SourceLoc loc) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findLocked(loc);
+}
+
+const std::string& SourceManager::name(FileId file) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return file < buffers.size() ? buffers[file].name : buffers[0].name;
+}
+
+std::string_view SourceManager::text(FileId file) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return file < buffers.size() ? std::string_view(buffers[file].text) : std::string_view();
+}
+
+void SourceManager::decode(SourceLoc loc, FileId& file, int& line, int& column) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    file = findLocked(loc);
+    if (file == 0) {
+        line = 0;
+        column = 0;
+        return;
+    }
+
+    const Buffer& buffer = buffers[file];
+    uint32_t offset = loc.raw() - buffer.start;
+    auto next = std::upper_bound(buffer.line_starts.begin(), buffer.line_starts.end(), offset);
+    line = static_cast<int>(next - buffer.line_starts.begin());
+    column = static_cast<int>(offset - *(next - 1)) + 1;
+}
+
+SourceLocation SourceManager::decode(SourceLoc loc) const {
+    FileId file;
+    int line;
+    int column;
+    decode(loc, file, line, column);
+    return SourceLocation(name(file), line, column);
+}
+
+std::string_view SourceManager::lineText(FileId file, int line) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file == 0 || file >= buffers.size() || line < 1 ||
+        static_cast<size_t>(line) > buffers[file].line_starts.size()) {
+        return {};
+    }
+
+    const Buffer& buffer = buffers[file];
+    std::string_view text(buffer.text);
+    size_t begin = buffer.line_starts[line - 1];
+    size_t end = static_cast<size_t>(line) < buffer.line_starts.size() ? buffer.line_starts[line] - 1
+                                                                       : text.size();
+    return text.substr(begin, end - begin);
+}
+
+FileId fileId(const std::string& filename) {
+    return SourceManager::global().fileNamed(filename);
+}
+
+const std::string& fileName(FileId file) {
+    return SourceManager::global().name(file);
+}
+
+} // namespace mana
@@ -0,0 +1,497 @@
+#include "task.hpp"
+#include "builtins.hpp"
+#include "csv.hpp"
+#include "file.hpp"
+#include "json.hpp"
+#include "map.hpp"
+#include "regex.hpp"
+#include "scheduler.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+namespace mana {
+
+namespace {
+
+// Capacity of a channel made without one
+constexpr int32_t kDefaultChannelCapacity = 64;
+
+Channel& expectChannel(const char* name, Value value) {
+    if (!isChannel(value)) {
+        throw RuntimeError(std::string(name) + "() expects a channel, not " + value.typeName());
+    }
+    return *asChannel(value)->channel;
+}
+
+// The result of a task, waiting for it to finish
+Value waitFor(VM& vm, Task& task, const char* verb, const Value* in_use) {
+    // A parked async call of this VM runs here; one that nothing awaits yet
+    // parks in turn instead of waiting
+    if (!vm.finishAsyncCall(task, in_use) && !task.finished()) {
+        if (vm.canPark()) {
+            vm.park();
+        }
+        if (vm.runsAsyncCall(task)) {
+            throw RuntimeError(std::string(verb) + " task cannot finish before the code waiting for it");
+        }
+        while (!task.finished() && vm.finishParkedCall(in_use)) {
+        }
+    }
+    if (task.join(parkerFor(vm)) == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+
+    Message value;
+    std::string error;
+    if (!task.result(value, error)) {
+        throw RuntimeError(std::string(verb) + " task failed: " + error);
+    }
+    return fromMessage(vm, value);
+}
+
+// Maps being copied by this thread, innermost last
+thread_local std::vector<const ObjMap*> copying_maps;
+
+Message copyMap(ObjMap* map) {
+    if (std::find(copying_maps.begin(), copying_maps.end(), map) != copying_maps.end()) {
+        throw RuntimeError("Cannot copy a map that contains itself to another task");
+    }
+    copying_maps.push_back(map);
+
+    auto copy = std::make_shared<MapMessage>();
+    copy->entries.reserve(map->count());
+    try {
+        for (Value key = map->next(Value::nil()); !key.isNil(); key = map->next(key)) {
+            copy->entries.emplace_back(toMessage(key), toMessage(map->get(key)));
+        }
+    } catch (...) {
+        copying_maps.pop_back();
+        throw;
+    }
+    copying_maps.pop_back();
+    return std::shared_ptr<const MapMessage>(std::move(copy));
+}
+
+// Collects what a map holds that can reach globals: functions, and maps
+// that may hold more
+class CodeCollector : public GcTracer {
+public:
+    explicit CodeCollector(std::vector<Value>& found) : found(found) {}
+
+    void visit(Value& slot) override {
+        if (isFunction(slot) || isMap(slot)) {
+            found.push_back(slot);
+        }
+    }
+
+private:
+    std::vector<Value>& found;
+};
+
+} // namespace
+
+Task* parkerFor(VM& vm) {
+    return vm.canSuspend() ? vm.task() : nullptr;
+}
+
+Value awaitTask(VM& vm, Task& task) {
+    return waitFor(vm, task, "Awaited", nullptr);
+}
+
+Message toMessage(Value value) {
+    if (value.isInt()) {
+        return value.asInt();
+    }
+    if (value.isDouble()) {
+        return value.asDouble();
+    }
+    if (value.isBool()) {
+        return value.asBool();
+    }
+    if (value.isNil()) {
+        return nullptr;
+    }
+
+    switch (value.asObj()->getType()) {
+        case ObjType::STRING:
+            return asString(value)->str();
+        case ObjType::FUNCTION:
+            return asFunction(value)->proto;
+        case ObjType::NATIVE: {
+            ObjNative* native = asNative(value);
+            return NativeMessage{native->name, native->arity, native->function};
+        }
+        case ObjType::EXTERN:
+            return ExternMessage{asExtern(value)->function, asExtern(value)->call};
+        case ObjType::CHANNEL:
+            return asChannel(value)->channel;
+        case ObjType::TASK:
+            return asTask(value)->task;
+        case ObjType::FILE:
+            return asFile(value)->file;
+        case ObjType::JSON:
+            return JsonMessage{asJson(value)->document, asJson(value)->value};
+        case ObjType::CSV:
+            return asCsv(value)->table;
+        case ObjType::REGEX:
+            return asRegex(value)->matcher->regex();
+        case ObjType::MAP:
+            return copyMap(asMap(value));
+    }
+    return nullptr;
+}
+
+Value fromMessage(VM& vm, const Message& message) {
+    return std::visit([&vm](const auto& item) -> Value {
+        using T = std::decay_t<decltype(item)>;
+        if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return Value::nil();
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return Value::boolean(item);
+        } else if constexpr (std::is_same_v<T, int32_t>) {
+            return Value::integer(item);
+        } else if constexpr (std::is_same_v<T, double>) {
+            return Value::number(item);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            return Value::object(vm.newString(item));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<const FunctionProto>>) {
+            return Value::object(vm.loadFunction(item));
+        } else if constexpr (std::is_same_v<T, NativeMessage>) {
+            return Value::object(vm.allocate<ObjNative>(Generation::OLD, item.name, item.arity, item.function));
+        } else if constexpr (std::is_same_v<T, ExternMessage>) {
+            return Value::object(vm.allocate<ObjExtern>(Generation::OLD, item.function, item.call));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<Channel>>) {
+            return Value::object(vm.allocate<ObjChannel>(Generation::YOUNG, item));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<Task>>) {
+            return Value::object(vm.allocate<ObjTask>(Generation::YOUNG, item));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<File>>) {
+            return Value::object(vm.allocate<ObjFile>(Generation::YOUNG, item));
+        } else if constexpr (std::is_same_v<T, JsonMessage>) {
+            return Value::object(vm.allocate<ObjJson>(Generation::YOUNG, item.document, item.value));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<const CsvTable>>) {
+            return Value::object(vm.allocate<ObjCsv>(Generation::YOUNG, item));
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<const MapMessage>>) {
+            // Allocating does not collect, so the map stays where it is
+            ObjMap* map = vm.allocate<ObjMap>(Generation::YOUNG);
+            for (const auto& [key_message, value_message] : item->entries) {
+                Value key = fromMessage(vm, key_message);
+                Value value = fromMessage(vm, value_message);
+                map->set(key, value);
+                vm.writeBarrier(map, key);
+                vm.writeBarrier(map, value);
+            }
+            return Value::object(map);
+        } else {
+            // The DFA states built so far stay with the sender
+            return Value::object(vm.allocate<ObjRegex>(Generation::YOUNG, std::make_unique<RegexMatcher>(item)));
+        }
+    }, message);
+}
+
+std::vector<std::pair<std::string, Message>> copyGlobals(VM& vm, const std::vector<Value>& roots) {
+    std::vector<std::pair<std::string, Message>> globals;
+    std::unordered_set<const FunctionProto*> seen_protos;
+    std::unordered_set<const Obj*> seen_maps;
+    std::unordered_set<std::string> seen_names;
+    std::vector<const FunctionProto*> protos;
+    std::vector<Value> values(roots);
+
+    // Nothing here allocates, so no object moves while it is walked
+    CodeCollector collector(values);
+    while (!values.empty() || !protos.empty()) {
+        if (!values.empty()) {
+            Value value = values.back();
+            values.pop_back();
+            if (isFunction(value) && seen_protos.insert(asFunction(value)->proto.get()).second) {
+                protos.push_back(asFunction(value)->proto.get());
+            } else if (isMap(value) && seen_maps.insert(value.asObj()).second) {
+                asMap(value)->trace(collector);
+            }
+            continue;
+        }
+
+        const FunctionProto* proto = protos.back();
+        protos.pop_back();
+        for (const std::string& name : proto->globals) {
+            Value value;
+            // Builtins are defined in every VM already
+            if (!seen_names.insert(name).second || !vm.findGlobal(name, value) ||
+                (isNative(value) && findBuiltin(name) >= 0)) {
+                continue;
+            }
+            globals.emplace_back(name, toMessage(value));
+            values.push_back(value);
+        }
+        for (const auto& nested : proto->functions) {
+            if (seen_protos.insert(nested.get()).second) {
+                protos.push_back(nested.get());
+            }
+        }
+    }
+    return globals;
+}
+
+void WaitList::notifyAll(std::unique_lock<std::mutex>& lock) {
+    std::vector<Task*> woken;
+    woken.swap(parked);
+    if (blocked_threads > 0) {
+        threads.notify_all();
+    }
+
+    // A woken task may run, finish and be destroyed at once, so the lock of
+    // whatever it waited on must not be held any more
+    lock.unlock();
+    for (Task* task : woken) {
+        task->wake();
+    }
+    lock.lock();
+}
+
+// Channels
+
+bool Channel::accepts(Value value) const {
+    if (element_type.empty()) {
+        return true;
+    }
+    if (element_type == "number") {
+        return value.isNumber();
+    }
+    return element_type == value.typeName();
+}
+
+Channel::Status Channel::send(Message message, Task* parker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!closed && items.size() >= capacity) {
+        if (parker) {
+            senders.parked.push_back(parker);
+            return Status::PARKED;
+        }
+        senders.blocked_threads++;
+        senders.threads.wait(lock);
+        senders.blocked_threads--;
+    }
+    if (closed) {
+        return Status::CLOSED;
+    }
+
+    items.push_back(std::move(message));
+    receivers.notifyAll(lock);
+    return Status::DONE;
+}
+
+Channel::Status Channel::receive(Message& message, Task* parker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!closed && items.empty()) {
+        if (parker) {
+            receivers.parked.push_back(parker);
+            return Status::PARKED;
+        }
+        receivers.blocked_threads++;
+        receivers.threads.wait(lock);
+        receivers.blocked_threads--;
+    }
+    if (items.empty()) {
+        message = nullptr;
+        return Status::DONE;
+    }
+
+    message = std::move(items.front());
+    items.pop_front();
+    senders.notifyAll(lock);
+    return Status::DONE;
+}
+
+bool Channel::ready(bool sending) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed || (sending ? items.size() < capacity : !items.empty());
+}
+
+void Channel::close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    senders.notifyAll(lock);
+    receivers.notifyAll(lock);
+}
+
+// Tasks
+
+Task::Task(Message callee, std::vector<Message> args, std::vector<std::pair<std::string, Message>> globals)
+    : callee(std::move(callee)), args(std::move(args)), globals(std::move(globals)) {}
+
+Task::Task(std::function<void(VM&)> job) : job(std::move(job)) {}
+
+Task::Task() = default;
+
+Task::~Task() = default;
+
+Channel::Status Task::join(Task* parker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!done) {
+        if (parker) {
+            joiners.parked.push_back(parker);
+            return Channel::Status::PARKED;
+        }
+        joiners.blocked_threads++;
+        joiners.threads.wait(lock);
+        joiners.blocked_threads--;
+    }
+    return Channel::Status::DONE;
+}
+
+bool Task::finished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done;
+}
+
+bool Task::result(Message& result_value, std::string& error_message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    result_value = value;
+    error_message = error;
+    return !failed;
+}
+
+void Task::finish(bool ok, Message result, std::string message) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done = true;
+    failed = !ok;
+    value = std::move(result);
+    error = std::move(message);
+    joiners.notifyAll(lock);
+}
+
+void Task::wake() {
+    // Still unwinding out of the VM: the scheduler resumes it when it gets there
+    if (state.exchange(NOTIFIED) == PARKED) {
+        scheduler->enqueue(this);
+    }
+}
+
+// Builtins
+
+Value nativeSpawn(VM& vm, int argc, const Value* args) {
+    if (argc < 1) {
+        throw RuntimeError("spawn() expects a function to call");
+    }
+    Value callee = args[0];
+    if (!isFunction(callee) && !isNative(callee) && !isExtern(callee)) {
+        throw RuntimeError(std::string("Can only spawn functions, not ") + callee.typeName());
+    }
+
+    std::vector<Message> messages;
+    messages.reserve(static_cast<size_t>(argc - 1));
+    for (int i = 1; i < argc; ++i) {
+        messages.push_back(toMessage(args[i]));
+    }
+
+    // The task starts with a copy of the spawner's globals that its code uses
+    auto task = std::make_shared<Task>(toMessage(callee), std::move(messages),
+                                       copyGlobals(vm, std::vector<Value>(args, args + argc)));
+    vm.scheduler().submit(task);
+    return Value::object(vm.allocate<ObjTask>(Generation::YOUNG, std::move(task)));
+}
+
+Value nativeJoin(VM& vm, int argc, const Value* args) {
+    if (!isTask(args[0])) {
+        throw RuntimeError(std::string("join() expects a task, not ") + args[0].typeName());
+    }
+    return waitFor(vm, *asTask(args[0])->task, "Joined", args + argc);
+}
+
+Value nativeAwait(VM& vm, int argc, const Value* args) {
+    if (!isTask(args[0])) {
+        return args[0];
+    }
+    return waitFor(vm, *asTask(args[0])->task, "Awaited", args + argc);
+}
+
+Value nativeSleep(VM& vm, int, const Value* args) {
+    if (!args[0].isNumber()) {
+        throw RuntimeError(std::string("sleep() expects a number of milliseconds, not ") + args[0].typeName());
+    }
+    auto delay = std::chrono::duration<double, std::milli>(std::max(0.0, args[0].asNumber()));
+    auto deadline = Scheduler::Clock::now() + std::chrono::duration_cast<Scheduler::Clock::duration>(delay);
+    vm.keepWakeTime(deadline);
+    if (vm.canPark()) {
+        vm.parkUntil(deadline);
+    }
+    if (vm.scheduler().sleepUntil(deadline, parkerFor(vm)) == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+    return Value::nil();
+}
+
+Value nativeChannel(VM& vm, int argc, const Value* args) {
+    if (argc > 2) {
+        throw RuntimeError("Expected at most 2 arguments but got " + std::to_string(argc));
+    }
+    int32_t capacity = kDefaultChannelCapacity;
+    if (argc >= 1) {
+        if (!args[0].isInt() || args[0].asInt() < 1) {
+            throw RuntimeError("channel() expects a capacity of at least 1");
+        }
+        capacity = args[0].asInt();
+    }
+    std::string element_type;
+    if (argc == 2) {
+        if (!isString(args[1])) {
+            throw RuntimeError(std::string("channel() expects a type name, not ") + args[1].typeName());
+        }
+        element_type = vm.flatten(asString(args[1]))->view();
+    }
+
+    auto channel = std::make_shared<Channel>(static_cast<size_t>(capacity), std::move(element_type));
+    return Value::object(vm.allocate<ObjChannel>(Generation::YOUNG, std::move(channel)));
+}
+
+Value nativeSend(VM& vm, int argc, const Value* args) {
+    Channel& channel = expectChannel("send", args[0]);
+    if (!channel.accepts(args[1])) {
+        throw RuntimeError("Cannot send " + std::string(args[1].typeName()) + " to a channel of " +
+                           channel.elementType());
+    }
+
+    if (vm.canPark() && !channel.ready(true)) {
+        vm.park();
+    }
+    // A parked async call may be the one to make room
+    while (!channel.ready(true) && vm.finishParkedCall(args + argc)) {
+    }
+    Channel::Status status = channel.send(toMessage(args[1]), parkerFor(vm));
+    if (status == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+    if (status == Channel::Status::CLOSED) {
+        throw RuntimeError("Cannot send to a closed channel");
+    }
+    return Value::nil();
+}
+
+Value nativeRecv(VM& vm, int argc, const Value* args) {
+    Channel& channel = expectChannel("recv", args[0]);
+    if (vm.canPark() && !channel.ready(false)) {
+        vm.park();
+    }
+    while (!channel.ready(false) && vm.finishParkedCall(args + argc)) {
+    }
+    Message message;
+    if (channel.receive(message, parkerFor(vm)) == Channel::Status::PARKED) {
+        vm.suspend();
+    }
+    return fromMessage(vm, message);
+}
+
+Value nativeClose(VM&, int, const Value* args) {
+    if (isFile(args[0])) {
+        asFile(args[0])->file->close();
+    } else if (isChannel(args[0])) {
+        asChannel(args[0])->channel->close();
+    } else {
+        throw RuntimeError(std::string("close() expects a channel or a file, not ") + args[0].typeName());
+    }
+    return Value::nil();
+}
+
+} // namespace mana
@@ -16,7 +16,11 @@ std::unordered_map<std::string, TokenType> Keywords::keywords = {
     {"continue", TokenType::CONTINUE},
     {"true", TokenType::TRUE},
     {"false", TokenType::FALSE},
-    {"nil", TokenType::NIL}
+    {"nil", TokenType::NIL},
+    {"import", TokenType::IMPORT},
+    {"spawn", TokenType::SPAWN},
+    {"async", TokenType::ASYNC},
+    {"await", TokenType::AWAIT}
 };
 
 TokenType Keywords::getKeyword(const std::string& text) {
@@ -58,6 +62,10 @@ std::string tokenTypeToString(TokenType type) {
         case TokenType::TRUE: return "TRUE";
         case TokenType::FALSE: return "FALSE";
         case TokenType::NIL: return "NIL";
+        case TokenType::IMPORT: return "IMPORT";
+        case TokenType::SPAWN: return "SPAWN";
+        case TokenType::ASYNC: return "ASYNC";
+        case TokenType::AWAIT: return "AWAIT";
         case TokenType::PLUS: return "PLUS";
         case TokenType::MINUS: return "MINUS";
         case TokenType::STAR: return "STAR";
@@ -1,4 +1,7 @@
 #include "transpiler.hpp"
+#include "builtins.hpp"
+#include "error.hpp"
+#include "extension.hpp"
 
 namespace mana {
 
@@ -11,6 +14,11 @@ Transpiler::Transpiler() {
     type_map["void"] = "void";
 }
 
+Transpiler::Transpiler(CompilationContext& context) : Transpiler() {
+    filename = context.filename();
+    reports = &context.reports();
+}
+
 void Transpiler::indent() {
     for (int i = 0; i < indent_level; ++i) {
         output << "    ";
@@ -37,17 +45,58 @@ std::string Transpiler::getTypeName(const std::string& mana_type) {
 std::string Transpiler::transpile(const std::vector<StmtPtr>& statements) {
     // Add includes and namespace
     output.str("");
+    output << "#include <charconv>\n";
+    output << "#include <cstdio>\n";
+    output << "#include <cstring>\n";
     output << "#include <iostream>\n";
     output << "#include <string>\n";
+    output << "#include <string_view>\n";
+    output << "#include <unistd.h>\n";
     output << "#include <vector>\n";
     output << "#include <functional>\n";
-    output << "#include <cmath>\n\n";
+    output << "#include <cmath>\n";
+    output << "#include <chrono>\n";
+    output << "#include <thread>\n\n";
     
-    // Add any helper functions or runtime support
+    // Output is buffered and written at exit, or on newline on a terminal
     output << "// Manascript runtime support\n";
-    output << "void print(const std::string& message) {\n";
-    output << "    std::cout << message << std::endl;\n";
-    output << "}\n\n";
+    output << "struct ManaOutput {\n";
+    output << "    char buffer[1 << 16];\n";
+    output << "    size_t used = 0;\n";
+    output << "    bool interactive = isatty(fileno(stdout));\n";
+    output << "    void flush() { std::fwrite(buffer, 1, used, stdout); used = 0; std::fflush(stdout); }\n";
+    output << "    void write(std::string_view text) {\n";
+    output << "        if (used + text.size() > sizeof(buffer)) flush();\n";
+    output << "        if (text.size() > sizeof(buffer)) { std::fwrite(text.data(), 1, text.size(), stdout); return; }\n";
+    output << "        std::memcpy(buffer + used, text.data(), text.size());\n";
+    output << "        used += text.size();\n";
+    output << "    }\n";
+    output << "    void endLine() { write(\"\\n\"); if (interactive) flush(); }\n";
+    output << "    ~ManaOutput() { flush(); }\n";
+    output << "};\n";
+    output << "static ManaOutput mana_output;\n\n";
+    output << "void print(std::string_view message) { mana_output.write(message); mana_output.endLine(); }\n";
+    output << "void print(const char* message) { print(std::string_view(message)); }\n";
+    output << "void print(const std::string& message) { print(std::string_view(message)); }\n";
+    output << "void print(bool value) { print(std::string_view(value ? \"true\" : \"false\")); }\n";
+    output << "void print(int value) {\n";
+    output << "    char digits[16];\n";
+    output << "    print(std::string_view(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits));\n";
+    output << "}\n";
+    output << "void print(int64_t value) {\n";
+    output << "    char digits[24];\n";
+    output << "    print(std::string_view(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr - digits));\n";
+    output << "}\n";
+    output << "void print(double value) {\n";
+    output << "    char digits[32];\n";
+    output << "    auto end = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 14).ptr;\n";
+    output << "    print(std::string_view(digits, end - digits));\n";
+    output << "}\n";
+    output << "template <typename A, typename B> auto mana_min(A a, B b) { return b < a ? b : a; }\n";
+    output << "template <typename A, typename B> auto mana_max(A a, B b) { return a < b ? b : a; }\n";
+    output << "int mana_len(std::string_view text) { return static_cast<int>(text.size()); }\n";
+    output << "void mana_sleep(double ms) { std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms)); }\n";
+    output << "struct ManaExtString { const char* data; size_t length; };\n\n";
     
     // Transpile statements
     for (const auto& stmt : statements) {
@@ -136,6 +185,17 @@ void Transpiler::visitGroupingExpr(GroupingExpr& expr) {
     write(")");
 }
 
+void Transpiler::visitSpawnExpr(SpawnExpr& expr) {
+    reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, expr.getLoc(),
+                    "spawn is not supported in C++ output");
+    expr.getCall()->accept(*this);
+}
+
+void Transpiler::visitAwaitExpr(AwaitExpr& expr) {
+    // Async functions are emitted as plain ones, so their results are ready
+    expr.getValue()->accept(*this);
+}
+
 void Transpiler::visitVariableExpr(VariableExpr& expr) {
     write(expr.getName().lexeme);
 }
@@ -146,7 +206,21 @@ void Transpiler::visitAssignExpr(AssignExpr& expr) {
 }
 
 void Transpiler::visitCallExpr(CallExpr& expr) {
-    expr.getCallee()->accept(*this);
+    // Builtins map to their C++ counterparts
+    auto* variable = dynamic_cast<VariableExpr*>(expr.getCallee().get());
+    int id = variable ? findBuiltin(variable->getName().lexeme) : -1;
+    auto wrapper = variable ? extern_wrappers.find(variable->getName().lexeme) : extern_wrappers.end();
+    if (id >= 0 && !builtins()[id].cpp_name) {
+        reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, expr.getLoc(),
+                        std::string(builtins()[id].name) + "() is not supported in C++ output");
+        write(builtins()[id].name);
+    } else if (id >= 0) {
+        write(builtins()[id].cpp_name);
+    } else if (wrapper != extern_wrappers.end()) {
+        write(wrapper->second);
+    } else {
+        expr.getCallee()->accept(*this);
+    }
     write("(");
     
     const auto& args = expr.getArguments();
@@ -246,6 +320,27 @@ void Transpiler::visitWhileStmt(WhileStmt& stmt) {
     }
 }
 
+void Transpiler::visitParallelForStmt(ParallelForStmt& stmt) {
+    // Iterations are independent, so running them in order is one valid schedule
+    const std::string& name = stmt.getVariable().lexeme;
+    indent();
+    write("for (auto " + name + " = ");
+    stmt.getStart()->accept(*this);
+    write("; " + name + " < ");
+    stmt.getEnd()->accept(*this);
+    write("; ++" + name + ") ");
+
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt.getBody().get())) {
+        block->accept(*this);
+    } else {
+        writeLine("{");
+        indent_level++;
+        stmt.getBody()->accept(*this);
+        indent_level--;
+        writeLine("}");
+    }
+}
+
 void Transpiler::visitFunctionStmt(FunctionStmt& stmt) {
     // Determine if this is the main function
     bool is_main = stmt.getName().lexeme == "main";
@@ -303,4 +398,57 @@ void Transpiler::visitReturnStmt(ReturnStmt& stmt) {
     write(";\n");
 }
 
+void Transpiler::visitImportStmt(ImportStmt& stmt) {
+    std::string error;
+    const ExtModule* module = loadExtension(stmt.getPath(), error);
+    if (!module) {
+        reports->report(DiagnosticSeverity::ERROR, "Cannot import " + error,
+                        SourceLocation(filename, stmt.getKeyword().line, stmt.getKeyword().column));
+        return;
+    }
+
+    // Declare each C function and wrap it so strings can be passed as views.
+    // Wrappers are prefixed so they cannot collide with C library names.
+    writeLine("// import \"" + stmt.getPath() + "\": link the program with this module");
+    for (uint32_t i = 0; i < module->count; ++i) {
+        const ExtFunction& function = module->functions[i];
+        if (!function.symbol) {
+            reports->report(DiagnosticSeverity::ERROR,
+                            std::string("Extension function ") + function.name + "() has no C symbol",
+                            SourceLocation(filename, stmt.getKeyword().line, stmt.getKeyword().column));
+            continue;
+        }
+
+        static const char* c_types[] = {"void", "int64_t", "double", "bool", "ManaExtString"};
+        std::string result = c_types[static_cast<int>(function.result)];
+        std::string c_params, params, args;
+        for (int p = 0; p < function.arity; ++p) {
+            std::string sep = p > 0 ? ", " : "";
+            std::string arg = "a" + std::to_string(p);
+            if (function.params[p] == ExtType::STRING) {
+                c_params += sep + "const char*, size_t";
+                params += sep + "std::string_view " + arg;
+                args += sep + arg + ".data(), " + arg + ".size()";
+            } else {
+                c_params += sep + c_types[static_cast<int>(function.params[p])];
+                params += sep + c_types[static_cast<int>(function.params[p])] + " " + arg;
+                args += sep + arg;
+            }
+        }
+
+        std::string wrapper = std::string("mana_ext_") + function.name;
+        extern_wrappers[function.name] = wrapper;
+
+        writeLine("extern \"C\" " + result + " " + function.symbol + "(" + c_params + ");");
+        if (function.result == ExtType::STRING) {
+            writeLine("inline std::string " + wrapper + "(" + params + ") { ManaExtString r = " +
+                      function.symbol + "(" + args + "); return std::string(r.data, r.length); }");
+        } else {
+            writeLine("inline " + result + " " + wrapper + "(" + params + ") { return " +
+                      function.symbol + "(" + args + "); }");
+        }
+    }
+    writeLine("");
+}
+
 } // namespace mana
\ No newline at end of file
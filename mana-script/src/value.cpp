@@ -0,0 +1,104 @@
+#include "value.hpp"
+#include "object.hpp"
+#include "csv.hpp"
+#include "file.hpp"
+#include "json.hpp"
+#include "map.hpp"
+#include "regex.hpp"
+#include "task.hpp"
+#include <charconv>
+
+namespace mana {
+
+const char* Value::typeName() const {
+    if (isInt()) return "int";
+    if (isDouble()) return "float";
+    if (isBool()) return "bool";
+    if (isNil()) return "nil";
+
+    switch (asObj()->getType()) {
+        case ObjType::STRING:   return "string";
+        case ObjType::FUNCTION: return "function";
+        case ObjType::NATIVE:   return "function";
+        case ObjType::EXTERN:   return "function";
+        case ObjType::CHANNEL:  return "channel";
+        case ObjType::TASK:     return "task";
+        case ObjType::FILE:     return "file";
+        case ObjType::JSON:     return "json";
+        case ObjType::CSV:      return "csv";
+        case ObjType::REGEX:    return "regex";
+        case ObjType::MAP:      return "map";
+        default: return "object";
+    }
+}
+
+std::string Value::toString() const {
+    if (isNumber()) {
+        char buffer[kMaxNumberChars];
+        return std::string(buffer, formatNumber(*this, buffer));
+    }
+    if (isBool()) {
+        return asBool() ? "true" : "false";
+    }
+    if (isNil()) {
+        return "nil";
+    }
+
+    switch (asObj()->getType()) {
+        case ObjType::STRING:
+            return asString(*this)->str();
+        case ObjType::FUNCTION:
+            return "<function " + asFunction(*this)->proto->name + ">";
+        case ObjType::NATIVE:
+            return "<native " + asNative(*this)->name + ">";
+        case ObjType::EXTERN:
+            return "<native " + std::string(asExtern(*this)->function->name) + ">";
+        case ObjType::CHANNEL:
+            return "<channel>";
+        case ObjType::TASK:
+            return "<task>";
+        case ObjType::FILE:
+            return "<file " + asFile(*this)->file->path() + ">";
+        case ObjType::JSON:
+            return std::string(asJson(*this)->document->raw(asJson(*this)->value));
+        case ObjType::CSV:
+            return "<csv " + std::to_string(asCsv(*this)->table->rows()) + " rows>";
+        case ObjType::REGEX:
+            return "<regex " + asRegex(*this)->matcher->regex()->pattern() + ">";
+        case ObjType::MAP:
+            return "<map " + std::to_string(asMap(*this)->count()) + " entries>";
+        default:
+            return "<object>";
+    }
+}
+
+char* formatNumber(Value value, char* out) {
+    char* end = out + kMaxNumberChars;
+    if (value.isInt()) {
+        return std::to_chars(out, end, value.asInt()).ptr;
+    }
+    return std::to_chars(out, end, value.asDouble(), std::chars_format::general, 14).ptr;
+}
+
+bool valuesEqual(Value a, Value b) {
+    if (a == b) {
+        // Identical bits; NaN is the one value that is not equal to itself
+        return !(a.isDouble() && a.asDouble() != a.asDouble());
+    }
+    if (a.isNumber() && b.isNumber()) {
+        return a.asNumber() == b.asNumber();
+    }
+    if (isString(a) && isString(b)) {
+        return stringsEqual(asString(a), asString(b));
+    }
+    // Each VM has handles of its own for a channel or task it received
+    if (isChannel(a) && isChannel(b)) {
+        return asChannel(a)->channel == asChannel(b)->channel;
+    }
+    if (isTask(a) && isTask(b)) {
+        return asTask(a)->task == asTask(b)->task;
+    }
+    return false;
+}
+
+} // namespace mana
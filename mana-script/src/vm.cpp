@@ -0,0 +1,1282 @@
+#include "vm.hpp"
+#include "builtins.hpp"
+#include "map.hpp"
+#include "scheduler.hpp"
+#include "task.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace mana {
+
+namespace {
+
+constexpr size_t kMaxFrames = 1 << 14;
+
+// After this many failed guards an instruction stays generic for good
+constexpr uint8_t kMaxDeopts = 4;
+
+// Concatenations shorter than this are copied; longer ones become ropes
+constexpr size_t kMinRopeLength = 64;
+
+// Strings that look like names are interned up to this length
+constexpr size_t kMaxInternLength = 32;
+
+bool isIdentifierLike(std::string_view chars) {
+    if (chars.empty() || chars.size() > kMaxInternLength) {
+        return false;
+    }
+    if (!std::isalpha(static_cast<unsigned char>(chars[0])) && chars[0] != '_') {
+        return false;
+    }
+    for (char c : chars) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Pick the type-specialized form of a generic instruction
+ * @return The quickened opcode, or op itself if these operand types have none
+ */
+OpCode specialize(OpCode op, Value left, Value right) {
+    bool ints = left.isInt() && right.isInt();
+    bool doubles = left.isDouble() && right.isDouble();
+
+    if (ints) {
+        switch (op) {
+            case OpCode::ADD: return OpCode::ADD_II;
+            case OpCode::SUB: return OpCode::SUB_II;
+            case OpCode::MUL: return OpCode::MUL_II;
+            case OpCode::DIV: return OpCode::DIV_II;
+            case OpCode::MOD: return OpCode::MOD_II;
+            case OpCode::EQ:  return OpCode::EQ_II;
+            case OpCode::NE:  return OpCode::NE_II;
+            case OpCode::LT:  return OpCode::LT_II;
+            case OpCode::LE:  return OpCode::LE_II;
+            case OpCode::GT:  return OpCode::GT_II;
+            case OpCode::GE:  return OpCode::GE_II;
+            case OpCode::IFLT: return OpCode::IFLT_II;
+            case OpCode::IFLE: return OpCode::IFLE_II;
+            default: return op;
+        }
+    }
+
+    if (doubles) {
+        switch (op) {
+            case OpCode::ADD: return OpCode::ADD_DD;
+            case OpCode::SUB: return OpCode::SUB_DD;
+            case OpCode::MUL: return OpCode::MUL_DD;
+            case OpCode::DIV: return OpCode::DIV_DD;
+            case OpCode::LT:  return OpCode::LT_DD;
+            case OpCode::LE:  return OpCode::LE_DD;
+            case OpCode::GT:  return OpCode::GT_DD;
+            case OpCode::GE:  return OpCode::GE_DD;
+            case OpCode::IFLT: return OpCode::IFLT_DD;
+            case OpCode::IFLE: return OpCode::IFLE_DD;
+            default: return op;
+        }
+    }
+
+    return op;
+}
+
+} // namespace
+
+VM::VM(size_t nursery_size, size_t stack_size) : heap(nursery_size) {
+    stack.reserve(stack_size);
+    frames.reserve(kMaxFrames);
+    defineBuiltins();
+}
+
+VM::~VM() = default;
+
+void VM::defineBuiltins() {
+    // Globals too, so builtins can be passed around and called like any function
+    for (const Builtin& builtin : builtins()) {
+        defineNative(builtin.name, builtin.arity, builtin.function);
+        builtin_table.push_back(builtin.function);
+    }
+}
+
+ObjString* VM::newString(std::string_view chars) {
+    if (isIdentifierLike(chars)) {
+        auto it = interned.find(chars);
+        if (it != interned.end()) {
+            return it->second;
+        }
+    }
+    return heap.allocate<ObjString>(Generation::YOUNG, chars);
+}
+
+ObjString* VM::intern(std::string_view chars) {
+    auto it = interned.find(chars);
+    if (it != interned.end()) {
+        return it->second;
+    }
+
+    // Old objects never move, so the table can key on their characters
+    ObjString* string = heap.allocate<ObjString>(Generation::OLD, chars);
+    string->interned = true;
+    interned.emplace(string->view(), string);
+    return string;
+}
+
+ObjString* VM::canonical(ObjString* string) {
+    if (string->interned || !isIdentifierLike(string->view())) {
+        return string;
+    }
+    auto it = interned.find(string->view());
+    return it != interned.end() ? it->second : string;
+}
+
+ObjString* VM::flatten(ObjString* string) {
+    if (ObjString* chars = string->flat()) {
+        return chars;
+    }
+
+    ObjString* copy = heap.allocate<ObjString>(Generation::YOUNG, static_cast<size_t>(string->length));
+    string->copyTo(copy->storage());
+
+    string->setFlat(copy);
+    heap.writeBarrier(string, Value::object(copy));
+    return copy;
+}
+
+void VM::traceRoots(GcTracer& tracer) {
+    for (Value* slot = stack.data(); slot < stackTop(); ++slot) {
+        tracer.visit(*slot);
+    }
+    for (Value& global : globals.values) {
+        tracer.visit(global);
+    }
+    for (Value& root : host_roots) {
+        tracer.visit(root);
+    }
+    for (auto& [order, call] : parked) {
+        for (Value& slot : call.registers) {
+            tracer.visit(slot);
+        }
+    }
+    // Functions and interned strings are old and never move; visiting them
+    // keeps them marked
+    for (const auto& [proto, function] : loaded_functions) {
+        Value value = Value::object(function);
+        tracer.visit(value);
+    }
+    for (const auto& [chars, string] : interned) {
+        Value value = Value::object(string);
+        tracer.visit(value);
+    }
+}
+
+void VM::collectGarbage(bool major) {
+    heap.collect(major, [this](GcTracer& tracer) { traceRoots(tracer); });
+}
+
+ObjFunction* VM::loadFunction(const std::shared_ptr<const FunctionProto>& proto) {
+    auto it = loaded_functions.find(proto.get());
+    if (it != loaded_functions.end()) {
+        return it->second;
+    }
+
+    // Code lives as long as the VM, so it skips the nursery along with its constants
+    ObjFunction* function = heap.allocate<ObjFunction>(Generation::OLD, proto);
+    loaded_functions[proto.get()] = function;
+
+    function->code = proto->code;
+    function->caches.resize(proto->num_caches);
+    function->constants.reserve(proto->constants.size());
+    for (const auto& constant : proto->constants) {
+        function->constants.push_back(materialize(constant));
+    }
+    return function;
+}
+
+Value VM::materialize(const Constant& constant) {
+    if (std::holds_alternative<int>(constant)) {
+        return Value::integer(std::get<int>(constant));
+    }
+    if (std::holds_alternative<double>(constant)) {
+        return Value::number(std::get<double>(constant));
+    }
+    if (std::holds_alternative<std::string>(constant)) {
+        const std::string& chars = std::get<std::string>(constant);
+        if (isIdentifierLike(chars)) {
+            return Value::object(intern(chars));
+        }
+        return Value::object(heap.allocate<ObjString>(Generation::OLD, chars));
+    }
+    if (std::holds_alternative<bool>(constant)) {
+        return Value::boolean(std::get<bool>(constant));
+    }
+    return Value::nil();
+}
+
+void VM::defineGlobal(const std::string& name, Value value) {
+    auto it = globals.slots.find(name);
+    if (it == globals.slots.end()) {
+        globals.slots.emplace(name, static_cast<uint32_t>(globals.values.size()));
+        globals.values.push_back(value);
+    } else {
+        globals.values[it->second] = value;
+    }
+    globals.version++;
+}
+
+void VM::forEachGlobal(const std::function<void(const std::string& name, Value value)>& visit) const {
+    for (const auto& [name, slot] : globals.slots) {
+        visit(name, globals.values[slot]);
+    }
+}
+
+void VM::resetGlobals() {
+    // The builtins were defined first, so they hold the lowest slots
+    uint32_t kept = static_cast<uint32_t>(builtin_table.size());
+    for (auto it = globals.slots.begin(); it != globals.slots.end();) {
+        it = it->second >= kept ? globals.slots.erase(it) : std::next(it);
+    }
+    globals.values.resize(kept);
+    globals.version++;
+
+    // Nor keep the code it ran: a host may have dropped those prototypes,
+    // and a pooled VM would otherwise hold them, and their sources, forever
+    loaded_functions.clear();
+    collectGarbage(true);
+}
+
+Value VM::getGlobal(const std::string& name) const {
+    auto it = globals.slots.find(name);
+    return it != globals.slots.end() ? globals.values[it->second] : Value::nil();
+}
+
+bool VM::findGlobal(const std::string& name, Value& value) const {
+    auto it = globals.slots.find(name);
+    if (it == globals.slots.end()) {
+        return false;
+    }
+    value = globals.values[it->second];
+    return true;
+}
+
+void VM::resolveGlobal(const std::string& name, InlineCache& cache) {
+    auto it = globals.slots.find(name);
+    if (it == globals.slots.end()) {
+        runtimeError("Undefined variable '" + name + "'");
+    }
+    cache.version = globals.version;
+    cache.slot = it->second;
+}
+
+void VM::defineNative(const std::string& name, int arity, NativeFn function) {
+    defineGlobal(name, Value::object(heap.allocate<ObjNative>(Generation::OLD, name, arity, function)));
+}
+
+void VM::importExtension(const std::string& path) {
+    std::string error;
+    const ExtModule* module = loadExtension(path, error);
+    if (!module) {
+        runtimeError("Cannot import " + error);
+    }
+
+    for (uint32_t i = 0; i < module->count; ++i) {
+        const ExtFunction& function = module->functions[i];
+        if (findBuiltin(function.name) >= 0) {
+            runtimeError("Cannot import '" + path + "': it redefines builtin '" + function.name + "'");
+        }
+        ExternFn caller = externCaller(function);
+        if (!caller) {
+            runtimeError("Cannot import '" + path + "': " + function.name + "() has an unsupported signature");
+        }
+        defineGlobal(function.name, Value::object(heap.allocate<ObjExtern>(Generation::OLD, &function, caller)));
+    }
+}
+
+InterpretResult VM::interpret(const std::shared_ptr<const FunctionProto>& script, AllocationMode mode) {
+    return call(Value::object(loadFunction(script)), {}, nullptr, mode);
+}
+
+InterpretResult VM::call(Value callee, const std::vector<Value>& args, Value* result, AllocationMode mode) {
+    if (mode == AllocationMode::HEAP || heap.inArena()) {
+        return invoke(callee, args, result);
+    }
+
+    Arena& arena = Arena::forThread();
+    if (!arena.acquire(this)) {
+        return invoke(callee, args, result);
+    }
+
+    heap.enterArena(arena);
+    Value value = Value::nil();
+    InterpretResult status = invoke(callee, args, &value);
+    leaveArena(value);
+    arena.release();
+
+    if (result && status == InterpretResult::OK) {
+        *result = value;
+    }
+    return status;
+}
+
+InterpretResult VM::callEach(Value callee, const std::function<bool(std::string_view&)>& next,
+                             const std::function<void(Value)>& take, AllocationMode mode) {
+    Arena& arena = Arena::forThread();
+    bool in_arena = mode == AllocationMode::ARENA && !heap.inArena() && arena.acquire(this);
+    if (in_arena) {
+        heap.enterArena(arena);
+    }
+
+    std::vector<Value> args(1);
+    Value value = Value::nil();
+    InterpretResult status = InterpretResult::OK;
+    size_t calls = 0;
+    std::string_view text;
+    try {
+        while (status == InterpretResult::OK && next(text)) {
+            args[0] = Value::object(newString(text));
+            status = invoke(callee, args, &value);
+            if (status == InterpretResult::OK && take) {
+                take(value);
+            }
+            if (in_arena && ++calls == kCallsPerArena) {
+                // Between calls only globals and host roots hold on to anything
+                value = Value::nil();
+                leaveArena(value);
+                heap.enterArena(arena);
+                calls = 0;
+            }
+        }
+    } catch (...) {
+        // next() or take() failed; the arena is left as it would be otherwise
+        if (in_arena) {
+            value = Value::nil();
+            leaveArena(value);
+            arena.release();
+        }
+        throw;
+    }
+
+    if (in_arena) {
+        value = Value::nil();
+        leaveArena(value);
+        arena.release();
+    }
+    return status;
+}
+
+// Frames of the arena call are gone, so only its result, globals and host
+// roots can still reach its objects
+void VM::leaveArena(Value& result) {
+    heap.leaveArena([&](GcTracer& tracer) {
+        tracer.visit(result);
+        for (Value& global : globals.values) {
+            tracer.visit(global);
+        }
+        for (Value& root : host_roots) {
+            tracer.visit(root);
+        }
+    });
+}
+
+InterpretResult VM::invoke(Value callee, const std::vector<Value>& args, Value* result) {
+    size_t depth = frames.size();
+    Value* window = stackTop();
+
+    invoke_depth++;
+    try {
+        if (!growStack(window + args.size() + 1)) {
+            runtimeError("Stack overflow");
+        }
+
+        window[0] = callee;
+        std::copy(args.begin(), args.end(), window + 1);
+
+        callValue(window, static_cast<int>(args.size()));
+    } catch (const RuntimeError& error) {
+        invoke_depth--;
+        reportRuntimeError(error, depth);
+        return InterpretResult::RUNTIME_ERROR;
+    }
+    InterpretResult status = finish(depth, window, result);
+    invoke_depth--;
+    return status;
+}
+
+InterpretResult VM::resume(Value* result) {
+    invoke_depth++;
+    InterpretResult status = finish(suspended_depth, suspended_window, result);
+    invoke_depth--;
+    return status;
+}
+
+// Run the frames above depth to completion or suspension
+InterpretResult VM::finish(size_t depth, Value* window, Value* result) {
+    for (;;) {
+        try {
+            if (frames.size() > depth) {
+                run(depth);
+            }
+            // Async calls that nothing awaited finish before the host call
+            // returns, above its result
+            if (invoke_depth == 1 && !parked.empty()) {
+                resumeAsyncCall(*parked.begin()->second.calls.front().task, window + 1);
+                continue;
+            }
+            break;
+        } catch (const RuntimeError& error) {
+            if (!async_calls.empty() && async_calls.back().depth >= depth) {
+                failAsyncCall(error.what());
+                continue;
+            }
+            reportRuntimeError(error, depth);
+            if (invoke_depth == 1) {
+                abandonAsyncCalls(error.what());
+            }
+            return InterpretResult::RUNTIME_ERROR;
+        } catch (const CallParked&) {
+            frames.back().pc--;
+            parkAsyncCall();
+        } catch (const TaskSuspended&) {
+            // Natives are called with the frame's pc past the call; point it back
+            frames.back().pc--;
+            suspended_depth = depth;
+            suspended_window = window;
+            return InterpretResult::SUSPENDED;
+        }
+    }
+
+    if (result) {
+        *result = window[0];
+    }
+    return InterpretResult::OK;
+}
+
+void VM::suspend() {
+    throw TaskSuspended();
+}
+
+bool VM::canPark() const {
+    if (heap.inArena()) {
+        return false;
+    }
+    // Calls being awaited wait the way their awaiter does
+    for (auto it = async_calls.rbegin(); it != async_calls.rend() && it->invoke_depth == invoke_depth; ++it) {
+        if (it->detached) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void VM::park() {
+    throw CallParked();
+}
+
+void VM::parkUntil(std::chrono::steady_clock::time_point wake_at) {
+    async_calls.back().asleep = true;
+    async_calls.back().wake_at = wake_at;
+    throw CallParked();
+}
+
+void VM::keepWakeTime(std::chrono::steady_clock::time_point& deadline) {
+    if (!async_calls.empty() && async_calls.back().asleep) {
+        async_calls.back().asleep = false;
+        deadline = async_calls.back().wake_at;
+    }
+}
+
+void VM::startAsyncCall(Value* window, int argc) {
+    async_calls.push_back({std::make_shared<Task>(), frames.size(), static_cast<size_t>(window - stack.data()),
+                           invoke_depth, true, false, {}});
+    try {
+        callValue(window, argc);
+    } catch (...) {
+        async_calls.pop_back();
+        throw;
+    }
+}
+
+// The first frame of the innermost call has returned result
+void VM::returnAsyncCall(Value& result) {
+    // Copied first: if it cannot be, the call fails instead
+    Message value = toMessage(result);
+    AsyncCall call = std::move(async_calls.back());
+    async_calls.pop_back();
+    call.task->finish(true, std::move(value), "");
+    if (call.detached) {
+        result = Value::object(heap.allocate<ObjTask>(Generation::YOUNG, call.task));
+    }
+}
+
+void VM::failAsyncCall(const std::string& message) {
+    AsyncCall call = std::move(async_calls.back());
+    async_calls.pop_back();
+    frames.resize(call.depth);
+    call.task->finish(false, nullptr, message);
+    if (call.detached) {
+        stack[call.window] = Value::object(heap.allocate<ObjTask>(Generation::YOUNG, call.task));
+    }
+}
+
+// Move the innermost detached call, and the calls it awaits, off the stack
+void VM::parkAsyncCall() {
+    size_t first = async_calls.size() - 1;
+    while (!async_calls[first].detached) {
+        first--;
+    }
+    size_t depth = async_calls[first].depth;
+    size_t window = async_calls[first].window;
+
+    ParkedCall call;
+    call.registers.assign(stack.data() + window, stackTop());
+    for (size_t i = depth; i < frames.size(); ++i) {
+        const CallFrame& frame = frames[i];
+        call.frames.push_back({frame.function, static_cast<size_t>(frame.pc - frame.function->code.data()),
+                               static_cast<size_t>(frame.base - stack.data()) - window});
+    }
+
+    uint64_t order = parked_count++;
+    for (size_t i = first; i < async_calls.size(); ++i) {
+        AsyncCall& held = async_calls[i];
+        held.depth -= depth;
+        held.window -= window;
+        parked_tasks[held.task.get()] = order;
+        call.calls.push_back(std::move(held));
+    }
+    async_calls.resize(first);
+    frames.resize(depth);
+
+    // The frame that started it carries on with the task
+    stack[window] = Value::object(heap.allocate<ObjTask>(Generation::YOUNG, call.calls.front().task));
+    parked.emplace(order, std::move(call));
+}
+
+// Put a parked call back above window, awaited now
+bool VM::resumeAsyncCall(const Task& task, Value* window) {
+    auto found = parked_tasks.find(&task);
+    if (found == parked_tasks.end()) {
+        return false;
+    }
+    auto it = parked.find(found->second);
+    ParkedCall& call = it->second;
+    if (frames.size() + call.frames.size() > kMaxFrames || !growStack(window + call.registers.size())) {
+        runtimeError("Stack overflow");
+    }
+
+    std::copy(call.registers.begin(), call.registers.end(), window);
+    size_t depth = frames.size();
+    for (const ParkedFrame& frame : call.frames) {
+        frames.push_back({frame.function, frame.function->code.data() + frame.pc, window + frame.base});
+    }
+    size_t offset = static_cast<size_t>(window - stack.data());
+    for (AsyncCall& held : call.calls) {
+        parked_tasks.erase(held.task.get());
+        held.depth += depth;
+        held.window += offset;
+        held.invoke_depth = invoke_depth;
+        held.detached = false;
+        async_calls.push_back(std::move(held));
+    }
+    parked.erase(it);
+    return true;
+}
+
+bool VM::finishAsyncCall(const Task& task, const Value* in_use) {
+    if (!parked_tasks.count(&task)) {
+        return false;
+    }
+    Value* window = std::max(stackTop(), const_cast<Value*>(in_use));
+    size_t depth = frames.size();
+
+    // A call in progress from C++, so nothing in it can suspend
+    invoke_depth++;
+    try {
+        resumeAsyncCall(task, window);
+    } catch (...) {
+        invoke_depth--;
+        throw;
+    }
+    finish(depth, window, nullptr);
+    invoke_depth--;
+    return true;
+}
+
+bool VM::finishParkedCall(const Value* in_use) {
+    return !parked.empty() && finishAsyncCall(*parked.begin()->second.calls.front().task, in_use);
+}
+
+bool VM::runsAsyncCall(const Task& task) const {
+    for (const AsyncCall& call : async_calls) {
+        if (call.task.get() == &task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The host call failed, so nothing will await what it left parked
+void VM::abandonAsyncCalls(const std::string& message) {
+    for (auto& [order, call] : parked) {
+        for (AsyncCall& held : call.calls) {
+            held.task->finish(false, nullptr, message);
+        }
+    }
+    parked.clear();
+    parked_tasks.clear();
+}
+
+Scheduler& VM::scheduler() const {
+    return task_scheduler ? *task_scheduler : Scheduler::global();
+}
+
+Value* VM::stackTop() {
+    if (frames.empty()) {
+        return stack.data();
+    }
+    const CallFrame& frame = frames.back();
+    return frame.base + frame.function->proto->num_registers;
+}
+
+// Make the registers below end exist; false past the reserved stack
+bool VM::growStack(Value* end) {
+    size_t needed = static_cast<size_t>(end - stack.data());
+    if (needed > stack.size()) {
+        if (needed > stack.capacity()) {
+            return false;
+        }
+        stack.resize(needed);
+    }
+    return true;
+}
+
+void VM::callValue(Value* window, int argc, InlineCache* cache) {
+    Value callee = window[0];
+
+    if (isFunction(callee)) {
+        ObjFunction* function = asFunction(callee);
+        int arity = function->proto->arity;
+
+        if (argc != arity) {
+            runtimeError("Expected " + std::to_string(arity) + " arguments but got " +
+                         std::to_string(argc));
+        }
+
+        // A call site always passes the same number of arguments, so a cache
+        // hit can skip the type and arity checks above
+        if (cache) {
+            cache->callee = callee;
+            heap.writeBarrier(frames.back().function, callee);
+        }
+        pushFrame(function, window, argc);
+        return;
+    }
+
+    if (isNative(callee)) {
+        ObjNative* native = asNative(callee);
+        if (native->arity >= 0 && argc != native->arity) {
+            runtimeError("Expected " + std::to_string(native->arity) + " arguments but got " +
+                         std::to_string(argc));
+        }
+        if (cache) {
+            cache->callee = callee;
+            heap.writeBarrier(frames.back().function, callee);
+        }
+        window[0] = native->function(*this, argc, window + 1);
+        return;
+    }
+
+    if (isExtern(callee)) {
+        ObjExtern* function = asExtern(callee);
+        if (argc != function->function->arity) {
+            runtimeError("Expected " + std::to_string(function->function->arity) + " arguments but got " +
+                         std::to_string(argc));
+        }
+        if (cache) {
+            cache->callee = callee;
+            heap.writeBarrier(frames.back().function, callee);
+        }
+        window[0] = function->call(*this, *function->function, window + 1);
+        return;
+    }
+
+    runtimeError(std::string("Can only call functions, not ") + callee.typeName());
+}
+
+void VM::pushFrame(ObjFunction* function, Value* window, int argc) {
+    int num_registers = function->proto->num_registers;
+    Value* base = window + 1;
+
+    if (frames.size() >= kMaxFrames || !growStack(base + num_registers)) {
+        runtimeError("Stack overflow");
+    }
+
+    std::fill(base + argc, base + num_registers, Value::nil());
+    frames.push_back({function, function->code.data(), base});
+}
+
+ObjString* VM::toStringObject(Value value) {
+    if (value.isNumber()) {
+        char digits[kMaxNumberChars];
+        char* end = formatNumber(value, digits);
+        return newString(std::string_view(digits, static_cast<size_t>(end - digits)));
+    }
+    return newString(value.toString());
+}
+
+Value VM::concatenate(Value left, Value right) {
+    ObjString* a = isString(left) ? asString(left) : toStringObject(left);
+    ObjString* b = isString(right) ? asString(right) : toStringObject(right);
+
+    // Strings are immutable, so an empty side needs no new string
+    if (a->length == 0) {
+        return Value::object(b);
+    }
+    if (b->length == 0) {
+        return Value::object(a);
+    }
+
+    size_t length = static_cast<size_t>(a->length) + b->length;
+    if (length > UINT32_MAX) {
+        runtimeError("String is too long");
+    }
+    if (length < kMinRopeLength) {
+        char chars[kMinRopeLength];
+        a->copyTo(chars);
+        b->copyTo(chars + a->length);
+        return Value::object(newString(std::string_view(chars, length)));
+    }
+
+    ObjString* rope = heap.allocate<ObjString>(Generation::YOUNG, ObjString::Rope{},
+                                               Value::object(a), Value::object(b), length);
+    heap.writeBarrier(rope, Value::object(a));
+    heap.writeBarrier(rope, Value::object(b));
+    return Value::object(rope);
+}
+
+bool VM::compareStrings(Value left, Value right, bool or_equal) {
+    if (!isString(left) || !isString(right)) {
+        runtimeError("Operands of a comparison must be numbers or strings");
+    }
+    int cmp = flatten(asString(left))->view().compare(flatten(asString(right))->view());
+    return or_equal ? cmp <= 0 : cmp < 0;
+}
+
+bool VM::equalValues(Value left, Value right) {
+    if (isString(left) && isString(right) && asString(left)->length == asString(right)->length) {
+        return stringsEqual(flatten(asString(left)), flatten(asString(right)));
+    }
+    return valuesEqual(left, right);
+}
+
+void VM::setOpcodeProfiling(bool enabled) {
+    pair_counts.assign(enabled ? kOpCodeCount * kOpCodeCount : 0, 0);
+}
+
+std::vector<OpcodePairCount> VM::opcodePairs() const {
+    std::vector<OpcodePairCount> pairs;
+    for (size_t i = 0; i < pair_counts.size(); ++i) {
+        if (pair_counts[i] > 0) {
+            pairs.push_back({static_cast<OpCode>(i / kOpCodeCount),
+                             static_cast<OpCode>(i % kOpCodeCount), pair_counts[i]});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const OpcodePairCount& x, const OpcodePairCount& y) {
+        return x.count > y.count;
+    });
+    return pairs;
+}
+
+void VM::runtimeError(const std::string& message) {
+    throw RuntimeError(message);
+}
+
+void VM::reportRuntimeError(const RuntimeError& error, size_t exit_depth) {
+    SourceLoc loc;
+    std::string filename;
+
+    if (frames.size() > exit_depth) {
+        const CallFrame& frame = frames.back();
+        const FunctionProto& proto = *frame.function->proto;
+        size_t offset = static_cast<size_t>(frame.pc - frame.function->code.data());
+        loc = offset > 0 ? proto.locations[offset - 1] : SourceLoc();
+        filename = proto.filename;
+    }
+
+    if (loc.isValid()) {
+        reports->report(DiagnosticSeverity::ERROR, DiagnosticCode::TEXT, loc, std::string(error.what()));
+    } else {
+        reports->report(DiagnosticSeverity::ERROR, error.what(), SourceLocation(filename, 0, 0));
+    }
+    frames.resize(exit_depth);
+}
+
+void VM::run(size_t exit_depth) {
+    if (pair_counts.empty()) {
+        execute<false>(exit_depth);
+    } else {
+        execute<true>(exit_depth);
+    }
+}
+
+template <bool kProfile>
+void VM::execute(size_t exit_depth) {
+    CallFrame* frame = &frames.back();
+    Instruction* pc = frame->pc;
+    Value* base = frame->base;
+    const Value* constants = frame->function->constants.data();
+    InlineCache* caches = frame->function->caches.data();
+
+#define R(x) base[x]
+#define K(x) constants[x]
+#define THROW(message) do { frame->pc = pc; runtimeError(message); } while (0)
+// Rewrite the executing instruction into its specialized form. Operands are
+// passed in source order; GT/GE swap theirs, which does not change the types.
+#define QUICKEN(left, right) do { \
+        if (pc[-1].deopts < kMaxDeopts) pc[-1].op = specialize(ins.op, left, right); \
+    } while (0)
+// A specialized guard failed: restore the generic form and execute that instead
+#define DEOPT() do { \
+        pc[-1].op = genericOpcode(pc[-1].op); \
+        if (pc[-1].deopts < UINT8_MAX) pc[-1].deopts++; \
+        pc--; \
+    } while (0)
+#define BINARY_II(opcode, result) \
+    case OpCode::opcode: { \
+        Value left = R(ins.b); \
+        Value right = R(ins.c); \
+        if (!left.isInt() || !right.isInt()) { DEOPT(); break; } \
+        int32_t x = left.asInt(); \
+        int32_t y = right.asInt(); \
+        R(ins.a) = (result); \
+        break; \
+    }
+#define BINARY_DD(opcode, result) \
+    case OpCode::opcode: { \
+        Value left = R(ins.b); \
+        Value right = R(ins.c); \
+        if (!left.isDouble() || !right.isDouble()) { DEOPT(); break; } \
+        double x = left.asDouble(); \
+        double y = right.asDouble(); \
+        R(ins.a) = (result); \
+        break; \
+    }
+#define BINARY_K(opcode, arith, symbol) \
+    case OpCode::opcode: { \
+        Value left = R(ins.b); \
+        Value right = K(ins.c); \
+        if (!left.isNumber() || !right.isNumber()) { \
+            THROW("Operands of '" symbol "' must be numbers"); \
+        } \
+        R(ins.a) = arith(left, right); \
+        break; \
+    }
+#define BRANCH_II(opcode, test) \
+    case OpCode::opcode: { \
+        Value left = R(ins.a); \
+        Value right = R(ins.b); \
+        if (!left.isInt() || !right.isInt()) { DEOPT(); break; } \
+        int32_t x = left.asInt(); \
+        int32_t y = right.asInt(); \
+        if (!(test)) pc += ins.sC(); \
+        break; \
+    }
+#define BRANCH_DD(opcode, test) \
+    case OpCode::opcode: { \
+        Value left = R(ins.a); \
+        Value right = R(ins.b); \
+        if (!left.isDouble() || !right.isDouble()) { DEOPT(); break; } \
+        double x = left.asDouble(); \
+        double y = right.asDouble(); \
+        if (!(test)) pc += ins.sC(); \
+        break; \
+    }
+// Calls and loop back-edges collect garbage once the heap asks for it
+#define SAFEPOINT() do { \
+        if (heap.collectionPending()) { \
+            frame->pc = pc; \
+            collectGarbage(heap.majorCollectionPending()); \
+        } \
+    } while (0)
+#define LOAD_FRAME() do { \
+        frame = &frames.back(); \
+        pc = frame->pc; \
+        base = frame->base; \
+        constants = frame->function->constants.data(); \
+        caches = frame->function->caches.data(); \
+    } while (0)
+
+    // Previous opcode when profiling; kOpCodeCount before the first one
+    size_t previous = kOpCodeCount;
+
+    for (;;) {
+        const Instruction ins = *pc++;
+
+        if constexpr (kProfile) {
+            // Count generic forms so quickening does not split a pair
+            size_t current = static_cast<size_t>(genericOpcode(ins.op));
+            if (previous < kOpCodeCount) {
+                pair_counts[previous * kOpCodeCount + current]++;
+            }
+            previous = current;
+        }
+
+        switch (ins.op) {
+            case OpCode::LOADK:     R(ins.a) = K(ins.b); break;
+            case OpCode::LOADNIL:   R(ins.a) = Value::nil(); break;
+            case OpCode::LOADTRUE:  R(ins.a) = Value::boolean(true); break;
+            case OpCode::LOADFALSE: R(ins.a) = Value::boolean(false); break;
+            case OpCode::MOVE:      R(ins.a) = R(ins.b); break;
+
+            case OpCode::GETGLOBAL: {
+                InlineCache& cache = caches[ins.c];
+                if (cache.version != globals.version) {
+                    frame->pc = pc;
+                    resolveGlobal(std::string(asString(K(ins.b))->view()), cache);
+                }
+                R(ins.a) = globals.values[cache.slot];
+                break;
+            }
+
+            case OpCode::SETGLOBAL: {
+                InlineCache& cache = caches[ins.c];
+                if (cache.version != globals.version) {
+                    frame->pc = pc;
+                    resolveGlobal(std::string(asString(K(ins.b))->view()), cache);
+                }
+                globals.values[cache.slot] = R(ins.a);
+                break;
+            }
+
+            case OpCode::DEFGLOBAL:
+                defineGlobal(std::string(asString(K(ins.b))->view()), R(ins.a));
+                break;
+
+            case OpCode::IMPORT:
+                frame->pc = pc;
+                importExtension(std::string(asString(K(ins.b))->view()));
+                break;
+
+            case OpCode::ADD: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                if (left.isNumber() && right.isNumber()) {
+                    R(ins.a) = addNumbers(left, right);
+                    QUICKEN(left, right);
+                } else if (isString(left) || isString(right)) {
+                    R(ins.a) = concatenate(left, right);
+                } else {
+                    THROW("Operands of '+' must be numbers or strings");
+                }
+                break;
+            }
+
+            case OpCode::SUB: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                if (!left.isNumber() || !right.isNumber()) {
+                    THROW("Operands of '-' must be numbers");
+                }
+                R(ins.a) = subNumbers(left, right);
+                QUICKEN(left, right);
+                break;
+            }
+
+            case OpCode::MUL: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                if (!left.isNumber() || !right.isNumber()) {
+                    THROW("Operands of '*' must be numbers");
+                }
+                R(ins.a) = mulNumbers(left, right);
+                QUICKEN(left, right);
+                break;
+            }
+
+            case OpCode::DIV: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                if (left.isInt() && right.isInt()) {
+                    if (right.asInt() == 0) {
+                        THROW("Division by zero");
+                    }
+                    R(ins.a) = fromInt64(static_cast<int64_t>(left.asInt()) / right.asInt());
+                } else if (left.isNumber() && right.isNumber()) {
+                    R(ins.a) = Value::number(left.asNumber() / right.asNumber());
+                } else {
+                    THROW("Operands of '/' must be numbers");
+                }
+                QUICKEN(left, right);
+                break;
+            }
+
+            case OpCode::MOD: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                if (!left.isInt() || !right.isInt()) {
+                    THROW("Modulo operator requires integer operands");
+                }
+                if (right.asInt() == 0) {
+                    THROW("Division by zero");
+                }
+                R(ins.a) = fromInt64(static_cast<int64_t>(left.asInt()) % right.asInt());
+                QUICKEN(left, right);
+                break;
+            }
+
+            case OpCode::NEG: {
+                Value operand = R(ins.b);
+                if (operand.isInt()) {
+                    R(ins.a) = fromInt64(-static_cast<int64_t>(operand.asInt()));
+                } else if (operand.isDouble()) {
+                    R(ins.a) = Value::number(-operand.asDouble());
+                } else {
+                    THROW("Operand of unary '-' must be a number");
+                }
+                break;
+            }
+
+            case OpCode::NOT:
+                R(ins.a) = Value::boolean(R(ins.b).isFalsey());
+                break;
+
+            case OpCode::EQ:
+            case OpCode::NE: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                bool equal = equalValues(left, right);
+                R(ins.a) = Value::boolean(ins.op == OpCode::EQ ? equal : !equal);
+                QUICKEN(left, right);
+                break;
+            }
+
+            case OpCode::LT:
+            case OpCode::LE:
+            case OpCode::GT:
+            case OpCode::GE: {
+                // GT and GE are LT and LE with the operands swapped
+                bool swap = ins.op == OpCode::GT || ins.op == OpCode::GE;
+                bool or_equal = ins.op == OpCode::LE || ins.op == OpCode::GE;
+                Value left = swap ? R(ins.c) : R(ins.b);
+                Value right = swap ? R(ins.b) : R(ins.c);
+
+                bool result;
+                if (left.isNumber() && right.isNumber()) {
+                    result = or_equal ? lessEqualNumbers(left, right) : lessNumbers(left, right);
+                    QUICKEN(left, right);
+                } else {
+                    frame->pc = pc;
+                    result = compareStrings(left, right, or_equal);
+                }
+                R(ins.a) = Value::boolean(result);
+                break;
+            }
+
+            // Superinstructions
+            case OpCode::ADDK: {
+                Value left = R(ins.b);
+                Value right = K(ins.c);
+                if (left.isNumber() && right.isNumber()) {
+                    R(ins.a) = addNumbers(left, right);
+                } else if (isString(left) || isString(right)) {
+                    R(ins.a) = concatenate(left, right);
+                } else {
+                    THROW("Operands of '+' must be numbers or strings");
+                }
+                break;
+            }
+
+            BINARY_K(SUBK, subNumbers, "-")
+            BINARY_K(MULK, mulNumbers, "*")
+
+            case OpCode::IFLT:
+            case OpCode::IFLE: {
+                bool or_equal = ins.op == OpCode::IFLE;
+                Value left = R(ins.a);
+                Value right = R(ins.b);
+
+                bool result;
+                if (left.isNumber() && right.isNumber()) {
+                    result = or_equal ? lessEqualNumbers(left, right) : lessNumbers(left, right);
+                    QUICKEN(left, right);
+                } else {
+                    frame->pc = pc;
+                    result = compareStrings(left, right, or_equal);
+                }
+                if (!result) pc += ins.sC();
+                break;
+            }
+
+            case OpCode::IFEQ:
+            case OpCode::IFNE: {
+                bool equal = equalValues(R(ins.a), R(ins.b));
+                if (equal != (ins.op == OpCode::IFEQ)) pc += ins.sC();
+                break;
+            }
+
+            // Quickened arithmetic and comparisons
+            BINARY_II(ADD_II, fromInt64(static_cast<int64_t>(x) + y))
+            BINARY_II(SUB_II, fromInt64(static_cast<int64_t>(x) - y))
+            BINARY_II(MUL_II, fromInt64(static_cast<int64_t>(x) * y))
+            BINARY_II(EQ_II, Value::boolean(x == y))
+            BINARY_II(NE_II, Value::boolean(x != y))
+            BINARY_II(LT_II, Value::boolean(x < y))
+            BINARY_II(LE_II, Value::boolean(x <= y))
+            BINARY_II(GT_II, Value::boolean(x > y))
+            BINARY_II(GE_II, Value::boolean(x >= y))
+
+            BINARY_DD(ADD_DD, Value::number(x + y))
+            BINARY_DD(SUB_DD, Value::number(x - y))
+            BINARY_DD(MUL_DD, Value::number(x * y))
+            BINARY_DD(DIV_DD, Value::number(x / y))
+            BINARY_DD(LT_DD, Value::boolean(x < y))
+            BINARY_DD(LE_DD, Value::boolean(x <= y))
+            BINARY_DD(GT_DD, Value::boolean(x > y))
+            BINARY_DD(GE_DD, Value::boolean(x >= y))
+
+            BRANCH_II(IFLT_II, x < y)
+            BRANCH_II(IFLE_II, x <= y)
+            BRANCH_DD(IFLT_DD, x < y)
+            BRANCH_DD(IFLE_DD, x <= y)
+
+            case OpCode::DIV_II:
+            case OpCode::MOD_II: {
+                Value left = R(ins.b);
+                Value right = R(ins.c);
+                // A zero divisor also takes the generic path, which reports it
+                if (!left.isInt() || !right.isInt() || right.asInt() == 0) {
+                    DEOPT();
+                    break;
+                }
+                int64_t x = left.asInt();
+                int64_t y = right.asInt();
+                R(ins.a) = fromInt64(ins.op == OpCode::DIV_II ? x / y : x % y);
+                break;
+            }
+
+            case OpCode::JMP:
+                pc += ins.sC();
+                if (ins.sC() < 0) {
+                    SAFEPOINT();
+                }
+                break;
+
+            case OpCode::JMPIF:
+                if (!R(ins.a).isFalsey()) pc += ins.sC();
+                break;
+
+            case OpCode::JMPIFNOT:
+                if (R(ins.a).isFalsey()) pc += ins.sC();
+                break;
+
+            case OpCode::CALL: {
+                SAFEPOINT();
+                Value* window = base + ins.a;
+                InlineCache& cache = caches[ins.c];
+                frame->pc = pc;
+
+                // The empty cache holds nil, so the object check also rejects calling nil
+                if (window[0] == cache.callee && window[0].isObj()) {
+                    Obj* callee = window[0].asObj();
+                    if (callee->getType() == ObjType::FUNCTION) {
+                        pushFrame(static_cast<ObjFunction*>(callee), window, ins.b);
+                    } else if (callee->getType() == ObjType::NATIVE) {
+                        window[0] = static_cast<ObjNative*>(callee)->function(*this, ins.b, window + 1);
+                    } else {
+                        auto* function = static_cast<ObjExtern*>(callee);
+                        window[0] = function->call(*this, *function->function, window + 1);
+                    }
+                } else {
+                    callValue(window, ins.b, &cache);
+                }
+
+                LOAD_FRAME();
+                break;
+            }
+
+            case OpCode::CALLB:
+                frame->pc = pc;
+                R(ins.a) = builtin_table[ins.c](*this, ins.b, &R(ins.a + 1));
+                break;
+
+            case OpCode::ASYNC:
+                SAFEPOINT();
+                frame->pc = pc;
+                startAsyncCall(base + ins.a, ins.b);
+                LOAD_FRAME();
+                break;
+
+            case OpCode::AWAIT: {
+                Value value = R(ins.b);
+                frame->pc = pc;
+                if (!isTask(value)) {
+                    R(ins.a) = value;
+                } else if (resumeAsyncCall(*asTask(value)->task, stackTop())) {
+                    // Run the call above this frame, then this instruction again
+                    frame->pc = pc - 1;
+                    LOAD_FRAME();
+                } else {
+                    R(ins.a) = awaitTask(*this, *asTask(value)->task);
+                }
+                break;
+            }
+
+            case OpCode::GETMAPK: {
+                Value map = R(ins.b);
+                if (!isMap(map)) {
+                    THROW(std::string("map_get() expects a map, not ") + map.typeName());
+                }
+                R(ins.a) = asMap(map)->get(K(ins.c));
+                break;
+            }
+
+            case OpCode::SETMAPK: {
+                Value map = R(ins.a);
+                if (!isMap(map)) {
+                    THROW(std::string("map_set() expects a map, not ") + map.typeName());
+                }
+                asMap(map)->set(K(ins.b), R(ins.c));
+                heap.writeBarrier(map.asObj(), K(ins.b));
+                heap.writeBarrier(map.asObj(), R(ins.c));
+                break;
+            }
+
+            case OpCode::FUNC:
+                R(ins.a) = Value::object(loadFunction(frame->function->proto->functions[ins.b]));
+                break;
+
+            case OpCode::RETURN:
+            case OpCode::RETURNNIL: {
+                // The callee's window starts right after the register that held it
+                base[-1] = ins.op == OpCode::RETURN ? R(ins.a) : Value::nil();
+                frames.pop_back();
+                if (!async_calls.empty() && async_calls.back().depth == frames.size()) {
+                    returnAsyncCall(base[-1]);
+                }
+                if (frames.size() == exit_depth) {
+                    return;
+                }
+                LOAD_FRAME();
+                break;
+            }
+
+            default:
+                THROW("Unknown opcode");
+        }
+    }
+
+#undef R
+#undef K
+#undef THROW
+#undef QUICKEN
+#undef DEOPT
+#undef BINARY_II
+#undef BINARY_DD
+#undef BINARY_K
+#undef BRANCH_II
+#undef BRANCH_DD
+#undef SAFEPOINT
+#undef LOAD_FRAME
+}
+
+} // namespace mana
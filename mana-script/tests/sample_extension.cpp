@@ -0,0 +1,65 @@
+#include "extension.hpp"
+#include <cctype>
+#include <cmath>
+#include <string>
+
+using namespace mana;
+
+namespace {
+
+int64_t calls = 0;
+
+} // namespace
+
+extern "C" {
+
+int64_t sample_add(int64_t a, int64_t b) { return a + b; }
+
+double sample_hypot(double a, double b) { return std::hypot(a, b); }
+
+bool sample_even(int64_t n) { return n % 2 == 0; }
+
+int64_t sample_count(const char* text, size_t length, const char* needle, size_t needle_length) {
+    if (needle_length == 0) {
+        return 0;
+    }
+    int64_t count = 0;
+    std::string_view haystack(text, length);
+    for (size_t at = haystack.find(std::string_view(needle, needle_length)); at != std::string_view::npos;
+         at = haystack.find(std::string_view(needle, needle_length), at + needle_length)) {
+        count++;
+    }
+    return count;
+}
+
+ExtString sample_upper(const char* text, size_t length) {
+    thread_local std::string result;
+    result.assign(text, length);
+    for (char& c : result) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return {result.data(), result.size()};
+}
+
+void sample_bump() { calls++; }
+
+int64_t sample_calls() { return calls; }
+
+const ExtModule* mana_extension_module() {
+    static const ExtFunction functions[] = {
+        {"add", "sample_add", reinterpret_cast<void*>(sample_add), ExtType::INT, 2, {ExtType::INT, ExtType::INT}},
+        {"hypot", "sample_hypot", reinterpret_cast<void*>(sample_hypot), ExtType::DOUBLE, 2,
+         {ExtType::DOUBLE, ExtType::DOUBLE}},
+        {"even", "sample_even", reinterpret_cast<void*>(sample_even), ExtType::BOOL, 1, {ExtType::INT}},
+        {"count", "sample_count", reinterpret_cast<void*>(sample_count), ExtType::INT, 2,
+         {ExtType::STRING, ExtType::STRING}},
+        {"upper", "sample_upper", reinterpret_cast<void*>(sample_upper), ExtType::STRING, 1, {ExtType::STRING}},
+        {"bump", "sample_bump", reinterpret_cast<void*>(sample_bump), ExtType::VOID, 0, {}},
+        {"calls", "sample_calls", reinterpret_cast<void*>(sample_calls), ExtType::INT, 0, {}},
+    };
+    static const ExtModule module = {kExtensionAbiVersion, "sample", functions,
+                                     sizeof(functions) / sizeof(functions[0])};
+    return &module;
+}
+
+} // extern "C"
@@ -0,0 +1,258 @@
+#include "engine.hpp"
+#include "error.hpp"
+#include "isolate.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mana;
+
+void test_compile_once_run_many() {
+    Engine engine;
+    auto script = engine.compile(
+        "var scale = 10;\n"
+        "function main() {\n"
+        "    var total = 0;\n"
+        "    var i = 0;\n"
+        "    while (i < n) { total = total + i * scale; i = i + 1; }\n"
+        "    return prefix + total;\n"
+        "}\n",
+        "sum.ms");
+    assert(script && script->filename() == "sum.ms");
+
+    for (int n = 0; n < 5; ++n) {
+        RunResult result = engine.run(*script, {{"n", n}, {"prefix", std::string("sum=")}});
+        assert(result.ok());
+        assert(std::get<std::string>(result.value) == "sum=" + std::to_string(10 * n * (n - 1) / 2));
+    }
+
+    // The bytecode the host holds is never modified by running it
+    size_t size = script->bytecode()->code.size();
+    engine.run(*script, {{"n", 1000}, {"prefix", std::string("")}});
+    assert(script->bytecode()->code.size() == size);
+}
+
+void test_runs_are_isolated() {
+    Engine engine;
+    auto script = engine.compile(
+        "var seen = nil;\n"
+        "function main() {\n"
+        "    if (seen == nil) { seen = 1; } else { seen = seen + 1; }\n"
+        "    return seen;\n"
+        "}\n");
+    assert(script);
+
+    assert(std::get<int>(engine.run(*script).value) == 1);
+    assert(std::get<int>(engine.run(*script).value) == 1);
+
+    // A VM the host keeps carries globals from one run to the next
+    auto counter = engine.compile("function main() { count = count + 1; return count; }");
+    VM vm;
+    vm.defineGlobal("count", Value::integer(40));
+    assert(std::get<int>(engine.run(*counter, vm).value) == 41);
+    assert(std::get<int>(engine.run(*counter, vm).value) == 42);
+}
+
+void test_result_types_and_entry_point() {
+    EngineOptions options;
+    options.entry = "handle";
+    Engine engine(options);
+
+    auto script = engine.compile("function handle() { return x; }");
+    assert(script);
+    assert(std::get<double>(engine.run(*script, {{"x", 2.5}}).value) == 2.5);
+    assert(std::get<bool>(engine.run(*script, {{"x", true}}).value));
+    assert(std::holds_alternative<std::nullptr_t>(engine.run(*script, {{"x", nullptr}}).value));
+
+    // Without the entry point only the top-level code runs
+    auto plain = engine.compile("var y = 1;");
+    RunResult result = engine.run(*plain);
+    assert(result.ok() && std::holds_alternative<std::nullptr_t>(result.value));
+}
+
+void test_errors() {
+    Engine engine;
+    assert(!engine.compile("var = ;"));
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+
+    assert(!engine.compileFile("/nonexistent/script.ms"));
+    diagnostics.clear();
+
+    auto script = engine.compile("function main() { return missing + 1; }");
+    assert(script);
+    RunResult result = engine.run(*script);
+    assert(result.status == InterpretResult::RUNTIME_ERROR);
+    assert(result.error.find("missing") != std::string::npos);
+    diagnostics.clear();
+
+    // A failed run leaves the script usable
+    result = engine.run(*script, {{"missing", 1}});
+    assert(result.ok() && std::get<int>(result.value) == 2);
+}
+
+void test_isolates_keep_state_and_errors_apart() {
+    Engine engine;
+    auto script = engine.compile(
+        "var total = 0;\n"
+        "function add(n) { total = total + n; return total; }\n"
+        "function fail() { return nil + 1; }\n");
+    assert(script);
+
+    Isolate first;
+    Isolate second;
+    assert(first.run(*script).ok() && second.run(*script).ok());
+    assert(std::get<int>(first.call("add", {5}).value) == 5);
+    assert(std::get<int>(first.call("add", {5}).value) == 10);
+    assert(std::get<int>(second.call("add", {1}).value) == 1);
+
+    RunResult result = first.call("fail");
+    assert(!result.ok() && !result.error.empty());
+    assert(first.reports().hasErrors());
+    assert(!second.reports().hasErrors());
+    assert(!diagnostics.hasErrors());
+
+    assert(!second.call("undefined").ok());
+}
+
+void test_isolates_run_in_parallel() {
+    Engine engine;
+    auto script = engine.compile(
+        "var seen = \"\";\n"
+        "function handle(n) {\n"
+        "    var s = \"\";\n"
+        "    var i = 0;\n"
+        "    while (i < n) { s = s + tenant; i = i + 1; }\n"
+        "    seen = s;\n"
+        "    return len(s);\n"
+        "}\n");
+    assert(script);
+
+    constexpr int kTenants = 8;
+    std::vector<std::unique_ptr<Isolate>> isolates;
+    for (int i = 0; i < kTenants; ++i) {
+        isolates.push_back(std::make_unique<Isolate>());
+    }
+
+    std::vector<int> failures(kTenants, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kTenants; ++t) {
+        workers.emplace_back([&, t] {
+            Isolate& isolate = *isolates[t];
+            std::string tenant = "t" + std::to_string(t);
+            if (!isolate.run(*script, {{"tenant", tenant}}).ok()) {
+                failures[t]++;
+            }
+            for (int n = 1; n <= 200; ++n) {
+                RunResult result = isolate.call("handle", {n});
+                if (!result.ok() || std::get<int>(result.value) != n * static_cast<int>(tenant.size())) {
+                    failures[t]++;
+                }
+            }
+            // Collect while the others keep allocating
+            isolate.vm().collectGarbage(true);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (int t = 0; t < kTenants; ++t) {
+        assert(failures[t] == 0);
+        std::string seen = isolates[t]->vm().getGlobal("seen").toString();
+        assert(seen.size() == 200 * 2 && seen.substr(0, 4) == "t" + std::to_string(t) + "t" + std::to_string(t));
+    }
+}
+
+void test_parallel_compiles_keep_their_errors() {
+    Engine engine;
+    constexpr int kCompiles = 8;
+    std::vector<std::unique_ptr<CompilationContext>> contexts;
+    std::vector<std::shared_ptr<const CompiledScript>> scripts(kCompiles);
+    for (int i = 0; i < kCompiles; ++i) {
+        contexts.push_back(std::make_unique<CompilationContext>("script" + std::to_string(i) + ".ms"));
+    }
+
+    // Odd scripts have a syntax error on their own line number
+    std::vector<std::thread> workers;
+    for (int i = 0; i < kCompiles; ++i) {
+        workers.emplace_back([&, i] {
+            std::string source;
+            for (int line = 1; line < 50; ++line) {
+                source += line == i && i % 2 == 1 ? "var = ;\n" : "var v" + std::to_string(line) + " = 1;\n";
+            }
+            scripts[i] = engine.compile(source, *contexts[i]);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (int i = 0; i < kCompiles; ++i) {
+        const auto& reports = contexts[i]->reports().getDiagnostics();
+        if (i % 2 == 0) {
+            assert(scripts[i] && reports.empty());
+            assert(scripts[i]->filename() == "script" + std::to_string(i) + ".ms");
+        } else {
+            assert(!scripts[i] && !reports.empty());
+            for (const Diagnostic& report : reports) {
+                assert(report.getLocation().filename == "script" + std::to_string(i) + ".ms");
+                assert(report.getLocation().line == i);
+            }
+        }
+    }
+    assert(!diagnostics.hasErrors());
+}
+
+void test_parser_recovers_after_each_error() {
+    CompilationContext context("broken.ms");
+    Lexer lexer(
+        "var a = ;\n"
+        "function f(1) {\n"
+        "    var ok = 1;\n"
+        "    return ok +;\n"
+        "}\n"
+        "var b = 0x10 + 0b11;\n"
+        "if (b { print(b); }\n"
+        "var c = 1 & 2;\n"
+        "const d;\n"
+        "print(b);\n",
+        context);
+    Parser parser(lexer.scanTokens(), context);
+    std::vector<StmtPtr> statements = parser.parse();
+
+    // One report per broken declaration, none for the tokens that follow it
+    std::vector<int> lines;
+    for (const Diagnostic& report : context.reports().getDiagnostics()) {
+        lines.push_back(report.getLine());
+    }
+    assert((lines == std::vector<int>{8, 1, 2, 4, 7, 9}));
+
+    // Only complete statements survive
+    assert(statements.size() == 2);
+    assert(dynamic_cast<VarDeclStmt*>(statements[0].get()));
+    assert(dynamic_cast<ExpressionStmt*>(statements[1].get()));
+
+    Engine engine;
+    auto script = engine.compile("var b = 0x10 + 0b11;\nfunction main() { return b; }");
+    assert(script && std::get<int>(engine.run(*script).value) == 19);
+}
+
+int main() {
+    test_compile_once_run_many();
+    test_runs_are_isolated();
+    test_result_types_and_entry_point();
+    test_errors();
+    test_isolates_keep_state_and_errors_apart();
+    test_isolates_run_in_parallel();
+    test_parallel_compiles_keep_their_errors();
+    test_parser_recovers_after_each_error();
+
+    std::cout << "All engine tests passed!\n";
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+
+using namespace mana;
+
+std::shared_ptr<FunctionProto> compileSource(const std::string& source) {
+    Lexer lexer(source);
+    Parser parser(lexer.scanTokens());
+    auto statements = parser.parse();
+    BytecodeCompiler compiler;
+    auto script = compiler.compile(statements);
+    assert(!diagnostics.hasErrors());
+    return script;
+}
+
+const std::string kImport = std::string("import \"") + SAMPLE_EXTENSION + "\";\n";
+
+void test_import_defines_typed_functions() {
+    VM vm;
+    InterpretResult status = vm.interpret(compileSource(
+        kImport +
+        "var sum = add(40, 2);\n"
+        "var h = hypot(3, 4);\n"
+        "var e = even(10);\n"
+        "var n = count(\"abcabcab\" + \"c\", \"abc\");\n"
+        "var u = upper(\"shout\");\n"
+        "function loop(k) { var i = 0; while (i < k) { bump(); i = i + 1; } return calls(); }\n"
+        "var c = loop(1000);\n"));
+    assert(status == InterpretResult::OK);
+
+    assert(vm.getGlobal("sum").asInt() == 42);
+    assert(vm.getGlobal("h").toString() == "5");
+    assert(vm.getGlobal("e") == Value::boolean(true));
+    assert(vm.getGlobal("n").asInt() == 3);
+    assert(vm.getGlobal("u").toString() == "SHOUT");
+    assert(vm.getGlobal("c").asInt() == 1000);
+    assert(vm.getGlobal("add").toString() == "<native add>");
+}
+
+void test_arguments_are_checked() {
+    VM vm;
+    assert(vm.interpret(compileSource(kImport + "var x = 1;\nvar y = add(x, \"two\");\n")) ==
+           InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.getDiagnostics().back().getLocation().line == 3);
+    assert(diagnostics.getDiagnostics().back().getMessage().find("argument 2") != std::string::npos);
+    diagnostics.clear();
+
+    assert(vm.interpret(compileSource("var y = add(1);\n")) == InterpretResult::RUNTIME_ERROR);
+    diagnostics.clear();
+
+    // Ints that overflowed into doubles still convert
+    assert(vm.interpret(compileSource("var big = add(2147483647 + 1, 1);\n")) == InterpretResult::OK);
+    assert(vm.getGlobal("big").toString() == "2147483649");
+}
+
+void test_import_errors() {
+    VM vm;
+    assert(vm.interpret(compileSource("import \"./does-not-exist.so\";\n")) == InterpretResult::RUNTIME_ERROR);
+    diagnostics.clear();
+
+    Lexer lexer("function f() { import \"x.so\"; }");
+    Parser parser(lexer.scanTokens());
+    BytecodeCompiler compiler;
+    compiler.compile(parser.parse());
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+}
+
+int main() {
+    test_import_defines_typed_functions();
+    test_arguments_are_checked();
+    test_import_errors();
+
+    std::cout << "All extension tests passed!\n";
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+
+using namespace mana;
+
+std::shared_ptr<FunctionProto> compileSource(const std::string& source) {
+    Lexer lexer(source);
+    Parser parser(lexer.scanTokens());
+    auto statements = parser.parse();
+    BytecodeCompiler compiler;
+    auto script = compiler.compile(statements);
+    assert(!diagnostics.hasErrors());
+    return script;
+}
+
+void test_minor_collection_promotes_reachable_objects() {
+    Heap heap(4096);
+    Value root = Value::object(heap.allocate<ObjString>(Generation::YOUNG, "kept"));
+    heap.allocate<ObjString>(Generation::YOUNG, "garbage");
+
+    assert(heap.isYoung(root.asObj()));
+    heap.collect(false, [&](GcTracer& tracer) { tracer.visit(root); });
+
+    assert(!heap.isYoung(root.asObj()));
+    assert(asString(root)->view() == "kept");
+    assert(heap.stats().minor.count == 1);
+    assert(heap.stats().promoted_bytes > 0);
+}
+
+void test_write_barrier_keeps_young_referents() {
+    Heap heap(4096);
+    auto proto = std::make_shared<FunctionProto>();
+    ObjFunction* owner = heap.allocate<ObjFunction>(Generation::OLD, proto);
+
+    // Only the old function refers to the young string
+    Value young = Value::object(heap.allocate<ObjString>(Generation::YOUNG, "young"));
+    owner->constants.push_back(young);
+    heap.writeBarrier(owner, young);
+    assert(owner->remembered);
+
+    heap.collect(false, [](GcTracer&) {});
+
+    assert(!owner->remembered);
+    assert(!heap.isYoung(owner->constants[0].asObj()));
+    assert(asString(owner->constants[0])->view() == "young");
+}
+
+void test_full_nursery_spills_until_safepoint() {
+    Heap heap(256);
+    std::vector<Value> roots;
+    for (int i = 0; i < 16; ++i) {
+        roots.push_back(Value::object(heap.allocate<ObjString>(Generation::YOUNG, std::to_string(i))));
+    }
+
+    assert(heap.collectionPending());
+    heap.collect(false, [&](GcTracer& tracer) {
+        for (Value& root : roots) tracer.visit(root);
+    });
+    assert(!heap.collectionPending());
+
+    for (int i = 0; i < 16; ++i) {
+        assert(asString(roots[i])->view() == std::to_string(i));
+    }
+}
+
+void test_major_collection_frees_old_garbage() {
+    Heap heap(4096);
+    Value root = Value::object(heap.allocate<ObjString>(Generation::OLD, "root"));
+    for (int i = 0; i < 10000; ++i) {
+        heap.allocate<ObjString>(Generation::OLD, "dead");
+    }
+    uint64_t before = heap.stats().old_bytes;
+
+    heap.collect(true, [&](GcTracer& tracer) { tracer.visit(root); });
+
+    assert(heap.stats().old_bytes < before / 100);
+    assert(heap.stats().major.count == 1);
+    assert(asString(root)->view() == "root");
+
+    // Freed lines are reused
+    for (int i = 0; i < 100; ++i) {
+        heap.allocate<ObjString>(Generation::OLD, "again");
+    }
+    assert(asString(root)->view() == "root");
+}
+
+void test_vm_collects_at_safepoints() {
+    VM vm(2048);
+    vm.interpret(compileSource(
+        "var kept = \"k\" + 1;\n"
+        "function build(n) {\n"
+        "    var s = \"\";\n"
+        "    var i = 0;\n"
+        "    while (i < n) { s = \"x\" + i; i = i + 1; }\n"
+        "    return s;\n"
+        "}\n"
+        "var last = build(5000);\n"));
+
+    assert(vm.gcStats().minor.count > 0);
+    assert(vm.getGlobal("kept").toString() == "k1");
+    assert(vm.getGlobal("last").toString() == "x4999");
+
+    vm.collectGarbage(true);
+    assert(vm.gcStats().major.count == 1);
+    assert(vm.getGlobal("kept").toString() == "k1");
+    assert(vm.getGlobal("last").toString() == "x4999");
+}
+
+void test_pause_histogram_buckets() {
+    PauseHistogram histogram;
+    histogram.record(std::chrono::microseconds(5));
+    histogram.record(std::chrono::microseconds(75));
+    histogram.record(std::chrono::milliseconds(50));
+
+    assert(histogram.count == 3);
+    assert(histogram.buckets[0] == 1);
+    assert(histogram.buckets[2] == 1);
+    assert(histogram.buckets.back() == 1);
+    assert(histogram.max_ns == 50000000);
+}
+
+void test_arena_reset_reuses_chunks() {
+    Arena arena;
+    void* first = arena.allocate(64);
+    for (int i = 0; i < 10000; ++i) {
+        arena.allocate(64);
+    }
+    size_t capacity = arena.capacity();
+    assert(arena.contains(first));
+
+    arena.reset();
+    assert(arena.allocate(64) == first);
+    for (int i = 0; i < 10000; ++i) {
+        arena.allocate(64);
+    }
+    assert(arena.capacity() == capacity);
+
+    // Larger than any chunk so far
+    void* big = arena.allocate(capacity * 4);
+    assert(arena.contains(big));
+}
+
+void test_arena_call_copies_out_escaping_values() {
+    VM vm(4096);
+    vm.interpret(compileSource(
+        "var saved = nil;\n"
+        "function handle(n) {\n"
+        "    var s = \"\";\n"
+        "    var i = 0;\n"
+        "    while (i < n) { s = \"item\" + i; i = i + 1; }\n"
+        "    saved = \"saved\" + n;\n"
+        "    return s;\n"
+        "}\n"));
+
+    Value result;
+    InterpretResult status = vm.call(vm.getGlobal("handle"), {Value::integer(5000)}, &result,
+                                     AllocationMode::ARENA);
+
+    assert(status == InterpretResult::OK);
+    assert(vm.gcStats().minor.count == 0);
+    assert(vm.gcStats().arena_bytes > 5000 * sizeof(ObjString));
+    assert(vm.gcStats().evacuated_bytes < 256);
+
+    Arena& arena = Arena::forThread();
+    assert(!arena.contains(result.asObj()));
+    assert(!arena.contains(vm.getGlobal("saved").asObj()));
+    assert(result.toString() == "item4999");
+    assert(vm.getGlobal("saved").toString() == "saved5000");
+
+    // The copies are ordinary heap objects
+    vm.collectGarbage(true);
+    assert(vm.getGlobal("saved").toString() == "saved5000");
+}
+
+void test_arena_call_keeps_globals_on_error() {
+    VM vm;
+    vm.interpret(compileSource(
+        "var saved = nil;\n"
+        "function fail() { saved = \"before\" + 1; return nil + 1; }\n"));
+
+    assert(vm.call(vm.getGlobal("fail"), {}, nullptr, AllocationMode::ARENA) ==
+           InterpretResult::RUNTIME_ERROR);
+    diagnostics.clear();
+
+    assert(!Arena::forThread().contains(vm.getGlobal("saved").asObj()));
+    assert(vm.getGlobal("saved").toString() == "before1");
+}
+
+void test_arena_flattening_of_heap_rope_is_copied_out() {
+    VM vm;
+    vm.interpret(compileSource(
+        "function build() {\n"
+        "    var s = \"\";\n"
+        "    var i = 0;\n"
+        "    while (i < 100) { s = s + \"abc\"; i = i + 1; }\n"
+        "    return s;\n"
+        "}\n"
+        "var kept = build();\n"
+        "function check() { return kept == build(); }\n"));
+    assert(asString(vm.getGlobal("kept"))->isRope());
+
+    // Comparing flattens the heap rope into an arena string
+    Value result;
+    assert(vm.call(vm.getGlobal("check"), {}, &result, AllocationMode::ARENA) == InterpretResult::OK);
+    assert(result == Value::boolean(true));
+
+    ObjString* flat = asString(vm.getGlobal("kept"))->flat();
+    assert(flat && !Arena::forThread().contains(flat));
+    assert(flat->length == 300 && flat->view().substr(0, 6) == "abcabc");
+}
+
+int main() {
+    test_minor_collection_promotes_reachable_objects();
+    test_write_barrier_keeps_young_referents();
+    test_full_nursery_spills_until_safepoint();
+    test_major_collection_frees_old_garbage();
+    test_vm_collects_at_safepoints();
+    test_pause_histogram_buckets();
+    test_arena_reset_reuses_chunks();
+    test_arena_call_copies_out_escaping_values();
+    test_arena_call_keeps_globals_on_error();
+    test_arena_flattening_of_heap_rope_is_copied_out();
+
+    std::cout << "All GC tests passed!\n";
+    return 0;
+}
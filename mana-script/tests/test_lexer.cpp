@@ -202,6 +202,89 @@ void test_complex_error_cases() {
     assert(diagnostics.hasErrors());
 }
 
+void test_errors_go_to_the_context() {
+    diagnostics.clear();
+    CompilationContext context("broken.ms");
+    Lexer lexer("var x = @;", context);
+    lexer.scanTokens();
+
+    assert(context.hasErrors());
+    assert(context.reports().getDiagnostics()[0].getLocation().filename == "broken.ms");
+    assert(!diagnostics.hasErrors());
+}
+
+void test_diagnostics_are_formatted_on_demand() {
+    CompilationContext context("lazy.ms");
+    Lexer lexer("var s = \"a\\q\";\nvar n = 0x;", context);
+    std::vector<Token> tokens = lexer.scanTokens();
+
+    const auto& reports = context.reports().getDiagnostics();
+    assert(reports.size() == 2);
+    assert(reports[0].getCode() == DiagnosticCode::INVALID_ESCAPE);
+    assert(reports[0].getMessage() == "Invalid escape sequence '\\q'");
+    assert(reports[1].getCode() == DiagnosticCode::INVALID_NUMBER);
+    assert(reports[1].getMessage() == "Invalid hexadecimal number");
+    assert(reports[1].getFile() == fileId("lazy.ms"));
+    assert(reports[1].toString().rfind("lazy.ms:2:", 0) == 0);
+}
+
+void test_source_locations() {
+    Lexer lexer("var a = 1;\n  a = a + 2;\n", "loc.ms");
+    std::vector<Token> tokens = lexer.scanTokens();
+
+    // Every token decodes to the line and column the lexer counted
+    SourceManager& sources = SourceManager::global();
+    for (const Token& token : tokens) {
+        assert(token.loc.isValid());
+        SourceLocation where = sources.decode(token.loc);
+        assert(where.filename == "loc.ms");
+        assert(where.line == token.line);
+        if (token.type != TokenType::END_OF_FILE) {
+            assert(where.column == token.column);
+        }
+    }
+
+    FileId file = sources.fileOf(tokens[0].loc);
+    assert(sources.lineText(file, 2) == "  a = a + 2;");
+    assert(sources.lineText(file, 9).empty());
+
+    // A second buffer gets its own range, even under the same name
+    Lexer again("a;", "loc.ms");
+    std::vector<Token> more = again.scanTokens();
+    assert(sources.fileOf(more[0].loc) != file);
+    assert(fileId("loc.ms") == sources.fileOf(more[0].loc));
+    assert(!sources.decode(SourceLoc()).line);
+}
+
+void test_source_buffers_are_released() {
+    SourceManager& sources = SourceManager::global();
+
+    // The same text under the same name is one buffer
+    assert(sources.addBuffer("same.ms", "a;") == sources.addBuffer("same.ms", "a;"));
+    assert(sources.addBuffer("same.ms", "a;") != sources.addBuffer("other.ms", "a;"));
+
+    // A context holds what it lexed; its diagnostics keep their lines
+    DiagnosticManager reports;
+    SourceLoc first;
+    {
+        CompilationContext context("held.ms", reports);
+        Lexer lexer("var n = 0x;\n", context);
+        first = lexer.scanTokens()[0].loc;
+        assert(sources.decode(first).line == 1);
+        assert(sources.share("held.ms", "var n = 0x;\n")->file() == sources.fileOf(first));
+    }
+    assert(!sources.decode(first).line);
+    assert(reports.getDiagnostics()[0].getCodeContext() == "var n = 0x;");
+    assert(reports.getDiagnostics()[0].getLocation().filename == "held.ms");
+
+    // and once released, its range is given to the next buffer
+    CompilationContext context("held.ms", reports);
+    Lexer lexer("var m = 1;\n", context);
+    std::vector<Token> tokens = lexer.scanTokens();
+    assert(tokens[0].loc == first);
+    assert(sources.decode(tokens[1].loc).column == 5);
+}
+
 int main() {
     test_simple_tokens();
     test_operators();
@@ -215,6 +298,10 @@ int main() {
     test_nested_comments();
     test_identifier_edge_cases();
     test_complex_error_cases();
+    test_errors_go_to_the_context();
+    test_diagnostics_are_formatted_on_demand();
+    test_source_locations();
+    test_source_buffers_are_released();
     
     std::cout << "All lexer tests passed!\n";
     return 0;
@@ -0,0 +1,148 @@
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <string>
+
+using namespace mana;
+
+std::shared_ptr<FunctionProto> compileSource(const std::string& source, bool optimize) {
+    Lexer lexer(source);
+    Parser parser(lexer.scanTokens());
+    auto statements = parser.parse();
+    BytecodeCompiler compiler("", optimize);
+    auto script = compiler.compile(statements);
+    assert(!diagnostics.hasErrors());
+    return script;
+}
+
+bool contains(const FunctionProto& proto, OpCode op) {
+    return std::any_of(proto.code.begin(), proto.code.end(),
+                       [op](const Instruction& ins) { return ins.op == op; });
+}
+
+// Run a script with and without the peephole pass and return both values of `result`
+std::pair<std::string, std::string> runBoth(const std::string& source) {
+    VM plain;
+    assert(plain.interpret(compileSource(source, false)) == InterpretResult::OK);
+    VM optimized;
+    assert(optimized.interpret(compileSource(source, true)) == InterpretResult::OK);
+    return {plain.getGlobal("result").toString(), optimized.getGlobal("result").toString()};
+}
+
+void test_loop_is_fused() {
+    auto script = compileSource(
+        "function sum(n) {\n"
+        "    var s = 0;\n"
+        "    var i = 0;\n"
+        "    while (i < n) { s = s + i * 2; i = i + 1; }\n"
+        "    return s;\n"
+        "}\n", true);
+    const FunctionProto& sum = *script->functions[0];
+
+    assert(contains(sum, OpCode::IFLT));
+    assert(contains(sum, OpCode::MULK));
+    assert(contains(sum, OpCode::ADDK));
+    assert(!contains(sum, OpCode::LT));
+    assert(!contains(sum, OpCode::JMPIFNOT));
+    assert(!contains(sum, OpCode::MOVE));
+    assert(sum.code.size() == sum.locations.size());
+}
+
+void test_fusion_preserves_results() {
+    const char* programs[] = {
+        // Loops with every comparison, including swapped GT/GE
+        "var result = 0; var i = 10; while (i > 0) { result = result + i; i = i - 1; }",
+        "var result = 0; var i = 10; while (i >= 1) { result = result * 2 + i; i = i - 1; }",
+        "var result = 0; var i = 0; while (i <= 5) { if (i == 3) result = result + 100; i = i + 1; }",
+        "var result = 0; var i = 0; while (i != 7) { if (i < 3) result = result + 1; else result = result - 1; i = i + 1; }",
+        // Constants on the left of '+' must not be reordered
+        "var x = \"b\"; var result = \"a\" + x + \"c\";",
+        "var x = 4; var result = 2 * x - 1;",
+        // Mixed int and double operands
+        "var result = 0.5; var i = 0; while (i < 10) { result = result * 1.5 + i; i = i + 1; }",
+        // Short-circuit operators jump into the middle of expressions
+        "var a = 1; var b = 0; var result = (a < 2 && b > -1) || a == 5;",
+        "function f(n) { if (n < 2) return n; return f(n - 1) + f(n - 2); } var result = f(12);",
+        // Values live across calls must stay below the callee's window
+        "function ack(m, n) { if (m == 0) return n + 1; if (n == 0) return ack(m - 1, 1);"
+        " return ack(m - 1, ack(m, n - 1)); } var result = ack(2, 3);",
+        "function id(x) { return x; }"
+        " function g(a) { var b = a * 2; var c = id(b) + id(a); var d = id(id(c) + b); return a + b + c + d; }"
+        " var result = g(5);",
+        "function sq(x) { return x * x; }"
+        " function h(n) { var t = 0; var i = 0; while (i < n) { var k = sq(i); t = t + k + sq(k); i = i + 1; } return t; }"
+        " var result = h(20);",
+    };
+
+    for (const char* program : programs) {
+        auto [plain, optimized] = runBoth(program);
+        assert(plain == optimized);
+    }
+}
+
+void test_frames_are_packed() {
+    auto plain = compileSource(
+        "function fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }", false);
+    auto packed = compileSource(
+        "function fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }", true);
+
+    const FunctionProto& before = *plain->functions[0];
+    const FunctionProto& after = *packed->functions[0];
+    assert(after.num_registers < before.num_registers);
+    assert(after.num_registers <= 4);
+
+    // Every register operand fits the smaller frame
+    for (const Instruction& ins : after.code) {
+        std::vector<uint16_t> reads;
+        instructionReads(ins, reads);
+        for (uint16_t reg : reads) {
+            assert(reg < after.num_registers);
+        }
+        assert(instructionWrite(ins) < after.num_registers);
+        assert(!(ins.op == OpCode::MOVE && ins.a == ins.b));
+    }
+
+    assert(disassemble(after).find("frame 32 bytes") != std::string::npos);
+}
+
+void test_runtime_errors_keep_their_line() {
+    VM vm;
+    auto script = compileSource("var a = nil;\nvar b = a - 1;\n", true);
+    assert(contains(*script, OpCode::SUBK));
+    assert(vm.interpret(script) == InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.getDiagnostics().back().getLocation().line == 2);
+    diagnostics.clear();
+}
+
+void test_opcode_pair_profile() {
+    VM vm;
+    vm.setOpcodeProfiling(true);
+    vm.interpret(compileSource("var i = 0; while (i < 100) { i = i + 1; }", false));
+
+    auto pairs = vm.opcodePairs();
+    assert(!pairs.empty());
+    for (size_t i = 1; i < pairs.size(); ++i) {
+        assert(pairs[i - 1].count >= pairs[i].count);
+    }
+
+    // The loop test runs 101 times and always feeds its branch
+    auto branch = std::find_if(pairs.begin(), pairs.end(), [](const OpcodePairCount& pair) {
+        return pair.first == OpCode::LT && pair.second == OpCode::JMPIFNOT;
+    });
+    assert(branch != pairs.end() && branch->count == 101);
+}
+
+int main() {
+    test_loop_is_fused();
+    test_fusion_preserves_results();
+    test_frames_are_packed();
+    test_runtime_errors_keep_their_line();
+    test_opcode_pair_profile();
+
+    std::cout << "All optimizer tests passed!\n";
+    return 0;
+}
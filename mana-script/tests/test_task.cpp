@@ -0,0 +1,554 @@
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "file.hpp"
+#include "scheduler.hpp"
+#include "task.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace mana;
+
+std::shared_ptr<FunctionProto> compileSource(const std::string& source) {
+    Lexer lexer(source);
+    Parser parser(lexer.scanTokens());
+    auto statements = parser.parse();
+    BytecodeCompiler compiler;
+    auto script = compiler.compile(statements);
+    assert(!diagnostics.hasErrors());
+    return script;
+}
+
+void test_deque_hands_out_each_item_once() {
+    constexpr int kItems = 100000;
+    constexpr int kThieves = 3;
+    WorkStealingDeque<int> deque(4);  // Small, so it grows while thieves read
+    std::vector<int> items(kItems);
+    std::vector<std::atomic<int>> taken(kItems);
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < kThieves; ++t) {
+        thieves.emplace_back([&] {
+            while (!done.load()) {
+                if (int* item = deque.steal()) {
+                    taken[*item]++;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < kItems; ++i) {
+        items[i] = i;
+        deque.push(&items[i]);
+        if (i % 3 == 0) {
+            if (int* item = deque.pop()) {
+                taken[*item]++;
+            }
+        }
+    }
+    while (int* item = deque.pop()) {
+        taken[*item]++;
+    }
+    done = true;
+    for (std::thread& thief : thieves) {
+        thief.join();
+    }
+
+    assert(deque.empty());
+    for (int i = 0; i < kItems; ++i) {
+        assert(taken[i] == 1);
+    }
+}
+
+void test_spawn_and_join() {
+    Scheduler scheduler(4);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "var scale = 3;\n"
+        "function sum(from, to) {\n"
+        "    var total = 0;\n"
+        "    while (from < to) { total = total + from * scale; from = from + 1; }\n"
+        "    return total;\n"
+        "}\n"
+        "var a = spawn sum(0, 500);\n"
+        "var b = spawn sum(500, 1000);\n"
+        "var total = join(a) + join(b);\n"
+        "var label = join(spawn len(\"four\"));\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("total").asInt() == 3 * 999 * 1000 / 2);
+    assert(vm.getGlobal("label").asInt() == 4);
+    assert(isTask(vm.getGlobal("a")));
+}
+
+void test_channels_park_tasks() {
+    // One worker: the consumer must park for the producer to ever run
+    Scheduler scheduler(1);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "function produce(ch, n) {\n"
+        "    var i = 0;\n"
+        "    while (i < n) { send(ch, i); i = i + 1; }\n"
+        "    close(ch);\n"
+        "}\n"
+        "function consume(ch, out) {\n"
+        "    var total = 0;\n"
+        "    var item = recv(ch);\n"
+        "    while (item != nil) { total = total + item; item = recv(ch); }\n"
+        "    send(out, \"sum \" + total);\n"
+        "    return total;\n"
+        "}\n"
+        "var ch = channel(1, \"number\");\n"
+        "var out = channel(1);\n"
+        "var consumer = spawn consume(ch, out);\n"
+        "spawn produce(ch, 200);\n"
+        "var message = recv(out);\n"
+        "var total = join(consumer);\n"
+        "var drained = recv(ch);\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("total").asInt() == 199 * 200 / 2);
+    assert(asString(vm.getGlobal("message"))->str() == "sum 19900");
+    assert(vm.getGlobal("drained").isNil());
+}
+
+void test_parsed_data_crosses_channels() {
+    // Views and patterns share what was parsed instead of copying it
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "function total(ch) {\n"
+        "    var items = recv(ch);\n"
+        "    var table = recv(ch);\n"
+        "    var sum = 0;\n"
+        "    var i = 0;\n"
+        "    while (i < json_len(items)) { sum = sum + json_get(items, i); i = i + 1; }\n"
+        "    i = 1;\n"
+        "    while (i < csv_rows(table)) { sum = sum + csv_number(table, i, \"n\"); i = i + 1; }\n"
+        "    if (regex_match(recv(ch), \"id=42\")) { sum = sum + 100; }\n"
+        "    return sum;\n"
+        "}\n"
+        "var ch = channel(3);\n"
+        "var worker = spawn total(ch);\n"
+        "send(ch, json_get(parse_json(\"{\\\"items\\\": [1, 2, 3]}\"), \"items\"));\n"
+        "send(ch, parse_csv(\"n\\n10\\n20\\n\"));\n"
+        "send(ch, regex(\"id=[0-9]+\"));\n"
+        "var sum = join(worker);\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("sum").asInt() == 136);
+}
+
+void test_maps_are_copied_between_tasks() {
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "function tally(ch) {\n"
+        "    var m = recv(ch);\n"
+        "    map_set(m, \"seen\", true);\n"
+        "    return map_get(m, 1) + map_get(map_get(m, \"inner\"), \"n\") + map_len(m);\n"
+        "}\n"
+        "var m = map();\n"
+        "var inner = map();\n"
+        "map_set(inner, \"n\", 30);\n"
+        "map_set(m, 1, 10);\n"
+        "map_set(m, \"inner\", inner);\n"
+        "var ch = channel(1);\n"
+        "var worker = spawn tally(ch);\n"
+        "send(ch, m);\n"
+        "var sum = join(worker);\n"
+        "var kept = map_len(m);\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("sum").asInt() == 43);
+    assert(vm.getGlobal("kept").asInt() == 2);  // The task changed its own copy
+}
+
+void test_spawn_copies_only_the_globals_it_uses() {
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "var big = map();\n"
+        "var i = 0;\n"
+        "while (i < 200000) { map_set(big, i, i); i = i + 1; }\n"
+        "var scale = 3;\n"
+        "function times(n) { return n * scale; }\n"
+        "var handlers = map();\n"
+        "map_set(handlers, \"times\", times);\n"
+        "function work(n) { return map_get(handlers, \"times\")(n) + 1; }\n"
+        "var r = join(spawn work(4));\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("r").asInt() == 13);
+
+    // The task gets what work names and what the functions it reaches name,
+    // and not the table nothing it runs refers to
+    std::vector<std::string> names;
+    for (const auto& [name, message] : copyGlobals(vm, {vm.getGlobal("work")})) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+    assert((names == std::vector<std::string>{"handlers", "scale"}));
+}
+
+void test_pooled_vms_drop_the_code_they_ran() {
+    Scheduler scheduler(1);
+    std::weak_ptr<const FunctionProto> code;
+    {
+        VM vm;
+        vm.setScheduler(scheduler);
+        auto script = compileSource("function work(n) { return n + 1; }\nvar r = join(spawn work(1));\n");
+        code = script->functions[0];
+        InterpretResult status = vm.interpret(script);
+        assert(status == InterpretResult::OK);
+        assert(vm.getGlobal("r").asInt() == 2);
+    }
+    // The worker's VM went back to the pool without it
+    assert(code.expired());
+}
+
+void test_task_errors() {
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+
+    const char* failing[] = {
+        "var ch = channel(4, \"number\"); send(ch, \"text\");",
+        "var ch = channel(4); close(ch); send(ch, 1);",
+        "var ch = channel(0);",
+        "join(spawn len(1));",
+        "join(1);",
+        "function cycle() { var m = map(); map_set(m, 1, m); send(channel(1), m); }\ncycle();",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+
+    // The error of a task surfaces where it is joined
+    assert(vm.interpret(compileSource("function f() { return nil + 1; }\njoin(spawn f());")) ==
+           InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.getDiagnostics().back().getMessage().find("Joined task failed") != std::string::npos);
+    diagnostics.clear();
+
+    // 'spawn' needs a call
+    Lexer lexer("var t = spawn f;");
+    Parser parser(lexer.scanTokens());
+    assert(parser.parse().empty());
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+}
+
+void test_parallel_for_and_reduce() {
+    Scheduler scheduler(4);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "var scale = 2;\n"
+        "function square(i) { return i * i; }\n"
+        "function add(a, b) { return a + b; }\n"
+        "function fill(n) {\n"
+        "    var out = channel(n, \"number\");\n"
+        "    var offset = 10;\n"
+        "    parallel for (i = 0; i < n) { send(out, i * scale + offset); }\n"
+        "    close(out);\n"
+        "    var total = 0;\n"
+        "    var item = recv(out);\n"
+        "    while (item != nil) { total = total + item; item = recv(out); }\n"
+        "    return total;\n"
+        "}\n"
+        "var filled = fill(1000);\n"
+        "var squares = parallel_reduce(0, 1000, 0, square, add);\n"
+        "var empty = parallel_reduce(5, 2, 7, square, add);\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("filled").asInt() == 2 * 999 * 1000 / 2 + 10 * 1000);
+    assert(vm.getGlobal("squares").asInt() == 999 * 1000 * 1999 / 6);
+    assert(vm.getGlobal("empty").asInt() == 7);
+}
+
+void test_deterministic_reduce_matches_across_pools() {
+    // Float addition is not associative; the chunks must not depend on the pool
+    const char* source =
+        "function inverse(i) { return 1.0 / (i + 1); }\n"
+        "function add(a, b) { return a + b; }\n"
+        "var sum = parallel_reduce(0, 20000, 0.0, inverse, add, true);\n";
+    double sums[2];
+    int workers[2] = {1, 4};
+    for (int i = 0; i < 2; ++i) {
+        Scheduler scheduler(workers[i]);
+        VM vm;
+        vm.setScheduler(scheduler);
+        assert(vm.interpret(compileSource(source)) == InterpretResult::OK);
+        sums[i] = vm.getGlobal("sum").asNumber();
+    }
+    assert(sums[0] == sums[1]);
+}
+
+void test_parallel_errors() {
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+
+    const char* failing[] = {
+        "function f() { parallel for (i = 0; i < 100) { if (i == 57) { print(nil + 1); } } }\nf();",
+        "function m(i) { return i; }\nparallel_reduce(0, 10, 0, m);",
+        "function m(i) { return i; }\nparallel_reduce(0, \"ten\", 0, m, m);",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+
+    // Iterations run concurrently, so they cannot write what they share
+    const char* rejected[] = {
+        "function f() { var x = 0; parallel for (i = 0; i < 10) { x = i; } }",
+        "var g = 0;\nfunction f() { parallel for (i = 0; i < 10) { g = i; } }",
+        "function f() { parallel for (i = 0; i < 10) { return i; } }",
+    };
+    for (const char* source : rejected) {
+        Lexer lexer(source);
+        Parser parser(lexer.scanTokens());
+        auto statements = parser.parse();
+        BytecodeCompiler compiler;
+        compiler.compile(statements);
+        assert(diagnostics.hasErrors());
+        diagnostics.clear();
+    }
+}
+
+void test_async_functions() {
+    // One worker keeps every sleeping call in flight at once
+    Scheduler scheduler(1);
+    VM vm;
+    vm.setScheduler(scheduler);
+    auto started = std::chrono::steady_clock::now();
+    InterpretResult status = vm.interpret(compileSource(
+        "async function fetch(i) { sleep(20); return i * 2; }\n"
+        "async function pair(i) { return await fetch(i) + await fetch(i + 1); }\n"
+        "var pending = channel(200);\n"
+        "var i = 0;\n"
+        "while (i < 200) { send(pending, fetch(i)); i = i + 1; }\n"
+        "close(pending);\n"
+        "var total = 0;\n"
+        "var t = recv(pending);\n"
+        "while (t != nil) { total = total + await t; t = recv(pending); }\n"
+        "var handle = pair(5);\n"
+        "var both = await handle;\n"
+        "var plain = await 7;\n"));
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("total").asInt() == 199 * 200);
+    assert(isTask(vm.getGlobal("handle")));
+    assert(vm.getGlobal("both").asInt() == 22);
+    assert(vm.getGlobal("plain").asInt() == 7);
+    assert(elapsed < std::chrono::seconds(2));  // Not 200 sleeps one after another
+
+    assert(vm.interpret(compileSource("async function f() { return nil + 1; }\nawait f();")) ==
+           InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.getDiagnostics().back().getMessage().find("Awaited task failed") != std::string::npos);
+    diagnostics.clear();
+
+    Lexer lexer("async var f = 1;");
+    Parser parser(lexer.scanTokens());
+    assert(parser.parse().empty());
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+}
+
+void test_async_calls_share_globals() {
+    VM vm;
+    InterpretResult status = vm.interpret(compileSource(
+        "var counter = 0;\n"
+        "async function inc() { counter = counter + 1; return counter; }\n"
+        "async function later(n) { sleep(5); counter = counter + n; return counter; }\n"
+        "var r = await inc();\n"
+        "var seen = counter;\n"
+        "var slow = later(10);\n"
+        "var before = counter;\n"
+        "var after = await slow;\n"
+        "later(100);\n"));
+
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("r").asInt() == 1);
+    assert(vm.getGlobal("seen").asInt() == 1);
+    assert(vm.getGlobal("before").asInt() == 1);  // Parked in sleep() until awaited
+    assert(vm.getGlobal("after").asInt() == 11);
+    assert(vm.getGlobal("counter").asInt() == 111);  // Finished before interpret() returned
+
+    // A recv that would block runs the parked producer first
+    assert(vm.interpret(compileSource(
+               "var ch = channel(1);\n"
+               "send(ch, 1);\n"
+               "async function produce() { send(ch, 42); return 1; }\n"
+               "var p = produce();\n"
+               "var first = recv(ch);\n"
+               "var second = recv(ch);\n")) == InterpretResult::OK);
+    assert(vm.getGlobal("second").asInt() == 42);
+}
+
+void test_files() {
+    // Longer than two buffers, so lines and reads cross chunks
+    std::string path = "test_task_file.txt";
+    std::string expected;
+    for (int i = 0; i < 60000; ++i) {
+        expected += "line " + std::to_string(i) + (i % 2 ? "\r\n" : "\n");
+    }
+    expected += "last";
+
+    auto writer = File::open(path, File::Mode::WRITE);
+    writer->write(expected.substr(0, 100000));
+    writer->write(expected.substr(100000));
+    writer->close();
+    writer->close();
+
+    for (bool use_ring : {true, false}) {
+        IoService io(use_ring);
+        auto file = File::open(path, File::Mode::READ, io);
+        int lines = 0;
+        std::string line;
+        auto take = [&](std::string_view text) { line = std::string(text); lines++; };
+        while (true) {
+            int before = lines;
+            Channel::Status status = file->readLine(take, nullptr);
+            assert(status == Channel::Status::DONE);
+            if (lines == before) {
+                break;
+            }
+            assert(line == (lines <= 60000 ? "line " + std::to_string(lines - 1) : "last"));
+        }
+        assert(lines == 60001);
+
+        auto chunks = File::open(path, File::Mode::READ, io);
+        std::string read;
+        auto append = [&](std::string_view bytes) { read.append(bytes); };
+        size_t before;
+        do {
+            before = read.size();
+            Channel::Status status = chunks->read(100000, append, nullptr);
+            assert(status == Channel::Status::DONE);
+        } while (read.size() != before);
+        assert(read == expected);
+    }
+
+    // A FIFO hands over what its writer has sent so far; short reads are
+    // not the end of it
+    std::string fifo = "test_task_fifo";
+    std::remove(fifo.c_str());
+    int made = mkfifo(fifo.c_str(), 0600);
+    assert(made == 0);
+    for (bool use_ring : {true, false}) {
+        IoService io(use_ring);
+        std::thread sender([&] {
+            int fd = ::open(fifo.c_str(), O_WRONLY);
+            ssize_t first = ::write(fd, "a\nb\n", 4);
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            ssize_t second = ::write(fd, "c\nd\n", 4);
+            ::close(fd);
+            assert(first == 4 && second == 4);
+        });
+        auto file = File::open(fifo, File::Mode::READ, io);
+        std::string lines;
+        bool more = true;
+        while (more) {
+            more = false;
+            file->readLine([&](std::string_view line) { lines += line; more = true; }, nullptr);
+        }
+        file->close();
+        sender.join();
+        assert(lines == "abcd");
+
+        // Nothing reads a pipe that is only opened, so closing it does not
+        // wait for its writer
+        std::atomic<bool> released{false};
+        std::thread holder([&] {
+            int fd = ::open(fifo.c_str(), O_WRONLY);
+            for (int i = 0; i < 500 && !released; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            ::close(fd);
+        });
+        auto started = std::chrono::steady_clock::now();
+        File::open(fifo, File::Mode::READ, io)->close();
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        released = true;
+        holder.join();
+        assert(elapsed < std::chrono::seconds(2));
+    }
+    std::remove(fifo.c_str());
+
+    Scheduler scheduler(2);
+    VM vm;
+    vm.setScheduler(scheduler);
+    InterpretResult status = vm.interpret(compileSource(
+        "async function count(path) {\n"
+        "    var f = open(path);\n"
+        "    var n = 0;\n"
+        "    var line = read_line(f);\n"
+        "    while (line != nil) { n = n + 1; line = read_line(f); }\n"
+        "    close(f);\n"
+        "    return n;\n"
+        "}\n"
+        "var a = count(\"" + path + "\");\n"
+        "var b = count(\"" + path + "\");\n"
+        "var lines = await a + await b;\n"
+        "var out = open(\"" + path + "\", \"a\");\n"
+        "write(out, \"!\");\n"
+        "close(out);\n"
+        "var f = open(\"" + path + "\");\n"
+        "var first = read(f, 4);\n"
+        "close(f);\n"));
+    assert(status == InterpretResult::OK);
+    assert(vm.getGlobal("lines").asInt() == 2 * 60001);
+    assert(asString(vm.getGlobal("first"))->str() == "line");
+
+    const std::string failing[] = {
+        "open(\"no/such/file\");",
+        "var f = open(\"" + path + "\", \"w\"); read_line(f);",
+        "open(\"" + path + "\", \"rw\");",
+        "var f = open(\"" + path + "\"); close(f); read(f);",
+    };
+    for (const std::string& source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+    std::remove(path.c_str());
+}
+
+int main() {
+    test_deque_hands_out_each_item_once();
+    test_spawn_and_join();
+    test_channels_park_tasks();
+    test_parsed_data_crosses_channels();
+    test_maps_are_copied_between_tasks();
+    test_spawn_copies_only_the_globals_it_uses();
+    test_pooled_vms_drop_the_code_they_ran();
+    test_task_errors();
+    test_parallel_for_and_reduce();
+    test_deterministic_reduce_matches_across_pools();
+    test_parallel_errors();
+    test_async_functions();
+    test_async_calls_share_globals();
+    test_files();
+
+    std::cout << "All task tests passed!\n";
+    return 0;
+}
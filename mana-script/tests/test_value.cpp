@@ -0,0 +1,130 @@
+#include "value.hpp"
+#include "object.hpp"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+using namespace mana;
+
+void test_tags_are_disjoint() {
+    Value values[] = {
+        Value::nil(), Value::boolean(true), Value::boolean(false),
+        Value::integer(0), Value::integer(-1), Value::number(0.0), Value::number(-2.5)
+    };
+
+    for (const Value& v : values) {
+        int kinds = v.isNil() + v.isBool() + v.isInt() + v.isDouble() + v.isObj();
+        assert(kinds == 1);
+    }
+}
+
+void test_round_trips() {
+    assert(Value::integer(42).asInt() == 42);
+    assert(Value::integer(INT32_MIN).asInt() == INT32_MIN);
+    assert(Value::integer(INT32_MAX).asInt() == INT32_MAX);
+    assert(Value::number(3.25).asDouble() == 3.25);
+    assert(Value::number(-0.0).isDouble());
+    assert(Value::boolean(true).asBool());
+    assert(!Value::boolean(false).asBool());
+
+    double inf = std::numeric_limits<double>::infinity();
+    assert(Value::number(inf).isDouble());
+    assert(Value::number(-inf).isDouble());
+    assert(Value::number(-inf).asDouble() == -inf);
+}
+
+void test_nan_is_canonicalized() {
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    Value v = Value::number(-nan);
+
+    assert(v.isDouble());
+    assert(!v.isNil() && !v.isObj());
+    assert(std::isnan(v.asDouble()));
+    assert(!valuesEqual(v, v));
+}
+
+// Strings keep their characters after the object, so they need room for them
+struct StringStorage {
+    alignas(16) unsigned char bytes[64];
+
+    ObjString* make(std::string_view chars) { return new (bytes) ObjString(chars); }
+};
+
+void test_objects() {
+    StringStorage storage;
+    ObjString* str = storage.make("hello");
+    Value v = Value::object(str);
+
+    assert(v.isObj());
+    assert(v.asObj() == str);
+    assert(isString(v));
+    assert(v.toString() == "hello");
+}
+
+void test_falsey() {
+    assert(Value::nil().isFalsey());
+    assert(Value::boolean(false).isFalsey());
+    assert(Value::integer(0).isFalsey());
+    assert(Value::number(0.0).isFalsey());
+    assert(Value::number(-0.0).isFalsey());
+    assert(!Value::integer(7).isFalsey());
+    assert(!Value::boolean(true).isFalsey());
+    assert(!Value::number(0.5).isFalsey());
+}
+
+void test_arithmetic_fast_paths() {
+    Value sum = addNumbers(Value::integer(2), Value::integer(3));
+    assert(sum.isInt() && sum.asInt() == 5);
+
+    Value mixed = addNumbers(Value::integer(1), Value::number(0.5));
+    assert(mixed.isDouble() && mixed.asDouble() == 1.5);
+
+    // int32 overflow widens instead of wrapping
+    Value wide = addNumbers(Value::integer(INT32_MAX), Value::integer(1));
+    assert(wide.isDouble() && wide.asDouble() == 2147483648.0);
+
+    Value product = mulNumbers(Value::integer(65536), Value::integer(65536));
+    assert(product.isDouble());
+
+    assert(lessNumbers(Value::integer(-1), Value::integer(1)));
+    assert(lessNumbers(Value::integer(1), Value::number(1.5)));
+    assert(lessEqualNumbers(Value::number(2.0), Value::integer(2)));
+}
+
+void test_equality() {
+    StringStorage a_storage, b_storage;
+    ObjString* a = a_storage.make("abc");
+    ObjString* b = b_storage.make("abc");
+
+    assert(valuesEqual(Value::integer(1), Value::number(1.0)));
+    assert(valuesEqual(Value::object(a), Value::object(b)));
+    assert(!valuesEqual(Value::nil(), Value::boolean(false)));
+    assert(!valuesEqual(Value::integer(0), Value::nil()));
+}
+
+void test_number_formatting() {
+    assert(Value::integer(-42).toString() == "-42");
+    assert(Value::number(2.5).toString() == "2.5");
+    assert(Value::number(0.1).toString() == "0.1");
+    assert(Value::number(1.0 / 3.0).toString() == "0.33333333333333");
+    assert(Value::number(1e20).toString() == "1e+20");
+
+    char buffer[kMaxNumberChars];
+    char* end = formatNumber(Value::integer(INT32_MIN), buffer);
+    assert(std::string(buffer, end) == "-2147483648");
+}
+
+int main() {
+    test_tags_are_disjoint();
+    test_round_trips();
+    test_nan_is_canonicalized();
+    test_objects();
+    test_falsey();
+    test_arithmetic_fast_paths();
+    test_equality();
+    test_number_formatting();
+
+    std::cout << "All value tests passed!\n";
+    return 0;
+}
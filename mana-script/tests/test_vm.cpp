@@ -0,0 +1,753 @@
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "output.hpp"
+#include "lines.hpp"
+#include "json.hpp"
+#include "csv.hpp"
+#include "regex.hpp"
+#include "map.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace mana;
+
+std::shared_ptr<FunctionProto> compileSource(const std::string& source) {
+    Lexer lexer(source);
+    Parser parser(lexer.scanTokens());
+    auto statements = parser.parse();
+    BytecodeCompiler compiler;
+    auto script = compiler.compile(statements);
+    assert(!diagnostics.hasErrors());
+    return script;
+}
+
+Value callGlobal(VM& vm, const std::string& name, const std::vector<Value>& args) {
+    Value result;
+    InterpretResult status = vm.call(vm.getGlobal(name), args, &result);
+    assert(status == InterpretResult::OK);
+    return result;
+}
+
+OpCode firstArithmeticOp(VM& vm, const std::string& name) {
+    for (const auto& ins : asFunction(vm.getGlobal(name))->code) {
+        if (genericOpcode(ins.op) == OpCode::ADD || genericOpcode(ins.op) == OpCode::LT) {
+            return ins.op;
+        }
+    }
+    assert(false);
+    return OpCode::ADD;
+}
+
+void test_globals_and_calls() {
+    VM vm;
+    vm.interpret(compileSource(
+        "function fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+        "var total = 0;\n"
+        "var i = 0;\n"
+        "while (i < 10) { total = total + i; i = i + 1; }\n"
+        "var result = fib(15);\n"));
+
+    assert(vm.getGlobal("total").asInt() == 45);
+    assert(vm.getGlobal("result").asInt() == 610);
+}
+
+void test_runtime_error() {
+    VM vm;
+    InterpretResult status = vm.interpret(compileSource("var x = 1 + nil;"));
+
+    assert(status == InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+}
+
+void test_quickening_specializes_and_deopts() {
+    VM vm;
+    vm.interpret(compileSource("function add(a, b) { return a + b; }"));
+
+    assert(firstArithmeticOp(vm, "add") == OpCode::ADD);
+
+    Value sum = callGlobal(vm, "add", {Value::integer(2), Value::integer(3)});
+    assert(sum.asInt() == 5);
+    assert(firstArithmeticOp(vm, "add") == OpCode::ADD_II);
+
+    // The int guard fails, the instruction falls back and requickens for doubles
+    sum = callGlobal(vm, "add", {Value::number(0.5), Value::number(0.25)});
+    assert(sum.asDouble() == 0.75);
+    assert(firstArithmeticOp(vm, "add") == OpCode::ADD_DD);
+
+    // Strings have no specialized form
+    sum = callGlobal(vm, "add", {Value::object(vm.newString("a")), Value::object(vm.newString("b"))});
+    assert(sum.toString() == "ab");
+    assert(firstArithmeticOp(vm, "add") == OpCode::ADD);
+}
+
+void test_quickening_gives_up_on_polymorphic_sites() {
+    VM vm;
+    vm.interpret(compileSource("function less(a, b) { return a < b; }"));
+
+    for (int i = 0; i < 10; ++i) {
+        Value result = i % 2 == 0
+            ? callGlobal(vm, "less", {Value::integer(1), Value::integer(2)})
+            : callGlobal(vm, "less", {Value::number(2.0), Value::number(1.0)});
+        assert(result.asBool() == (i % 2 == 0));
+    }
+
+    assert(firstArithmeticOp(vm, "less") == OpCode::LT);
+}
+
+void test_int_overflow_stays_correct() {
+    VM vm;
+    vm.interpret(compileSource("function mul(a, b) { return a * b; }"));
+
+    Value small = callGlobal(vm, "mul", {Value::integer(3), Value::integer(4)});
+    assert(small.asInt() == 12);
+
+    Value wide = callGlobal(vm, "mul", {Value::integer(100000), Value::integer(100000)});
+    assert(wide.isDouble() && wide.asDouble() == 1e10);
+}
+
+void test_inline_caches_follow_redefinition() {
+    VM vm;
+    vm.interpret(compileSource(
+        "var limit = 1;\n"
+        "function f() { return 1; }\n"
+        "function g() { return f() + limit; }\n"));
+
+    assert(callGlobal(vm, "g", {}).asInt() == 2);
+    assert(callGlobal(vm, "g", {}).asInt() == 2);
+
+    // Both the global read and the call site are now cached
+    ObjFunction* g = asFunction(vm.getGlobal("g"));
+    bool cached_call = false;
+    for (const auto& cache : g->caches) {
+        cached_call = cached_call || cache.callee == vm.getGlobal("f");
+    }
+    assert(cached_call);
+
+    vm.interpret(compileSource("limit = 10;"));
+    assert(callGlobal(vm, "g", {}).asInt() == 11);
+
+    vm.interpret(compileSource("function f() { return 5; }"));
+    assert(callGlobal(vm, "g", {}).asInt() == 15);
+
+    vm.interpret(compileSource("var limit = 100;"));
+    assert(callGlobal(vm, "g", {}).asInt() == 105);
+}
+
+void test_concatenation_builds_ropes() {
+    VM vm;
+    vm.interpret(compileSource(
+        "function build(n) {\n"
+        "    var s = \"\";\n"
+        "    var i = 0;\n"
+        "    while (i < n) { s = s + \"ab\" + i % 10; i = i + 1; }\n"
+        "    return s;\n"
+        "}\n"
+        "var short = \"x\" + 1;\n"));
+
+    Value short_string = vm.getGlobal("short");
+    assert(!asString(short_string)->isRope());
+    assert(short_string.toString() == "x1");
+
+    Value built = callGlobal(vm, "build", {Value::integer(100000)});
+    ObjString* rope = asString(built);
+    assert(rope->isRope() && rope->length == 300000);
+    assert(rope->flat() == nullptr);
+
+    // First read flattens; later reads reuse the copy
+    ObjString* flat = vm.flatten(rope);
+    assert(!flat->isRope() && vm.flatten(rope) == flat);
+    assert(flat->view().substr(0, 9) == "ab0ab1ab2");
+    assert(flat->view().substr(299997) == "ab9");
+
+    // Keep the first result where the collector can see it
+    vm.defineGlobal("first", built);
+    Value other = callGlobal(vm, "build", {Value::integer(100000)});
+    assert(valuesEqual(vm.getGlobal("first"), other));
+}
+
+void test_identifier_like_strings_are_interned() {
+    VM vm;
+    vm.interpret(compileSource(
+        "var a = \"total\";\n"
+        "function f() { return \"total\"; }\n"
+        "var b = f();\n"
+        "var c = \"to\" + \"tal\";\n"
+        "var d = \"not an identifier\";\n"));
+
+    assert(vm.getGlobal("a") == vm.getGlobal("b"));
+    assert(vm.getGlobal("a") == vm.getGlobal("c"));
+    assert(asString(vm.getGlobal("a"))->interned);
+    assert(!asString(vm.getGlobal("d"))->interned);
+}
+
+std::string readAll(std::FILE* file) {
+    std::rewind(file);
+    std::string text;
+    char chunk[4096];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        text.append(chunk, n);
+    }
+    std::fseek(file, 0, SEEK_END);
+    return text;
+}
+
+void test_output_buffer() {
+    std::FILE* file = std::tmpfile();
+    {
+        OutputBuffer output(file);
+        output.write(std::string_view("n="));
+        output.write(int32_t(-7));
+        output.write(' ');
+        output.write(0.25);
+        output.write(' ');
+        output.write(true);
+        output.write('\n');
+        assert(readAll(file).empty());
+    }
+    assert(readAll(file) == "n=-7 0.25 true\n");
+    std::fclose(file);
+
+    // A full buffer writes whole lines and keeps the partial one
+    file = std::tmpfile();
+    {
+        OutputBuffer output(file);
+        std::string line(1000, 'x');
+        line += '\n';
+        for (size_t i = 0; i < OutputBuffer::kBufferSize / line.size(); ++i) {
+            output.write(line);
+        }
+        output.write(std::string_view("partial"));
+        output.write(line);
+        std::string written = readAll(file);
+        assert(!written.empty() && written.back() == '\n');
+        assert(written.find("partial") == std::string::npos);
+    }
+    std::fclose(file);
+}
+
+bool containsOp(const std::vector<Instruction>& code, OpCode op) {
+    for (const auto& ins : code) {
+        if (ins.op == op) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_operands_are_read_left_to_right() {
+    // An assignment in the right operand must not change the left one,
+    // whether the variable is a local or a global
+    VM vm;
+    vm.interpret(compileSource(
+        "function q() { var x = 5; return x + (x = 1); }\n"
+        "function r() { var x = 2; var y = x * (x = 10) + x; return y; }\n"
+        "var x = 5;\n"
+        "var g = x + (x = 1);\n"));
+    assert(callGlobal(vm, "q", {}).asInt() == 6);
+    assert(callGlobal(vm, "r", {}).asInt() == 30);
+    assert(vm.getGlobal("g").asInt() == 6);
+}
+
+void test_builtins_are_folded_or_inlined() {
+    // Constant arguments are evaluated by the compiler
+    auto script = compileSource("var folded = sqrt(abs(-16)) + min(2, 3.5) + len(\"four\");\n");
+    assert(!containsOp(script->code, OpCode::CALLB) && !containsOp(script->code, OpCode::CALL));
+    VM folded;
+    folded.interpret(script);
+    assert(folded.getGlobal("folded").toString() == "10");
+
+    VM vm;
+    vm.interpret(compileSource(
+        "function f(x, s) { return abs(x) + max(x, 2) + min(x, 2) + len(s) + sqrt(x * x); }\n"
+        "function shadow(abs) { return abs(1); }\n"
+        "function one(n) { return n + 1; }\n"));
+    assert(containsOp(asFunction(vm.getGlobal("f"))->code, OpCode::CALLB));
+    assert(!containsOp(asFunction(vm.getGlobal("f"))->code, OpCode::CALL));
+    assert(containsOp(asFunction(vm.getGlobal("shadow"))->code, OpCode::CALL));
+
+    Value s = Value::object(vm.newString(std::string(100, 'x')));
+    assert(callGlobal(vm, "f", {Value::integer(-3), s}).toString() == "105");
+    assert(callGlobal(vm, "f", {Value::number(2.5), s}).toString() == "109.5");
+    assert(callGlobal(vm, "shadow", {vm.getGlobal("one")}).asInt() == 2);
+
+    // Builtins are still ordinary values
+    vm.interpret(compileSource("var g = abs; var r = g(-4);\n"));
+    assert(vm.getGlobal("r").asInt() == 4);
+}
+
+void test_builtin_misuse() {
+    const char* errors[] = {
+        "var x = abs(1, 2);",
+        "var x = len(42);",
+        "var x = sqrt(\"nine\");",
+        "var len = 3;",
+        "function max(a, b) { return a; }",
+        "min = 1;",
+    };
+    for (const char* source : errors) {
+        Lexer lexer(source);
+        Parser parser(lexer.scanTokens());
+        BytecodeCompiler compiler;
+        compiler.compile(parser.parse());
+        assert(diagnostics.hasErrors());
+        diagnostics.clear();
+    }
+
+    // Wrong types that are only known at runtime fail on the call's line
+    VM vm;
+    assert(vm.interpret(compileSource("var s = \"a\";\nvar x = abs(s);\n")) == InterpretResult::RUNTIME_ERROR);
+    assert(diagnostics.getDiagnostics().back().getLocation().line == 2);
+    diagnostics.clear();
+}
+
+void test_lines_are_split_and_streamed() {
+    // Lines of every length up to a few blocks, some ending in "\r\n"
+    std::string text;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 300; ++i) {
+        std::string line(static_cast<size_t>(i * 7 % 150), static_cast<char>('a' + i % 26));
+        expected.push_back(line);
+        text += line + (i % 3 == 0 ? "\r\n" : "\n");
+    }
+    text += "tail";
+
+    LineScanner scanner(text.data(), text.data() + text.size());
+    std::string_view line;
+    for (const std::string& want : expected) {
+        assert(scanner.next(line, false) && line == want);
+    }
+    assert(!scanner.next(line, false));
+    assert(scanner.rest() == "tail");
+    assert(scanner.next(line, true) && line == "tail");
+    assert(!scanner.next(line, true));
+
+    std::string path = "test_vm_lines.txt";
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    std::fwrite(text.data(), 1, text.size(), file);
+    std::fclose(file);
+    expected.push_back("tail");
+
+    // Results are taken as they come; strings kept in globals outlive arena resets
+    VM vm;
+    vm.interpret(compileSource(
+        "var count = 0;\n"
+        "var first = nil;\n"
+        "function each(line) {\n"
+        "    count = count + 1;\n"
+        "    if (first == nil) { first = line; }\n"
+        "    return len(line);\n"
+        "}\n"));
+    std::unique_ptr<LineInput> input;
+    size_t calls = 0;
+    bool lengths_match = true;
+    for (int round = 0; round < 5; ++round) {
+        input = LineInput::open(path);
+        auto next = [&](std::string_view& text) { return input->next(text); };
+        auto take = [&](Value value) {
+            lengths_match &= value.asInt() == static_cast<int32_t>(expected[calls++ % expected.size()].size());
+        };
+        assert(vm.callEach(vm.getGlobal("each"), next, take, AllocationMode::ARENA) == InterpretResult::OK);
+    }
+    assert(lengths_match);
+    assert(calls == 5 * expected.size() && calls > VM::kCallsPerArena);
+    assert(vm.getGlobal("count").asInt() == static_cast<int32_t>(calls));
+    assert(asString(vm.getGlobal("first"))->str() == expected[0]);
+
+    // The first failing call ends the run
+    vm.interpret(compileSource("function each(line) { return line - 1; }"));
+    input = LineInput::open(path);
+    auto next = [&](std::string_view& text) { return input->next(text); };
+    assert(vm.callEach(vm.getGlobal("each"), next, nullptr, AllocationMode::ARENA) == InterpretResult::RUNTIME_ERROR);
+    diagnostics.clear();
+
+    // A file and a pipe give the same lines, down to a last line that is
+    // longer than a block and ends in '\r'
+    std::string unterminated = "first\r\n" + std::string(200, 'x') + "\r";
+    file = std::fopen(path.c_str(), "wb");
+    std::fwrite(unterminated.data(), 1, unterminated.size(), file);
+    std::fclose(file);
+    std::string fifo = "test_vm_lines.fifo";
+    std::remove(fifo.c_str());
+    int made = mkfifo(fifo.c_str(), 0600);
+    assert(made == 0);
+    std::thread writer([&] {
+        int fd = ::open(fifo.c_str(), O_WRONLY);
+        for (size_t at = 0; at < unterminated.size(); at += 50) {
+            ssize_t written = ::write(fd, unterminated.data() + at, std::min<size_t>(50, unterminated.size() - at));
+            assert(written > 0);
+        }
+        ::close(fd);
+    });
+    for (const std::string& source : {path, fifo}) {
+        input = LineInput::open(source);
+        std::vector<std::string> lines;
+        std::string_view text;
+        while (input->next(text)) {
+            lines.emplace_back(text);
+        }
+        assert((lines == std::vector<std::string>{"first", std::string(200, 'x')}));
+    }
+    writer.join();
+    std::remove(fifo.c_str());
+    std::remove(path.c_str());
+}
+
+void test_json_documents() {
+    // Escapes and runs of backslashes fall on every offset of a block
+    std::string text = "[";
+    std::vector<std::string> names;
+    for (int i = 0; i < 200; ++i) {
+        std::string name(static_cast<size_t>(i % 70), 'x');
+        std::string escaped = name;
+        if (i % 3 == 0) {
+            name += "\"q\\";
+            escaped += "\\\"q\\\\";
+        }
+        if (i % 5 == 0) {
+            name += "\n\\\\";
+            escaped += "\\n\\\\\\\\";
+        }
+        names.push_back(name);
+        text += (i ? ", " : "") + std::string("{\"id\": ") + std::to_string(i) + ", \"name\": \"" + escaped +
+                "\", \"half\": " + std::to_string(i) + ".5, \"ok\": " + (i % 2 ? "true" : "false") +
+                ", \"tags\": [null, {}, []]}";
+    }
+    text += "]";
+
+    auto document = JsonDocument::parse(text);
+    uint32_t root = JsonDocument::kRoot;
+    assert(document->kind(root) == JsonDocument::Kind::ARRAY);
+    assert(document->size(root) == 200);
+    JsonDocument::Cursor cursor;
+    std::string scratch;
+    for (int i = 0; i < 200; ++i) {
+        uint32_t item = document->element(root, static_cast<size_t>(i), cursor);
+        assert(document->number(document->member(item, "id")).asInt() == i);
+        assert(document->string(document->member(item, "name"), scratch) == names[static_cast<size_t>(i)]);
+        assert(document->number(document->member(item, "half")).asDouble() == i + 0.5);
+        assert(document->boolean(document->member(item, "ok")) == (i % 2 == 1));
+        assert(document->size(document->member(item, "tags")) == 3);
+        assert(document->member(item, "missing") == JsonDocument::kNone);
+    }
+    JsonDocument::Cursor fresh;
+    assert(document->element(root, 200, fresh) == JsonDocument::kNone);
+    assert(document->number(document->member(document->element(root, 7, fresh), "id")).asInt() == 7);
+
+    const char* invalid[] = {"", "[1,]", "{\"a\" 1}", "{\"a\": 1", "\"open", "[1 2]", "{1: 2}", "[1]]", "[1] 2"};
+    for (const char* source : invalid) {
+        bool failed = false;
+        try {
+            JsonDocument::parse(source);
+        } catch (const RuntimeError&) {
+            failed = true;
+        }
+        assert(failed);
+    }
+
+    VM vm;
+    assert(vm.interpret(compileSource(
+        "var doc = parse_json(\"{\\\"user\\\": {\\\"id\\\": 7, \\\"tags\\\": [\\\"a\\\", 2.5]}, \\\"big\\\": 3000000000}\");\n"
+        "var user = json_get(doc, \"user\");\n"
+        "var id = json_get(user, \"id\");\n"
+        "var tag = json_get(json_get(user, \"tags\"), 0);\n"
+        "var count = json_len(json_get(user, \"tags\"));\n"
+        "var big = json_get(doc, \"big\");\n"
+        "var missing = json_get(user, \"nope\");\n")) == InterpretResult::OK);
+    assert(vm.getGlobal("id").asInt() == 7);
+    assert(asString(vm.getGlobal("tag"))->str() == "a");
+    assert(vm.getGlobal("count").asInt() == 2);
+    assert(vm.getGlobal("big").asDouble() == 3000000000.0);
+    assert(vm.getGlobal("missing").isNil());
+
+    const char* failing[] = {
+        "json_get(parse_json(\"[tru]\"), 0);",
+        "json_get(parse_json(\"[1]\"), \"a\");",
+        "json_len(1);",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+}
+
+void test_csv_tables() {
+    // Quoted fields hold separators, line breaks and doubled quotes
+    std::string text = "id,name,score\r\n";
+    for (int i = 0; i < 300; ++i) {
+        std::string name = std::string(static_cast<size_t>(i % 90), 'n');
+        if (i % 4 == 0) {
+            name = "\"" + name + ", \"\"quoted\"\"\nline\"";
+        }
+        text += std::to_string(i) + "," + name + "," + (i % 7 ? std::to_string(i) + ".25" : "") +
+                (i % 2 ? "\r\n" : "\n");
+    }
+    text += "last,row";
+
+    auto table = CsvTable::parse(text);
+    assert(table->rows() == 302);
+    assert(table->column("score") == 2 && table->column("nope") == -1);
+    std::string_view chars;
+    std::string scratch;
+    for (int i = 0; i < 300; ++i) {
+        size_t row = static_cast<size_t>(i) + 1;
+        assert(table->field(row, 0, chars, scratch) && chars == std::to_string(i));
+        std::string name = std::string(static_cast<size_t>(i % 90), 'n');
+        if (i % 4 == 0) {
+            name += ", \"quoted\"\nline";
+        }
+        assert(table->field(row, 1, chars, scratch) && chars == name);
+        assert(table->field(row, 2, chars, scratch) && chars == (i % 7 ? std::to_string(i) + ".25" : ""));
+        assert(!table->field(row, 3, chars, scratch));
+    }
+    assert(table->field(301, 1, chars, scratch) && chars == "row");
+    assert(!table->field(301, 2, chars, scratch) && !table->field(302, 0, chars, scratch));
+
+    VM vm;
+    assert(vm.interpret(compileSource(
+        "var t = parse_csv(\"city,pop\\nOslo,709000\\nBergen,\\n\");\n"
+        "var rows = csv_rows(t);\n"
+        "var city = csv_get(t, 1, \"city\");\n"
+        "var pop = csv_number(t, 1, \"pop\");\n"
+        "var empty = csv_number(t, 2, 1);\n"
+        "var outside = csv_get(t, 5, 0);\n")) == InterpretResult::OK);
+    assert(vm.getGlobal("rows").asInt() == 3);
+    assert(asString(vm.getGlobal("city"))->str() == "Oslo");
+    assert(vm.getGlobal("pop").asInt() == 709000);
+    assert(vm.getGlobal("empty").isNil() && vm.getGlobal("outside").isNil());
+
+    const char* failing[] = {
+        "parse_csv(\"a,\\\"b\\n\");",
+        "csv_get(parse_csv(\"a\\n1\"), 1, \"b\");",
+        "csv_number(parse_csv(\"a\\nx\"), 1, 0);",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+}
+
+void test_regex_matching() {
+    struct Case {
+        const char* pattern;
+        std::string text;
+        long begin;  // -1 for no match
+        long end;
+    };
+    std::string far = std::string(300, 'x') + "needle" + std::string(10, 'y');
+    std::string decoys;
+    for (int i = 0; i < 40; ++i) {
+        decoys += "nxxxxe";  // First and last byte of "needle" in place, the rest wrong
+    }
+    decoys += "needle";
+    std::vector<Case> cases = {
+        {"abcd|c", "abcd", 0, 4},              // Leftmost, not first to end
+        {"a+b", "xxaaabyy", 2, 6},
+        {"(a|ab)(c|bcd)", "abcd", 0, 4},       // Longest
+        {"^ab", "ab", 0, 2},
+        {"^b", "ab", -1, -1},
+        {"b$", "abab", 3, 4},
+        {"a$", "a\n", -1, -1},                 // $ is only the end of the text
+        {"[a-c]{2,3}", "zzabcabc", 2, 5},
+        {"[^,]+", ",,field,", 2, 7},
+        {"\\d+\\.\\d*", "v 12.5s", 2, 6},
+        {"\\w+@\\w+", "mail bob@host!", 5, 13},
+        {"x*", "abc", 0, 0},
+        {"", "abc", 0, 0},
+        {"(?:ab)+", "ababab", 0, 6},
+        {"needle", far, 300, 306},
+        {"needle", decoys, 240, 246},
+        {"needle[0-9]", far, -1, -1},
+        {"(a*)*b", std::string(100000, 'a'), -1, -1},
+        {"(x+x+)+y", std::string(100000, 'x') + "y", 0, 100001},
+    };
+
+    // Thousands of DFA states, so the state cache fills and starts over
+    std::string bits;
+    for (int i = 0; i < 20000; ++i) {
+        bits += (i * 7919 % 13) < 6 ? 'a' : 'b';
+    }
+    bits[bits.size() - 13] = 'a';
+    cases.push_back({"a[ab]{12}c", bits + "c", static_cast<long>(bits.size()) - 13, static_cast<long>(bits.size()) + 1});
+
+    for (const Case& c : cases) {
+        RegexMatcher matcher(Regex::compile(c.pattern));
+        size_t begin = 0;
+        size_t end = 0;
+        bool found = matcher.find(c.text, begin, end);
+        assert(matcher.search(c.text) == found);
+        assert(found == (c.begin >= 0));
+        assert(!found || (static_cast<long>(begin) == c.begin && static_cast<long>(end) == c.end));
+    }
+    assert(Regex::compile("a+b") == Regex::compile("a+b"));
+
+    const char* invalid[] = {"a(", "a)", "[ab", "*a", "a**", "a*?", "(a)\\1", "x{3,2}", "x{2", "(?=a)", "a\\"};
+    for (const char* pattern : invalid) {
+        bool failed = false;
+        try {
+            Regex::compile(pattern);
+        } catch (const RuntimeError&) {
+            failed = true;
+        }
+        assert(failed);
+    }
+
+    VM vm;
+    assert(vm.interpret(compileSource(
+        "var re = regex(\"[0-9]+ms\");\n"
+        "var hit = regex_match(re, \"took 125ms\");\n"
+        "var miss = regex_match(re, \"took long\");\n"
+        "var took = regex_find(re, \"took 125ms and 3ms\");\n"
+        "var none = regex_find(\"z+\", \"abc\");\n"
+        "var word = regex_find(\"[a-z]+\", \"42 apples\");\n")) == InterpretResult::OK);
+    assert(vm.getGlobal("hit").asBool() && !vm.getGlobal("miss").asBool());
+    assert(asString(vm.getGlobal("took"))->str() == "125ms");
+    assert(vm.getGlobal("none").isNil());
+    assert(asString(vm.getGlobal("word"))->str() == "apples");
+
+    // A constant pattern is compiled, and rejected, with the script
+    Lexer lexer("var ok = regex_match(\"a(\", \"a\");");
+    Parser parser(lexer.scanTokens());
+    BytecodeCompiler compiler;
+    compiler.compile(parser.parse());
+    assert(diagnostics.hasErrors());
+    diagnostics.clear();
+
+    const char* failing[] = {
+        "var p = \"[a\"; regex(p);",
+        "regex_match(1, \"a\");",
+        "regex_find(\"a\", 1);",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+}
+
+void test_map_tables() {
+    // Heavy churn over a small key range: deletions shift keys back instead
+    // of leaving tombstones, so every lookup must still agree
+    FlatTable<IntKeys> table;
+    std::unordered_map<int32_t, int32_t> expected;
+    uint32_t seed = 12345;
+    for (int i = 0; i < 200000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        int32_t key = static_cast<int32_t>((seed >> 8) % 5000) - 2500;
+        if ((seed >> 4) % 3 == 0) {
+            assert(table.erase(key) == (expected.erase(key) == 1));
+        } else {
+            table.valueAt(table.insert(key)) = Value::integer(i);
+            expected[key] = i;
+        }
+    }
+    assert(table.size() == expected.size());
+    for (int32_t key = -2600; key < 2600; ++key) {
+        auto it = expected.find(key);
+        Value value = table.get(key);
+        assert(it == expected.end() ? value.isNil() : value.asInt() == it->second);
+    }
+    assert(table.capacity() * 7 >= table.size() * 8);
+
+    VM vm;
+    vm.interpret(compileSource(
+        "var m = map();\n"
+        "map_set(m, \"apple\", 3);\n"
+        "map_set(m, \"pe\" + \"ar\", 5);\n"
+        "var fruit = map_get(m, \"apple\") + map_get(m, \"pear\");\n"
+        "map_set(m, 2.0, \"two\");\n"                 // Spills into the mixed layout
+        "var two = map_get(m, 2);\n"
+        "map_set(m, true, 1.5);\n"
+        "map_set(m, 0.5, 7);\n"
+        "map_set(m, \"apple\", nil);\n"               // Storing nil removes
+        "var size = map_len(m);\n"
+        "var gone = map_has(m, \"apple\");\n"
+        "var deleted = map_delete(m, 0.5);\n"
+        "var again = map_delete(m, 0.5);\n"
+        "var seen = 0;\n"
+        "var k = map_next(m, nil);\n"
+        "while (k != nil) { seen = seen + 1; k = map_next(m, k); }\n"
+        "function fill(n) {\n"
+        "  var h = map();\n"
+        "  var i = 0;\n"
+        "  while (i < n) { map_set(h, \"k\" + i, i); i = i + 1; }\n"
+        "  return h;\n"
+        "}\n"
+        "var big = fill(20000);\n"
+        "function get(h) { return map_get(h, \"k\"); }\n"
+        "function put(h, v) { map_set(h, \"k\", v); }\n"
+        "function lookup(h, key) { return map_get(h, key); }\n"));
+    assert(vm.getGlobal("fruit").asInt() == 8);
+    assert(asString(vm.getGlobal("two"))->str() == "two");
+    assert(vm.getGlobal("size").asInt() == 4);
+    assert(!vm.getGlobal("gone").asBool());
+    assert(vm.getGlobal("deleted").asBool() && !vm.getGlobal("again").asBool());
+    assert(vm.getGlobal("seen").asInt() == 3);
+    assert(asMap(vm.getGlobal("m"))->layout == ObjMap::Layout::MIXED);
+    assert(asMap(vm.getGlobal("big"))->layout == ObjMap::Layout::STRINGS);
+    assert(vm.getGlobal("m").toString() == "<map 3 entries>");
+
+    // Constant keys are looked up in line; other keys go through the builtin
+    assert(containsOp(asFunction(vm.getGlobal("get"))->code, OpCode::GETMAPK));
+    assert(containsOp(asFunction(vm.getGlobal("put"))->code, OpCode::SETMAPK));
+    assert(!containsOp(asFunction(vm.getGlobal("lookup"))->code, OpCode::GETMAPK));
+
+    // Young keys and values survive being moved by the collector
+    vm.collectGarbage();
+    vm.collectGarbage(true);
+    Value big = vm.getGlobal("big");
+    assert(asMap(big)->count() == 20000);
+    for (int i = 0; i < 20000; i += 997) {
+        Value key = Value::object(vm.newString("k" + std::to_string(i)));
+        assert(callGlobal(vm, "lookup", {big, key}).asInt() == i);
+    }
+    Value fresh = callGlobal(vm, "fill", {Value::integer(0)});
+    callGlobal(vm, "put", {fresh, Value::integer(9)});
+    assert(callGlobal(vm, "get", {fresh}).asInt() == 9);
+
+    const char* failing[] = {
+        "map_get(1, \"k\");",
+        "map_set(map(), nil, 1);",
+        "map_set(map(), map(), 1);",
+        "map_get(map(), 0 / 0.0);",
+        "map_next(map(), \"missing\");",
+    };
+    for (const char* source : failing) {
+        assert(vm.interpret(compileSource(source)) == InterpretResult::RUNTIME_ERROR);
+        diagnostics.clear();
+    }
+}
+
+int main() {
+    test_globals_and_calls();
+    test_runtime_error();
+    test_quickening_specializes_and_deopts();
+    test_quickening_gives_up_on_polymorphic_sites();
+    test_int_overflow_stays_correct();
+    test_inline_caches_follow_redefinition();
+    test_concatenation_builds_ropes();
+    test_identifier_like_strings_are_interned();
+    test_output_buffer();
+    test_operands_are_read_left_to_right();
+    test_builtins_are_folded_or_inlined();
+    test_builtin_misuse();
+    test_lines_are_split_and_streamed();
+    test_json_documents();
+    test_csv_tables();
+    test_regex_matching();
+    test_map_tables();
+
+    std::cout << "All VM tests passed!\n";
+    return 0;
+}